@@ -0,0 +1,45 @@
+#define LOG_MODULE POOL
+
+#include "FramePool.h"
+#include "RF24Network_config.h"
+#include "MeshLog.h"
+
+FramePool::FramePool(void)
+{
+	free_count = FRAME_POOL_SIZE;
+	for(uint8_t i=0;i<FRAME_POOL_SIZE;i++)
+		free_slots[i] = i;
+}
+
+int8_t FramePool::alloc(void)
+{
+	if(free_count == 0)
+	{
+		MESH_LOG(LOG_WARN, "%lu: *WARNING* FramePool exhausted\n\r",millis());
+		return -1;
+	}
+
+	return free_slots[--free_count];
+}
+
+void FramePool::release(int8_t slot)
+{
+	free_slots[free_count++] = slot;
+}
+
+uint16_t FramePool::queuedAt(int8_t slot)
+{
+	uint16_t ms;
+	memcpy(&ms,frames[slot] + FRAME_POOL_STAMP_OFFSET,sizeof(ms));
+	return ms;
+}
+
+void FramePool::setQueuedAt(int8_t slot, uint16_t ms)
+{
+	memcpy(frames[slot] + FRAME_POOL_STAMP_OFFSET,&ms,sizeof(ms));
+}
+
+void FramePool::clearQueuedAt(int8_t slot)
+{
+	memset(frames[slot] + FRAME_POOL_STAMP_OFFSET,0,sizeof(uint16_t));
+}
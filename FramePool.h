@@ -0,0 +1,67 @@
+#ifndef __FRAMEPOOL_H__
+#define __FRAMEPOOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "RF24NetworkHeader.h"
+
+#define RECEIVE_QUEUE_SIZE 5 /**< Frames waiting to be handled */
+#define SEND_QUEUE_SIZE 5 /**< Frames waiting for the radio, shared by all classes */
+
+#define FRAME_POOL_FRAME_SIZE 32
+#define FRAME_POOL_STAMP_OFFSET 30 /**< Behind the header: millis() when a frame was queued for the radio, cleared before it goes out */
+/**
+ * Every receive and send queue slot, plus one for the frame being handled
+ */
+#define FRAME_POOL_SIZE (RECEIVE_QUEUE_SIZE + SEND_QUEUE_SIZE + 1)
+
+/**
+ * Fixed pool of frames shared by receiving, dispatching and sending
+ *
+ * A frame is read from the radio straight into a slot, and the queues only
+ * pass the slot number along.  A forwarded frame is patched in place and
+ * written to the radio from the same slot it was received into, so it is
+ * never copied on the way through the node.
+ *
+ * The two bytes of a slot behind the header keep the time its frame entered
+ * the send queue, so the pool needs no stamps of its own.
+ */
+class FramePool
+{
+private:
+	uint8_t frames[FRAME_POOL_SIZE][FRAME_POOL_FRAME_SIZE];
+	uint8_t free_slots[FRAME_POOL_SIZE];
+	uint8_t free_count;
+public:
+	FramePool(void);
+
+	/**
+	 * Take a slot
+	 *
+	 * @return The slot number, or -1 if the pool is exhausted
+	 */
+	int8_t alloc(void);
+
+	/**
+	 * Give a slot back, the frame in it is gone
+	 */
+	void release(int8_t slot);
+
+	uint8_t* frame(int8_t slot) { return frames[slot]; }
+	RF24NetworkHeader& header(int8_t slot) { return * reinterpret_cast<RF24NetworkHeader*>(frames[slot]); }
+
+	/**
+	 * Low 16 bits of millis() when the frame entered the send queue
+	 */
+	uint16_t queuedAt(int8_t slot);
+	void setQueuedAt(int8_t slot, uint16_t ms);
+
+	/**
+	 * Clear the stamp, the bytes go over the air with the frame
+	 */
+	void clearQueuedAt(int8_t slot);
+
+	uint8_t available(void) { return free_count; }
+};
+
+#endif //__FRAMEPOOL_H__
@@ -0,0 +1,141 @@
+#include "LatencyStats.h"
+#include "RF24Network_config.h"
+
+LatencyStats::LatencyStats(void)
+{
+	reset();
+}
+
+void LatencyStats::reset(void)
+{
+	source_count = 0;
+	source_next = 0;
+	memset(by_source,0,sizeof(by_source));
+	memset(by_hops,0,sizeof(by_hops));
+	memset(queue_by_hops,0,sizeof(queue_by_hops));
+}
+
+uint8_t LatencyStats::bucket(uint16_t ms)
+{
+	uint8_t b = 0;
+	while(ms && b < LATENCY_BUCKETS - 1)
+	{
+		ms >>= 1;
+		b++;
+	}
+	return b;
+}
+
+uint16_t LatencyStats::bucketStart(uint8_t bucket)
+{
+	return bucket ? (1 << (bucket - 1)) : 0;
+}
+
+uint8_t LatencyStats::hopIndex(uint16_t hops)
+{
+	if(hops == 0)
+		return 0;
+	return (hops > LATENCY_HOPS) ? LATENCY_HOPS - 1 : hops - 1;
+}
+
+/**
+ * Histogram of a source, a new entry is taken if it is not known yet
+ */
+int8_t LatencyStats::source(T_IP ip)
+{
+	for(uint8_t i=0;i<source_count;i++)
+	{
+		if(sources[i] == ip)
+			return i;
+	}
+
+	uint8_t i;
+	if(source_count < LATENCY_SOURCES)
+		i = source_count++;
+	else
+	{
+		i = source_next;
+		source_next = (source_next + 1) % LATENCY_SOURCES;
+	}
+
+	sources[i] = ip;
+	memset(&by_source[i],0,sizeof(LatencyHistogram));
+	return i;
+}
+
+void LatencyStats::stamp(RF24NetworkHeader& header, uint16_t now)
+{
+	header.flags |= HEADER_FLAG_TIMED;
+	memcpy(header.payload + LATENCY_ORIGIN_OFFSET,&now,sizeof(now));
+	memset(header.payload + LATENCY_QUEUE_OFFSET,0,sizeof(uint16_t));
+}
+
+void LatencyStats::addQueueDelay(RF24NetworkHeader& header, uint16_t ms)
+{
+	if(!(header.flags & HEADER_FLAG_TIMED))
+		return;
+
+	uint16_t queued;
+	memcpy(&queued,header.payload + LATENCY_QUEUE_OFFSET,sizeof(queued));
+
+	uint32_t total = (uint32_t)queued + ms;
+	queued = (total > 0xffff) ? 0xffff : total;
+	memcpy(header.payload + LATENCY_QUEUE_OFFSET,&queued,sizeof(queued));
+}
+
+void LatencyStats::record(const RF24NetworkHeader& header, uint16_t now)
+{
+	if(!(header.flags & HEADER_FLAG_TIMED))
+		return;
+
+	uint16_t origin, queued;
+	memcpy(&origin,header.payload + LATENCY_ORIGIN_OFFSET,sizeof(origin));
+	memcpy(&queued,header.payload + LATENCY_QUEUE_OFFSET,sizeof(queued));
+
+	// Wraps like the stamp, right as long as the latency is below 65s
+	uint16_t latency = now - origin;
+
+	// The origin sends with weight 0 and every relay adds one
+	uint8_t hops = hopIndex(header.source_data.weight + 1);
+
+	by_source[source(header.source_data.ip)].count[bucket(latency)]++;
+	by_hops[hops].count[bucket(latency)]++;
+	queue_by_hops[hops].count[bucket(queued)]++;
+}
+
+uint16_t LatencyStats::percentile(const LatencyHistogram& h, uint8_t percent)
+{
+	uint32_t total = 0;
+	for(uint8_t b=0;b<LATENCY_BUCKETS;b++)
+		total += h.count[b];
+	if(total == 0)
+		return 0;
+
+	uint32_t rank = (total * percent + 99) / 100;
+	uint32_t seen = 0;
+	for(uint8_t b=0;b<LATENCY_BUCKETS;b++)
+	{
+		seen += h.count[b];
+		if(seen >= rank)
+			return bucketStart(b);
+	}
+	return bucketStart(LATENCY_BUCKETS - 1);
+}
+
+static void printHistogram(const char* name, const char* by, uint16_t key, const LatencyHistogram& h)
+{
+	printf_P(PSTR("%s,%s,%u"),name,by,key);
+	for(uint8_t b=0;b<LATENCY_BUCKETS;b++)
+		printf_P(PSTR(",%u"),h.count[b]);
+	printf_P(PSTR("\n\r"));
+}
+
+void LatencyStats::print(void)
+{
+	for(uint8_t i=0;i<source_count;i++)
+		printHistogram("latency","source",sources[i],by_source[i]);
+	for(uint8_t i=0;i<LATENCY_HOPS;i++)
+		printHistogram("latency","hops",i+1,by_hops[i]);
+	for(uint8_t i=0;i<LATENCY_HOPS;i++)
+		printHistogram("queue","hops",i+1,queue_by_hops[i]);
+}
@@ -0,0 +1,113 @@
+#ifndef __LATENCYSTATS_H__
+#define __LATENCYSTATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "RF24NetworkHeader.h"
+
+/**
+ * Layout of the latency stamp at the end of the payload of data frames
+ * with HEADER_FLAG_TIMED
+ *
+ * The origin stamp is the low half of the network millis, so latencies
+ * are measured correctly up to 65 seconds.  The queue delay is added to by
+ * every hop as the frame leaves its send queue.
+ */
+#define LATENCY_STAMP_OFFSET 12 /**< Longest reading send_SensorData() stamps */
+#define LATENCY_ORIGIN_OFFSET 12 /**< Network millis at the origin, low 16 bits */
+#define LATENCY_QUEUE_OFFSET 14 /**< ms spent in queues on all hops so far */
+
+#define LATENCY_BUCKETS 12 /**< <1ms, 1ms, 2-3ms, 4-7ms ... 512-1023ms, 1024ms and more */
+#ifndef LATENCY_SOURCES
+#define LATENCY_SOURCES 8 /**< Originating nodes with their own histogram */
+#endif
+#ifndef LATENCY_HOPS
+#define LATENCY_HOPS 6 /**< Hop counts with their own histogram, 1 .. LATENCY_HOPS, longer paths count as the last */
+#endif
+
+/**
+ * Log scale histogram of ms values
+ */
+typedef struct
+{
+	uint16_t count[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+/**
+ * Latency of readings arriving at the master
+ *
+ * Only the master needs one, see RF24Mesh::setLatencyStats().  Each timed
+ * reading is counted by its end to end latency, from send_SensorData() on
+ * the origin to its arrival at the master, both per originating node and per
+ * number of hops.  The part of it spent waiting in send queues is counted
+ * per number of hops as well.
+ */
+class LatencyStats
+{
+private:
+	T_IP sources[LATENCY_SOURCES];
+	uint8_t source_count;
+	uint8_t source_next; /**< Entry to reuse once the table is full */
+	LatencyHistogram by_source[LATENCY_SOURCES];
+	LatencyHistogram by_hops[LATENCY_HOPS];
+	LatencyHistogram queue_by_hops[LATENCY_HOPS];
+
+	int8_t source(T_IP ip);
+	static uint8_t hopIndex(uint16_t hops);
+public:
+	LatencyStats(void);
+
+	void reset(void);
+
+	/**
+	 * Bucket of a value, 0 .. LATENCY_BUCKETS-1
+	 */
+	static uint8_t bucket(uint16_t ms);
+
+	/**
+	 * Smallest value counted in a bucket
+	 */
+	static uint16_t bucketStart(uint8_t bucket);
+
+	/**
+	 * Stamp a frame about to be queued on its origin
+	 */
+	static void stamp(RF24NetworkHeader& header, uint16_t now);
+
+	/**
+	 * Add to the queue delay of a timed frame leaving a send queue
+	 */
+	static void addQueueDelay(RF24NetworkHeader& header, uint16_t ms);
+
+	/**
+	 * Count a timed frame arriving at the master
+	 *
+	 * @param now Network millis of the master
+	 */
+	void record(const RF24NetworkHeader& header, uint16_t now);
+
+	uint8_t getSourceCount(void) { return source_count; }
+	T_IP getSource(uint8_t i) { return sources[i]; }
+	const LatencyHistogram& getSourceHistogram(uint8_t i) { return by_source[i]; }
+	const LatencyHistogram& getHopsHistogram(uint8_t hops) { return by_hops[hopIndex(hops)]; }
+	const LatencyHistogram& getQueueHistogram(uint8_t hops) { return queue_by_hops[hopIndex(hops)]; }
+
+	/**
+	 * Smallest value at or above the @p percent percentile of a histogram
+	 *
+	 * Only as precise as the buckets: the start of the bucket the percentile
+	 * falls in.
+	 */
+	static uint16_t percentile(const LatencyHistogram& h, uint8_t percent);
+
+	/**
+	 * Write all histograms as CSV lines
+	 *
+	 * "latency,source,<ip>,<count>..." for each originating node,
+	 * "latency,hops,<hops>,<count>..." and "queue,hops,<hops>,<count>..." for
+	 * each hop count, with the counts of the buckets in order.
+	 */
+	void print(void);
+};
+
+#endif //__LATENCYSTATS_H__
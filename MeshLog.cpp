@@ -0,0 +1,85 @@
+#include "RF24Network_config.h"
+#include "MeshLog.h"
+
+#ifdef LOG_SINK_BINARY
+
+static MeshLog::Record ring[LOG_RING_SIZE];
+static uint8_t ring_head;
+static uint8_t ring_count;
+static uint16_t ring_lost;
+
+void MeshLog::record(uint8_t module, uint16_t line, uint8_t nargs, const uint32_t* args)
+{
+	if(ring_count == LOG_RING_SIZE)
+	{
+		ring_head = (ring_head + 1) % LOG_RING_SIZE;
+		ring_count--;
+		ring_lost++;
+	}
+
+	Record& r = ring[(ring_head + ring_count) % LOG_RING_SIZE];
+	ring_count++;
+
+	r.time = millis();
+	r.module = module;
+	r.line = line;
+	r.nargs = nargs;
+	for(uint8_t i=0;i<nargs;i++)
+		r.args[i] = args[i];
+}
+
+static void put(uint32_t v, uint8_t bytes)
+{
+	while(bytes--)
+	{
+		putchar(v & 0xff);
+		v >>= 8;
+	}
+}
+
+uint8_t MeshLog::flush(uint8_t max)
+{
+	uint8_t written = 0;
+
+	while(ring_count && written < max)
+	{
+		Record& r = ring[ring_head];
+
+		putchar(LOG_SYNC);
+		put(r.time,4);
+		put(r.module,1);
+		put(r.line,2);
+		put(r.nargs,1);
+		for(uint8_t i=0;i<r.nargs;i++)
+			put(r.args[i],4);
+
+		ring_head = (ring_head + 1) % LOG_RING_SIZE;
+		ring_count--;
+		written++;
+	}
+
+	return written;
+}
+
+uint16_t MeshLog::lost(void)
+{
+	return ring_lost;
+}
+
+#else
+
+void MeshLog::record(uint8_t module, uint16_t line, uint8_t nargs, const uint32_t* args)
+{
+}
+
+uint8_t MeshLog::flush(uint8_t max)
+{
+	return 0;
+}
+
+uint16_t MeshLog::lost(void)
+{
+	return 0;
+}
+
+#endif
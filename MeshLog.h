@@ -0,0 +1,147 @@
+#ifndef __MESHLOG_H__
+#define __MESHLOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file MeshLog.h
+ *
+ * Leveled logging, filtered at compile time
+ *
+ * Each source file names its module before including this header:
+ *
+ * @code
+ * #define LOG_MODULE MESH
+ * #include "MeshLog.h"
+ *
+ * MESH_LOG(LOG_DEBUG, "%lu: forward to ip: %d\n\r", millis(), ip);
+ * @endcode
+ *
+ * A message is compiled in only if its level is at or below the level of
+ * its module, LOG_LEVEL_MESH here.  The test is on constants, so messages
+ * above the level cost nothing, not even their arguments.
+ *
+ * By default messages are formatted with printf_P.  With LOG_SINK_BINARY
+ * defined they are only recorded into a small ring buffer as module, line
+ * and raw arguments, and MeshLog::flush() writes the records out as bytes.
+ * tools/meshlog_decode.py finds the format strings in the sources and does
+ * the formatting on the host.  Arguments must be numbers in that case.
+ */
+
+#define LOG_NONE 0
+#define LOG_ERROR 1
+#define LOG_WARN 2
+#define LOG_INFO 3
+#define LOG_DEBUG 4
+
+#ifndef LOG_LEVEL_DEFAULT
+#define LOG_LEVEL_DEFAULT LOG_INFO
+#endif
+
+#ifndef LOG_LEVEL_MESH
+#define LOG_LEVEL_MESH LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_ROUTING
+#define LOG_LEVEL_ROUTING LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_QUEUE
+#define LOG_LEVEL_QUEUE LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_POOL
+#define LOG_LEVEL_POOL LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_TIME
+#define LOG_LEVEL_TIME LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_RADIO
+#define LOG_LEVEL_RADIO LOG_LEVEL_DEFAULT
+#endif
+
+// Module numbers in binary records, keep in sync with tools/meshlog_decode.py
+#define LOG_ID_MESH 1
+#define LOG_ID_ROUTING 2
+#define LOG_ID_QUEUE 3
+#define LOG_ID_POOL 4
+#define LOG_ID_TIME 5
+#define LOG_ID_RADIO 6
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 8 /**< Records kept until flush(), the oldest are overwritten */
+#endif
+#define LOG_MAX_ARGS 6
+#define LOG_SYNC 0xA5 /**< First byte of every flushed record */
+
+/**
+ * Short description of a header, for messages about frames
+ *
+ * toString() formats into a static buffer, which costs a lot and cannot be
+ * recorded by the binary sink.
+ */
+#define LOG_HEADER_FMT "id:%u type:%c from:%u to:%u"
+#define LOG_HEADER(h) (h).id, (h).type, (h).from_node, (h).to_node
+
+// Number of variadic arguments, 0 .. LOG_MAX_ARGS
+#define LOG_NARG(...) LOG_NARG_X(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARG_X(...) LOG_NARG_(__VA_ARGS__)
+#define LOG_NARG_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+
+// Each argument as a raw 32 bit word
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+#define LOG_ARGS(...) LOG_CAT(LOG_ARGS_, LOG_NARG(__VA_ARGS__))(__VA_ARGS__)
+#define LOG_ARGS_0() 0
+#define LOG_ARGS_1(a) (uint32_t)(a)
+#define LOG_ARGS_2(a, b) LOG_ARGS_1(a), (uint32_t)(b)
+#define LOG_ARGS_3(a, b, c) LOG_ARGS_2(a, b), (uint32_t)(c)
+#define LOG_ARGS_4(a, b, c, d) LOG_ARGS_3(a, b, c), (uint32_t)(d)
+#define LOG_ARGS_5(a, b, c, d, e) LOG_ARGS_4(a, b, c, d), (uint32_t)(e)
+#define LOG_ARGS_6(a, b, c, d, e, f) LOG_ARGS_5(a, b, c, d, e), (uint32_t)(f)
+
+#ifdef LOG_SINK_BINARY
+#define LOG_SINK(id, fmt, ...) \
+  { uint32_t _log_args[] = { LOG_ARGS(__VA_ARGS__) }; \
+    MeshLog::record(id, __LINE__, LOG_NARG(__VA_ARGS__), _log_args); }
+#else
+#define LOG_SINK(id, fmt, ...) printf_P(PSTR(fmt), ##__VA_ARGS__)
+#endif
+
+#define MESH_LOG(level, fmt, ...) LOG_(LOG_MODULE, level, fmt, ##__VA_ARGS__)
+#define LOG_(module, level, fmt, ...) LOG__(module, level, fmt, ##__VA_ARGS__)
+#define LOG__(module, level, fmt, ...) \
+  do { if ((level) <= LOG_LEVEL_##module) LOG_SINK(LOG_ID_##module, fmt, ##__VA_ARGS__); } while (0)
+
+/**
+ * Ring buffer behind LOG_SINK_BINARY
+ */
+class MeshLog
+{
+public:
+	typedef struct
+	{
+		uint32_t time; /**< millis() */
+		uint16_t line;
+		uint8_t module;
+		uint8_t nargs;
+		uint32_t args[LOG_MAX_ARGS];
+	} Record;
+
+	static void record(uint8_t module, uint16_t line, uint8_t nargs, const uint32_t* args);
+
+	/**
+	 * Write up to @p max records to stdout and drop them
+	 *
+	 * Each record goes out as LOG_SYNC, time (4 bytes), module, line (2 bytes),
+	 * number of arguments and the arguments, all little endian.
+	 *
+	 * @return The number of records written
+	 */
+	static uint8_t flush(uint8_t max = LOG_RING_SIZE);
+
+	/**
+	 * Records overwritten before they were flushed
+	 */
+	static uint16_t lost(void);
+};
+
+#endif //__MESHLOG_H__
@@ -0,0 +1,85 @@
+#include "RF24Network_config.h"
+#include "MeshTrace.h"
+
+#ifdef MESH_TRACE
+
+MeshTrace::MeshTrace(void)
+{
+	ring_head = 0;
+	ring_count = 0;
+	ring_lost = 0;
+	node = 0;
+	clock = NULL;
+}
+
+void MeshTrace::begin(T_IP _node, TimeSync* _clock)
+{
+	node = _node;
+	clock = _clock;
+}
+
+void MeshTrace::record(uint8_t event, T_IP origin, uint16_t id, T_IP peer,
+		uint8_t pipe, uint8_t retries, uint8_t depth)
+{
+	if(ring_count == MESH_TRACE_SIZE)
+	{
+		ring_head = (ring_head + 1) % MESH_TRACE_SIZE;
+		ring_count--;
+		ring_lost++;
+	}
+
+	Event& e = ring[(ring_head + ring_count) % MESH_TRACE_SIZE];
+	ring_count++;
+
+	e.time = clock ? clock->networkMicros() : micros();
+	e.event = event;
+	e.origin = origin;
+	e.id = id;
+	e.peer = peer;
+	e.pipe = pipe;
+	e.retries = retries;
+	e.depth = depth;
+}
+
+static void put(uint32_t v, uint8_t bytes)
+{
+	while(bytes--)
+	{
+		putchar(v & 0xff);
+		v >>= 8;
+	}
+}
+
+uint8_t MeshTrace::flush(uint8_t max)
+{
+	uint8_t written = 0;
+
+	while(ring_count && written < max)
+	{
+		Event& e = ring[ring_head];
+
+		putchar(MESH_TRACE_SYNC);
+		put(e.time,4);
+		put(node,2);
+		put(e.event,1);
+		put(e.origin,2);
+		put(e.id,2);
+		put(e.peer,2);
+		put(e.pipe,1);
+		put(e.retries,1);
+		put(e.depth,1);
+
+		ring_head = (ring_head + 1) % MESH_TRACE_SIZE;
+		ring_count--;
+		written++;
+	}
+
+	return written;
+}
+
+uint16_t MeshTrace::lost(void)
+{
+	return ring_lost;
+}
+
+#endif
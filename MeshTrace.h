@@ -0,0 +1,122 @@
+#ifndef __MESHTRACE_H__
+#define __MESHTRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "RF24NetworkHeader.h"
+#include "TimeSync.h"
+
+/**
+ * @file MeshTrace.h
+ *
+ * Binary trace of radio and mesh events
+ *
+ * With MESH_TRACE defined, the points where frames enter and leave the
+ * queues and the radio, state changes and routing changes record a fixed
+ * size event into a ring buffer.  MeshTrace::flush() writes them out as
+ * bytes and tools/meshtrace_decode.py merges the traces of several nodes
+ * into per packet hop timelines.  Without MESH_TRACE the calls compile to
+ * nothing and no ring is kept.
+ *
+ * Each RF24Mesh keeps its own trace, see RF24Mesh::getTrace(), stamped with
+ * its own node and clock, so several meshes in one process, as in the
+ * bench, do not mix up their events.
+ *
+ * Events are stamped with network time, so traces taken on different nodes
+ * line up once the nodes are synchronized.  A packet is known by the node
+ * which created it (source_data.ip) and its header id, which stay the same
+ * on every hop.
+ */
+
+/**
+ * Event numbers, keep in sync with tools/meshtrace_decode.py
+ */
+typedef enum
+{
+	TRACE_RX = 1, /**< Frame read from the radio, pipe set */
+	TRACE_RX_DROP, /**< Frame read from the radio but no slot to keep it */
+	TRACE_ENQUEUE, /**< Frame added to the receive queue, depth set */
+	TRACE_ENQUEUE_DROP, /**< Receive queue full */
+	TRACE_SEND_ENQUEUE, /**< Frame added to the send queue, depth set */
+	TRACE_SEND_DROP, /**< Send queue dropped the frame */
+	TRACE_TX, /**< Frame acknowledged, retries set */
+	TRACE_TX_FAIL, /**< Frame given up on */
+	TRACE_STATE, /**< State change, peer is the old and id the new state */
+	TRACE_ROUTE_ADD, /**< Neighbour added or updated, peer is it, id its weight */
+	TRACE_ROUTE_PARENT, /**< Neighbour became our parent, peer is it, id our new weight */
+	TRACE_ROUTE_REMOVE /**< Neighbour removed, peer is it, id its weight */
+} TraceEvent;
+
+#ifndef MESH_TRACE_SIZE
+#define MESH_TRACE_SIZE 8 /**< Events kept until flush(), the oldest are overwritten */
+#endif
+#define MESH_TRACE_SYNC 0x5A /**< First byte of every flushed event */
+
+/**
+ * Record an event into the MeshTrace @p trace
+ */
+#ifdef MESH_TRACE
+#define TRACE_EVENT(trace, ...) (trace).record(__VA_ARGS__)
+#else
+#define TRACE_EVENT(trace, ...) do {} while (0)
+#endif
+
+/**
+ * Trace an event about a frame
+ */
+#define TRACE_FRAME(trace, event, header, peer, pipe, retries, depth) \
+	TRACE_EVENT(trace, event, (header).source_data.ip, (header).id, peer, pipe, retries, depth)
+
+class MeshTrace
+{
+public:
+	typedef struct
+	{
+		uint32_t time; /**< Network micros */
+		uint8_t event;
+		T_IP origin; /**< Node which created the frame */
+		uint16_t id; /**< Header id given by the origin */
+		T_IP peer; /**< Node the frame came from or goes to */
+		uint8_t pipe;
+		uint8_t retries;
+		uint8_t depth; /**< Queue depth after the event */
+	} Event;
+
+	MeshTrace(void);
+
+	/**
+	 * Set the node the events are recorded on and the clock they are
+	 * stamped with
+	 */
+	void begin(T_IP node, TimeSync* clock);
+
+	void record(uint8_t event, T_IP origin, uint16_t id, T_IP peer,
+			uint8_t pipe = 0, uint8_t retries = 0, uint8_t depth = 0);
+
+	/**
+	 * Write up to @p max events to stdout and drop them
+	 *
+	 * Each event goes out as MESH_TRACE_SYNC, time (4 bytes), node (2),
+	 * event, origin (2), id (2), peer (2), pipe, retries and depth, all
+	 * little endian, 18 bytes in all.
+	 *
+	 * @return The number of events written
+	 */
+	uint8_t flush(uint8_t max = MESH_TRACE_SIZE);
+
+	/**
+	 * Events overwritten before they were flushed
+	 */
+	uint16_t lost(void);
+
+private:
+	Event ring[MESH_TRACE_SIZE];
+	uint8_t ring_head;
+	uint8_t ring_count;
+	uint16_t ring_lost;
+
+	T_IP node;
+	TimeSync* clock;
+};
+
+#endif //__MESHTRACE_H__
@@ -6,9 +6,12 @@
  version 2 as published by the Free Software Foundation.
  */
 
+#define LOG_MODULE RADIO
+
 #include "nRF24L01.h"
 #include "RF24_config.h"
 #include "RF24.h"
+#include "MeshLog.h"
 
 /****************************************************************************/
 
@@ -23,6 +26,8 @@ void RF24::csn(int mode)
   SPI.setDataMode(SPI_MODE0);
   SPI.setClockDivider(SPI_CLOCK_DIV4);
 #endif
+  if ( mode == LOW )
+    stats.spi_transactions++;
   digitalWrite(csn_pin,mode);
 }
 
@@ -83,7 +88,7 @@ uint8_t RF24::write_register(uint8_t reg, uint8_t value)
 {
   uint8_t status;
 
-  IF_SERIAL_DEBUG(printf_P(PSTR("write_register(%02x,%02x)\r\n"),reg,value));
+  MESH_LOG(LOG_DEBUG, "write_register(%02x,%02x)\r\n",reg,value);
 
   csn(LOW);
   status = SPI.transfer( W_REGISTER | ( REGISTER_MASK & reg ) );
@@ -209,7 +214,7 @@ void RF24::print_observe_tx(uint8_t value)
 void RF24::print_byte_register(const char* name, uint8_t reg, uint8_t qty)
 {
   char extra_tab = strlen_P(name) < 8 ? '\t' : 0;
-  printf_P(PSTR(PRIPSTR"\t%c ="),name,extra_tab);
+  printf_P(PSTR(PRIPSTR "\t%c ="),name,extra_tab);
   while (qty--)
     printf_P(PSTR(" 0x%02x"),read_register(reg++));
   printf_P(PSTR("\r\n"));
@@ -220,7 +225,7 @@ void RF24::print_byte_register(const char* name, uint8_t reg, uint8_t qty)
 void RF24::print_address_register(const char* name, uint8_t reg, uint8_t qty)
 {
   char extra_tab = strlen_P(name) < 8 ? '\t' : 0;
-  printf_P(PSTR(PRIPSTR"\t%c ="),name,extra_tab);
+  printf_P(PSTR(PRIPSTR "\t%c ="),name,extra_tab);
 
   while (qty--)
   {
@@ -241,8 +246,9 @@ void RF24::print_address_register(const char* name, uint8_t reg, uint8_t qty)
 RF24::RF24(uint8_t _cepin, uint8_t _cspin):
   ce_pin(_cepin), csn_pin(_cspin), wide_band(true), p_variant(false), 
   payload_size(32), ack_payload_available(false), dynamic_payloads_enabled(false),
-  pipe0_reading_address(0)
+  pipe0_reading_address(0), last_retries(0)
 {
+  resetStats();
 }
 
 /****************************************************************************/
@@ -322,10 +328,10 @@ void RF24::printDetails(void)
   print_byte_register(PSTR("CONFIG"),CONFIG);
   print_byte_register(PSTR("DYNPD/FEATURE"),DYNPD,2);
 
-  printf_P(PSTR("Data Rate\t = %S\r\n"),pgm_read_word(&rf24_datarate_e_str_P[getDataRate()]));
-  printf_P(PSTR("Model\t\t = %S\r\n"),pgm_read_word(&rf24_model_e_str_P[isPVariant()]));
-  printf_P(PSTR("CRC Length\t = %S\r\n"),pgm_read_word(&rf24_crclength_e_str_P[getCRCLength()]));
-  printf_P(PSTR("PA Power\t = %S\r\n"),pgm_read_word(&rf24_pa_dbm_e_str_P[getPALevel()]));
+  printf_P(PSTR("Data Rate\t = " PRIPSTR "\r\n"),pgm_read_word(&rf24_datarate_e_str_P[getDataRate()]));
+  printf_P(PSTR("Model\t\t = " PRIPSTR "\r\n"),pgm_read_word(&rf24_model_e_str_P[isPVariant()]));
+  printf_P(PSTR("CRC Length\t = " PRIPSTR "\r\n"),pgm_read_word(&rf24_crclength_e_str_P[getCRCLength()]));
+  printf_P(PSTR("PA Power\t = " PRIPSTR "\r\n"),pgm_read_word(&rf24_pa_dbm_e_str_P[getPALevel()]));
 }
 
 /****************************************************************************/
@@ -395,7 +401,7 @@ void RF24::begin(void)
 
 void RF24::startListening(void)
 {
-  printf_P(PSTR("start listening\n\r"));
+  MESH_LOG(LOG_DEBUG, "start listening\n\r");
 
   write_register(CONFIG, read_register(CONFIG) | _BV(PWR_UP) | _BV(PRIM_RX));
   write_register(STATUS, _BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT) );
@@ -404,8 +410,7 @@ void RF24::startListening(void)
   if (pipe0_reading_address)
     write_register(RX_ADDR_P0, reinterpret_cast<const uint8_t*>(&pipe0_reading_address), 5);
 
-  // Flush buffers
-  flush_rx();
+  // Only the TX FIFO is flushed, frames in the RX FIFO were acked already
   flush_tx();
 
   // Go!
@@ -419,10 +424,9 @@ void RF24::startListening(void)
 
 void RF24::stopListening(void)
 {
-	 printf_P(PSTR("stop listening\n\r"));
+  MESH_LOG(LOG_DEBUG, "stop listening\n\r");
   ce(LOW);
   flush_tx();
-  flush_rx();
 }
 
 /****************************************************************************/
@@ -469,6 +473,7 @@ bool RF24::write( const void* buf, uint8_t len )
 	//print_observe_tx( observe_tx);//,HEX));
   }
   while( ! ( status & ( _BV(TX_DS) | _BV(MAX_RT) ) ) && ( millis() - sent_at < timeout ) );
+  last_retries = ( observe_tx >> ARC_CNT ) & B1111;
 
   // The part above is what you could recreate with your own interrupt handler,
   // and then call this when you got an interrupt
@@ -485,6 +490,15 @@ bool RF24::write( const void* buf, uint8_t len )
   //Serial.printf("What happened:%u%u%u\r\n",tx_ok,tx_fail,ack_payload_available);
 
   result = tx_ok;
+
+  stats.writes++;
+  stats.retries += last_retries;
+  if ( tx_ok )
+    stats.write_ok++;
+  else if ( tx_fail )
+    stats.max_rt++;
+  else
+    stats.timeouts++;
   IF_SERIAL_DEBUG(Serial.print(result?"...OK.":"...Failed"));
 
   // Handle the ack packet
@@ -538,6 +552,27 @@ uint8_t RF24::getDynamicPayloadSize(void)
 
 /****************************************************************************/
 
+uint8_t RF24::getRetries(void)
+{
+  return last_retries;
+}
+
+/****************************************************************************/
+
+const rf24_stats_t& RF24::getStats(void)
+{
+  return stats;
+}
+
+/****************************************************************************/
+
+void RF24::resetStats(void)
+{
+  memset(&stats,0,sizeof(stats));
+}
+
+/****************************************************************************/
+
 bool RF24::available(void)
 {
   return available(NULL);
@@ -555,7 +590,7 @@ bool RF24::available(uint8_t* pipe_num)
   bool result = ( status & _BV(RX_DR) );
 
   if (result)
-  {  IF_SERIAL_DEBUG(printf_P(PSTR("%lu:rx data available\n\r"), millis()));
+  {  MESH_LOG(LOG_DEBUG, "%lu:rx data available\n\r", millis());
     // If the caller wants the pipe number, include that
     if ( pipe_num )
       *pipe_num = ( status >> RX_P_NO ) & B111;
@@ -583,6 +618,7 @@ bool RF24::read( void* buf, uint8_t len )
 {
   // Fetch the payload
   read_payload( buf, len );
+  stats.reads++;
 
   // was this the last of the data available?
   return read_register(FIFO_STATUS) & _BV(RX_EMPTY);
@@ -633,7 +669,7 @@ static const uint8_t child_pipe_enable[] PROGMEM =
 
 void RF24::openReadingPipe(uint8_t child, uint64_t address)
 {
-	printf_P(PSTR("RF24 openReadingPipe: child: %d  addres:%lu\n\r"),child, address);
+	MESH_LOG(LOG_DEBUG, "RF24 openReadingPipe: child: %d  addres:%lu\n\r",child, (unsigned long)address);
 
   // If this is pipe 0, cache the address.  This is needed because
   // openWritingPipe() will overwrite the pipe 0 address, so
@@ -38,6 +38,20 @@ typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS } rf24_datarate_e;
  */
 typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e;
 
+/**
+ * Driver counters, see RF24::getStats()
+ */
+typedef struct
+{
+  uint32_t spi_transactions; /**< Times the chip was selected */
+  uint16_t writes; /**< Payloads written with write() */
+  uint16_t write_ok; /**< ... and acknowledged */
+  uint16_t max_rt; /**< ... and given up on by the radio, MAX_RT */
+  uint16_t timeouts; /**< ... and neither, the radio did not answer in time */
+  uint32_t retries; /**< Auto retransmissions over all writes, from OBSERVE_TX */
+  uint16_t reads; /**< Payloads read */
+} rf24_stats_t;
+
 /**
  * Driver for nRF24L01(+) 2.4GHz Wireless Transceiver
  */
@@ -54,6 +68,8 @@ private:
   bool dynamic_payloads_enabled; /**< Whether dynamic payloads are enabled. */ 
   uint8_t ack_payload_length; /**< Dynamic size of pending ack payload. */
   uint64_t pipe0_reading_address; /**< Last address set on pipe 0 for reading. */
+  uint8_t last_retries; /**< Auto retransmissions of the last write, ARC_CNT */
+  rf24_stats_t stats;
 
 protected:
   /**
@@ -280,6 +296,19 @@ public:
    */
   bool write( const void* buf, uint8_t len );
 
+  /**
+   * Number of times the radio retransmitted the last payload written
+   *
+   * @return ARC_CNT of the last write(), 0 if it was acknowledged at once
+   */
+  uint8_t getRetries(void);
+
+  /**
+   * Counters kept since the driver was created or resetStats() was called
+   */
+  const rf24_stats_t& getStats(void);
+  void resetStats(void);
+
   /**
    * Test whether there are bytes available to be read
    *
@@ -5,9 +5,12 @@
  modify it under the terms of the GNU General Public License
  version 2 as published by the Free Software Foundation.
  */
-#define SERIAL_DEBUG
+#define LOG_MODULE MESH
 
 #include "RF24Network_config.h"
+#include "MeshLog.h"
+#include "MeshTrace.h"
+#include "LatencyStats.h"
 #include "RF24.h"
 #include "RF24Mesh.h"
 #include "RoutingTable.h"
@@ -17,7 +20,6 @@ uint16_t RF24NetworkHeader::next_id = 1;
 
 unsigned long last_time_sent;
 
-RoutingTable rTable;
 
 // Array of nodes we are aware of
 const short max_active_nodes = 10;
@@ -33,9 +35,32 @@ bool is_valid_address( uint16_t node );
 
 /******************************************************************/
 
-RF24Mesh::RF24Mesh( RF24& _radio, StatusCallback& _callback ): radio(_radio), callback(_callback), receive_frame(receive_queue), send_frame_p(send_queue), state(INIT), state_time(0)
+RF24Mesh::RF24Mesh( RF24& _radio, StatusCallback& _callback ): radio(_radio), callback(_callback), receive_head(0), receive_count(0), dispatch_slot(-1), send_queue(frame_pool), state_time(0), state(INIT)
 {
 	last_join_time = 0;
+	low_power = false;
+	radio_asleep = false;
+	lpl_period = LPL_PERIOD;
+	lpl_window = LPL_WINDOW;
+	last_reading_time = 0;
+	reading_id = 1;
+	last_data_time = 0;
+	blind_time = 0;
+	last_notify_time = 0;
+	last_beacon_time = 0;
+	notified_congestion = 0;
+	forward_callback = true;
+	fast_forward = true;
+	frame_callback = false;
+	irq_time = 0;
+	irq_pending = false;
+	error_rate = 0;
+	memset(&forward_stats,0,sizeof(forward_stats));
+	memset(&stats,0,sizeof(stats));
+	stats_query = 0;
+	latency_stamps = false;
+	latency_stats = NULL;
+	send_queue.setFilter(&RF24Mesh::sendable, this);
 }
 
 /******************************************************************/
@@ -45,6 +70,10 @@ void RF24Mesh::begin(uint8_t _channel, T_IP _node_address )
 
   node_address = _node_address;
   rTable.setCurrentNode(node_address);
+#ifdef MESH_TRACE
+  trace.begin(node_address, &rTable.getTimeSync());
+  rTable.setTrace(&trace);
+#endif
 
   if(rTable.amImaster())
 	  state = JOINED;
@@ -57,6 +86,13 @@ void RF24Mesh::begin(uint8_t _channel, T_IP _node_address )
   radio.setCRCLength(RF24_CRC_8);
   radio.setRetries(5,15);
 
+  // Fixed latency between stamping a frame and the receiver noticing it:
+  // power up and CE pulse in RF24::startWrite(), shifting the frame over SPI,
+  // then preamble, address, payload, CRC and packet control field on air at
+  // 250kbps.
+  const uint32_t air_bits = (1 + 5 + frame_size + 1) * 8 + 9;
+  rTable.getTimeSync().begin(rTable.amImaster(), 150 + 15 + 2 * (frame_size + 1) + air_bits * 4);
+
 
   radio.openReadingPipe(0, rTable.getBroadcastMac());
   radio.openReadingPipe(1, rTable.getMac(_node_address));
@@ -74,17 +110,12 @@ void RF24Mesh::begin(uint8_t _channel, T_IP _node_address )
 
 void RF24Mesh::loop(void)
 {
-	static int i=0;
+	if(low_power && !wake())
+		return;
 
 	fastloop();
 
-	i++;
-
-	//if(i == 10)
-	{
-		slowloop();
-		i = 0;
-	}
+	slowloop();
 
 }
 
@@ -99,11 +130,104 @@ void RF24Mesh::fastloop()
 	  handlePacket();
 }
 
+/******************************************************************/
+
+void RF24Mesh::setLowPower(bool enable, uint16_t period, uint16_t window)
+{
+	// The master is the time reference and the sink, it never sleeps
+	low_power = enable && !rTable.amImaster();
+	lpl_period = period;
+	lpl_window = window;
+}
+
+bool RF24Mesh::inWakeWindow(uint16_t guard)
+{
+	return (rTable.getMillis() % lpl_period) + guard < lpl_window;
+}
+
+/**
+ * Whether a frame to @p to may go out now
+ *
+ * Sleeping nodes only hear us inside the common wake window, so frames to
+ * them are held back in the send queue until then.  A broadcast waits if
+ * any neighbour sleeps.
+ *
+ * Before we are synchronized we do not know when the window is.  Broadcasts
+ * then go out for the neighbours which are awake, and a frame to a sleeping
+ * hop is tried once a period, each try a little later in the period than
+ * the one before so that one falls into the window.  A frame the hop did not
+ * take is queued again for the next try, see write().
+ */
+bool RF24Mesh::canSendNow(T_IP to)
+{
+	bool broadcast = to == rTable.getBroadcastNode().ip;
+	bool sleepy = broadcast ? rTable.hasSleepyNode() : rTable.isSleepy(to);
+
+	if(!sleepy)
+		return true;
+	if(rTable.getTimeSync().isSynced())
+		return inWakeWindow(LPL_GUARD);
+	if(broadcast)
+		return true;
+	return millis() - blind_time >= (unsigned long)lpl_period + lpl_window - 2 * LPL_GUARD;
+}
+
+/**
+ * Send queue filter: a frame waits while its next hop sleeps, and data
+ * also while that hop is congested, see backpressureGap()
+ */
+bool RF24Mesh::sendable(void* mesh, const RF24NetworkHeader& header)
+{
+	RF24Mesh* m = (RF24Mesh*)mesh;
+
+	if ( !m->canSendNow(header.to_node) )
+		return false;
+	if ( SendQueue::classify(header) == SQ_CONTROL )
+		return true;
+	return millis() - m->last_data_time >= m->backpressureGap(header.to_node);
+}
+
+/**
+ * Switch the radio on or off for the duty cycle
+ *
+ * The radio is kept on while joining, inside the wake window, and while
+ * there is something in the send queue which can go out right away.
+ *
+ * @return Whether the rest of the loop should run
+ */
+bool RF24Mesh::wake()
+{
+	bool pending = send_queue.peek() != NULL;
+
+	// Until the clock follows the parent, our windows do not line up with theirs
+	if(!isState(JOINED) || !rTable.getTimeSync().isSynced() || pending || inWakeWindow(0))
+	{
+		if(radio_asleep)
+		{
+			radio.powerUp();
+			radio.startListening();
+			radio_asleep = false;
+		}
+		return true;
+	}
+
+	if(!radio_asleep)
+	{
+		MESH_LOG(LOG_DEBUG, "%lu: LPL radio down\n\r",rTable.getMillis());
+		radio.stopListening();
+		radio.powerDown();
+		radio_asleep = true;
+	}
+	return false;
+}
+
 // TODO slow loop icin sure ve timer ayarlanacak
 void RF24Mesh::slowloop()
 {
 	handlePacket();
 
+	beacon();
+
 	sendPackets();
 }
 /******************************************************************/
@@ -115,17 +239,19 @@ void RF24Mesh::updateNetworkTopology(void)
 			joinNetwork();
 			setState(SENDJOIN);
 
-			IF_SERIAL_DEBUG(printf_P(PSTR("%lu: Join network called last_join_time: %lu \n\r"),rTable.getMillis(),last_join_time));
+			MESH_LOG(LOG_DEBUG, "%lu: Join network called last_join_time: %lu \n\r",rTable.getMillis(),last_join_time);
 	}
 	else if (!rTable.amImaster() && (isState(JOINED)))
 		{
+			// Now and then introduce ourselves again.  Our route stays as it
+			// is meanwhile, so the frames of our children keep flowing; the
+			// welcomes coming back may show a shorter one.
 			if (last_join_time == 0 || (millis() - last_join_time) > JOIN_DURATION) //bir dakika
 			{
-				setState(NJOINED);
-				joinNetwork();
-				setState(SENDJOIN);
+				last_join_time = millis();
+				send_JoinMessage();
 
-				IF_SERIAL_DEBUG(printf_P(PSTR("%lu: Join network called last_join_time: %lu \n\r"),rTable.getMillis(),last_join_time));
+				MESH_LOG(LOG_DEBUG, "%lu: Join refreshed last_join_time: %lu \n\r",rTable.getMillis(),last_join_time);
 			}
 		}
 	else if (isState(NEW_JOINED))
@@ -143,12 +269,12 @@ void RF24Mesh::updateNetworkTopology(void)
 			{
 				setState(JOINED);
 				last_join_time = millis();
-				IF_SERIAL_DEBUG(printf_P(PSTR("%lu: I have joined the network: %lu \n\r"),rTable.getMillis(),last_join_time));
+				MESH_LOG(LOG_DEBUG, "%lu: I have joined the network: %lu \n\r",rTable.getMillis(),last_join_time);
 			}
 			else
 			{
 				setState(NJOINED);
-				IF_SERIAL_DEBUG(printf_P(PSTR("%lu: I could ****NOT*** joined the network: %lu \n\r"),rTable.getMillis(),last_join_time));
+				MESH_LOG(LOG_DEBUG, "%lu: I could ****NOT*** joined the network: %lu \n\r",rTable.getMillis(),last_join_time);
 			}
 		}
 	}
@@ -174,7 +300,6 @@ void RF24Mesh::sendAckToWelcome()
 {
 	//TODO doldur sendAckToWelcome
 	int size = rTable.getNumOfWelcomes();
-	T_IP ips[size];
 
 	for(int i=0;i<size;i++)
 	{
@@ -188,7 +313,6 @@ void RF24Mesh::sendWelcomeToJoin()
 {
 	//TODO doldur. sendWelcomeToJoin
 	int size = rTable.getNumOfJoines();
-	T_IP ips[size];
 
 	for(int i=0;i<size;i++)
 	{
@@ -203,11 +327,13 @@ void RF24Mesh::handlePacket()
 	// Is there anything ready for us?
   while ( available() )
   {
-	  IF_SERIAL_DEBUG(printf_P(PSTR("There are available received message %d \n\r"),count++));
+	  MESH_LOG(LOG_DEBUG, "There are available received message %d \n\r",count++);
 
-    // If so, take a look at it 
-    RF24NetworkHeader header;
-    peek(header);
+    // Handle the frame where it is, the handler may pass it on to the send queue
+    dispatch_slot = receive_queue[receive_head];
+    receive_head = (receive_head + 1) % RECEIVE_QUEUE_SIZE;
+    receive_count--;
+    RF24NetworkHeader& header = frame_pool.header(dispatch_slot);
 
     // Dispatch the message to the correct handler.
     switch (header.type)
@@ -227,31 +353,54 @@ void RF24Mesh::handlePacket()
 	case 'U':
 	  handle_UpdateWeightMessage(header);
 	  break;
+	case 'Q':
+	  handle_StatsQuery(header);
+	  break;
+	case 'S':
+	  handle_StatsReport(header);
+	  break;
     default:
-	  printf_P(PSTR("*** WARNING *** Unknown message type %s\n\r"),header.toString());
-      read(header,0,0);
+	  MESH_LOG(LOG_WARN, "*** WARNING *** Unknown message type " LOG_HEADER_FMT "\n\r",LOG_HEADER(header));
       break;
     };
+
+    if ( dispatch_slot >= 0 )
+      frame_pool.release(dispatch_slot);
+    dispatch_slot = -1;
   }
 
 }
 
 void RF24Mesh::sendPackets()
 {
-	static int error_rate = 0;
-	// Is there anything ready for us?
-	  while ( send_available() )
+	// The queue drained since the last round, maybe below what we announced
+	notifyCongestion();
+
+	// Is there anything ready for us?  Frames to a sleeping or congested
+	// hop stay queued, see sendable(), and the others go past them.
+	  RF24NetworkHeader* next;
+	  while ( (next = send_queue.peek()) != NULL )
 	  {
-		  if(write() == false)
-			  error_rate++;
-		  else
+		  bool data = SendQueue::classify(*next) != SQ_CONTROL;
+		  bool sleepy = next->to_node != rTable.getBroadcastNode().ip && rTable.isSleepy(next->to_node);
+
+		  // Only frames the radio failed to deliver say anything about the
+		  // route, and not even those if the hop may have been asleep
+		  int8_t sent = write();
+		  if(sent < 0)
+			  break;
+		  if(data)
+			  last_data_time = millis();
+		  if(sent == 1)
 			  error_rate = 0;
+		  else if(!sleepy)
+			  error_rate++;
 	  }
 
 	  if (error_rate > 4)
 	  {
 		  setState(NJOINED);
-		  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: Fazla gonderme hatasi oldugu icin network dustu\n\r"),rTable.getMillis()));
+		  MESH_LOG(LOG_DEBUG, "%lu: Fazla gonderme hatasi oldugu icin network dustu\n\r",rTable.getMillis());
 		  error_rate = 0;
 	  }
 }
@@ -268,33 +417,80 @@ void RF24Mesh::listenRadio()
 	  uint8_t pipe_num;
 	  while ( radio.available(&pipe_num) )
 	  {
-		  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: NET radio available pipe: %x\n\r"),rTable.getMillis(),pipe_num));
+		uint32_t rx_time = micros();
+
+		// The first frame after an edge came when the edge did, unless that is
+		// too long ago to be the same frame
+		noInterrupts();
+		if ( irq_pending && rx_time - irq_time < IRQ_STAMP_MAX_AGE )
+			rx_time = irq_time;
+		irq_pending = false;
+		interrupts();
+		  MESH_LOG(LOG_DEBUG, "%lu: NET radio available pipe: %x\n\r",rTable.getMillis(),pipe_num);
 
 		// Dump the payloads until we've gotten everything
 		boolean done = false;
 		while (!done)
 		{
+		  // Fetch the payload straight into the slot it is handled and
+		  // forwarded from.  Without a slot it can only be dropped: only the
+		  // sender is read, the radio clocks out the rest of the payload.
+		  int8_t slot = frame_pool.alloc();
+		  if ( slot < 0 )
+		  {
+			  T_IP from;
+			  done = radio.read( &from, sizeof(from) );
+			  stats.rx_drops++;
+			  TRACE_EVENT(trace, TRACE_RX_DROP, 0, 0, from, pipe_num, 0, 0);
+			  continue;
+		  }
+		  uint8_t* frame = frame_pool.frame(slot);
+
 		  // Fetch the payload, and see if this was the last one.
-		  done = radio.read( frame_buffer, sizeof(frame_buffer) );
-		  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: done is %s"),rTable.getMillis(), (done ? "true":"false")));
+		  done = radio.read( frame, frame_size );
+		  MESH_LOG(LOG_DEBUG, "%lu: done is %d",rTable.getMillis(), done);
+
+		  if ( frame_callback )
+			  callback.incomingFrame(frame, pipe_num, rx_time);
 
 		  // Read the beginning of the frame as the header
-		  RF24NetworkHeader& header = * reinterpret_cast<RF24NetworkHeader*>(frame_buffer);
+		  RF24NetworkHeader& header = * reinterpret_cast<RF24NetworkHeader*>(frame);
 
-		  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: MAC Received on pipe %u %s\n\r"),rTable.getMillis(),pipe_num,header.toString()));
+		  stats.rx[statType(header.type)]++;
+		  rTable.setSleepy(header.from_node, header.flags & HEADER_FLAG_SLEEPY);
+		  rTable.setCongestion(header.from_node, (header.flags & HEADER_CONGESTION_MASK) >> HEADER_CONGESTION_SHIFT);
+
+		  MESH_LOG(LOG_DEBUG, "%lu: MAC Received on pipe %u " LOG_HEADER_FMT "\n\r",rTable.getMillis(),pipe_num,LOG_HEADER(header));
+
+		  if ( header.type == 'W' || header.type == 'U' )
+			  rTable.getTimeSync().stampRx(header.payload, rx_time);
+
+		  TRACE_FRAME(trace, TRACE_RX, header, header.from_node, pipe_num, 0, 0);
+
+		  // Fast path for data passing through: it never enters the receive
+		  // queue, the header is patched and the slot goes to the send queue.
+		  if ( fast_forward && header.type == 'F' && header.to_node == node_address && header.from_node != node_address
+				  && isState(JOINED) && !rTable.amImaster() )
+		  {
+			  if ( forward_callback )
+				  callback.incomingData(header);
+			  forward(slot);
+			  continue;
+		  }
 
 		  // Is this for us?
 		  if ( header.to_node == rTable.getCurrentNode().ip || header.to_node == rTable.getBroadcastNode().ip)
 		  {
-			    IF_SERIAL_DEBUG(printf_P(PSTR("%lu: MAC Received message for me, enqueuing \n\r"),rTable.getMillis()));
+			    MESH_LOG(LOG_DEBUG, "%lu: MAC Received message for me, enqueuing \n\r",rTable.getMillis());
 				// Add it to the buffer of frames for us
-				enqueue();
+				enqueue(slot);
 
 				//goker handlePacket();
 		  }
 		  else
 		  {
-			  printf_P(PSTR("%lu: MAC Received message *****NOT for me**, *WARNING* wrong message not forwarding %d != %d \n\r"), rTable.getMillis(), header.to_node, rTable.getCurrentNode().ip);
+			  MESH_LOG(LOG_WARN, "%lu: MAC Received message *****NOT for me**, *WARNING* wrong message not forwarding %d != %d \n\r", rTable.getMillis(), header.to_node, rTable.getCurrentNode().ip);
+			  frame_pool.release(slot);
 		  }
 
 
@@ -315,6 +511,7 @@ void RF24Mesh::listenRadio()
 }
 void RF24Mesh::joinNetwork()
 {
+	stats.join_attempts++;
 	rTable.cleanTable();
 	send_JoinMessage();
 	//listenRadio(true);
@@ -325,63 +522,109 @@ bool RF24Mesh::isJoined()
 }
 /******************************************************************/
 
-bool RF24Mesh::enqueue(void)
+bool RF24Mesh::enqueue(int8_t slot)
 {
   bool result = false;
   
-  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: NET Enqueue @%x "),rTable.getMillis(),receive_frame-receive_queue));
+  MESH_LOG(LOG_DEBUG, "%lu: NET Enqueue @%d ",rTable.getMillis(),receive_count);
 
-  // Copy the current frame into the frame queue
-  if ( receive_frame < receive_queue + sizeof(receive_queue) )
+  // Queue the slot, the frame stays where it is
+  if ( receive_count < RECEIVE_QUEUE_SIZE )
   {
-    memcpy(receive_frame,frame_buffer, frame_size );
-    receive_frame += frame_size; 
+    receive_queue[(receive_head + receive_count) % RECEIVE_QUEUE_SIZE] = slot;
+    receive_count++;
+    if ( receive_count > stats.rx_queue_high_water )
+      stats.rx_queue_high_water = receive_count;
 
     result = true;
-    IF_SERIAL_DEBUG(printf_P(PSTR("ok\n\r")));
+    MESH_LOG(LOG_DEBUG, "ok\n\r");
+    TRACE_FRAME(trace, TRACE_ENQUEUE, frame_pool.header(slot), frame_pool.header(slot).from_node, 0, 0, receive_count);
   }
   else
   {
-    printf_P(PSTR("failed\n\r"));
+    MESH_LOG(LOG_WARN, "failed\n\r");
+    stats.rx_drops++;
+    TRACE_FRAME(trace, TRACE_ENQUEUE_DROP, frame_pool.header(slot), frame_pool.header(slot).from_node, 0, 0, receive_count);
+    frame_pool.release(slot);
   }
 
   return result;
 }
 
-bool RF24Mesh::send_enqueue()
+bool RF24Mesh::send_enqueue(int8_t slot)
 {
-	bool result = false;
+	MESH_LOG(LOG_DEBUG, "%lu: NET Send Enqueue depth %d\n\r",rTable.getMillis(),send_queue.depth());
 
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu: NET Send Enqueue @%x "),rTable.getMillis(),send_frame_p-send_queue));
+	// The queue decides by the class of the frame whether there is room.
+	// A dropped frame stays readable until its slot is allocated again.
+	frame_pool.setQueuedAt(slot, millis()); // queue delay counts from here
+	bool result = send_queue.push(slot);
+	TRACE_FRAME(trace, result ? TRACE_SEND_ENQUEUE : TRACE_SEND_DROP, frame_pool.header(slot), frame_pool.header(slot).to_node, 0, 0, send_queue.depth());
 
-	// Copy the current frame into the frame queue
-	if (send_frame_p < send_queue + sizeof(send_queue))
-	{
-		memcpy(send_frame_p, frame_buffer, frame_size);
-		send_frame_p += frame_size;
+	notifyCongestion();
+	return result;
+}
 
-		result = true;
-		IF_SERIAL_DEBUG(printf_P(PSTR("copied to send buffer\n\r")));
-	}
-	else
+/**
+ * Minimum time between data frames to @p to
+ *
+ * Zero while the neighbour is not congested, then doubling with every level
+ * it reports.
+ */
+unsigned long RF24Mesh::backpressureGap(T_IP to)
+{
+	uint8_t level = rTable.getCongestion(to);
+
+	return level ? (unsigned long)BACKPRESSURE_GAP << (level - 1) : 0;
+}
+
+/**
+ * Give the children our time to take samples from
+ *
+ * A 'U' carries our time stamp, see write(), so one goes out when the last
+ * was sent TIME_SYNC_BEACON ago.  Without it the children would only get
+ * samples when the routes or the congestion change.
+ */
+void RF24Mesh::beacon()
+{
+	if(isState(JOINED) && rTable.getTimeSync().isSynced() && millis() - last_beacon_time >= TIME_SYNC_BEACON)
+		send_UpdateWeight();
+}
+
+/**
+ * Tell the neighbours when our send queue fills up
+ *
+ * Our level goes out with every frame anyway, but children only hear
+ * frames addressed to them or broadcast.  A 'U' is broadcast and goes out
+ * ahead of the data which congests us.  Once the queue drains below the
+ * level announced last, another 'U' lets the neighbours speed up again.
+ */
+void RF24Mesh::notifyCongestion()
+{
+	uint8_t level = send_queue.congestion();
+	bool rising = level >= 2 && level > notified_congestion;
+	bool falling = level < notified_congestion;
+
+	if((rising || falling) && isState(JOINED) && millis() - last_notify_time > BACKPRESSURE_NOTIFY)
 	{
-		printf_P(PSTR("*******WARNING!!!!!!******* failed to write send queue Memory is not enough for message buffer\n\r"));
+		MESH_LOG(LOG_DEBUG, "%lu: NET congested, level %d\n\r",rTable.getMillis(),level);
+		notified_congestion = level;
+		last_notify_time = millis();
+		send_UpdateWeight();
 	}
-
-	return result;
 }
 /******************************************************************/
 
 bool RF24Mesh::available(void)
 {
   // Are there frames on the queue for us?
-  return (receive_frame > receive_queue);
+  return receive_count > 0;
 }
 
 bool RF24Mesh::send_available(void)
 {
   // Are there frames on the queue for us?
-  return (send_frame_p > send_queue);
+  return send_queue.available();
 }
 /******************************************************************/
 
@@ -390,7 +633,7 @@ void RF24Mesh::peek(RF24NetworkHeader& header)
   if ( available() )
   {
     // Copy the next available frame from the queue into the provided buffer
-    memcpy(&header,receive_frame-frame_size,sizeof(RF24NetworkHeader));
+    memcpy(&header,frame_pool.frame(receive_queue[receive_head]),sizeof(RF24NetworkHeader));
   }
 }
 
@@ -402,9 +645,11 @@ size_t RF24Mesh::read(RF24NetworkHeader& header,void* message, size_t maxlen)
 
   if ( available() )
   {
-    // Move the pointer back one in the queue 
-    receive_frame -= frame_size;
-    uint8_t* frame = receive_frame;
+    // Take the oldest frame off the queue
+    int8_t slot = receive_queue[receive_head];
+    receive_head = (receive_head + 1) % RECEIVE_QUEUE_SIZE;
+    receive_count--;
+    uint8_t* frame = frame_pool.frame(slot);
       
     // How much buffer size should we actually copy?
     bufsize = min(maxlen,frame_size-sizeof(RF24NetworkHeader));
@@ -412,30 +657,45 @@ size_t RF24Mesh::read(RF24NetworkHeader& header,void* message, size_t maxlen)
     // Copy the next available frame from the queue into the provided buffer
     memcpy(&header,frame,sizeof(RF24NetworkHeader));
     memcpy(message,frame+sizeof(RF24NetworkHeader),bufsize);
+    frame_pool.release(slot);
     
-    IF_SERIAL_DEBUG(printf_P(PSTR("%lu: *****NET _RF24Mesh::read Received (%s)\n\r"),rTable.getMillis(),header.toString()));
+    MESH_LOG(LOG_DEBUG, "%lu: *****NET _RF24Mesh::read Received (" LOG_HEADER_FMT ")\n\r",rTable.getMillis(),LOG_HEADER(header));
   }
 
   return bufsize;
 }
 
+/**
+ * Queue a frame in a pool slot for the radio, or for ourselves
+ */
+bool RF24Mesh::send_frame(int8_t slot)
+{
+  // If the user is trying to send it to himself
+  if ( frame_pool.header(slot).to_node == rTable.getCurrentNode().ip )
+    // Just queue it in the received queue
+    return enqueue(slot);
+  else
+    // Otherwise send it out over the air
+    return send_enqueue(slot);
+}
+
 bool RF24Mesh::write(RF24NetworkHeader& header, T_MAC mac)
 {
   // Fill out the header
 //	header.from_node = rTable.getCurrentNode().ip;
 	
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu: NET 1 Sending message(%s) \n\r"),rTable.getMillis(),header.toString()));
+	MESH_LOG(LOG_DEBUG, "%lu: NET 1 Sending message(" LOG_HEADER_FMT ") \n\r",rTable.getMillis(),LOG_HEADER(header));
 
   // Build the full frame to send
-  memcpy(frame_buffer,&header,sizeof(RF24NetworkHeader));
+  int8_t slot = frame_pool.alloc();
+  if ( slot < 0 )
+    return false;
 
-  // If the user is trying to send it to himself
-  if ( header.to_node == rTable.getCurrentNode().ip )
-    // Just queue it in the received queue
-    return enqueue();
-  else
-    // Otherwise send it out over the air
-	return send_enqueue(); //write(mac);
+  uint8_t* frame = frame_pool.frame(slot);
+  memcpy(frame,&header,sizeof(RF24NetworkHeader));
+  memset(frame+sizeof(RF24NetworkHeader),0,frame_size-sizeof(RF24NetworkHeader));
+
+  return send_frame(slot); //write(mac);
 }
 
 /******************************************************************/
@@ -445,73 +705,76 @@ bool RF24Mesh::write(RF24NetworkHeader& header)
   // Fill out the header
 	header.from_node = rTable.getCurrentNode().ip;
 	
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu: NET 2 Sending message(%s) \n\r"),rTable.getMillis(),header.toString()));
+	MESH_LOG(LOG_DEBUG, "%lu: NET 2 Sending message(" LOG_HEADER_FMT ") \n\r",rTable.getMillis(),LOG_HEADER(header));
 
   // Build the full frame to send
-  memcpy(frame_buffer,&header,sizeof(RF24NetworkHeader));
+  int8_t slot = frame_pool.alloc();
+  if ( slot < 0 )
+    return false;
 
-  // If the user is trying to send it to himself
-  if ( header.to_node == rTable.getCurrentNode().ip )
-    // Just queue it in the received queue
-    return enqueue();
-  else
-    // Otherwise send it out over the air
-	  return send_enqueue(); //write(mac); return write(rTable.getMac(header.to_node));
+  uint8_t* frame = frame_pool.frame(slot);
+  memcpy(frame,&header,sizeof(RF24NetworkHeader));
+  memset(frame+sizeof(RF24NetworkHeader),0,frame_size-sizeof(RF24NetworkHeader));
+
+  return send_frame(slot); //write(mac); return write(rTable.getMac(header.to_node));
 }
 
 /******************************************************************/
-int RF24Mesh::write()
+int8_t RF24Mesh::write()
 {
-	  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: write to air \n\r"),rTable.getMillis()));
-	  bool result = false;
+	  MESH_LOG(LOG_DEBUG, "%lu: write to air \n\r",rTable.getMillis());
+	  int8_t result = -1;
 
-	  if ( send_available() )
+	  int8_t slot = send_queue.pop();
+	  if ( slot >= 0 )
 	  {
-		shiftleft(send_queue, frame_size, frame_buffer, send_frame_p);
-
-		  // Move the pointer back one in the queue
-	    send_frame_p -= frame_size;
-
-	    RF24NetworkHeader h;
-	    // Copy the next available frame from the queue into the provided buffer
-	    memcpy(&h,frame_buffer,sizeof(RF24NetworkHeader));
-
-	    result = write(rTable.getMac(h.to_node));
+	    // Sent from the slot it was queued in, no copy
+	    RF24NetworkHeader& h = frame_pool.header(slot);
+	    bool blind = h.to_node != rTable.getBroadcastNode().ip && rTable.isSleepy(h.to_node) && !rTable.getTimeSync().isSynced();
+	    if ( blind )
+	      blind_time = millis();
+
+	    uint16_t latency = (uint16_t)millis() - frame_pool.queuedAt(slot);
+	    frame_pool.clearQueuedAt(slot);
+	    if ( h.type == 'F' || h.type == 'D' )
+	      LatencyStats::addQueueDelay(h, latency);
+	    result = write(rTable.getMac(h.to_node), frame_pool.frame(slot)) ? 1 : 0;
 	    rTable.sentData(h);
-	    IF_SERIAL_DEBUG(printf_P(PSTR("%lu: NET *RF24*Mesh::sent to Air to mac: %lx (%s)\n\r"),rTable.getMillis(), rTable.getMac(h.to_node), h.toString()));
+
+	    if ( h.source_data.ip != node_address && (h.type == 'F' || h.type == 'D') )
+	    {
+	      forward_stats.count++;
+	      forward_stats.total += latency;
+	      if ( latency > forward_stats.max )
+	        forward_stats.max = latency;
+	    }
+	    MESH_LOG(LOG_DEBUG, "%lu: NET *RF24*Mesh::sent to Air (" LOG_HEADER_FMT ")\n\r",rTable.getMillis(), LOG_HEADER(h));
+	    if ( result == 0 && blind )
+	    {
+	      // The hop was most likely asleep, try again a period later
+	      frame_pool.setQueuedAt(slot, millis());
+	      send_queue.push(slot);
+	    }
+	    else
+	      frame_pool.release(slot);
 	  }
 
 	  return result;
 }
 
-void RF24Mesh::shiftleft(uint8_t *send_queue, const int frame_size, uint8_t *frame_buffer,  uint8_t *last_pointer)
-{
-	memcpy(frame_buffer, send_queue, frame_size);
-
-	uint8_t* p1 = send_queue;
-	uint8_t* p2 = send_queue + frame_size;
-
-	while (p2<=last_pointer)
-	{
-		memcpy(p1, p2, frame_size);
-		p1 += frame_size;
-		p2 += frame_size;
-	}
-
-}
-
-bool RF24Mesh::write(T_MAC to_mac)
+bool RF24Mesh::write(T_MAC to_mac, uint8_t* frame)
 {
   bool ok = false;
   
-  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: NET Trying to write mac %lu \n\r"),rTable.getMillis(),to_mac) );
+  // Addresses are 40 bits, logged as two words so every argument fits a long
+  MESH_LOG(LOG_DEBUG, "%lu: NET Trying to write mac %02x%08lx \n\r",rTable.getMillis(),(unsigned)(to_mac >> 32),(unsigned long)to_mac);
 
   // First, stop listening so we can talk
   radio.stopListening();
  
   if (to_mac != rTable.getBroadcastMac())
   {
-	  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: It is not broadcast mac so acknowledge is true %lu \n\r"),rTable.getMillis(),to_mac) );
+	  MESH_LOG(LOG_DEBUG, "%lu: It is not broadcast mac so acknowledge is true %02x%08lx \n\r",rTable.getMillis(),(unsigned)(to_mac >> 32),(unsigned long)to_mac);
 	  radio.setAutoAck(0,true);
   }
   else
@@ -520,12 +783,28 @@ bool RF24Mesh::write(T_MAC to_mac)
   // Open the correct pipe for writing.  
   radio.openWritingPipe(to_mac);
 
+  RF24NetworkHeader& header = * reinterpret_cast<RF24NetworkHeader*>(frame);
+
+  // Flags describe this hop, not the node which created the frame
+  if ( low_power )
+    header.flags |= HEADER_FLAG_SLEEPY;
+  else
+    header.flags &= ~HEADER_FLAG_SLEEPY;
+  header.flags = (header.flags & ~HEADER_CONGESTION_MASK) | (send_queue.congestion() << HEADER_CONGESTION_SHIFT);
+
   // Retry a few times
   short attempts = 15;
+  uint8_t retries = 0;
   do
   {
-    ok = radio.write( frame_buffer, frame_size );
-    IF_SERIAL_DEBUG(printf_P(PSTR("%lu: Tried to send packet result:%d attempt %d \n\r"),rTable.getMillis(),ok, attempts) );
+    // Time stamps are taken as late as possible, so only the fixed hop delay
+    // is left between the stamp and the receiver
+    if ( header.type == 'W' || header.type == 'U' )
+      rTable.getTimeSync().stampTx(header.payload);
+
+    ok = radio.write( frame, frame_size );
+    retries += radio.getRetries();
+    MESH_LOG(LOG_DEBUG, "%lu: Tried to send packet result:%d attempt %d \n\r",rTable.getMillis(),ok, attempts);
   }
   while ( !ok && --attempts );
 
@@ -533,6 +812,12 @@ bool RF24Mesh::write(T_MAC to_mac)
   radio.startListening();
   radio.setAutoAck(0,false);
 
+  TRACE_FRAME(trace, ok ? TRACE_TX : TRACE_TX_FAIL, header, header.to_node, 0, retries, send_queue.depth());
+  if ( ok )
+    stats.tx[statType(header.type)]++;
+  else
+    stats.tx_failed++;
+
   if(!ok)
 	  callback.sendingFailed(to_mac);
 
@@ -569,8 +854,10 @@ bool RF24Mesh::is_valid_address( uint16_t node )
 
 void RF24Mesh::setState(STATES s)
 {
-	IF_SERIAL_DEBUG(printf_P(PSTR("setState %d\n\r"), s));
+	MESH_LOG(LOG_DEBUG, "setState %d\n\r", s);
+	TRACE_EVENT(trace, TRACE_STATE, node_address, s, state);
 
+	stats.time_in_state[state] += millis() - state_time;
 	state = s;
 	state_time = millis();
 }
@@ -592,7 +879,7 @@ bool RF24Mesh::send_JoinMessage()
   
 	header.source_data.ip = rTable.getCurrentNode().ip;
 	header.source_data.weight = rTable.getCurrentNode().weight;
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu:Sending join message (%s) \n\r"),rTable.getMillis(),header.toString()));
+	MESH_LOG(LOG_DEBUG, "%lu:Sending join message (" LOG_HEADER_FMT ") \n\r",rTable.getMillis(),LOG_HEADER(header));
 	return write(header);
 }
 
@@ -605,41 +892,47 @@ bool RF24Mesh::send_UpdateWeight()
 	header.source_data.ip = rTable.getCurrentNode().ip;
 	header.source_data.weight = rTable.getCurrentNode().weight;
 	header.prev_node = rTable.getShortestRouteNode().ip;
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu:Sending update weight (%s) \n\r"),rTable.getMillis(),header.toString()));
+	last_beacon_time = millis();
+	MESH_LOG(LOG_DEBUG, "%lu:Sending update weight (" LOG_HEADER_FMT ") \n\r",rTable.getMillis(),LOG_HEADER(header));
 	return write(header);
 }
 
 bool RF24Mesh::send_WelcomeMessage(T_IP toNode)
 {
-	unsigned long time = rTable.getMillis();
 	uint8_t data[16];
 
-	memset(&data,0,sizeof(unsigned long));
-	memcpy(&data,&time,sizeof(unsigned long));
+	// Time stamp is filled in when the frame goes to the radio
+	memset(&data,0,sizeof(data));
 
 	RF24NetworkHeader header(toNode, 'W',data , rTable.getCurrentNode().ip);
 	header.source_data.ip = rTable.getCurrentNode().ip;
 	header.source_data.weight = rTable.getCurrentNode().weight;
   
-	printf_P(PSTR("---------------------------------\n\r"));
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu: APP Sending Welcome Message (%s)...\n\r"),rTable.getMillis(),header.toString()));
+	MESH_LOG(LOG_DEBUG, "---------------------------------\n\r");
+	MESH_LOG(LOG_DEBUG, "%lu: APP Sending Welcome Message (" LOG_HEADER_FMT ")...\n\r",rTable.getMillis(),LOG_HEADER(header));
 	return write(header); //broadcast mac'ine gonder.
 }
 
 /**
  * Send a 'T' message, the current time
  */
-bool RF24Mesh::send_SensorData(uint8_t data[16])
+bool RF24Mesh::send_SensorData(const uint8_t* data, uint8_t length, bool urgent)
 {
+	if(length > SENSOR_DATA_SIZE)
+	{
+		MESH_LOG(LOG_WARN, "%lu: send_SensorData, reading of %u bytes does not fit\n\r",rTable.getMillis(),(unsigned)length);
+		return false;
+	}
+
 	if(rTable.amImaster())
 	{
-		IF_SERIAL_DEBUG(printf_P(PSTR("%lu: send_SensorData, since I am master i do not send to myself ------------\n\r"),rTable.getMillis()));
+		MESH_LOG(LOG_DEBUG, "%lu: send_SensorData, since I am master i do not send to myself ------------\n\r",rTable.getMillis());
 		 return true;
 	}
 
 	if(state != JOINED)
 	{
-		printf_P(PSTR("%lu: send_SensorData, I havent joined yet\n\r"),rTable.getMillis());
+		MESH_LOG(LOG_WARN, "%lu: send_SensorData, I havent joined yet\n\r",rTable.getMillis());
 		callback.sendingFailed(0);
 		return false;
 	}
@@ -647,34 +940,37 @@ bool RF24Mesh::send_SensorData(uint8_t data[16])
 	T_IP ip = rTable.getShortestRouteNode().ip;
 	unsigned char type = 'D';
 
+	// Do not queue readings our parent would only drop
+	if (!urgent && millis() - last_reading_time < backpressureGap(ip))
+	{
+		MESH_LOG(LOG_DEBUG, "%lu: send_SensorData, parent %d congested, reading refused\n\r",rTable.getMillis(),ip);
+		return false;
+	}
+	last_reading_time = millis();
+
 	if (ip != rTable.getMasterNode().ip)
 	{	type = 'F';
-		IF_SERIAL_DEBUG(printf_P(PSTR("%lu: APP Send_SersorData short ip: %d masterip: %d"),rTable.getMillis(),ip,rTable.getMasterNode().ip));
+		MESH_LOG(LOG_DEBUG, "%lu: APP Send_SersorData short ip: %d masterip: %d",rTable.getMillis(),ip,rTable.getMasterNode().ip);
 	}
-	RF24NetworkHeader header(ip,  type, data );
+	RF24NetworkHeader header(ip,  type );
+	memset(header.payload,0,sizeof(header.payload));
+	memcpy(header.payload,data,length);
+	header.id = reading_id++;
 	header.source_data.ip = rTable.getCurrentNode().ip; //source ip
 	header.source_data.weight = 0; //not important
+	if(urgent)
+		header.flags |= HEADER_FLAG_URGENT;
+	// The stamp only goes behind readings which leave it room
+	if(latency_stamps && length <= LATENCY_STAMP_OFFSET && rTable.getTimeSync().isSynced())
+		LatencyStats::stamp(header, rTable.getMillis());
   
   
-  IF_SERIAL_DEBUG(printf_P(PSTR("---------------------------------\n\r")));
-  printf_P(PSTR("%lu: APP Sending send_SensorData %s ...\n\r"),rTable.getMillis(), header.toString());
-  bool result = write(header);
-  int trycount=0;
-  while (!result)
-  {
-  	  if(!rTable.removeUnreacheable(rTable.getShortestRouteNode()))//There are no neighbour nodes
-  	  {
-  		  setState(NJOINED);
-  		  return false;
-  	  }
-
-	  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: APP Repeating failed send_SensorData, (%s)"),rTable.getMillis(),header.toString()));
-	  result = write(header);
-	  trycount++;
-	  if(trycount > 10)
-		  return false;
-  }
-  return result;
+  MESH_LOG(LOG_DEBUG, "---------------------------------\n\r");
+  MESH_LOG(LOG_DEBUG, "%lu: APP Sending send_SensorData " LOG_HEADER_FMT " ...\n\r",rTable.getMillis(), LOG_HEADER(header));
+  // write() only queues the frame.  If it fails the send queue dropped it
+  // to keep room for route maintenance, which says nothing about our parent,
+  // so the route is left alone; sendPackets() notices unreachable parents.
+  return write(header);
 }
 
 
@@ -686,9 +982,7 @@ bool RF24Mesh::send_SensorData(uint8_t data[16])
  */
 void RF24Mesh::handle_JoinMessage(RF24NetworkHeader& header)
 {
-
-  read(header,0,0);
-  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: handle_JoinMessage (%s) \n\r"),rTable.getMillis(),header.toString()));
+  MESH_LOG(LOG_DEBUG, "%lu: handle_JoinMessage (" LOG_HEADER_FMT ") \n\r",rTable.getMillis(),LOG_HEADER(header));
 
   if(state == JOINED)
   {
@@ -699,10 +993,11 @@ void RF24Mesh::handle_JoinMessage(RF24NetworkHeader& header)
 		  send_WelcomeMessage(header.source_data.ip);
 
 	  }
-	  else //benim bagli oldugum node'dan join mesaji gelmis
+	  else if ( header.source_data.weight >= MAX_WEIGHT ) //benim bagli oldugum node'dan join mesaji gelmis
 	  {
+		  // Our parent lost its route, a join with a weight only refreshes it
 
-		  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: bagli oldugum node Join mesaji gonderdi. Demekki hattan dustum.**********\n\r"),rTable.getMillis()));
+		  MESH_LOG(LOG_DEBUG, "%lu: bagli oldugum node Join mesaji gonderdi. Demekki hattan dustum.**********\n\r",rTable.getMillis());
 		  setState(NJOINED);
 		  rTable.cleanTable();
 	  }
@@ -714,6 +1009,120 @@ void RF24Mesh::handle_JoinMessage(RF24NetworkHeader& header)
  //   else printf_P(PSTR("%lu: there is not more message  \n\r"),rTable.getMillis());
 }
 
+const SendQueueStats& RF24Mesh::getSendQueueStats(SendQueueClass c)
+{
+	return send_queue.getStats(c);
+}
+
+uint8_t RF24Mesh::getSourceCount()
+{
+	return send_queue.getSourceCount();
+}
+
+const SourceStats& RF24Mesh::getSourceStats(uint8_t i)
+{
+	return send_queue.getSourceStats(i);
+}
+
+const MeshStats& RF24Mesh::getStats(void)
+{
+	return stats;
+}
+
+RoutingTable& RF24Mesh::getRoutingTable(void)
+{
+	return rTable;
+}
+
+#ifdef MESH_TRACE
+MeshTrace& RF24Mesh::getTrace(void)
+{
+	return trace;
+}
+#endif
+
+unsigned long RF24Mesh::getTimeInState(STATES s)
+{
+	unsigned long result = stats.time_in_state[s];
+	if ( state == s )
+		result += millis() - state_time;
+	return result;
+}
+
+uint8_t RF24Mesh::statType(unsigned char type)
+{
+	static const char types[] = "JWUDFQS";
+
+	for ( uint8_t i = 0; i < MESH_STAT_TYPES - 1; i++ )
+	{
+		if ( types[i] == type )
+			return i;
+	}
+	return MESH_STAT_TYPES - 1;
+}
+
+void RF24Mesh::queryStats(void)
+{
+	if ( !rTable.amImaster() )
+		return;
+
+	uint8_t data[16];
+	memset(&data,0,sizeof(data));
+	data[0] = ++stats_query;
+
+	RF24NetworkHeader header(rTable.getBroadcastNode().ip, 'Q', data, rTable.getCurrentNode().ip);
+	header.source_data.ip = rTable.getCurrentNode().ip;
+	MESH_LOG(LOG_DEBUG, "%lu: Sending stats query %u\n\r",rTable.getMillis(),stats_query);
+	write(header);
+}
+
+bool RF24Mesh::send_StatsReport(void)
+{
+	MeshStatsReport report;
+	const rf24_stats_t& radio_stats = radio.getStats();
+
+	memset(&report,0,sizeof(report));
+	for ( uint8_t i = 0; i < MESH_STAT_TYPES; i++ )
+	{
+		report.rx += stats.rx[i];
+		report.tx += stats.tx[i];
+	}
+	report.tx_failed = stats.tx_failed;
+	report.retries = radio_stats.retries;
+	report.max_rt = radio_stats.max_rt;
+	report.drops = stats.rx_drops;
+	for ( uint8_t c = 0; c < SQ_CLASSES; c++ )
+	{
+		const SendQueueStats& s = send_queue.getStats((SendQueueClass)c);
+		report.drops += s.tail_drops + s.early_drops;
+		if ( s.high_water > report.send_queue_high_water )
+			report.send_queue_high_water = s.high_water;
+	}
+	report.route_changes = rTable.getRouteChanges();
+	report.join_attempts = stats.join_attempts;
+	report.rx_queue_high_water = stats.rx_queue_high_water;
+
+	uint8_t data[16];
+	memset(&data,0,sizeof(data));
+	memcpy(data,&report,sizeof(report));
+
+	RF24NetworkHeader header(rTable.getShortestRouteNode().ip, 'S', data);
+	header.source_data.ip = rTable.getCurrentNode().ip;
+	header.source_data.weight = 0;
+	MESH_LOG(LOG_DEBUG, "%lu: Sending stats report (" LOG_HEADER_FMT ")\n\r",rTable.getMillis(),LOG_HEADER(header));
+	return write(header);
+}
+
+uint32_t RF24Mesh::networkMicros()
+{
+	return rTable.getMicros();
+}
+
+unsigned long RF24Mesh::networkMillis()
+{
+	return rTable.getMillis();
+}
+
 unsigned short int RF24Mesh::getMyIP()
 {
 	return rTable.getCurrentNode().ip;
@@ -721,17 +1130,17 @@ unsigned short int RF24Mesh::getMyIP()
 
 void RF24Mesh::handle_UpdateWeightMessage(RF24NetworkHeader& header)
 {
-
-  read(header,0,0);
-  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: handle_UpdateWeightMessage (%s) \n\r"),rTable.getMillis(),header.toString()));
+  MESH_LOG(LOG_DEBUG, "%lu: handle_UpdateWeightMessage (" LOG_HEADER_FMT ") \n\r",rTable.getMillis(),LOG_HEADER(header));
 
   if(isState(JOINED))
   {
+	  rTable.syncTime(header.source_data.ip, header.payload);
+
 	  // If this message is from ourselves or the base, don't bother adding it to the active nodes.
 		if (header.from_node != rTable.getShortestRouteNode().ip
 				&& header.prev_node != getMyIP())
 	  {
-		  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: handle_U farkli node kaydet ve cevap ver\n\r"),rTable.getMillis()));
+		  MESH_LOG(LOG_DEBUG, "%lu: handle_U farkli node kaydet ve cevap ver\n\r",rTable.getMillis());
 		  bool shortenedPath = rTable.addNearNode(header.source_data);
 		  if(shortenedPath)
 		  {
@@ -746,7 +1155,7 @@ void RF24Mesh::handle_UpdateWeightMessage(RF24NetworkHeader& header)
   }
   else if(isState(NJOINED))
   {
-	  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: handle_U farkli node kaydet ve cevap ver\n\r"),rTable.getMillis()));
+	  MESH_LOG(LOG_DEBUG, "%lu: handle_U farkli node kaydet ve cevap ver\n\r",rTable.getMillis());
 	  bool shortenedPath = rTable.addNearNode(header.source_data);
 	  if(shortenedPath)
 	  {
@@ -763,25 +1172,25 @@ void RF24Mesh::handle_UpdateWeightMessage(RF24NetworkHeader& header)
  */
 void RF24Mesh::handle_WelcomeMessage(RF24NetworkHeader& header)
 {
-  //IP_MAC message;
-  read(header,0,0);
-  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: handle_WelcomeMessage (%s) \n\r"),rTable.getMillis(),header.toString()));
+  MESH_LOG(LOG_DEBUG, "%lu: handle_WelcomeMessage (" LOG_HEADER_FMT ") \n\r",rTable.getMillis(),LOG_HEADER(header));
 
 //  if(isState(SENDJOIN) || isState(JOINED))
   {
 	  // If this message is from ourselves or the base, don't bother adding it to the active nodes.
 	  if ( header.from_node != this->node_address)
+	  {
 		  if(rTable.addNearNode(header.source_data))
 		  {
-			  rTable.setMillis(header.payload);
-			  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: handle_WelcomeMessage, update join status\n\r"),rTable.getMillis()));
+			  MESH_LOG(LOG_DEBUG, "%lu: handle_WelcomeMessage, update join status\n\r",rTable.getMillis());
 			  setState(NEW_JOINED);
 		  }
+		  rTable.syncTime(header.source_data.ip, header.payload);
+	  }
 	   rTable.printTable();
   }
  // else
   {
-//	  IF_SERIAL_DEBUG(printf_P(PSTR("%lu: OMITTING WelcomeMessage (%s) \n\r"),rTable.getMillis(),header.toString()));
+//	  MESH_LOG(LOG_DEBUG, "%lu: OMITTING WelcomeMessage (" LOG_HEADER_FMT ") \n\r",rTable.getMillis(),LOG_HEADER(header));
   }
 }
 
@@ -790,13 +1199,13 @@ void RF24Mesh::handle_WelcomeMessage(RF24NetworkHeader& header)
  */
 void RF24Mesh::handle_DataMessage(RF24NetworkHeader& header)
 {
-  //uint64_t message;
-  read(header,NULL,0);
 
   if(header.from_node == rTable.getCurrentNode().ip)
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu: handle_DataMessage APP I got my own data omitting.(%s)\n\r"),rTable.getMillis(), header.toString()));
+	MESH_LOG(LOG_DEBUG, "%lu: handle_DataMessage APP I got my own data omitting.(" LOG_HEADER_FMT ")\n\r",rTable.getMillis(), LOG_HEADER(header));
   else
   {
+	  if(latency_stats && rTable.amImaster())
+		  latency_stats->record(header, rTable.getMillis());
 	  callback.incomingData(header);
   }
 
@@ -804,34 +1213,123 @@ void RF24Mesh::handle_DataMessage(RF24NetworkHeader& header)
 
 void RF24Mesh::handle_ForwardData(RF24NetworkHeader& header)
 {
-  uint64_t message;
-  read(header,NULL,0);
 
   if(header.from_node == rTable.getCurrentNode().ip)
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu: handle_DataMessage APP I got my own data omitting. (%s)\n\r"),rTable.getMillis(),header.toString()));
+	MESH_LOG(LOG_DEBUG, "%lu: handle_DataMessage APP I got my own data omitting. (" LOG_HEADER_FMT ")\n\r",rTable.getMillis(),LOG_HEADER(header));
   else
   {
 	  callback.incomingData(header);
 
-	  T_IP ip = rTable.getShortestRouteNode().ip;
-	  unsigned char type = 'D';
-
-	  header.source_data.weight++;
-	  header.prev_node = header.from_node;
-	  header.from_node = rTable.getCurrentNode().ip;
-	  header.to_node = ip;
-      if (ip != rTable.getMasterNode().ip)
-	  {	
-		  type = 'F';
-		  printf_P(PSTR("%lu: APP handle_ForwardData short ip: %d masterip: %d"),rTable.getMillis(),ip,rTable.getMasterNode().ip);
-	  }
-	  header.type = type;
- 
-	  write(header);
+	  // Frames we could not take the fast path for, e.g. while joining
+	  forward(dispatch_slot);
+	  dispatch_slot = -1;
   }
 
 }
 
+/**
+ * Handle a 'Q' frame, pass it on once and answer it
+ */
+void RF24Mesh::handle_StatsQuery(RF24NetworkHeader& header)
+{
+	uint8_t query = header.payload[0];
+
+	if ( rTable.amImaster() || !isState(JOINED) || query == stats_query )
+		return;
+	stats_query = query;
+
+	MESH_LOG(LOG_DEBUG, "%lu: handle_StatsQuery %u from %u\n\r",rTable.getMillis(),query,header.from_node);
+
+	RF24NetworkHeader flood(rTable.getBroadcastNode().ip, 'Q', header.payload, rTable.getCurrentNode().ip);
+	flood.source_data.ip = header.source_data.ip;
+	write(flood);
+
+	send_StatsReport();
+}
+
+/**
+ * Handle an 'S' frame, a node's counters on their way to the master
+ */
+void RF24Mesh::handle_StatsReport(RF24NetworkHeader& header)
+{
+	if ( rTable.amImaster() )
+		callback.incomingStats(header);
+	else if ( isState(JOINED) )
+	{
+		forward(dispatch_slot);
+		dispatch_slot = -1;
+	}
+}
+
+/**
+ * Pass a received data frame on towards the master
+ *
+ * Only the hop fields of the header are patched, in the slot the frame was
+ * received into, and the slot is handed to the send queue.
+ */
+bool RF24Mesh::forward(int8_t slot)
+{
+	RF24NetworkHeader& header = frame_pool.header(slot);
+
+	// Frames still arriving from children after we lost our own route
+	if ( !rTable.amIJoinedNetwork() )
+	{
+		MESH_LOG(LOG_DEBUG, "%lu: APP no route, dropping (" LOG_HEADER_FMT ")\n\r",rTable.getMillis(),LOG_HEADER(header));
+		stats.rx_drops++;
+		frame_pool.release(slot);
+		return false;
+	}
+
+	T_IP ip = rTable.getShortestRouteNode().ip;
+
+	header.source_data.weight++;
+	header.prev_node = header.from_node;
+	header.from_node = node_address;
+	header.to_node = ip;
+	// Stats reports keep their type, the master tells them apart by it
+	if ( header.type != 'S' )
+		header.type = (ip == rTable.getMasterNode().ip) ? 'D' : 'F';
+
+	MESH_LOG(LOG_DEBUG, "%lu: APP forward to ip: %d (" LOG_HEADER_FMT ")\n\r",rTable.getMillis(),ip,LOG_HEADER(header));
+	return send_enqueue(slot);
+}
+
+const RF24Mesh::ForwardStats& RF24Mesh::getForwardStats(void)
+{
+	return forward_stats;
+}
+
+void RF24Mesh::setForwardCallback(bool enable)
+{
+	forward_callback = enable;
+}
+
+void RF24Mesh::setFastForward(bool enable)
+{
+	fast_forward = enable;
+}
+
+void RF24Mesh::setFrameCallback(bool enable)
+{
+	frame_callback = enable;
+}
+
+void RF24Mesh::radioInterrupt(uint32_t at_micros)
+{
+	irq_time = at_micros;
+	irq_pending = true;
+}
+
+void RF24Mesh::setLatencyStamps(bool enable)
+{
+	latency_stamps = enable;
+}
+
+void RF24Mesh::setLatencyStats(LatencyStats* _latency_stats)
+{
+	latency_stats = _latency_stats;
+}
+
 StatusCallback::StatusCallback()
 {
 	receivedPacket = 0;
@@ -844,12 +1342,26 @@ void StatusCallback::println(const char * str)
 void StatusCallback::sendingFailed(T_MAC node)
 {
 	//TODO buraya fail sebebi gelmeli
-	printf_P(PSTR("%lu: ******NET On node 0%x has written failed******\n\r"),rTable.getMillis(),node);
+	MESH_LOG(LOG_WARN, "%lu: ******NET On node 0%x has written failed******\n\r",millis(),(unsigned)node);
 }
 
 void StatusCallback::incomingData(RF24NetworkHeader packet)
 {
 	receivedPacket++;
-	printf_P(PSTR("%lu: Callback %dth data received (%s)\n\r"),rTable.getMillis(),receivedPacket, packet.toString());
+	MESH_LOG(LOG_INFO, "%lu: Callback %dth data received (" LOG_HEADER_FMT ")\n\r",millis(),receivedPacket, LOG_HEADER(packet));
+}
+
+void StatusCallback::incomingFrame(const uint8_t* frame, uint8_t pipe, uint32_t rx_time)
+{
+
+}
+
+void StatusCallback::incomingStats(RF24NetworkHeader packet)
+{
+	MeshStatsReport report;
+	memcpy(&report,packet.payload,sizeof(report));
+
+	MESH_LOG(LOG_INFO, "%lu: Stats of %u rx:%u tx:%u failed:%u retries:%u\n\r",millis(),packet.source_data.ip,report.rx,report.tx,report.tx_failed,report.retries);
+	MESH_LOG(LOG_INFO, "%lu: Stats of %u drops:%u routes:%u joins:%u\n\r",millis(),packet.source_data.ip,report.drops,report.route_changes,report.join_attempts);
 }
 // vim:ai:cin:sts=2 sw=2 ft=cpp
@@ -19,17 +19,31 @@
 #include <stdint.h>
 #include "RF24NetworkHeader.h"
 #include "RoutingTable.h"
+#include "SendQueue.h"
+#include "MeshTrace.h"
 
 class RF24;
+class LatencyStats;
 
 
 
 
-#define SEND_QUEUE_SIZE 5
-#define RECEIVE_QUEUE_SIZE 5
+
+#define LPL_PERIOD 1000 /**< Default ms between the wake windows of sleeping nodes */
+#define LPL_WINDOW 40 /**< Default ms the radio of a sleeping node listens each period */
+#define LPL_GUARD 5 /**< ms kept free at the end of a window for clock error */
+
+#define BACKPRESSURE_GAP 50 /**< ms between data frames to a neighbour at congestion level 1, doubled per level */
+#define BACKPRESSURE_NOTIFY 1000 /**< ms between 'U' frames sent to tell neighbours we are congested */
+#define MESH_STAT_TYPES 8 /**< Frame types counted apart, see RF24Mesh::statType() */
+#define SENSOR_DATA_SIZE 16 /**< Largest reading, the header payload, see send_SensorData() */
+#define IRQ_STAMP_MAX_AGE 20000 /**< us after which an IRQ stamp is taken to belong to an older frame, see radioInterrupt() */
+
 /**
 * Callback Interface
 * 
+* The default implementation only logs, a program overrides what it needs,
+* e.g. incomingData() on the master to keep the readings.
 */
 
 class StatusCallback
@@ -38,9 +52,22 @@ class StatusCallback
 	
 public:
  StatusCallback();
- void println(const char * str);
- void sendingFailed(T_MAC node);
- void incomingData(RF24NetworkHeader packet);
+ virtual ~StatusCallback() {}
+ virtual void println(const char * str);
+ virtual void sendingFailed(T_MAC node);
+ virtual void incomingData(RF24NetworkHeader packet);
+ virtual void incomingStats(RF24NetworkHeader packet);
+
+ /**
+  * Every frame as it comes off the radio, before the mesh looks at it,
+  * see RF24Mesh::setFrameCallback()
+  *
+  * @param frame The frame_size bytes read
+  * @param pipe Pipe it came in on
+  * @param rx_time micros() of the IRQ edge it came with, see
+  * RF24Mesh::radioInterrupt(), or else when the radio was found to have it
+  */
+ virtual void incomingFrame(const uint8_t* frame, uint8_t pipe, uint32_t rx_time);
 };
 
 /**
@@ -51,6 +78,38 @@ public:
  */
 typedef enum  {INIT = 0, NJOINED, SENDJOIN, JOINRECEIVED, NEW_JOINED, JOINED} STATES;
 
+/**
+ * Mesh layer counters, see RF24Mesh::getStats()
+ */
+typedef struct
+{
+  uint16_t rx[MESH_STAT_TYPES]; /**< Frames read from the radio, by RF24Mesh::statType() */
+  uint16_t tx[MESH_STAT_TYPES]; /**< Frames delivered to the next hop, by type */
+  uint16_t tx_failed; /**< Frames given up on after all attempts */
+  uint16_t rx_drops; /**< Frames received but dropped, no slot or no room in the receive queue */
+  uint8_t rx_queue_high_water;
+  uint16_t join_attempts;
+  uint32_t time_in_state[JOINED + 1]; /**< ms spent in each state, not counting the current stay */
+} MeshStats;
+
+/**
+ * Payload of an 'S' frame, the counters a node reports to the master when
+ * it is queried, see RF24Mesh::queryStats()
+ */
+typedef struct
+{
+  uint16_t rx; /**< Frames received, all types */
+  uint16_t tx; /**< Frames delivered, all types */
+  uint16_t tx_failed;
+  uint16_t retries; /**< Radio retransmissions */
+  uint16_t max_rt; /**< Writes the radio gave up on */
+  uint16_t drops; /**< Receive and send queue drops */
+  uint8_t route_changes;
+  uint8_t join_attempts;
+  uint8_t rx_queue_high_water;
+  uint8_t send_queue_high_water; /**< Highest of the traffic classes */
+} MeshStatsReport;
+
 class RF24Mesh
 {
 public:
@@ -125,10 +184,139 @@ public:
   bool write(RF24NetworkHeader& header);
   
   /**
-   * Send a message, the current time
+   * Send a reading towards the master
+   *
+   * @param data The reading
+   * @param length Its size, at most SENSOR_DATA_SIZE.  Readings of at most
+   * LATENCY_STAMP_OFFSET bytes leave room for the latency stamp, see
+   * setLatencyStamps(); longer ones are sent whole and unstamped.
+   * @param urgent Alarms and other latency sensitive readings overtake bulk
+   * data in the send queue of every hop, see SendQueue
+   * @return False if the reading was not queued.  Readings are refused while
+   * the parent reports congestion and the previous one went out less than
+   * backpressureGap() ago, unless they are urgent, and when they are longer
+   * than SENSOR_DATA_SIZE.
+   *
+   * Readings are numbered on their own in the header id, apart from the
+   * other frames we send, so the sink can tell the lost ones from the gaps.
+   */
+  bool send_SensorData(const uint8_t* data, uint8_t length, bool urgent = false);
+
+  /**
+   * Stamp readings so that the master can measure their latency
+   *
+   * Once we are synchronized, send_SensorData() writes the network time into
+   * the payload bytes behind readings of at most LATENCY_STAMP_OFFSET bytes.
+   * Longer readings are never stamped, so the stamp cannot overwrite them.
+   * Every hop adds the time the reading waited in its send queue.
+   */
+  void setLatencyStamps(bool enable);
+
+  /**
+   * Where the master counts the latency of stamped readings, NULL for nowhere
+   */
+  void setLatencyStats(LatencyStats* _latency_stats);
+
+  /**
+   * Time frames spend in this node on their way to the master
+   */
+  typedef struct
+  {
+    uint16_t count; /**< Frames forwarded */
+    uint32_t total; /**< ms from entering the send queue to going to the radio, summed */
+    uint32_t max;
+  } ForwardStats;
+
+  const ForwardStats& getForwardStats(void);
+
+  /**
+   * Whether the callback sees frames which are only passing through
+   *
+   * Forwarded frames are patched and queued right in listenRadio(), see
+   * forward().  Skipping the callback keeps that path short on relays
+   * which do not need to look at their descendants' data.
+   */
+  void setForwardCallback(bool enable);
+
+  /**
+   * Whether data passing through takes the fast path of forward()
+   *
+   * On by default.  Off, it goes through the receive queue and
+   * handlePacket() like every other frame, which is only useful to measure
+   * what the fast path saves.
+   */
+  void setFastForward(bool enable);
+
+  /**
+   * Whether the callback sees every frame read from the radio, see
+   * StatusCallback::incomingFrame()
+   *
+   * Off by default.  Also frames which are dropped for want of a slot are
+   * handed over, so a recording of them has what was on the air.
+   */
+  void setFrameCallback(bool enable);
+
+  /**
+   * Tell the mesh when the radio pulled its IRQ line low
    *
+   * Call it from the interrupt handler with micros(), or with the time of
+   * the edge if the platform stamps it.  The next frame read is then taken
+   * to have arrived at that time rather than when loop() found it, which
+   * keeps the polling latency out of the time stamps of 'W' and 'U'
+   * frames, see TimeSync.
    */
-  bool send_SensorData(uint8_t data[16]);
+  void radioInterrupt(uint32_t at_micros);
+
+  /**
+   * Counters of the send queue for one traffic class
+   */
+  const SendQueueStats& getSendQueueStats(SendQueueClass c);
+
+  /**
+   * Counters of the data we sent or forwarded, per originating node
+   */
+  uint8_t getSourceCount(void);
+  const SourceStats& getSourceStats(uint8_t i);
+
+  /**
+   * Counters of this layer, see RF24::getStats() for the driver
+   */
+  const MeshStats& getStats(void);
+
+  /**
+   * Neighbours, route changes and congestion as the mesh sees them
+   */
+  RoutingTable& getRoutingTable(void);
+
+#ifdef MESH_TRACE
+  /**
+   * Events of this mesh, to flush() now and then
+   */
+  MeshTrace& getTrace(void);
+#endif
+
+  /**
+   * ms spent in @p s so far, including the current stay
+   */
+  unsigned long getTimeInState(STATES s);
+
+  /**
+   * Index of a frame type in the per type counters
+   *
+   * 'J', 'W', 'U', 'D', 'F', 'Q' and 'S' in that order, then anything else.
+   */
+  static uint8_t statType(unsigned char type);
+
+  /**
+   * Ask every node for its counters
+   *
+   * Only on the master.  A 'Q' frame is flooded through the network, every
+   * joined node broadcasts it once more and sends an 'S' frame with a
+   * MeshStatsReport up to the master, where it is handed to
+   * StatusCallback::incomingStats().
+   */
+  void queryStats(void);
+  bool send_StatsReport(void);
 
   bool send_WelcomeMessage(T_IP);
 
@@ -150,6 +338,8 @@ void handle_ForwardData(RF24NetworkHeader& header);
 
 void handle_JoinMessage(RF24NetworkHeader& header);
 void handle_UpdateWeightMessage(RF24NetworkHeader& header);
+void handle_StatsQuery(RF24NetworkHeader& header);
+void handle_StatsReport(RF24NetworkHeader& header);
 
 /**
  * Add a particular node to the current list of active nodes
@@ -164,22 +354,57 @@ void loop(void);
 void joinNetwork();
 bool isJoined();
 
+/**
+ * Duty cycle the radio
+ *
+ * Once joined and synchronized, the radio is powered down except for a
+ * window of @p window ms every @p period ms, aligned to network time so that
+ * all sleeping nodes wake together.  Neighbours learn from the frames we
+ * send that we sleep, and hold frames for us until the window.  Our own
+ * frames still go out immediately unless the next hop sleeps as well.
+ *
+ * Meant for leaves.  A sleeping relay is only reachable in the window, so
+ * the frames of its children wait up to one period on every sleeping hop.
+ *
+ * Ignored on the master.
+ */
+void setLowPower(bool enable, uint16_t period = LPL_PERIOD, uint16_t window = LPL_WINDOW);
+
+/**
+ * Network time, synchronized to the master
+ *
+ * Both follow the clock of the master node, compensated for the delay of
+ * every hop and for the drift of our own oscillator.  On the master they
+ * are just micros() and millis().
+ */
+uint32_t networkMicros();
+unsigned long networkMillis();
+
 protected:
 	void fastloop();
 	void slowloop();
 
+	bool wake();
+	bool inWakeWindow(uint16_t guard);
+	bool canSendNow(T_IP to);
+	unsigned long backpressureGap(T_IP to);
+	static bool sendable(void* mesh, const RF24NetworkHeader& header);
+	void notifyCongestion();
+	void beacon();
+
 	void setState(STATES s);
 	bool isState(STATES s);
 
   void open_pipes(void);
   uint16_t find_node( uint16_t current_node, uint16_t target_node );
-  void shiftleft(uint8_t *send_queue, const int frame_size, uint8_t *frame_buffer, uint8_t *last_pointer);
-  bool write(T_MAC);
-  int write();
+  bool write(T_MAC to_mac, uint8_t* frame);
+  int8_t write(); /**< Send the next queued frame: 1 sent, 0 the radio failed, -1 none taken */
   bool write(RF24NetworkHeader& header, T_MAC mac);
+  bool send_frame(int8_t slot);
+  bool forward(int8_t slot);
   bool write_to_pipe( uint16_t node, uint8_t pipe );
-  bool enqueue(void);
-  bool send_enqueue();
+  bool enqueue(int8_t slot);
+  bool send_enqueue(int8_t slot);
 
   bool is_valid_address( uint16_t node );
   void listenRadio();
@@ -193,13 +418,15 @@ private:
   RF24& radio; /**< Underlying radio driver, provides link/physical layers */ 
   StatusCallback& callback;
   uint16_t node_address; /**< Logical node address of this unit, 1 .. UINT_MAX */
+  RoutingTable rTable; /**< Neighbours, route to the master and network time */
   const static int frame_size = 32; /**< How large is each frame over the air */ 
-  uint8_t frame_buffer[frame_size]; /**< Space to put the frame that will be sent/received over the air */
-  uint8_t receive_queue[RECEIVE_QUEUE_SIZE*frame_size]; /**< Space for a small set of frames that need to be delivered to the app layer */
-  uint8_t* receive_frame; /**< Pointer into the @p frame_queue where we should place the next received frame */
+  FramePool frame_pool; /**< Every frame received, handled or waiting to be sent */
+  uint8_t receive_queue[RECEIVE_QUEUE_SIZE]; /**< Slots of frames that need to be delivered to the app layer, oldest first */
+  uint8_t receive_head;
+  uint8_t receive_count;
+  int8_t dispatch_slot; /**< Slot of the frame handlePacket() is handling, -1 once a handler took it over */
 
-  uint8_t send_queue[SEND_QUEUE_SIZE*frame_size];
-  uint8_t* send_frame_p;
+  SendQueue send_queue; /**< Frames waiting for the radio, by priority */
 
   //uint16_t parent_node; /**< Our parent's node address */
   //uint8_t parent_pipe; /**< The pipe our parent uses to listen to us */
@@ -210,6 +437,34 @@ private:
 
 	unsigned long state_time; //use millis()
 	STATES state;
+
+	bool low_power; /**< Duty cycle the radio, see setLowPower() */
+	bool radio_asleep;
+	uint16_t lpl_period;
+	uint16_t lpl_window;
+
+	unsigned long last_reading_time; /**< When send_SensorData() last queued a reading */
+	unsigned long blind_time; /**< When a frame last went to a sleeping hop before we were synchronized, see canSendNow() */
+	uint16_t reading_id; /**< Id of our next reading */
+	unsigned long last_data_time; /**< When sendPackets() last sent a data frame */
+	unsigned long last_notify_time; /**< When we last announced our congestion */
+	unsigned long last_beacon_time; /**< When we last sent a 'U', see beacon() */
+	uint8_t notified_congestion; /**< Level announced last by a 'U' */
+
+	bool forward_callback; /**< See setForwardCallback() */
+	bool fast_forward; /**< See setFastForward() */
+	bool frame_callback; /**< See setFrameCallback() */
+	volatile uint32_t irq_time; /**< See radioInterrupt() */
+	volatile bool irq_pending;
+	int error_rate; /**< Failed sends in a row, the route is given up after a few */
+	ForwardStats forward_stats;
+	MeshStats stats;
+	uint8_t stats_query; /**< Number of the last stats query seen or sent */
+	bool latency_stamps; /**< See setLatencyStamps() */
+	LatencyStats* latency_stats;
+#ifdef MESH_TRACE
+	MeshTrace trace;
+#endif
 };
 
 /**
@@ -273,13 +528,16 @@ private:
  * this layer will get them there no matter how many hops it takes.
  * @li Ad-hoc Joining.  A node can join a network without any changes to any
  * existing nodes.
+ * @li Power-efficient listening.  Nodes may sleep between wake windows which
+ * are aligned to network time, see RF24Mesh::setLowPower().  Their neighbours
+ * hold frames for them until the next window.
+ * @li Telemetry.  Every node counts frames, drops, retries and routing
+ * changes, see RF24Mesh::getStats(), and the master can collect the counters
+ * of all nodes with RF24Mesh::queryStats().
  *
  * The layer does not (yet) provide:
  * @li Fragmentation/reassembly.  Ability to send longer messages and put them
  * all back together before exposing them up to the app.
- * @li Power-efficient listening.  It would be useful for nodes who are listening
- * to sleep for extended periods of time if they could know that they would miss
- * no traffic.
  * @li Dynamic address assignment.
  *
  * @section More How to learn more
@@ -338,12 +596,11 @@ private:
  * (i.e. leaf nodes).  This is useful in a case where
  * the leaf nodes are operating on batteries and need to sleep.
  * This is useful for a sensor network.  The leaf nodes can sleep most of the time, and wake
- * every few minutes to send in a reading.  However, messages cannot be sent to these 
- * sleeping nodes.
+ * every few minutes to send in a reading.
  *
- * In the future, I plan to write a system where messages can still be passed upward from
- * the base, and get delivered when a sleeping node is ready to receive them.  The radio
- * and underlying driver support 'ack payloads', which will be a handy mechanism for this.
+ * With RF24Mesh::setLowPower() sleeping nodes wake for a short window every period,
+ * aligned to the network time of the master.  Frames for them, and broadcasts while
+ * any of them is around, wait in the send queue of the neighbour until that window.
  *
  * @page Zigbee Comparison to ZigBee
  *
@@ -13,6 +13,12 @@
 #define T_IP uint16_t
 #define T_MAC uint64_t
 
+#define HEADER_FLAG_SLEEPY 0x01 /**< Sender powers its radio down between wake windows */
+#define HEADER_FLAG_URGENT 0x02 /**< Latency sensitive data, kept along the whole path */
+#define HEADER_CONGESTION_MASK 0x0C /**< Send queue level of the sender of this hop, 0..3 */
+#define HEADER_CONGESTION_SHIFT 2
+#define HEADER_FLAG_TIMED 0x10 /**< The last 4 payload bytes are a latency stamp, see LatencyStats.h */
+
 
 typedef struct
 {
@@ -30,6 +36,7 @@ struct RF24NetworkHeader
   uint8_t payload[16];
   IP_MAC source_data; //it is used as ip and weight info for join data; original ip and hop count for sensor data
   unsigned char type; /**< Type of the packet.  0-127 are user-defined types, 128-255 are reserved for system */
+  uint8_t flags; /**< HEADER_FLAG_* bits describing the node which sent this hop */
 
   static uint16_t next_id; /**< The message ID of the next message to be sent */
 
@@ -54,12 +61,12 @@ struct RF24NetworkHeader
    * @param _type The type of message which follows.  Only 0-127 are allowed for
    * user messages.
    */
-  RF24NetworkHeader(uint16_t _to, unsigned char _type = 0, uint64_t _data = 0, uint16_t _from = 0): to_node(_to), id(next_id++), type(_type&0x7f), from_node(_from), prev_node(0) {
+  RF24NetworkHeader(uint16_t _to, unsigned char _type = 0, uint64_t _data = 0, uint16_t _from = 0): from_node(_from), prev_node(0), to_node(_to), id(next_id++), type(_type&0x7f), flags(0) {
 	  memcpy(&payload, &_data,8);
 
   }
 
-  RF24NetworkHeader(uint16_t _to, unsigned char _type, uint8_t _data[16], uint16_t _from = 0): to_node(_to), id(next_id++), type(_type&0x7f), from_node(_from), prev_node(0) {
+  RF24NetworkHeader(uint16_t _to, unsigned char _type, uint8_t _data[16], uint16_t _from = 0): from_node(_from), prev_node(0), to_node(_to), id(next_id++), type(_type&0x7f), flags(0) {
 
 	  for(int i=0;i<16;i++)
 	  {
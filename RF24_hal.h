@@ -0,0 +1,131 @@
+#ifndef __RF24_HAL_H__
+#define __RF24_HAL_H__
+
+/**
+ * @file RF24_hal.h
+ *
+ * What the library needs from the platform it runs on
+ *
+ * @li Time: millis(), micros(), delay(), delayMicroseconds()
+ * @li Interrupts: noInterrupts(), interrupts()
+ * @li GPIO: pinMode(), digitalWrite(), for the CE and CSN pins
+ * @li SPI: the SPI object, one byte at a time with SPI.transfer()
+ * @li Logging: printf_P(), and PSTR() and friends for strings in flash
+ *
+ * On an Arduino these are the Arduino core itself and cost nothing.
+ * Anywhere else this header declares them and a backend defines them:
+ *
+ * @li RF24_hal_linux.cpp, built with RF24_HAL_LINUX: spidev and the GPIO
+ * character device of a Linux board, for gateways on a Raspberry Pi and
+ * the like.
+ * @li RF24_hal_mock.cpp, built with RF24_HAL_MOCK: a software clock and
+ * an SPI bus handed to a function of the test, see RF24_hal_mock.h.
+ * @li tests/bench/Sim.cpp: the simulated nodes of the host benchmark.
+ *
+ * The interface keeps the Arduino names, so the library is the same code
+ * on every platform.
+ */
+
+#ifdef ARDUINO
+
+#if ARDUINO < 100
+#include <WProgram.h>
+#else
+#include <Arduino.h>
+#endif
+#include <SPI.h>
+#include <avr/pgmspace.h>
+
+// Avoid spurious warnings
+#ifndef NATIVE
+#undef PROGMEM
+#define PROGMEM __attribute__(( section(".progmem.data") ))
+#undef PSTR
+#define PSTR(s) (__extension__({static const char __c[] PROGMEM = (s); &__c[0];}))
+#endif
+
+#define PRIPSTR "%S"
+
+#else // !ARDUINO
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+#define B0100 4
+#define B111 7
+#define B1111 15
+#define B111111 63
+
+#define _BV(x) (1<<(x))
+
+template<class T, class U> static inline T min(T a, U b) { return a < (T)b ? a : (T)b; }
+template<class T, class U> static inline T max(T a, U b) { return a > (T)b ? a : (T)b; }
+
+// Time, from the start of the program
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Interrupts, there are no handlers between two instructions here: what
+// stands for the IRQ of the radio runs on the thread of the mesh
+
+static inline void noInterrupts(void) {}
+static inline void interrupts(void) {}
+
+// GPIO, pins are numbered by the backend
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+
+// SPI, mode 0, most significant bit first
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+#define SPI_CLOCK_DIV2 0
+#define SPI_CLOCK_DIV4 1
+
+class SPIClass
+{
+public:
+	void begin(void);
+	uint8_t transfer(uint8_t data);
+
+	/**
+	 * The backend sets the bus up once in begin()
+	 */
+	void setBitOrder(int) {}
+	void setDataMode(int) {}
+	void setClockDivider(int) {}
+};
+extern SPIClass SPI;
+
+// Logging, flash is ordinary memory here
+
+int printf_P(const char* format, ...);
+
+typedef char prog_char;
+typedef uint16_t prog_uint16_t;
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(p))
+#define strlen_P strlen
+#define snprintf_P snprintf
+#define PRIPSTR "%s"
+
+#endif // ARDUINO
+
+#endif //__RF24_HAL_H__
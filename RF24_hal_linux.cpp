@@ -0,0 +1,252 @@
+/**
+ * @file RF24_hal_linux.cpp
+ *
+ * Backend of RF24_hal.h for Linux boards, built with RF24_HAL_LINUX
+ *
+ * The radio hangs off a spidev device and two lines of a GPIO chip, pins
+ * are the line offsets on that chip.  CSN is driven as a GPIO line like
+ * CE, because the driver selects the chip around several bytes and spidev
+ * would toggle its own chip select after each one; the bus is thus
+ * opened with SPI_NO_CS, and the CE0/CE1 pin of the board stays unused.
+ *
+ * Lines are requested through the GPIO character device, the interface
+ * libgpiod wraps, so nothing beyond the kernel headers is needed.
+ */
+
+#if !defined(ARDUINO) && defined(RF24_HAL_LINUX)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+#include "RF24_hal.h"
+#include "RF24_hal_linux.h"
+
+#define HAL_LINUX_PINS 64
+#define HAL_LINUX_SPIN_US 100 /**< Shorter delays spin, the scheduler is too coarse for them */
+
+SPIClass SPI;
+
+static int spi_fd = -1;
+static int chip_fd = -1;
+static int line_fd[HAL_LINUX_PINS];
+static bool line_open[HAL_LINUX_PINS];
+static uint32_t spi_speed = RF24_HAL_SPI_SPEED;
+static struct timespec start;
+
+/****************************************************************************/
+
+static uint64_t elapsedNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	if(!start.tv_sec && !start.tv_nsec)
+		start = now;
+	return (uint64_t)(now.tv_sec - start.tv_sec) * 1000000000ULL + now.tv_nsec - start.tv_nsec;
+}
+
+// Both wrap at 32 bits as on an Arduino, the time math of the library
+// counts on it
+unsigned long millis(void)
+{
+	return (uint32_t)(elapsedNs() / 1000000);
+}
+
+unsigned long micros(void)
+{
+	return (uint32_t)(elapsedNs() / 1000);
+}
+
+void delay(unsigned long ms)
+{
+	struct timespec t;
+	t.tv_sec = ms / 1000;
+	t.tv_nsec = (ms % 1000) * 1000000L;
+	while(nanosleep(&t,&t) < 0 && errno == EINTR);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	if(us >= HAL_LINUX_SPIN_US)
+	{
+		struct timespec t;
+		t.tv_sec = us / 1000000;
+		t.tv_nsec = (us % 1000000) * 1000L;
+		while(nanosleep(&t,&t) < 0 && errno == EINTR);
+		return;
+	}
+
+	uint64_t end = elapsedNs() + us * 1000ULL;
+	while(elapsedNs() < end);
+}
+
+/****************************************************************************/
+
+bool HalLinux::open(const char* spidev, const char* gpiochip, uint32_t speed_hz)
+{
+	close();
+	spi_speed = speed_hz;
+
+	spi_fd = ::open(spidev,O_RDWR);
+	if(spi_fd < 0)
+	{
+		perror(spidev);
+		return false;
+	}
+
+	uint32_t mode = SPI_MODE_0 | SPI_NO_CS;
+	uint8_t bits = 8;
+	if(ioctl(spi_fd,SPI_IOC_WR_MODE32,&mode) < 0 || ioctl(spi_fd,SPI_IOC_WR_BITS_PER_WORD,&bits) < 0 ||
+		ioctl(spi_fd,SPI_IOC_WR_MAX_SPEED_HZ,&spi_speed) < 0)
+	{
+		perror(spidev);
+		close();
+		return false;
+	}
+
+	chip_fd = ::open(gpiochip,O_RDWR);
+	if(chip_fd < 0)
+	{
+		perror(gpiochip);
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void HalLinux::close(void)
+{
+	for(int i=0;i<HAL_LINUX_PINS;i++)
+	{
+		if(line_open[i])
+			::close(line_fd[i]);
+		line_open[i] = false;
+	}
+	if(chip_fd >= 0)
+		::close(chip_fd);
+	if(spi_fd >= 0)
+		::close(spi_fd);
+	chip_fd = -1;
+	spi_fd = -1;
+}
+
+bool HalLinux::isOpen(void)
+{
+	return spi_fd >= 0 && chip_fd >= 0;
+}
+
+int HalLinux::openIrq(uint8_t pin)
+{
+	if(chip_fd < 0)
+		return -1;
+
+	struct gpioevent_request request;
+	memset(&request,0,sizeof(request));
+	request.lineoffset = pin;
+	request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	request.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+	strncpy(request.consumer_label,"rf24-irq",sizeof(request.consumer_label) - 1);
+
+	if(ioctl(chip_fd,GPIO_GET_LINEEVENT_IOCTL,&request) < 0)
+	{
+		fprintf(stderr,"GPIO line %u: %s\n",pin,strerror(errno));
+		return -1;
+	}
+	return request.fd;
+}
+
+/**
+ * Open the default devices if the program did not open any
+ */
+static bool ready(void)
+{
+	if(HalLinux::isOpen())
+		return true;
+
+	static bool failed;
+	if(failed)
+		return false;
+
+	failed = !HalLinux::open(RF24_HAL_SPIDEV,RF24_HAL_GPIOCHIP,spi_speed);
+	return !failed;
+}
+
+/****************************************************************************/
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	if(pin >= HAL_LINUX_PINS || mode != OUTPUT || !ready() || line_open[pin])
+		return;
+
+	struct gpiohandle_request request;
+	memset(&request,0,sizeof(request));
+	request.lineoffsets[0] = pin;
+	request.lines = 1;
+	request.flags = GPIOHANDLE_REQUEST_OUTPUT;
+	request.default_values[0] = 1;
+	strncpy(request.consumer_label,"rf24",sizeof(request.consumer_label) - 1);
+
+	if(ioctl(chip_fd,GPIO_GET_LINEHANDLE_IOCTL,&request) < 0)
+	{
+		fprintf(stderr,"GPIO line %u: %s\n",pin,strerror(errno));
+		return;
+	}
+	line_fd[pin] = request.fd;
+	line_open[pin] = true;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+	if(pin >= HAL_LINUX_PINS || !line_open[pin])
+		return;
+
+	struct gpiohandle_data data;
+	memset(&data,0,sizeof(data));
+	data.values[0] = level;
+	ioctl(line_fd[pin],GPIOHANDLE_SET_LINE_VALUES_IOCTL,&data);
+}
+
+/****************************************************************************/
+
+void SPIClass::begin(void)
+{
+	ready();
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+	if(spi_fd < 0)
+		return 0;
+
+	uint8_t in = 0;
+	struct spi_ioc_transfer t;
+	memset(&t,0,sizeof(t));
+	t.tx_buf = (unsigned long)&data;
+	t.rx_buf = (unsigned long)&in;
+	t.len = 1;
+	t.speed_hz = spi_speed;
+	t.bits_per_word = 8;
+
+	if(ioctl(spi_fd,SPI_IOC_MESSAGE(1),&t) < 0)
+		return 0;
+	return in;
+}
+
+/****************************************************************************/
+
+int printf_P(const char* format, ...)
+{
+	va_list args;
+	va_start(args,format);
+	int n = vprintf(format,args);
+	va_end(args);
+	return n;
+}
+
+#endif // RF24_HAL_LINUX
@@ -0,0 +1,53 @@
+#ifndef __RF24_HAL_LINUX_H__
+#define __RF24_HAL_LINUX_H__
+
+#include <stdint.h>
+
+/**
+ * @file RF24_hal_linux.h
+ *
+ * Devices of the Linux backend of RF24_hal.h
+ *
+ * SPI.begin() opens the default devices below unless the program opened
+ * others before, e.g. from its command line.
+ */
+
+#ifndef RF24_HAL_SPIDEV
+#define RF24_HAL_SPIDEV "/dev/spidev0.0"
+#endif
+#ifndef RF24_HAL_GPIOCHIP
+#define RF24_HAL_GPIOCHIP "/dev/gpiochip0"
+#endif
+#ifndef RF24_HAL_SPI_SPEED
+#define RF24_HAL_SPI_SPEED 4000000 /**< Hz, as an Arduino at 16 MHz with SPI_CLOCK_DIV4 */
+#endif
+
+class HalLinux
+{
+public:
+	/**
+	 * Open the SPI bus and the GPIO chip of the radio
+	 *
+	 * Prints the reason and returns false if either cannot be set up.
+	 */
+	static bool open(const char* spidev, const char* gpiochip, uint32_t speed_hz = RF24_HAL_SPI_SPEED);
+
+	/**
+	 * Release the bus, the chip and every requested line
+	 */
+	static void close(void);
+
+	static bool isOpen(void);
+
+	/**
+	 * Watch the IRQ line of the radio, which it pulls low on RX_DR, TX_DS
+	 * and MAX_RT
+	 *
+	 * @return A descriptor that becomes readable on each falling edge, for
+	 * poll() or epoll, or -1.  Read struct gpioevent_data records from it to
+	 * consume the edges, and close it when done.
+	 */
+	static int openIrq(uint8_t pin);
+};
+
+#endif //__RF24_HAL_LINUX_H__
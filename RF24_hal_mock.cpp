@@ -0,0 +1,139 @@
+/**
+ * @file RF24_hal_mock.cpp
+ *
+ * Software backend of RF24_hal.h, see RF24_hal_mock.h
+ */
+
+#if !defined(ARDUINO) && defined(RF24_HAL_MOCK)
+
+#include <stdarg.h>
+
+#include "RF24_hal.h"
+#include "RF24_hal_mock.h"
+
+SPIClass SPI;
+
+static uint64_t clock_us;
+static uint8_t levels[RF24_HAL_MOCK_PINS];
+static HalMockSpi spi_handler;
+static void* spi_context;
+static HalMockPin pin_handler;
+static void* pin_context;
+static uint32_t spi_bytes;
+static bool verbose = true;
+
+/****************************************************************************/
+
+void HalMock::reset(void)
+{
+	clock_us = 0;
+	memset(levels,LOW,sizeof(levels));
+	spi_handler = NULL;
+	spi_context = NULL;
+	pin_handler = NULL;
+	pin_context = NULL;
+	spi_bytes = 0;
+}
+
+void HalMock::setSpi(HalMockSpi handler, void* context)
+{
+	spi_handler = handler;
+	spi_context = context;
+}
+
+void HalMock::setPins(HalMockPin handler, void* context)
+{
+	pin_handler = handler;
+	pin_context = context;
+}
+
+void HalMock::advance(uint32_t us)
+{
+	clock_us += us;
+}
+
+uint64_t HalMock::now(void)
+{
+	return clock_us;
+}
+
+uint8_t HalMock::level(uint8_t pin)
+{
+	if(pin >= RF24_HAL_MOCK_PINS)
+		return LOW;
+	return levels[pin];
+}
+
+uint32_t HalMock::getSpiBytes(void)
+{
+	return spi_bytes;
+}
+
+void HalMock::setVerbose(bool _verbose)
+{
+	verbose = _verbose;
+}
+
+/****************************************************************************/
+
+// Wrapping at 32 bits like the Arduino core, see HalMock::now() for the
+// whole clock
+unsigned long millis(void)
+{
+	clock_us += RF24_HAL_MOCK_CALL_US;
+	return (uint32_t)(clock_us / 1000);
+}
+
+unsigned long micros(void)
+{
+	clock_us += RF24_HAL_MOCK_CALL_US;
+	return (uint32_t)clock_us;
+}
+
+void delay(unsigned long ms)
+{
+	clock_us += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	clock_us += us;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+	if(pin < RF24_HAL_MOCK_PINS)
+		levels[pin] = level;
+	if(pin_handler)
+		pin_handler(pin,level,pin_context);
+}
+
+void SPIClass::begin(void)
+{
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+	spi_bytes++;
+	if(!spi_handler)
+		return 0;
+	return spi_handler(data,spi_context);
+}
+
+int printf_P(const char* format, ...)
+{
+	if(!verbose)
+		return 0;
+
+	va_list args;
+	va_start(args,format);
+	int n = vprintf(format,args);
+	va_end(args);
+	return n;
+}
+
+#endif // RF24_HAL_MOCK
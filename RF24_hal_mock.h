@@ -0,0 +1,68 @@
+#ifndef __RF24_HAL_MOCK_H__
+#define __RF24_HAL_MOCK_H__
+
+#include <stdint.h>
+
+/**
+ * @file RF24_hal_mock.h
+ *
+ * Software backend of RF24_hal.h, built with RF24_HAL_MOCK
+ *
+ * Nothing waits for real.  The clock moves only by delays and by
+ * RF24_HAL_MOCK_CALL_US on every millis() or micros() call, so loops that
+ * wait for a timeout end even if nothing answers.  SPI bytes go to the
+ * handler of the test; without one every transfer reads 0.
+ */
+
+#ifndef RF24_HAL_MOCK_CALL_US
+#define RF24_HAL_MOCK_CALL_US 1
+#endif
+#define RF24_HAL_MOCK_PINS 64
+
+/**
+ * Answer of the device to one SPI byte, HalMock::level() of its chip
+ * select tells whether it is selected
+ */
+typedef uint8_t (*HalMockSpi)(uint8_t data, void* context);
+
+/**
+ * Sees every level written to a pin, e.g. chip select going high at the
+ * end of an SPI transaction
+ */
+typedef void (*HalMockPin)(uint8_t pin, uint8_t level, void* context);
+
+class HalMock
+{
+public:
+	/**
+	 * Back to time 0, all pins low, no handlers, counters cleared
+	 */
+	static void reset(void);
+
+	static void setSpi(HalMockSpi handler, void* context);
+	static void setPins(HalMockPin handler, void* context);
+
+	/**
+	 * Move the clock forward as if the program had waited
+	 */
+	static void advance(uint32_t us);
+
+	/**
+	 * Microseconds since reset()
+	 */
+	static uint64_t now(void);
+
+	/**
+	 * Last level written to @p pin, LOW if never written
+	 */
+	static uint8_t level(uint8_t pin);
+
+	static uint32_t getSpiBytes(void);
+
+	/**
+	 * Messages of the library go to stdout only if set, the default
+	 */
+	static void setVerbose(bool verbose);
+};
+
+#endif //__RF24_HAL_MOCK_H__
@@ -1,5 +1,9 @@
+#define LOG_MODULE ROUTING
+
 #include "RoutingTable.h"
 #include "RF24Network_config.h"
+#include "MeshLog.h"
+#include "MeshTrace.h"
 
 const IP_MAC BROADCAST_ADDRESS = {0x7918,  0};
 
@@ -9,14 +13,26 @@ const T_MAC base_address = 0xE8E8E8E8LL;
 
 const uint8_t MAX_WEIGHT = 255;
 
+/* Routing changes go to the trace of the owning mesh, if one was given */
+#ifdef MESH_TRACE
+#define ROUTE_EVENT(...) do { if(trace) TRACE_EVENT(*trace, __VA_ARGS__); } while (0)
+#else
+#define ROUTE_EVENT(...) do {} while (0)
+#endif
+
 RoutingTable::RoutingTable(void)
 {
 	tableCount = 0;
 	myNode.weight = MAX_WEIGHT;
 	iAmMaster=false;
 	shortestPath = MAX_WEIGHT;
-	millis_delta = 0;
-	printf_P(PSTR("Created new routing table"));
+	sleepyCount = 0;
+	congestedCount = 0;
+	routeChanges = 0;
+#ifdef MESH_TRACE
+	trace = NULL;
+#endif
+	MESH_LOG(LOG_DEBUG, "Created new routing table");
 }
 
 RoutingTable::~RoutingTable(void)
@@ -24,33 +40,33 @@ RoutingTable::~RoutingTable(void)
 }
 
 
-void RoutingTable::setMillis(uint8_t data[16])
+/**
+ * Take a time sample from a stamped 'W' or 'U' frame
+ *
+ * Only our parent on the shortest path is trusted as a time source, so the
+ * time always flows down the same tree the data flows up.
+ */
+bool RoutingTable::syncTime(T_IP from, uint8_t data[16])
 {
-	unsigned long a=0;
-	//memcpy(&a,&data, sizeof(unsigned long));
-	//unsigned long a =  data;
-	a = data[3];
-	a=  (a << 8) + data[2];
-	a = (a << 8) + data[1];
-	a = (a << 8) + data[0];
+	if(iAmMaster || !amIJoinedNetwork() || from != table[shortestPath].ip_mac.ip)
+		return false;
 
-	if(a > millis())
-	{
-		millis_delta = a - millis();
-		millis_delta_positive =  true;
-	}else
-	{
-		millis_delta = millis() - a;
-		millis_delta_positive =  false;
-	}
-	printf_P(PSTR("SetMillis called: sizeof unsigned long is %d a:%lx delta:%lx d0:%d d1:%d d2:%d d3:%d \n\r"),sizeof(unsigned long),a,millis_delta, data[0], data[1],data[2],data[3]);
+	return clock.addSample(from, data);
 }
+
+TimeSync& RoutingTable::getTimeSync()
+{
+	return clock;
+}
+
 unsigned long RoutingTable::getMillis()
 {
-	if(millis_delta_positive)
-		return millis() + millis_delta;
-	else
-		return millis() - millis_delta;
+	return clock.networkMillis();
+}
+
+uint32_t RoutingTable::getMicros()
+{
+	return clock.networkMicros();
 }
 
 IP_MAC RoutingTable::getMasterNode()
@@ -68,7 +84,7 @@ IP_MAC RoutingTable::getBroadcastNode()
 
 IP_MAC RoutingTable::getCurrentNode()
 {
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu: getCurrentNode IP:%u weight: %u \n\r"),millis(), myNode.ip, myNode.weight));
+	MESH_LOG(LOG_DEBUG, "%lu: getCurrentNode IP:%u weight: %u \n\r",millis(), myNode.ip, myNode.weight);
 	return myNode;
 }
 
@@ -76,22 +92,22 @@ IP_MAC RoutingTable::getCurrentNode()
 void RoutingTable::setCurrentNode(T_IP myIP)
 {
 	static int i=0;
-	printf_P(PSTR("%lu:SetCurrentNode called %u times"),millis(), ++i);
+	MESH_LOG(LOG_DEBUG, "%lu:SetCurrentNode called %u times",millis(), ++i);
 	
 	if(myIP == MASTER_SYNC_ADDRESS.ip)
 	{
 		this->myNode = MASTER_SYNC_ADDRESS;
 		iAmMaster = true;
-		IF_SERIAL_DEBUG(printf_P(PSTR("%lu:SetCurrent This is master node ip:%u,  weight:%02x\n\r"),millis(),myNode.ip,  myNode.weight));
+		MESH_LOG(LOG_DEBUG, "%lu:SetCurrent This is master node ip:%u,  weight:%02x\n\r",millis(),myNode.ip,  myNode.weight);
 	}
 	else
 	{
 		this->myNode.ip = myIP;
 		this->myNode.weight = MAX_WEIGHT;
-		IF_SERIAL_DEBUG(printf_P(PSTR("%lu: SetCurrent3 MyNode IP:%d  weight:%u \n\r"),millis(),myNode.ip, this->myNode.weight ));
+		MESH_LOG(LOG_DEBUG, "%lu: SetCurrent3 MyNode IP:%d  weight:%u \n\r",millis(),myNode.ip, this->myNode.weight );
 		if(this->myNode.weight == MAX_WEIGHT)
 		{
-			IF_SERIAL_DEBUG(printf_P(PSTR("%lu: SetCurrent4 it is 0 MyNode IP:%d  weight:%u \n\r"),millis(),myNode.ip, this->myNode.weight ));
+			MESH_LOG(LOG_DEBUG, "%lu: SetCurrent4 it is 0 MyNode IP:%d  weight:%u \n\r",millis(),myNode.ip, this->myNode.weight );
 		}
 	}
 	
@@ -111,10 +127,10 @@ bool RoutingTable::addNearNode(IP_MAC nearNode)
 	bool result = false;
 	int8_t position = checkTable(nearNode.ip);
 	
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu: addNearNode IP:%d weight:0%d myweight:0%d \n\r"),millis(),nearNode.ip,nearNode.weight,myNode.weight ));
+	MESH_LOG(LOG_DEBUG, "%lu: addNearNode IP:%d weight:0%d myweight:0%d \n\r",millis(),nearNode.ip,nearNode.weight,myNode.weight );
 	if(nearNode.weight + 1 < myNode.weight)
 	{
-		IF_SERIAL_DEBUG(printf_P(PSTR("%lu: addNearNode IP:%d position:%d \n\r"),millis(),nearNode.ip, position ));
+		MESH_LOG(LOG_DEBUG, "%lu: addNearNode IP:%d position:%d \n\r",millis(),nearNode.ip, position );
 		myNode.weight = nearNode.weight + 1;
 		if(position != -1)
 		{
@@ -147,9 +163,17 @@ bool RoutingTable::addNearNode(IP_MAC nearNode)
 
 	if(tableCount == MAX_NEAR_NODE)
 	{			
-		printf_P(PSTR("%lu: *****WARNING**** reached to maximum routing table size %d\r\n"), millis(), MAX_NEAR_NODE);;
+		MESH_LOG(LOG_WARN, "%lu: *****WARNING**** reached to maximum routing table size %d\r\n", millis(), MAX_NEAR_NODE);
 		tableCount--;
 	}
+
+	if(result)
+	{
+		routeChanges++;
+		ROUTE_EVENT(TRACE_ROUTE_PARENT, myNode.ip, myNode.weight, nearNode.ip);
+	}
+	else
+		ROUTE_EVENT(TRACE_ROUTE_ADD, myNode.ip, nearNode.weight, nearNode.ip);
 	return result;
 }
 int8_t RoutingTable::getShortestNodePosition()
@@ -172,7 +196,11 @@ bool RoutingTable::removeUnreacheable(IP_MAC nearNode)
 {
 	int8_t position = checkTable(nearNode.ip);
 	
-	printf_P(PSTR("%lu: removeUnreacheable IP:%d weight:%lu myweight:%lu \n\r"),millis(),nearNode.ip,nearNode.weight,myNode.weight );
+	MESH_LOG(LOG_INFO, "%lu: removeUnreacheable IP:%d weight:%u myweight:%u \n\r",millis(),nearNode.ip,nearNode.weight,myNode.weight );
+	ROUTE_EVENT(TRACE_ROUTE_REMOVE, myNode.ip, nearNode.weight, nearNode.ip);
+	routeChanges++;
+	setSleepy(nearNode.ip, false);
+	setCongestion(nearNode.ip, 0);
 	
 	for(int i=position;i<tableCount;i++)
 	{
@@ -185,13 +213,149 @@ bool RoutingTable::removeUnreacheable(IP_MAC nearNode)
 		return false;
 	}
 
-	printf_P(PSTR("%lu: removeUnreacheable shortestPath == position IP:%d position:%d \n\r"),millis(),nearNode.ip, position );
+	MESH_LOG(LOG_DEBUG, "%lu: removeUnreacheable shortestPath == position IP:%d position:%d \n\r",millis(),nearNode.ip, position );
 	position = getShortestNodePosition();
 	if(position == MAX_WEIGHT)
 		cleanTable();
 
 	return true;
 }
+/**
+ * Remember which neighbours keep their radio off between wake windows
+ *
+ * Frames to them have to wait for the next window.  A neighbour not heard
+ * from for SLEEPY_TIMEOUT, or taken out of the table, is forgotten, so
+ * frames to others do not wait for it.
+ */
+void RoutingTable::setSleepy(T_IP ip, bool sleepy)
+{
+	for(int i=0;i<sleepyCount;i++)
+	{
+		if(sleepyNodes[i] == ip)
+		{
+			if(sleepy)
+				sleepyTime[i] = millis();
+			else
+				removeSleepy(i);
+			return;
+		}
+	}
+
+	if(sleepy && sleepyCount < MAX_NEAR_NODE)
+	{
+		MESH_LOG(LOG_DEBUG, "%lu: setSleepy IP:%u \n\r",millis(),ip);
+		sleepyNodes[sleepyCount] = ip;
+		sleepyTime[sleepyCount++] = millis();
+	}
+}
+
+void RoutingTable::removeSleepy(uint8_t i)
+{
+	sleepyCount--;
+	sleepyNodes[i] = sleepyNodes[sleepyCount];
+	sleepyTime[i] = sleepyTime[sleepyCount];
+}
+
+void RoutingTable::expireSleepy()
+{
+	for(int i=sleepyCount-1;i>=0;i--)
+	{
+		if(millis() - sleepyTime[i] > SLEEPY_TIMEOUT)
+		{
+			MESH_LOG(LOG_DEBUG, "%lu: sleepy IP:%u timed out \n\r",millis(),sleepyNodes[i]);
+			removeSleepy(i);
+		}
+	}
+}
+
+bool RoutingTable::isSleepy(T_IP ip)
+{
+	expireSleepy();
+	for(int i=0;i<sleepyCount;i++)
+	{
+		if(sleepyNodes[i] == ip)
+			return true;
+	}
+	return false;
+}
+
+bool RoutingTable::hasSleepyNode()
+{
+	expireSleepy();
+	return sleepyCount > 0;
+}
+
+/**
+ * Remember the send queue level a neighbour reported in its last frame
+ *
+ * A level not heard again for CONGESTION_TIMEOUT is forgotten, in case the
+ * frame which would have cleared it never reached us.
+ */
+void RoutingTable::setCongestion(T_IP ip, uint8_t level)
+{
+	for(int i=0;i<congestedCount;i++)
+	{
+		if(congestedNodes[i] == ip)
+		{
+			if(level)
+			{
+				congestionLevel[i] = level;
+				congestionTime[i] = millis();
+			}
+			else
+				removeCongested(i);
+			return;
+		}
+	}
+
+	if(level && congestedCount < MAX_NEAR_NODE)
+	{
+		congestedNodes[congestedCount] = ip;
+		congestionTime[congestedCount] = millis();
+		congestionLevel[congestedCount++] = level;
+	}
+}
+
+void RoutingTable::removeCongested(uint8_t i)
+{
+	congestedCount--;
+	congestedNodes[i] = congestedNodes[congestedCount];
+	congestionLevel[i] = congestionLevel[congestedCount];
+	congestionTime[i] = congestionTime[congestedCount];
+}
+
+void RoutingTable::expireCongestion()
+{
+	for(int i=congestedCount-1;i>=0;i--)
+	{
+		if(millis() - congestionTime[i] > CONGESTION_TIMEOUT)
+			removeCongested(i);
+	}
+}
+
+uint8_t RoutingTable::getCongestion(T_IP ip)
+{
+	expireCongestion();
+	for(int i=0;i<congestedCount;i++)
+	{
+		if(congestedNodes[i] == ip)
+			return congestionLevel[i];
+	}
+	return 0;
+}
+
+uint16_t RoutingTable::getRouteChanges()
+{
+	return routeChanges;
+}
+
+#ifdef MESH_TRACE
+void RoutingTable::setTrace(MeshTrace* _trace)
+{
+	trace = _trace;
+}
+#endif
+
 void RoutingTable::addReacheableNode(T_IP nearNodeID, T_IP* reachableNodeID, int numOfReacheableNodes)
 {
 
@@ -199,7 +363,7 @@ void RoutingTable::addReacheableNode(T_IP nearNodeID, T_IP* reachableNodeID, int
 
 IP_MAC RoutingTable::getShortestRouteNode()
 {
-	IF_SERIAL_DEBUG(printf_P(PSTR("%lu: getShortestRouteNode \r\n"), millis()));
+	MESH_LOG(LOG_DEBUG, "%lu: getShortestRouteNode \r\n", millis());
 	if(iAmMaster)
 	{
 		return MASTER_SYNC_ADDRESS;
@@ -215,6 +379,8 @@ void RoutingTable::cleanTable()
 		tableCount = 0;
 		myNode.weight = MAX_WEIGHT;
 		shortestPath = MAX_WEIGHT;
+		sleepyCount = 0;
+		congestedCount = 0;
 	}
 }
 
@@ -247,13 +413,17 @@ void RoutingTable::printTable()
 	{
 		printf_P(PSTR("ip:%u  weight:%u\n\r"),table[i].ip_mac.ip,  table[i].ip_mac.weight);
 	}
-	printf_P(PSTR("my_ip:%u  my_weight:%u shortest path = ip:%u  weight:%u \n\r"),myNode.ip,  myNode.weight, table[shortestPath].ip_mac.ip,  table[shortestPath].ip_mac.weight);
+	if(amIJoinedNetwork() && !iAmMaster)
+		printf_P(PSTR("my_ip:%u  my_weight:%u shortest path = ip:%u  weight:%u \n\r"),myNode.ip,  myNode.weight, table[shortestPath].ip_mac.ip,  table[shortestPath].ip_mac.weight);
+	else
+		printf_P(PSTR("my_ip:%u  my_weight:%u\n\r"),myNode.ip,  myNode.weight);
 	printf_P(PSTR("----END OF JOINED TABLE---------\n\r"));
 }
 
 bool RoutingTable::isPathShortened()
 {
 //TODO isPathShortened
+	return false;
 }
 void RoutingTable::connectShortened()
 {
@@ -262,12 +432,24 @@ void RoutingTable::connectShortened()
 
 int RoutingTable::getNumOfWelcomes()
 {
-//TODO getNumOfWelcomes
+	int count = 0;
+	for(int i=0;i<tableCount;i++)
+	{
+		if(table[i].status == GOT_WELCOME)
+			count++;
+	}
+	return count;
 }
 
 int RoutingTable::getNumOfJoines()
 {
-//TODO getNumOfJoines
+	int count = 0;
+	for(int i=0;i<tableCount;i++)
+	{
+		if(table[i].status == GOT_JOIN)
+			count++;
+	}
+	return count;
 }
 
 void RoutingTable::setWelcomeMessageSent(T_IP ip)
@@ -315,7 +497,7 @@ T_MAC RoutingTable::getShortestMac(T_IP ip)
 
 	if(iAmMaster)
 	{
-		printf_P(PSTR("%lu: *********DONT CALLME********I AM MASTER********getShortestMac ip:%u \r\n"), millis(),ip);
+		MESH_LOG(LOG_WARN, "%lu: *********DONT CALLME********I AM MASTER********getShortestMac ip:%u \r\n", millis(),ip);
 	}
 	/*
 	for(int i=0;i<tableCount;i++)
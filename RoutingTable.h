@@ -4,9 +4,15 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "RF24NetworkHeader.h"
+#include "TimeSync.h"
+#include "MeshTrace.h"
 
 
 #define MAX_NEAR_NODE 10
+#define SLEEPY_TIMEOUT 60000 /**< ms a neighbour is taken to sleep after its last frame saying so */
+#define CONGESTION_TIMEOUT 5000 /**< ms a neighbour's congestion level is kept after its last frame */
+
+extern const uint8_t MAX_WEIGHT; /**< Weight of a node without a route */
 
 typedef enum {SENT_WELCOME, GOT_WELCOME, GOT_JOIN, SHORTENED, CONNECTED, DEAD} RoutingStates;
 
@@ -27,8 +33,23 @@ private:
 	uint8_t tableCount;
 	uint8_t shortestPath;
 	bool iAmMaster;
-	unsigned long millis_delta;
-	bool millis_delta_positive;
+	T_IP sleepyNodes[MAX_NEAR_NODE];
+	unsigned long sleepyTime[MAX_NEAR_NODE]; /**< millis() of the last frame saying so */
+	uint8_t sleepyCount;
+	T_IP congestedNodes[MAX_NEAR_NODE];
+	uint8_t congestionLevel[MAX_NEAR_NODE];
+	unsigned long congestionTime[MAX_NEAR_NODE]; /**< millis() of the last frame with the level */
+	uint8_t congestedCount;
+	uint16_t routeChanges;
+	TimeSync clock;
+#ifdef MESH_TRACE
+	MeshTrace* trace; /**< Of the mesh, see setTrace() */
+#endif
+
+	void removeSleepy(uint8_t i);
+	void expireSleepy();
+	void removeCongested(uint8_t i);
+	void expireCongestion();
 public:
 	RoutingTable(void);
 	~RoutingTable(void);
@@ -58,9 +79,20 @@ public:
 	T_MAC getMac(T_IP ip);
 	T_MAC getBroadcastMac();
 	T_MAC getShortestMac(T_IP ip);
-	void setMillis(uint8_t data[16]);
+	bool syncTime(T_IP from, uint8_t data[16]);
+	TimeSync& getTimeSync();
 	unsigned long getMillis();
+	uint32_t getMicros();
 	bool removeUnreacheable(IP_MAC nearNode);
 	int8_t getShortestNodePosition();
+	void setSleepy(T_IP ip, bool sleepy);
+	bool isSleepy(T_IP ip);
+	bool hasSleepyNode();
+	void setCongestion(T_IP ip, uint8_t level);
+	uint8_t getCongestion(T_IP ip);
+	uint16_t getRouteChanges(); /**< New parents taken and neighbours removed */
+#ifdef MESH_TRACE
+	void setTrace(MeshTrace* trace); /**< Where routing changes are recorded */
+#endif
 };
 #endif //__ROUTINGTABLE_H__
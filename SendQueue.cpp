@@ -0,0 +1,328 @@
+#define LOG_MODULE QUEUE
+
+#include "SendQueue.h"
+#include "RF24Network_config.h"
+#include "MeshLog.h"
+
+SendQueue::SendQueue(FramePool& _pool): pool(_pool)
+{
+	free_count = SEND_QUEUE_SIZE;
+
+	memset(last_source,0,sizeof(last_source));
+	memset(stats,0,sizeof(stats));
+	urgent_credit = SEND_QUEUE_URGENT_WEIGHT;
+	source_count = 0;
+	source_next = 0;
+	filter = NULL;
+	filter_context = NULL;
+}
+
+SendQueueClass SendQueue::classify(const RF24NetworkHeader& header)
+{
+	switch(header.type)
+	{
+	case 'J':
+	case 'W':
+	case 'U':
+		return SQ_CONTROL;
+	default:
+		return (header.flags & HEADER_FLAG_URGENT) ? SQ_URGENT : SQ_DATA;
+	}
+}
+
+void SendQueue::setFilter(SendQueueFilter _filter, void* context)
+{
+	filter = _filter;
+	filter_context = context;
+}
+
+bool SendQueue::eligible(uint8_t c, uint8_t i)
+{
+	return !filter || filter(filter_context,pool.header(order[c][i]));
+}
+
+/**
+ * Counters of a source, a new entry is taken if it is not known yet
+ */
+SourceStats* SendQueue::source(T_IP ip)
+{
+	for(uint8_t i=0;i<source_count;i++)
+	{
+		if(sources[i].ip == ip)
+			return &sources[i];
+	}
+
+	SourceStats* s;
+	if(source_count < SEND_QUEUE_SOURCES)
+		s = &sources[source_count++];
+	else
+	{
+		s = &sources[source_next];
+		source_next = (source_next + 1) % SEND_QUEUE_SOURCES;
+	}
+
+	memset(s,0,sizeof(SourceStats));
+	s->ip = ip;
+	return s;
+}
+
+T_IP SendQueue::sourceAt(uint8_t c, uint8_t i)
+{
+	return pool.header(order[c][i]).source_data.ip;
+}
+
+/**
+ * Take a frame out of the queue
+ *
+ * @return Its slot
+ */
+uint8_t SendQueue::remove(uint8_t c, uint8_t i)
+{
+	uint8_t slot = order[c][i];
+
+	free_count++;
+	stats[c].depth--;
+	for(;i<stats[c].depth;i++)
+		order[c][i] = order[c][i+1];
+
+	return slot;
+}
+
+/**
+ * Throw away a queued frame to make room
+ */
+void SendQueue::drop(uint8_t c, uint8_t i)
+{
+	source(sourceAt(c,i))->drops++;
+	stats[c].early_drops++;
+	pool.release(remove(c,i));
+}
+
+/**
+ * Make room in a data class by dropping the newest frame of the source
+ * with the most frames queued
+ *
+ * Only done if that source has more frames queued than @p incoming, so a
+ * source never pushes out its own frames and heavy sources lose first.
+ *
+ * @return Whether a frame was dropped
+ */
+bool SendQueue::pushOut(uint8_t c, T_IP incoming)
+{
+	uint8_t depth = stats[c].depth;
+	uint8_t incoming_count = 0;
+	uint8_t max_count = 0;
+	int8_t victim = -1;
+
+	for(uint8_t i=0;i<depth;i++)
+	{
+		T_IP ip = sourceAt(c,i);
+		if(ip == incoming)
+			incoming_count++;
+
+		uint8_t count = 0;
+		for(uint8_t j=0;j<depth;j++)
+		{
+			if(sourceAt(c,j) == ip)
+				count++;
+		}
+
+		// Later frames win ties, so the newest frame of the heaviest source goes
+		if(count >= max_count)
+		{
+			max_count = count;
+			victim = i;
+		}
+	}
+
+	if(victim < 0 || max_count <= incoming_count)
+		return false;
+
+	MESH_LOG(LOG_DEBUG, "%lu: SendQueue pushing out source:%u class:%d\n\r",millis(),sourceAt(c,victim),c);
+	drop(c,victim);
+	return true;
+}
+
+bool SendQueue::push(int8_t slot)
+{
+	const RF24NetworkHeader& header = pool.header(slot);
+	SendQueueClass c = classify(header);
+	SendQueueStats& s = stats[c];
+
+	if(c == SQ_DATA && s.depth >= SEND_QUEUE_EARLY_DROP && !pushOut(c,header.source_data.ip))
+	{
+		s.early_drops++;
+		source(header.source_data.ip)->drops++;
+		MESH_LOG(LOG_DEBUG, "%lu: SendQueue early drop class:%d depth:%d\n\r",millis(),c,s.depth);
+		pool.release(slot);
+		return false;
+	}
+
+	if(c == SQ_CONTROL)
+	{
+		// Route maintenance takes the place of bulk data if it has to
+		if(free_count == 0 && stats[SQ_DATA].depth)
+			drop(SQ_DATA,stats[SQ_DATA].depth-1);
+	}
+	else if(free_count <= SEND_QUEUE_CONTROL_RESERVE)
+		pushOut(c,header.source_data.ip);
+
+	if(free_count == 0 || (c != SQ_CONTROL && free_count <= SEND_QUEUE_CONTROL_RESERVE))
+	{
+		s.tail_drops++;
+		if(c != SQ_CONTROL)
+			source(header.source_data.ip)->drops++;
+		MESH_LOG(LOG_WARN, "%lu: *WARNING* SendQueue full, dropping class:%d\n\r",millis(),c);
+		pool.release(slot);
+		return false;
+	}
+
+	free_count--;
+	order[c][s.depth] = slot;
+
+	s.depth++;
+	s.enqueued++;
+	if(s.depth > s.high_water)
+		s.high_water = s.depth;
+	if(c != SQ_CONTROL)
+		source(header.source_data.ip)->enqueued++;
+
+	return true;
+}
+
+/**
+ * Pick the class to serve next, and the frame in it
+ *
+ * Control first, then urgent and bulk data in SEND_QUEUE_URGENT_WEIGHT:1,
+ * among the frames which may go out.
+ */
+int8_t SendQueue::nextClass(uint8_t& index)
+{
+	int8_t control = nextIndex(SQ_CONTROL);
+	if(control >= 0)
+	{
+		index = control;
+		return SQ_CONTROL;
+	}
+
+	int8_t urgent = nextIndex(SQ_URGENT);
+	int8_t data = nextIndex(SQ_DATA);
+
+	if(urgent >= 0 && (data < 0 || urgent_credit))
+	{
+		index = urgent;
+		return SQ_URGENT;
+	}
+	if(data >= 0)
+	{
+		index = data;
+		return SQ_DATA;
+	}
+
+	return -1;
+}
+
+/**
+ * Pick the frame to serve next within a class, -1 if none may go out
+ *
+ * Control frames go in order.  Data frames go to the source following the
+ * one served last, in order of address, and to its oldest frame.  As all
+ * frames have the same size, this is deficit round robin with a quantum of
+ * one frame.
+ */
+int8_t SendQueue::nextIndex(uint8_t c)
+{
+	if(c == SQ_CONTROL)
+	{
+		for(uint8_t i=0;i<stats[c].depth;i++)
+		{
+			if(eligible(c,i))
+				return i;
+		}
+		return -1;
+	}
+
+	int8_t after = -1; // oldest frame of the smallest source above last_source
+	int8_t first = -1; // oldest frame of the smallest source overall
+	for(uint8_t i=0;i<stats[c].depth;i++)
+	{
+		if(!eligible(c,i))
+			continue;
+
+		T_IP ip = sourceAt(c,i);
+		if(ip > last_source[c] && (after < 0 || ip < sourceAt(c,after)))
+			after = i;
+		if(first < 0 || ip < sourceAt(c,first))
+			first = i;
+	}
+
+	return (after >= 0) ? after : first;
+}
+
+bool SendQueue::available(void)
+{
+	return free_count < SEND_QUEUE_SIZE;
+}
+
+RF24NetworkHeader* SendQueue::peek(void)
+{
+	uint8_t i;
+	int8_t c = nextClass(i);
+	if(c < 0)
+		return NULL;
+
+	return &pool.header(order[c][i]);
+}
+
+int8_t SendQueue::pop(void)
+{
+	uint8_t i;
+	int8_t c = nextClass(i);
+	if(c < 0)
+		return -1;
+
+	if(c != SQ_CONTROL)
+	{
+		last_source[c] = sourceAt(c,i);
+		source(last_source[c])->sent++;
+	}
+
+	uint8_t slot = remove(c,i);
+	stats[c].sent++;
+
+	// Data held back by the filter may leave the credit used up
+	if(c == SQ_URGENT && stats[SQ_DATA].depth && urgent_credit)
+		urgent_credit--;
+	else if(c == SQ_DATA)
+		urgent_credit = SEND_QUEUE_URGENT_WEIGHT;
+
+	return slot;
+}
+
+uint8_t SendQueue::depth(void)
+{
+	return SEND_QUEUE_SIZE - free_count;
+}
+
+uint8_t SendQueue::congestion(void)
+{
+	uint8_t data = stats[SQ_URGENT].depth + stats[SQ_DATA].depth;
+	uint8_t level = data * 3 / (SEND_QUEUE_SIZE - SEND_QUEUE_CONTROL_RESERVE);
+
+	return (level > 3) ? 3 : level;
+}
+
+const SendQueueStats& SendQueue::getStats(SendQueueClass c)
+{
+	return stats[c];
+}
+
+uint8_t SendQueue::getSourceCount(void)
+{
+	return source_count;
+}
+
+const SourceStats& SendQueue::getSourceStats(uint8_t i)
+{
+	return sources[i];
+}
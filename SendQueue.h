@@ -0,0 +1,136 @@
+#ifndef __SENDQUEUE_H__
+#define __SENDQUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "RF24NetworkHeader.h"
+#include "FramePool.h"
+
+#define SEND_QUEUE_CONTROL_RESERVE 1 /**< Slots only control frames may use */
+#define SEND_QUEUE_EARLY_DROP 3 /**< Bulk data frames queued before new ones are dropped */
+#define SEND_QUEUE_URGENT_WEIGHT 4 /**< Urgent frames sent for each bulk frame while both wait */
+#define SEND_QUEUE_SOURCES 8 /**< Originating nodes with their own counters */
+
+/**
+ * Traffic classes, in order of priority
+ */
+typedef enum {SQ_CONTROL = 0, SQ_URGENT, SQ_DATA, SQ_CLASSES} SendQueueClass;
+
+typedef struct _SendQueueStats
+{
+	uint16_t enqueued;
+	uint16_t sent;
+	uint16_t tail_drops; /**< No room left for this class */
+	uint16_t early_drops; /**< Dropped to keep room for more important frames */
+	uint8_t depth;
+	uint8_t high_water;
+} SendQueueStats;
+
+typedef struct _SourceStats
+{
+	T_IP ip; /**< Node which generated the data, source_data.ip */
+	uint16_t enqueued;
+	uint16_t sent;
+	uint16_t drops;
+} SourceStats;
+
+/**
+ * Whether a queued frame may go out now, see SendQueue::setFilter()
+ */
+typedef bool (*SendQueueFilter)(void* context, const RF24NetworkHeader& header);
+
+/**
+ * Send queue with priority classes
+ *
+ * Route maintenance ('J', 'W', 'U') is always sent first, so a flood of
+ * data cannot make a node lose its parent.  Urgent data (HEADER_FLAG_URGENT)
+ * and bulk data share the rest by weighted round robin.  The classes share
+ * SEND_QUEUE_SIZE places, the last of which are reserved for control frames.
+ * Frames stay in their FramePool slot, the queue only orders slot numbers.
+ *
+ * Within a data class the originating nodes take turns, and when the class
+ * is full the node with the most queued frames loses one.  Otherwise a relay
+ * close to the master would mostly forward whichever of its descendants
+ * happens to reach it first, and traffic from deep nodes would be dropped.
+ *
+ * Frames the filter holds back, e.g. to a node which sleeps right now, are
+ * passed over and keep their place; the frames behind them go first.
+ */
+class SendQueue
+{
+private:
+	FramePool& pool;
+	uint8_t free_count; /**< Places left in the queue */
+
+	uint8_t order[SQ_CLASSES][SEND_QUEUE_SIZE]; /**< Slot numbers, oldest first */
+	T_IP last_source[SQ_CLASSES]; /**< Source served last, for round robin */
+	uint8_t urgent_credit; /**< Urgent frames left before bulk data gets a turn */
+
+	SendQueueStats stats[SQ_CLASSES];
+	SourceStats sources[SEND_QUEUE_SOURCES];
+	uint8_t source_count;
+	uint8_t source_next; /**< Entry to reuse once the table is full */
+
+	SendQueueFilter filter;
+	void* filter_context;
+
+	int8_t nextClass(uint8_t& index);
+	int8_t nextIndex(uint8_t c);
+	bool eligible(uint8_t c, uint8_t i);
+	T_IP sourceAt(uint8_t c, uint8_t i);
+	uint8_t remove(uint8_t c, uint8_t i);
+	void drop(uint8_t c, uint8_t i);
+	bool pushOut(uint8_t c, T_IP source);
+	SourceStats* source(T_IP ip);
+public:
+	SendQueue(FramePool& _pool);
+
+	static SendQueueClass classify(const RF24NetworkHeader& header);
+
+	/**
+	 * Hold back the frames @p filter returns false for, until it does not
+	 *
+	 * @param filter NULL lets every frame go
+	 */
+	void setFilter(SendQueueFilter filter, void* context);
+
+	/**
+	 * Add a frame
+	 *
+	 * The queue owns the slot from now on, it is released if the frame is
+	 * dropped, now or later.
+	 *
+	 * @return False if the frame was dropped
+	 */
+	bool push(int8_t slot);
+
+	bool available(void);
+
+	/**
+	 * The frame which pop() would return, or NULL if none may go out
+	 */
+	RF24NetworkHeader* peek(void);
+
+	/**
+	 * Take the next frame according to the schedule
+	 *
+	 * @return The slot of the frame, which the caller releases after sending,
+	 * or -1 if no frame may go out
+	 */
+	int8_t pop(void);
+
+	uint8_t depth(void);
+
+	/**
+	 * How full the data classes are, 0 (empty) .. 3 (dropping)
+	 *
+	 * Sent along with every frame, so that neighbours slow down before
+	 * their frames to us get dropped.
+	 */
+	uint8_t congestion(void);
+	const SendQueueStats& getStats(SendQueueClass c);
+	uint8_t getSourceCount(void);
+	const SourceStats& getSourceStats(uint8_t i);
+};
+
+#endif //__SENDQUEUE_H__
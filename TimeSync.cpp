@@ -0,0 +1,193 @@
+#define LOG_MODULE TIME
+
+#include "TimeSync.h"
+#include "RF24Network_config.h"
+#include "MeshLog.h"
+
+// Crystal oscillators are specified well below this.  Anything larger comes
+// from bad samples, e.g. a frame which sat in the receive FIFO for a while.
+const float MAX_SKEW = 500e-6;
+
+TimeSync::TimeSync(void)
+{
+	master = false;
+	hop_delay = 0;
+	rejected = 0;
+	reset();
+}
+
+void TimeSync::begin(bool _master, uint32_t _hop_delay)
+{
+	master = _master;
+	hop_delay = _hop_delay;
+	reset();
+	MESH_LOG(LOG_DEBUG, "%lu: TimeSync begin master:%d hop_delay:%luus\n\r",millis(),master,hop_delay);
+}
+
+void TimeSync::reset(void)
+{
+	sample_count = 0;
+	sample_next = 0;
+	window_count = 0;
+	rejected_run = 0;
+	reference = 0;
+	synced = false;
+	base_local = 0;
+	base_offset = 0;
+	skew = 0;
+	millis_delta = 0;
+	base_millis = 0;
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	uint32_t v = p[3];
+	v = (v << 8) + p[2];
+	v = (v << 8) + p[1];
+	v = (v << 8) + p[0];
+	return v;
+}
+
+void TimeSync::stampTx(uint8_t payload[16])
+{
+	put32(payload + TIME_SYNC_MILLIS_OFFSET, networkMillis());
+	put32(payload + TIME_SYNC_TX_OFFSET, networkMicros());
+	payload[TIME_SYNC_FLAGS_OFFSET] = isSynced() ? TIME_SYNC_VALID : 0;
+}
+
+void TimeSync::stampRx(uint8_t payload[16], uint32_t rx_micros)
+{
+	put32(payload + TIME_SYNC_RX_OFFSET, rx_micros);
+}
+
+bool TimeSync::addSample(T_IP from, const uint8_t payload[16])
+{
+	if (master || !(payload[TIME_SYNC_FLAGS_OFFSET] & TIME_SYNC_VALID))
+		return false;
+
+	if (from != reference)
+	{
+		reset();
+		reference = from;
+	}
+
+	uint32_t remote = get32(payload + TIME_SYNC_TX_OFFSET) + hop_delay;
+	uint32_t local = get32(payload + TIME_SYNC_RX_OFFSET);
+	int32_t offset = (int32_t)(remote - local);
+
+	if (synced && sample_count > 1)
+	{
+		int32_t error = offset - (int32_t)(toNetworkMicros(local) - local);
+		if (error > TIME_SYNC_MAX_ERROR || (error < -TIME_SYNC_MAX_ERROR && ++rejected_run >= TIME_SYNC_SAMPLES))
+		{
+			MESH_LOG(LOG_DEBUG, "%lu: TimeSync reference clock moved by %ldus, starting over\n\r",millis(),(long)error);
+			reset();
+			reference = from;
+		}
+		else if (error < -TIME_SYNC_MAX_ERROR)
+		{
+			rejected++;
+			return false;
+		}
+		else
+			rejected_run = 0;
+	}
+
+	// A new window takes the next slot, which is then the newest sample
+	if (window_count == 0)
+	{
+		sample_next = (sample_next + 1) % TIME_SYNC_SAMPLES;
+		if (sample_count < TIME_SYNC_SAMPLES)
+			sample_count++;
+	}
+	uint8_t slot = (sample_next + TIME_SYNC_SAMPLES - 1) % TIME_SYNC_SAMPLES;
+	bool best = window_count == 0 || offset > sample_offset[slot];
+	window_count = (window_count + 1) % TIME_SYNC_WINDOW;
+	if (!best)
+		return true;
+
+	sample_local[slot] = local;
+	sample_offset[slot] = offset;
+	fit();
+
+	// Millis run on their own counter which does not wrap together with
+	// micros, so the delta is taken from the millis stamp of the sender.
+	unsigned long rx_millis = millis() - (uint32_t)((uint32_t)micros() - local) / 1000;
+	millis_delta = (long)(get32(payload + TIME_SYNC_MILLIS_OFFSET) + hop_delay / 1000 - rx_millis);
+	base_millis = rx_millis;
+	synced = true;
+
+	MESH_LOG(LOG_DEBUG, "%lu: TimeSync sample from:%u n:%u offset:%ld skew:%ldppb\n\r",millis(),from,sample_count,(long)base_offset,(long)(skew * 1e9));
+	return true;
+}
+
+/**
+ * Least squares fit of offset over local time
+ *
+ * Local times are taken relative to the newest sample, so that the sums
+ * stay small and the line is anchored where it is most accurate.
+ */
+void TimeSync::fit()
+{
+	uint8_t newest = (sample_next + TIME_SYNC_SAMPLES - 1) % TIME_SYNC_SAMPLES;
+	uint32_t anchor = sample_local[newest];
+
+	float mean_x = 0;
+	float mean_y = 0;
+	for (uint8_t i = 0; i < sample_count; i++)
+	{
+		mean_x += (int32_t)(sample_local[i] - anchor);
+		mean_y += sample_offset[i] - sample_offset[newest];
+	}
+	mean_x /= sample_count;
+	mean_y /= sample_count;
+
+	float num = 0;
+	float den = 0;
+	for (uint8_t i = 0; i < sample_count; i++)
+	{
+		float dx = (int32_t)(sample_local[i] - anchor) - mean_x;
+		float dy = (sample_offset[i] - sample_offset[newest]) - mean_y;
+		num += dx * dy;
+		den += dx * dx;
+	}
+
+	skew = (den > 0) ? num / den : 0;
+	if (skew > MAX_SKEW || skew < -MAX_SKEW)
+		skew = 0;
+
+	base_local = anchor;
+	base_offset = sample_offset[newest] + (int32_t)(mean_y - skew * mean_x);
+}
+
+uint32_t TimeSync::toNetworkMicros(uint32_t local)
+{
+	if (master)
+		return local;
+
+	int32_t dx = (int32_t)(local - base_local);
+	return local + base_offset + (int32_t)(skew * dx);
+}
+
+uint32_t TimeSync::networkMicros(void)
+{
+	return toNetworkMicros(micros());
+}
+
+unsigned long TimeSync::networkMillis(void)
+{
+	if (master)
+		return millis();
+
+	unsigned long now = millis();
+	long dx = (long)(now - base_millis);
+	return now + millis_delta + (long)(skew * dx);
+}
@@ -0,0 +1,125 @@
+#ifndef __TIMESYNC_H__
+#define __TIMESYNC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "RF24NetworkHeader.h"
+
+#define TIME_SYNC_SAMPLES 8 /**< Samples the line is fitted through */
+#define TIME_SYNC_WINDOW 4 /**< Stamped frames per sample, the one with the least delay is kept */
+#define TIME_SYNC_MAX_ERROR 3000 /**< us a frame may be off the fitted line before it is not taken */
+#define TIME_SYNC_BEACON 2000 /**< ms between the stamped 'U' frames a synchronized node broadcasts for its children */
+
+/**
+ * Layout of the time stamp carried in the payload of 'W' and 'U' frames.
+ *
+ * Bytes 0..3 keep the network millis for old nodes, the rest is filled in
+ * by the sender just before the frame goes to the radio and by the receiver
+ * as soon as the radio reports it.
+ */
+#define TIME_SYNC_MILLIS_OFFSET 0 /**< Network millis of the sender at TX */
+#define TIME_SYNC_TX_OFFSET 4 /**< Network micros of the sender at TX */
+#define TIME_SYNC_RX_OFFSET 8 /**< Local micros of the receiver at RX */
+#define TIME_SYNC_FLAGS_OFFSET 12 /**< TIME_SYNC_VALID if the sender is synchronized */
+
+#define TIME_SYNC_VALID 0x01
+
+/**
+ * Network time synchronization
+ *
+ * Keeps the last few (local, remote) time stamp pairs heard from our parent
+ * and fits a line through them, so that both the offset and the oscillator
+ * skew against the master clock are compensated.  Every synchronized node
+ * broadcasts a stamped 'U' each TIME_SYNC_BEACON, so a new sample comes at
+ * least every TIME_SYNC_WINDOW beacons.  Each sample is corrected by the
+ * per-hop delay, the time the frame spends between being stamped at the
+ * sender and being noticed by our radio.  That delay is modelled from the
+ * air time, not measured; being the same for every sample, its error
+ * shifts the offset by a constant per hop but leaves the skew alone.
+ *
+ * Anything else between the two stamps only ever adds delay: the sender's
+ * radio retransmitting, the frame waiting in our FIFO until loop() reads
+ * it.  So of each TIME_SYNC_WINDOW stamped frames only the one with the
+ * least delay, the largest offset, becomes a sample.  A frame further than
+ * TIME_SYNC_MAX_ERROR behind the fitted line is not taken at all; one as
+ * far ahead of it means the clock of the reference jumped, and so does a
+ * whole run of frames behind it, so the samples are discarded.
+ */
+class TimeSync
+{
+private:
+	uint32_t sample_local[TIME_SYNC_SAMPLES]; /**< Local micros at RX, delay compensated */
+	int32_t sample_offset[TIME_SYNC_SAMPLES]; /**< Remote micros minus local micros */
+	uint8_t sample_count;
+	uint8_t sample_next; /**< Slot of the next window, the current one is the slot before */
+	uint8_t window_count; /**< Frames taken in the current window */
+	uint8_t rejected_run; /**< Frames in a row too far behind the line */
+	uint16_t rejected;
+
+	T_IP reference; /**< Node we are taking time from */
+	bool master;
+	bool synced;
+
+	uint32_t hop_delay; /**< Fixed TX->RX latency of one hop in micros */
+
+	uint32_t base_local; /**< Local micros where the fitted line is anchored */
+	int32_t base_offset; /**< Offset at base_local */
+	float skew; /**< Relative drift of the remote clock, 1e-6 == 1 ppm */
+
+	long millis_delta; /**< Network millis minus local millis */
+	unsigned long base_millis; /**< Local millis of the newest sample */
+
+	void fit();
+public:
+	TimeSync(void);
+
+	/**
+	 * Set up the service
+	 *
+	 * @param _master The master is the time reference of the whole network
+	 * @param _hop_delay Fixed TX->RX latency of one hop in micros, a model
+	 * value
+	 */
+	void begin(bool _master, uint32_t _hop_delay);
+
+	/**
+	 * Forget all samples, e.g. because our parent changed
+	 */
+	void reset(void);
+
+	/**
+	 * Write our network time into the payload of a frame about to be sent
+	 */
+	void stampTx(uint8_t payload[16]);
+
+	/**
+	 * Record the local time the frame was received into its payload
+	 */
+	void stampRx(uint8_t payload[16], uint32_t rx_micros);
+
+	/**
+	 * Take a sample from a stamped frame
+	 *
+	 * Only frames coming from the reference node are used.  If @p from is
+	 * different from the current reference, the old samples are discarded.
+	 *
+	 * @return Whether the sample was accepted
+	 */
+	bool addSample(T_IP from, const uint8_t payload[16]);
+
+	/**
+	 * Convert a local micros() reading into network time
+	 */
+	uint32_t toNetworkMicros(uint32_t local);
+
+	uint32_t networkMicros(void);
+	unsigned long networkMillis(void);
+
+	bool isSynced(void) { return master || synced; }
+	float getSkew(void) { return skew; }
+	uint32_t getHopDelay(void) { return hop_delay; }
+	uint8_t getSampleCount(void) { return sample_count; }
+	uint16_t getRejected(void) { return rejected; }
+};
+
+#endif //__TIMESYNC_H__
@@ -39,6 +39,7 @@
 
 #include <avr/pgmspace.h>
 #include <RF24Mesh.h>
+#include <LatencyStats.h>
 #include <RF24.h>
 #include <SPI.h>
 #include "nodeconfig.h"
@@ -60,6 +61,9 @@ RF24Mesh network(radio, callme);
 // Our node address
 uint16_t this_node;
 
+// Set to 0 on units placed to relay for others, see setup()
+#define SENSOR_LEAF 1
+
 long message_no = 0;
 #include <SoftwareSerial.h>
 
@@ -105,17 +109,29 @@ void setup(void)
   SPI.begin();
   
   network.begin(/*channel*/ 88, /*node address*/ this_node );
+
+  // Sensors only need the radio when they have a reading to send, or
+  // for the short wake window where the parent may have frames for us.
+  // Units others route through should stay awake: while they sleep, the
+  // readings of their children wait for the window, up to a period a hop.
+#if SENSOR_LEAF
+  network.setLowPower(true);
+#endif
+
+  // Let the root measure how long our readings take, our readings are
+  // short enough to leave room for the stamp
+  network.setLatencyStamps(true);
 }
 
 void loop(void)
 {
-  uint8_t data[16];
+  uint8_t data[LATENCY_STAMP_OFFSET];
   
   data[4] = message_no++;
   // Pump the network regularly
   network.loop();
   if (this_node != 0 && network.isJoined() && millis()%10000 == 0)
-  network.send_SensorData(data);
+  network.send_SensorData(data, sizeof(data));
   
   
 }
@@ -39,6 +39,7 @@
 
 #include <avr/pgmspace.h>
 #include <RF24Mesh.h>
+#include <LatencyStats.h>
 #include <RF24.h>
 #include <SPI.h>
 #include "nodeconfig.h"
@@ -55,6 +56,10 @@ StatusCallback callme;
 RF24 radio(9,10);
 RF24Mesh network(radio, callme);
 
+// Latency of the readings of all sensors
+LatencyStats latency;
+unsigned long last_latency_print = 0;
+
 // Our node address
 uint16_t this_node;
 
@@ -86,13 +91,20 @@ void setup(void)
   SPI.begin();
   
   network.begin(/*channel*/ 88, /*node address*/ this_node );
+  network.setLatencyStats(&latency);
 }
 
 void loop(void)
 {
   // Pump the network regularly
   network.loop();
-    
+
+  // Dump the histograms once a minute
+  if ( millis() - last_latency_print > 60000 )
+  {
+    last_latency_print = millis();
+    latency.print();
+  }
 }
 
 
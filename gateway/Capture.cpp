@@ -0,0 +1,186 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Capture.h"
+
+CaptureWriter::CaptureWriter()
+{
+	fd = -1;
+	memset(&stats,0,sizeof(stats));
+}
+
+CaptureWriter::~CaptureWriter()
+{
+	close();
+}
+
+bool CaptureWriter::open(const std::string& _path, uint8_t channel)
+{
+	path = _path;
+	fd = ::open(path.c_str(),O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,0644);
+	if(fd < 0)
+	{
+		perror(path.c_str());
+		return false;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+
+	CaptureHeader h;
+	memset(&h,0,sizeof(h));
+	h.magic = CAPTURE_MAGIC;
+	h.version = CAPTURE_VERSION;
+	h.record_bytes = sizeof(CaptureRecord);
+	h.channel = channel;
+	h.created_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	if(write(fd,&h,sizeof(h)) != sizeof(h))
+	{
+		perror(path.c_str());
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	stats.bytes += sizeof(h);
+	buffer.reserve(CAPTURE_BUFFER_RECORDS);
+	return true;
+}
+
+void CaptureWriter::close(void)
+{
+	if(fd < 0)
+		return;
+	flush();
+	::close(fd);
+	fd = -1;
+}
+
+bool CaptureWriter::isOpen(void)
+{
+	return fd >= 0;
+}
+
+void CaptureWriter::add(const CaptureRecord* records, size_t n)
+{
+	for(size_t i=0;i<n;i++)
+	{
+		buffer.push_back(records[i]);
+		if(buffer.size() >= CAPTURE_BUFFER_RECORDS)
+			flush();
+	}
+}
+
+bool CaptureWriter::flush(void)
+{
+	if(buffer.empty())
+		return true;
+
+	const uint8_t* p = (const uint8_t*)buffer.data();
+	size_t len = buffer.size() * sizeof(CaptureRecord);
+	while(fd >= 0 && len)
+	{
+		ssize_t n = write(fd,p,len);
+		if(n <= 0)
+		{
+			perror(path.c_str());
+			break;
+		}
+		p += n;
+		len -= n;
+		stats.bytes += n;
+	}
+
+	// A record written in part is left to readers to drop
+	size_t written = buffer.size() * sizeof(CaptureRecord) - len;
+	stats.records += written / sizeof(CaptureRecord);
+	stats.failed += buffer.size() - written / sizeof(CaptureRecord);
+	buffer.clear();
+	return len == 0;
+}
+
+const CaptureStats& CaptureWriter::getStats(void)
+{
+	return stats;
+}
+
+/****************************************************************************/
+
+CaptureReader::CaptureReader()
+{
+	map = NULL;
+	size = 0;
+	memset(&header,0,sizeof(header));
+}
+
+CaptureReader::~CaptureReader()
+{
+	close();
+}
+
+bool CaptureReader::open(const std::string& path)
+{
+	close();
+
+	int fd = ::open(path.c_str(),O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if(fd < 0 || fstat(fd,&st) < 0)
+	{
+		perror(path.c_str());
+		if(fd >= 0)
+			::close(fd);
+		return false;
+	}
+	if((size_t)st.st_size < sizeof(CaptureHeader))
+	{
+		fprintf(stderr,"%s: not a capture\n",path.c_str());
+		::close(fd);
+		return false;
+	}
+
+	void* m = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	::close(fd);
+	if(m == MAP_FAILED)
+	{
+		perror("mmap");
+		return false;
+	}
+	map = (const uint8_t*)m;
+	size = st.st_size;
+
+	memcpy(&header,map,sizeof(header));
+	if(header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION || header.record_bytes != sizeof(CaptureRecord))
+	{
+		fprintf(stderr,"%s: not a capture of this version\n",path.c_str());
+		close();
+		return false;
+	}
+	return true;
+}
+
+void CaptureReader::close(void)
+{
+	if(map)
+		munmap((void*)map,size);
+	map = NULL;
+	size = 0;
+}
+
+const CaptureHeader& CaptureReader::getHeader(void)
+{
+	return header;
+}
+
+size_t CaptureReader::getCount(void)
+{
+	return map ? (size - sizeof(CaptureHeader)) / sizeof(CaptureRecord) : 0;
+}
+
+const CaptureRecord* CaptureReader::getRecords(void)
+{
+	return map ? (const CaptureRecord*)(map + sizeof(CaptureHeader)) : NULL;
+}
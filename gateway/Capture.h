@@ -0,0 +1,125 @@
+#ifndef __GATEWAY_CAPTURE_H__
+#define __GATEWAY_CAPTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * @file Capture.h
+ *
+ * Recordings of the raw frames the radio of the gateway received
+ *
+ * With a capture file, the radio thread hands every frame it reads to the
+ * application thread as it is, see StatusCallback::incomingFrame(), and
+ * this writes them out.  A recording can be fed back to a mesh on the mock
+ * radio as often as wanted, see gwreplay.cpp.
+ *
+ * A file is a CaptureHeader and then CaptureRecord after CaptureRecord, of
+ * fixed size so a reader can map the file and index the records, all
+ * little endian.  A record cut short by a crash is left out.
+ */
+
+#define CAPTURE_MAGIC 0x50414352 /**< "RCAP" */
+#define CAPTURE_VERSION 1
+#define CAPTURE_FRAME_BYTES 32
+#define CAPTURE_BUFFER_RECORDS 1024 /**< Records collected before a write() */
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_bytes; /**< sizeof(CaptureRecord) */
+	uint8_t channel;
+	uint8_t reserved[7];
+	uint64_t created_us; /**< Unix time */
+} __attribute__((packed)) CaptureHeader;
+
+typedef struct
+{
+	uint64_t time_us; /**< Unix time it was read off the radio */
+	uint8_t pipe;
+	uint8_t len; /**< Bytes of the frame, CAPTURE_FRAME_BYTES */
+	uint8_t reserved[6];
+	uint8_t frame[CAPTURE_FRAME_BYTES];
+} __attribute__((packed)) CaptureRecord;
+
+/**
+ * Counters of a writer
+ */
+typedef struct
+{
+	uint64_t records;
+	uint64_t bytes;
+	uint64_t failed; /**< Records that could not be written */
+} CaptureStats;
+
+class CaptureWriter
+{
+public:
+	CaptureWriter();
+	~CaptureWriter();
+
+	/**
+	 * Make the file @p path, or empty it
+	 *
+	 * @param channel Of the radio, kept in the header
+	 */
+	bool open(const std::string& path, uint8_t channel);
+
+	/**
+	 * Write what is left, close the file
+	 */
+	void close(void);
+
+	bool isOpen(void);
+
+	/**
+	 * Append records, written out once CAPTURE_BUFFER_RECORDS are waiting
+	 */
+	void add(const CaptureRecord* records, size_t n);
+
+	/**
+	 * Write the records waiting, they are not synced to disk
+	 */
+	bool flush(void);
+
+	const CaptureStats& getStats(void);
+
+private:
+	int fd;
+	std::string path;
+	std::vector<CaptureRecord> buffer;
+	CaptureStats stats;
+};
+
+class CaptureReader
+{
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	/**
+	 * Map the file @p path
+	 *
+	 * @return False, with the reason on stderr, if it is not a capture
+	 */
+	bool open(const std::string& path);
+	void close(void);
+
+	const CaptureHeader& getHeader(void);
+
+	/**
+	 * Whole records in the file
+	 */
+	size_t getCount(void);
+	const CaptureRecord* getRecords(void);
+
+private:
+	const uint8_t* map;
+	size_t size;
+	CaptureHeader header;
+};
+
+#endif //__GATEWAY_CAPTURE_H__
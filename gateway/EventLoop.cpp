@@ -0,0 +1,141 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+
+#include "EventLoop.h"
+
+EventLoop::EventLoop()
+{
+	epoll_fd = -1;
+	running = false;
+	wakeups = 0;
+}
+
+EventLoop::~EventLoop()
+{
+	if(epoll_fd >= 0)
+		close(epoll_fd);
+}
+
+bool EventLoop::begin(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(epoll_fd < 0)
+	{
+		perror("epoll_create1");
+		return false;
+	}
+	return true;
+}
+
+bool EventLoop::add(int fd, uint32_t events, EventHandler* handler)
+{
+	struct epoll_event e;
+	memset(&e,0,sizeof(e));
+	e.events = events;
+	e.data.ptr = handler;
+	if(epoll_ctl(epoll_fd,EPOLL_CTL_ADD,fd,&e) < 0)
+	{
+		perror("epoll_ctl");
+		return false;
+	}
+	return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events, EventHandler* handler)
+{
+	struct epoll_event e;
+	memset(&e,0,sizeof(e));
+	e.events = events;
+	e.data.ptr = handler;
+	return epoll_ctl(epoll_fd,EPOLL_CTL_MOD,fd,&e) == 0;
+}
+
+void EventLoop::remove(int fd)
+{
+	epoll_ctl(epoll_fd,EPOLL_CTL_DEL,fd,NULL);
+}
+
+int EventLoop::addTimer(uint64_t period_us, EventHandler* handler)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC);
+	if(fd < 0)
+	{
+		perror("timerfd_create");
+		return -1;
+	}
+
+	struct itimerspec t;
+	t.it_interval.tv_sec = period_us / 1000000;
+	t.it_interval.tv_nsec = (period_us % 1000000) * 1000L;
+	t.it_value = t.it_interval;
+	if(timerfd_settime(fd,0,&t,NULL) < 0 || !add(fd,EPOLLIN,handler))
+	{
+		perror("timerfd_settime");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void EventLoop::run(void)
+{
+	struct epoll_event events[EVENT_LOOP_BATCH];
+
+	running = true;
+	while(running)
+	{
+		int n = epoll_wait(epoll_fd,events,EVENT_LOOP_BATCH,-1);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		wakeups++;
+		for(int i=0;i<n && running;i++)
+		{
+			EventHandler* handler = static_cast<EventHandler*>(events[i].data.ptr);
+			if(!isRetired(handler))
+				handler->onEvent(events[i].events);
+		}
+
+		for(size_t i=0;i<retired.size();i++)
+			delete retired[i];
+		retired.clear();
+	}
+}
+
+void EventLoop::retire(EventHandler* handler)
+{
+	retired.push_back(handler);
+}
+
+bool EventLoop::isRetired(EventHandler* handler)
+{
+	return std::find(retired.begin(),retired.end(),handler) != retired.end();
+}
+
+void EventLoop::stop(void)
+{
+	running = false;
+}
+
+uint64_t EventLoop::getWakeups(void)
+{
+	return wakeups;
+}
+
+uint64_t drainCounter(int fd)
+{
+	uint64_t count = 0;
+	if(read(fd,&count,sizeof(count)) != sizeof(count))
+		return 0;
+	return count;
+}
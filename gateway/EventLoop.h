@@ -0,0 +1,103 @@
+#ifndef __GATEWAY_EVENT_LOOP_H__
+#define __GATEWAY_EVENT_LOOP_H__
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @file EventLoop.h
+ *
+ * epoll around the descriptors of the gateway: radio IRQ, timers, signals
+ * and sockets
+ */
+
+#define EVENT_LOOP_BATCH 32 /**< Events taken per epoll_wait() */
+
+/**
+ * Whatever waits on a descriptor
+ */
+class EventHandler
+{
+public:
+	virtual ~EventHandler() {}
+
+	/**
+	 * @param events EPOLLIN, EPOLLOUT, ... as they happened
+	 */
+	virtual void onEvent(uint32_t events) = 0;
+};
+
+/**
+ * Handler calling a member function, for objects waiting on several
+ * descriptors
+ */
+template<class T> class EventCallback: public EventHandler
+{
+public:
+	EventCallback(T& _object, void (T::*_method)(uint32_t)): object(_object), method(_method) {}
+
+	void onEvent(uint32_t events)
+	{
+		(object.*method)(events);
+	}
+
+private:
+	T& object;
+	void (T::*method)(uint32_t);
+};
+
+class EventLoop
+{
+public:
+	EventLoop();
+	~EventLoop();
+
+	/**
+	 * @return False if epoll cannot be had
+	 */
+	bool begin(void);
+
+	bool add(int fd, uint32_t events, EventHandler* handler);
+	bool modify(int fd, uint32_t events, EventHandler* handler);
+	void remove(int fd);
+
+	/**
+	 * Delete a handler once the events at hand are dispatched
+	 *
+	 * Its descriptor must have been removed.  Events of it still pending in
+	 * the same round are skipped.
+	 */
+	void retire(EventHandler* handler);
+
+	/**
+	 * A timerfd firing every @p period_us, -1 on failure
+	 *
+	 * The handler has to read the expiration count from it.
+	 */
+	int addTimer(uint64_t period_us, EventHandler* handler);
+
+	/**
+	 * Dispatch events until stop()
+	 */
+	void run(void);
+	void stop(void);
+
+	uint64_t getWakeups(void);
+
+private:
+	int epoll_fd;
+	bool running;
+	uint64_t wakeups; /**< Returns from epoll_wait() with events */
+	std::vector<EventHandler*> retired;
+
+	bool isRetired(EventHandler* handler);
+};
+
+/**
+ * Read a timerfd or eventfd, so it stops being readable
+ *
+ * @return The count it held, 0 if none
+ */
+uint64_t drainCounter(int fd);
+
+#endif //__GATEWAY_EVENT_LOOP_H__
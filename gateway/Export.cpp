@@ -0,0 +1,285 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <algorithm>
+
+#include "Export.h"
+
+ExportClient::ExportClient(ExportServer& _server, int _fd): server(_server), fd(_fd)
+{
+	queued = 0;
+	dropped = 0;
+	want_write = false;
+}
+
+ExportClient::~ExportClient()
+{
+	if(fd >= 0)
+		::close(fd);
+}
+
+void ExportClient::send(uint32_t sequence, const std::shared_ptr<const std::vector<uint8_t> >& records, uint16_t count)
+{
+	size_t size = sizeof(ExportBatch) + records->size();
+	if(queued + size > server.limit)
+	{
+		dropped += count;
+		server.stats.records_dropped += count;
+		return;
+	}
+
+	Pending p;
+	memset(&p.header,0,sizeof(p.header));
+	p.header.magic = EXPORT_MAGIC;
+	p.header.version = EXPORT_VERSION;
+	p.header.count = count;
+	p.header.record_size = sizeof(ExportRecord);
+	p.header.sequence = sequence;
+	p.header.dropped = dropped;
+	p.records = records;
+	p.offset = 0;
+	queue.push_back(p);
+	queued += size;
+	dropped = 0;
+
+	// Most of the time the socket takes it right away and epoll never sees it
+	if(!want_write && !write())
+		close();
+}
+
+bool ExportClient::write(void)
+{
+	while(!queue.empty())
+	{
+		Pending& p = queue.front();
+		struct iovec iov[2];
+		int n = 0;
+
+		if(p.offset < sizeof(ExportBatch))
+		{
+			iov[n].iov_base = (uint8_t*)&p.header + p.offset;
+			iov[n].iov_len = sizeof(ExportBatch) - p.offset;
+			n++;
+			iov[n].iov_base = (void*)p.records->data();
+			iov[n].iov_len = p.records->size();
+			n++;
+		}
+		else
+		{
+			size_t done = p.offset - sizeof(ExportBatch);
+			iov[n].iov_base = (void*)(p.records->data() + done);
+			iov[n].iov_len = p.records->size() - done;
+			n++;
+		}
+
+		struct msghdr msg;
+		memset(&msg,0,sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		ssize_t sent = sendmsg(fd,&msg,MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(sent < 0)
+		{
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+
+		server.stats.bytes_sent += sent;
+		p.offset += sent;
+		queued -= sent;
+		if(p.offset < sizeof(ExportBatch) + p.records->size())
+			break;
+		queue.pop_front();
+	}
+
+	// Only ask for EPOLLOUT while there is something left
+	bool more = !queue.empty();
+	if(more != want_write)
+	{
+		want_write = more;
+		server.loop.modify(fd,EPOLLIN | EPOLLRDHUP | (more ? EPOLLOUT : 0),this);
+	}
+	return true;
+}
+
+void ExportClient::onEvent(uint32_t events)
+{
+	if(events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+	{
+		close();
+		return;
+	}
+
+	if(events & EPOLLIN)
+	{
+		// Clients have nothing to say, whatever they send is thrown away
+		char buffer[256];
+		ssize_t n = recv(fd,buffer,sizeof(buffer),MSG_DONTWAIT);
+		if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+		{
+			close();
+			return;
+		}
+	}
+
+	if((events & EPOLLOUT) && !write())
+		close();
+}
+
+size_t ExportClient::getQueued(void)
+{
+	return queued;
+}
+
+void ExportClient::close(void)
+{
+	server.loop.remove(fd);
+	server.closed(this);
+	server.loop.retire(this);
+}
+
+/****************************************************************************/
+
+ExportServer::ExportServer(EventLoop& _loop): loop(_loop)
+{
+	fd = -1;
+	limit = EXPORT_CLIENT_LIMIT;
+	batch_records = EXPORT_BATCH_RECORDS;
+	batch_count = 0;
+	sequence = 0;
+	memset(&stats,0,sizeof(stats));
+}
+
+ExportServer::~ExportServer()
+{
+	for(size_t i=0;i<clients.size();i++)
+	{
+		loop.remove(clients[i]->fd);
+		delete clients[i];
+	}
+	if(fd >= 0)
+	{
+		::close(fd);
+		unlink(path.c_str());
+	}
+}
+
+bool ExportServer::begin(const std::string& _path, size_t _limit, uint16_t _batch_records)
+{
+	path = _path;
+	limit = _limit;
+	batch_records = _batch_records;
+
+	struct sockaddr_un addr;
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr,"%s: path too long\n",path.c_str());
+		return false;
+	}
+	strcpy(addr.sun_path,path.c_str());
+
+	fd = socket(AF_UNIX,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+	if(fd < 0)
+	{
+		perror("socket");
+		return false;
+	}
+
+	unlink(path.c_str());
+	if(bind(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0 || listen(fd,EXPORT_MAX_CLIENTS) < 0)
+	{
+		perror(path.c_str());
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	return loop.add(fd,EPOLLIN,this);
+}
+
+void ExportServer::push(const ExportRecord& record)
+{
+	if(!batch)
+	{
+		batch.reset(new std::vector<uint8_t>());
+		batch->reserve(batch_records * sizeof(ExportRecord));
+	}
+
+	const uint8_t* bytes = (const uint8_t*)&record;
+	batch->insert(batch->end(),bytes,bytes + sizeof(record));
+	batch_count++;
+	stats.records++;
+
+	if(batch_count >= batch_records)
+		flush();
+}
+
+void ExportServer::flush(void)
+{
+	if(!batch_count)
+		return;
+
+	// Every client gets the same records, only the headers differ
+	std::shared_ptr<const std::vector<uint8_t> > records = batch;
+	uint16_t count = batch_count;
+	batch.reset();
+	batch_count = 0;
+	sequence++;
+	stats.batches++;
+
+	// send() may close a client, which takes it out of the list
+	std::vector<ExportClient*> targets(clients);
+	for(size_t i=0;i<targets.size();i++)
+		targets[i]->send(sequence,records,count);
+}
+
+void ExportServer::onEvent(uint32_t events)
+{
+	for(;;)
+	{
+		int client_fd = accept4(fd,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(client_fd < 0)
+			break;
+
+		if(clients.size() >= EXPORT_MAX_CLIENTS)
+		{
+			::close(client_fd);
+			stats.clients_refused++;
+			continue;
+		}
+
+		ExportClient* client = new ExportClient(*this,client_fd);
+		if(!loop.add(client_fd,EPOLLIN | EPOLLRDHUP,client))
+		{
+			delete client;
+			continue;
+		}
+		clients.push_back(client);
+		stats.clients_accepted++;
+	}
+}
+
+const ExportStats& ExportServer::getStats(void)
+{
+	return stats;
+}
+
+size_t ExportServer::getClientCount(void)
+{
+	return clients.size();
+}
+
+void ExportServer::closed(ExportClient* client)
+{
+	clients.erase(std::remove(clients.begin(),clients.end(),client),clients.end());
+}
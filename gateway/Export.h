@@ -0,0 +1,129 @@
+#ifndef __GATEWAY_EXPORT_H__
+#define __GATEWAY_EXPORT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EventLoop.h"
+#include "ExportProtocol.h"
+
+/**
+ * @file Export.h
+ *
+ * Unix socket the gateway streams its records out of, see ExportProtocol.h
+ *
+ * Records are collected into a batch, which goes out once it holds
+ * EXPORT_BATCH_RECORDS or when flush() is called, from a timer of the
+ * gateway.  Each client has its own queue of batches and is written to only
+ * when its socket has room, so a slow client never holds up the radio or
+ * the others.  A client whose queue is over its byte limit loses the new
+ * batches and is told how many records it lost in the next one it gets.
+ */
+
+#define EXPORT_BATCH_RECORDS 128
+#define EXPORT_CLIENT_LIMIT (4 * 1024 * 1024) /**< Bytes queued per client before it loses batches */
+#define EXPORT_MAX_CLIENTS 16
+
+class ExportServer;
+
+/**
+ * Counters of the export, for the whole server
+ */
+typedef struct
+{
+	uint64_t records; /**< Pushed */
+	uint64_t batches; /**< Made */
+	uint64_t bytes_sent;
+	uint64_t records_dropped; /**< Lost by slow clients, counted per client */
+	uint64_t clients_accepted;
+	uint64_t clients_refused; /**< Over EXPORT_MAX_CLIENTS */
+} ExportStats;
+
+class ExportClient: public EventHandler
+{
+public:
+	ExportClient(ExportServer& server, int fd);
+	~ExportClient();
+
+	/**
+	 * Queue a batch, or count it as lost if over the limit
+	 */
+	void send(uint32_t sequence, const std::shared_ptr<const std::vector<uint8_t> >& records, uint16_t count);
+
+	void onEvent(uint32_t events);
+
+	size_t getQueued(void);
+
+private:
+	friend class ExportServer;
+
+	typedef struct
+	{
+		ExportBatch header;
+		std::shared_ptr<const std::vector<uint8_t> > records;
+		size_t offset; /**< Bytes of header and records written */
+	} Pending;
+
+	ExportServer& server;
+	int fd;
+	std::deque<Pending> queue;
+	size_t queued; /**< Bytes in queue not yet written */
+	uint32_t dropped; /**< Records lost since the last queued batch */
+	bool want_write; /**< EPOLLOUT is on */
+
+	/**
+	 * Write as much as the socket takes
+	 *
+	 * @return False if the client is gone
+	 */
+	bool write(void);
+	void close(void);
+};
+
+class ExportServer: public EventHandler
+{
+public:
+	ExportServer(EventLoop& loop);
+	~ExportServer();
+
+	/**
+	 * Listen on @p path, which is replaced if it exists
+	 *
+	 * @param limit Bytes queued per client before it loses batches
+	 */
+	bool begin(const std::string& path, size_t limit = EXPORT_CLIENT_LIMIT, uint16_t batch_records = EXPORT_BATCH_RECORDS);
+
+	void push(const ExportRecord& record);
+
+	/**
+	 * Send out the records collected so far
+	 */
+	void flush(void);
+
+	void onEvent(uint32_t events);
+
+	const ExportStats& getStats(void);
+	size_t getClientCount(void);
+
+private:
+	friend class ExportClient;
+
+	EventLoop& loop;
+	int fd;
+	std::string path;
+	size_t limit;
+	uint16_t batch_records;
+	std::vector<ExportClient*> clients;
+	std::shared_ptr<std::vector<uint8_t> > batch;
+	uint16_t batch_count;
+	uint32_t sequence;
+	ExportStats stats;
+
+	void closed(ExportClient* client);
+};
+
+#endif //__GATEWAY_EXPORT_H__
@@ -0,0 +1,50 @@
+#ifndef __GATEWAY_EXPORT_PROTOCOL_H__
+#define __GATEWAY_EXPORT_PROTOCOL_H__
+
+#include <stdint.h>
+
+/**
+ * @file ExportProtocol.h
+ *
+ * Wire format of the export socket of the gateway
+ *
+ * A client connects to the Unix stream socket and only reads.  The stream
+ * is a sequence of batches, each an ExportBatch header followed by @c count
+ * records of @c record_size bytes.  Readers skip bytes of a record beyond
+ * what they know, so records may grow at the end.  Everything is little
+ * endian.
+ */
+
+#define EXPORT_SOCKET "/run/rf24gw.sock" /**< Where the gateway listens by default */
+#define EXPORT_MAGIC 0x42574752 /**< "RGWB" */
+#define EXPORT_VERSION 1
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count; /**< Records following */
+	uint16_t record_size;
+	uint16_t reserved;
+	uint32_t sequence; /**< Of the batch, counts up by one per batch made, also those this client lost */
+	uint32_t dropped; /**< Records this client lost since its previous batch, because it read too slowly */
+} __attribute__((packed)) ExportBatch;
+
+/**
+ * A frame the master handed to the application
+ */
+typedef struct
+{
+	uint64_t time_us; /**< Unix time at the gateway */
+	uint32_t network_ms; /**< Network time of the mesh, RF24Mesh::networkMillis() */
+	uint16_t source; /**< Node that took the reading, source_data.ip */
+	uint16_t from; /**< Neighbour it came from */
+	uint16_t id;
+	uint8_t hops; /**< source_data.weight, forwards on the way */
+	uint8_t type; /**< 'D' or 'F' for readings, 'S' for stats reports */
+	uint8_t flags;
+	uint8_t reserved[3];
+	uint8_t payload[16];
+} __attribute__((packed)) ExportRecord;
+
+#endif //__GATEWAY_EXPORT_PROTOCOL_H__
@@ -0,0 +1,742 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <algorithm>
+
+#include "Gateway.h"
+
+Gateway::Gateway(const GatewayConfig& _config): config(_config), radio(_config), exporter(loop), metrics(loop),
+	on_notify(*this, &Gateway::notified), on_done(*this, &Gateway::done), on_flush(*this, &Gateway::flush), on_query(*this, &Gateway::query),
+	on_signal(*this, &Gateway::signal), on_metrics(*this, &Gateway::refresh)
+{
+	memset(&stats,0,sizeof(stats));
+	threaded = config.workers > 0;
+	memset(&mesh_metrics,0,sizeof(mesh_metrics));
+	have_mesh_metrics = false;
+	notify_fd = -1;
+	done_fd = -1;
+	flush_fd = -1;
+	query_fd = -1;
+	signal_fd = -1;
+	metrics_fd = -1;
+}
+
+Gateway::~Gateway()
+{
+	radio.stop();
+	shards.clear();
+
+	int fds[] = { done_fd, flush_fd, query_fd, signal_fd, metrics_fd };
+	for(size_t i=0;i<sizeof(fds)/sizeof(fds[0]);i++)
+	{
+		if(fds[i] >= 0)
+			close(fds[i]);
+	}
+}
+
+bool Gateway::begin(void)
+{
+	// Both threads leave SIGINT and SIGTERM to the signalfd
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals,SIGINT);
+	sigaddset(&signals,SIGTERM);
+	sigprocmask(SIG_BLOCK,&signals,NULL);
+
+	if(!radio.begin() || !loop.begin() || !exporter.begin(config.socket,config.client_limit,config.batch_records))
+		return false;
+
+	if(!config.capture.empty() && !capture.open(config.capture,config.channel))
+		return false;
+
+	notify_fd = radio.getNotifyFd();
+	if(!loop.add(notify_fd,EPOLLIN,&on_notify))
+		return false;
+
+	// Without workers, one shard on this thread
+	done_fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+	if(done_fd < 0 || !loop.add(done_fd,EPOLLIN,&on_done))
+	{
+		perror("eventfd");
+		return false;
+	}
+	for(unsigned i=0;i<(threaded ? config.workers : 1);i++)
+	{
+		shards.push_back(std::unique_ptr<Shard>(new Shard(i)));
+		if(!shards.back()->begin(done_fd,config))
+			return false;
+	}
+
+	flush_fd = loop.addTimer((uint64_t)config.flush_ms * 1000,&on_flush);
+	if(flush_fd < 0)
+		return false;
+
+	if(config.query_s)
+	{
+		query_fd = loop.addTimer((uint64_t)config.query_s * 1000000,&on_query);
+		if(query_fd < 0)
+			return false;
+	}
+
+	signal_fd = signalfd(-1,&signals,SFD_NONBLOCK | SFD_CLOEXEC);
+	if(signal_fd < 0 || !loop.add(signal_fd,EPOLLIN,&on_signal))
+	{
+		perror("signalfd");
+		return false;
+	}
+
+	if(!config.metrics.empty())
+	{
+		if(!metrics.begin(config.metrics))
+			return false;
+		metrics_fd = loop.addTimer((uint64_t)config.metrics_ms * 1000,&on_metrics);
+		if(metrics_fd < 0)
+			return false;
+		shard_metrics.resize(shards.size());
+		render();
+	}
+
+	return true;
+}
+
+void Gateway::run(void)
+{
+	if(threaded)
+	{
+		for(size_t i=0;i<shards.size();i++)
+			shards[i]->start();
+	}
+	radio.start();
+	loop.run();
+	radio.stop();
+
+	// What the radio thread queued before it stopped, and the workers made
+	// of it before they stopped
+	receive();
+	for(size_t i=0;i<shards.size();i++)
+		shards[i]->stop();
+	collect();
+	exporter.flush();
+	record();
+	capture.close();
+}
+
+bool Gateway::send(const RF24NetworkHeader& header)
+{
+	MeshCommand c;
+	c.type = COMMAND_SEND;
+	c.header = header;
+	return radio.command(c);
+}
+
+bool Gateway::queryStats(void)
+{
+	MeshCommand c;
+	c.type = COMMAND_QUERY_STATS;
+	return radio.command(c);
+}
+
+/****************************************************************************/
+
+void Gateway::notified(uint32_t events)
+{
+	drainCounter(notify_fd);
+	stats.wakeups++;
+	receive();
+	record();
+}
+
+void Gateway::done(uint32_t events)
+{
+	drainCounter(done_fd);
+	collect();
+}
+
+void Gateway::flush(uint32_t events)
+{
+	drainCounter(flush_fd);
+	if(!threaded)
+		shards[0]->service();
+	exporter.flush();
+	record();
+	capture.flush();
+}
+
+void Gateway::query(uint32_t events)
+{
+	drainCounter(query_fd);
+	if(queryStats())
+		stats.queries++;
+}
+
+void Gateway::signal(uint32_t events)
+{
+	struct signalfd_siginfo info;
+	if(read(signal_fd,&info,sizeof(info)) == sizeof(info))
+		printf("Signal %u, stopping\n",info.ssi_signo);
+	loop.stop();
+}
+
+void Gateway::refresh(uint32_t events)
+{
+	drainCounter(metrics_fd);
+	render();
+}
+
+void Gateway::receive(void)
+{
+	size_t n;
+	while((n = radio.receive(frames,GATEWAY_RECEIVE_BATCH)) > 0)
+	{
+		stats.frames += n;
+		if(!threaded)
+		{
+			shards[0]->process(frames,n);
+			shards[0]->service();
+			collect();
+			continue;
+		}
+
+		for(size_t i=0;i<n;i++)
+		{
+			Shard& shard = *shards[shardOf(frames[i].header.source_data.ip,shards.size())];
+			if(!shard.dispatch(frames[i]))
+				stats.dispatch_full++;
+		}
+		for(size_t i=0;i<shards.size();i++)
+			shards[i]->kick();
+	}
+}
+
+void Gateway::collect(void)
+{
+	for(size_t i=0;i<shards.size();i++)
+	{
+		size_t n;
+		while((n = shards[i]->collect(records,SHARD_BATCH)) > 0)
+		{
+			stats.records += n;
+			for(size_t j=0;j<n;j++)
+				exporter.push(records[j]);
+		}
+	}
+}
+
+void Gateway::record(void)
+{
+	if(!capture.isOpen())
+		return;
+
+	size_t n;
+	while((n = radio.receiveCaptured(captured,GATEWAY_RECEIVE_BATCH)) > 0)
+		capture.add(captured,n);
+}
+
+/****************************************************************************/
+
+/**
+ * A 64 bit counter of a struct, for a table of metrics
+ */
+template<class S> struct MetricsField
+{
+	const char* name;
+	const char* help;
+	uint64_t S::*field;
+};
+
+template<class S, size_t N> static void counters(MetricsText& text, const MetricsField<S> (&fields)[N], const S& s)
+{
+	for(size_t i=0;i<N;i++)
+	{
+		text.counter(fields[i].name,fields[i].help);
+		text.sample(s.*fields[i].field);
+	}
+}
+
+/**
+ * A ring with its labels
+ */
+typedef struct
+{
+	std::string labels;
+	SpscRingStats stats;
+} MetricsRing;
+
+template<class T> static void rings(MetricsText& text, const std::vector<MetricsRing>& r, T SpscRingStats::*field)
+{
+	for(size_t i=0;i<r.size();i++)
+		text.sample((uint64_t)(r[i].stats.*field),r[i].labels.c_str());
+}
+
+static const MetricsField<GatewayStats> gatewayFields[] = {
+	{ "rf24_gateway_wakeups_total", "Notifications of the radio thread", &GatewayStats::wakeups },
+	{ "rf24_gateway_frames_total", "Frames taken off the up ring", &GatewayStats::frames },
+	{ "rf24_gateway_dispatch_full_total", "Frames lost to the full in ring of a worker", &GatewayStats::dispatch_full },
+	{ "rf24_gateway_records_total", "Records collected from the workers", &GatewayStats::records },
+	{ "rf24_gateway_stats_queries_total", "Stats queries sent to the nodes", &GatewayStats::queries },
+};
+
+static const MetricsField<ExportStats> exportFields[] = {
+	{ "rf24_export_records_total", "Records pushed to the export", &ExportStats::records },
+	{ "rf24_export_batches_total", "Batches made", &ExportStats::batches },
+	{ "rf24_export_sent_bytes_total", "Bytes written to export clients", &ExportStats::bytes_sent },
+	{ "rf24_export_dropped_records_total", "Records lost by slow export clients, per client", &ExportStats::records_dropped },
+	{ "rf24_export_clients_accepted_total", "Export clients accepted", &ExportStats::clients_accepted },
+	{ "rf24_export_clients_refused_total", "Export clients refused, too many", &ExportStats::clients_refused },
+};
+
+static const MetricsField<MetricsStats> metricsFields[] = {
+	{ "rf24_metrics_scrapes_total", "Pages of metrics sent", &MetricsStats::scrapes },
+	{ "rf24_metrics_bad_requests_total", "Requests for anything else", &MetricsStats::bad_requests },
+	{ "rf24_metrics_timeouts_total", "Metrics clients closed for taking too long", &MetricsStats::timeouts },
+};
+
+void Gateway::render(void)
+{
+	if(radio.receiveMetrics(mesh_metrics))
+		have_mesh_metrics = true;
+	for(size_t i=0;i<shards.size();i++)
+		shards[i]->receiveMetrics(shard_metrics[i]);
+
+	// The page keeps its room from one round to the next
+	page.clear();
+	MetricsText text(page);
+
+	counters(text,gatewayFields,stats);
+
+	std::vector<MetricsRing> r;
+	MetricsRing ring;
+	ring.labels = "ring=\"up\"";
+	radio.getUpStats(ring.stats);
+	r.push_back(ring);
+	ring.labels = "ring=\"down\"";
+	radio.getDownStats(ring.stats);
+	r.push_back(ring);
+	if(capture.isOpen())
+	{
+		ring.labels = "ring=\"capture\"";
+		radio.getCaptureStats(ring.stats);
+		r.push_back(ring);
+	}
+	for(size_t i=0;i<shards.size();i++)
+	{
+		char labels[48];
+		if(threaded)
+		{
+			snprintf(labels,sizeof(labels),"ring=\"in\",shard=\"%zu\"",i);
+			ring.labels = labels;
+			shards[i]->getInStats(ring.stats);
+			r.push_back(ring);
+		}
+		snprintf(labels,sizeof(labels),"ring=\"out\",shard=\"%zu\"",i);
+		ring.labels = labels;
+		shards[i]->getOutStats(ring.stats);
+		r.push_back(ring);
+	}
+	text.gauge("rf24_ring_depth","Items in a ring between two threads");
+	rings(text,r,&SpscRingStats::depth);
+	text.gauge("rf24_ring_high_water","Most items the consumer found in a ring");
+	rings(text,r,&SpscRingStats::high_water);
+	text.gauge("rf24_ring_capacity","Items a ring holds");
+	rings(text,r,&SpscRingStats::capacity);
+	text.counter("rf24_ring_pushed_total","Items put into a ring");
+	rings(text,r,&SpscRingStats::pushed);
+	text.counter("rf24_ring_full_total","Items lost to a full ring");
+	rings(text,r,&SpscRingStats::full);
+	text.counter("rf24_ring_popped_total","Items taken off a ring");
+	rings(text,r,&SpscRingStats::popped);
+
+	counters(text,exportFields,exporter.getStats());
+	text.gauge("rf24_export_clients","Export clients connected");
+	text.sample(exporter.getClientCount());
+
+	if(capture.isOpen())
+	{
+		const CaptureStats& c = capture.getStats();
+		text.counter("rf24_capture_records_total","Raw frames written to the capture file");
+		text.sample(c.records);
+		text.counter("rf24_capture_failed_total","Raw frames the capture file did not take");
+		text.sample(c.failed);
+	}
+
+	counters(text,metricsFields,metrics.getStats());
+
+	if(have_mesh_metrics)
+		renderMesh(text);
+	renderNodes(text);
+
+	metrics.publish(page);
+}
+
+static const MetricsField<RadioStats> radioThreadFields[] = {
+	{ "rf24_radio_thread_irqs_total", "Edges seen on the IRQ line", &RadioStats::irqs },
+	{ "rf24_radio_thread_ticks_total", "Ticks of the mesh timers", &RadioStats::ticks },
+	{ "rf24_radio_thread_services_total", "Runs of the mesh loop", &RadioStats::services },
+	{ "rf24_radio_thread_readings_total", "Readings handed to the application", &RadioStats::readings },
+	{ "rf24_radio_thread_reports_total", "Stats reports handed to the application", &RadioStats::reports },
+	{ "rf24_radio_thread_commands_total", "Commands of the application", &RadioStats::commands },
+	{ "rf24_radio_thread_sends_failed_total", "Frames to send the mesh did not take", &RadioStats::sends_failed },
+};
+
+static const MetricsField<MeshMetrics> meshFields[] = {
+	{ "rf24_mesh_tx_failed_total", "Frames given up on after all attempts", &MeshMetrics::tx_failed },
+	{ "rf24_mesh_rx_drops_total", "Frames received but dropped, no slot or no room in the receive queue", &MeshMetrics::rx_drops },
+	{ "rf24_mesh_join_attempts_total", "Joins sent", &MeshMetrics::join_attempts },
+	{ "rf24_mesh_forwarded_frames_total", "Frames forwarded towards the master", &MeshMetrics::forwarded },
+	{ "rf24_radio_spi_transactions_total", "Times the chip was selected", &MeshMetrics::spi_transactions },
+	{ "rf24_radio_writes_total", "Payloads written", &MeshMetrics::writes },
+	{ "rf24_radio_write_ok_total", "Payloads written and acknowledged", &MeshMetrics::write_ok },
+	{ "rf24_radio_max_rt_total", "Payloads written and given up on by the radio", &MeshMetrics::max_rt },
+	{ "rf24_radio_timeouts_total", "Payloads written the radio did not answer for in time", &MeshMetrics::timeouts },
+	{ "rf24_radio_retries_total", "Auto retransmissions over all writes", &MeshMetrics::retries },
+	{ "rf24_radio_reads_total", "Payloads read", &MeshMetrics::reads },
+	{ "rf24_route_changes_total", "New parents taken and neighbours removed", &MeshMetrics::route_changes },
+};
+
+static const MetricsField<SendQueueMetrics> queueFields[] = {
+	{ "rf24_send_queue_enqueued_total", "Frames queued for sending", &SendQueueMetrics::enqueued },
+	{ "rf24_send_queue_sent_total", "Frames sent off the queue", &SendQueueMetrics::sent },
+	{ "rf24_send_queue_tail_drops_total", "Frames dropped, no room left for their class", &SendQueueMetrics::tail_drops },
+	{ "rf24_send_queue_early_drops_total", "Frames dropped to keep room for more important ones", &SendQueueMetrics::early_drops },
+};
+
+static const MetricsField<SourceMetrics> sourceFields[] = {
+	{ "rf24_send_queue_source_enqueued_total", "Frames queued for sending, by originating node", &SourceMetrics::enqueued },
+	{ "rf24_send_queue_source_sent_total", "Frames sent off the queue, by originating node", &SourceMetrics::sent },
+	{ "rf24_send_queue_source_drops_total", "Frames dropped from the queue, by originating node", &SourceMetrics::drops },
+};
+
+void Gateway::renderMesh(MetricsText& text)
+{
+	const MeshMetrics& m = mesh_metrics;
+	char labels[48];
+
+	text.gauge("rf24_mesh_snapshot_timestamp_seconds","When the radio thread took the counters of the mesh");
+	text.sampleReal(m.time_us / 1e6);
+	text.gauge("rf24_mesh_network_seconds","Network time of the master");
+	text.sampleReal(m.network_ms / 1e3);
+
+	counters(text,radioThreadFields,m.radio);
+
+	static const char types[MESH_STAT_TYPES] = { 'J', 'W', 'U', 'D', 'F', 'Q', 'S', '?' };
+	text.counter("rf24_mesh_rx_frames_total","Frames read from the radio, by type");
+	for(int t=0;t<MESH_STAT_TYPES;t++)
+	{
+		snprintf(labels,sizeof(labels),"type=\"%c\"",types[t]);
+		text.sample(m.rx[t],labels);
+	}
+	text.counter("rf24_mesh_tx_frames_total","Frames delivered to the next hop, by type");
+	for(int t=0;t<MESH_STAT_TYPES;t++)
+	{
+		snprintf(labels,sizeof(labels),"type=\"%c\"",types[t]);
+		text.sample(m.tx[t],labels);
+	}
+	counters(text,meshFields,m);
+
+	static const char* states[JOINED + 1] = { "INIT", "NJOINED", "SENDJOIN", "JOINRECEIVED", "NEW_JOINED", "JOINED" };
+	text.counter("rf24_mesh_state_seconds_total","Time spent in each state of the mesh");
+	for(int i=INIT;i<=JOINED;i++)
+	{
+		snprintf(labels,sizeof(labels),"state=\"%s\"",states[i]);
+		text.sampleReal(m.state_ms[i] / 1e3,labels);
+	}
+	text.gauge("rf24_mesh_rx_queue_high_water","Most frames waiting in the receive queue");
+	text.sample(m.rx_queue_high_water);
+	text.counter("rf24_mesh_forward_seconds_total","Time forwarded frames spent in the master");
+	text.sampleReal(m.forward_ms / 1e3);
+	text.gauge("rf24_mesh_forward_max_seconds","Longest time a forwarded frame spent in the master");
+	text.sampleReal(m.forward_max_ms / 1e3);
+
+	static const char* classes[SQ_CLASSES] = { "control", "urgent", "data" };
+	text.gauge("rf24_send_queue_depth","Frames waiting in the send queue, by class");
+	for(int c=0;c<SQ_CLASSES;c++)
+	{
+		snprintf(labels,sizeof(labels),"class=\"%s\"",classes[c]);
+		text.sample(m.queues[c].depth,labels);
+	}
+	text.gauge("rf24_send_queue_high_water","Most frames waiting in the send queue, by class");
+	for(int c=0;c<SQ_CLASSES;c++)
+	{
+		snprintf(labels,sizeof(labels),"class=\"%s\"",classes[c]);
+		text.sample(m.queues[c].high_water,labels);
+	}
+	for(size_t f=0;f<sizeof(queueFields)/sizeof(queueFields[0]);f++)
+	{
+		text.counter(queueFields[f].name,queueFields[f].help);
+		for(int c=0;c<SQ_CLASSES;c++)
+		{
+			snprintf(labels,sizeof(labels),"class=\"%s\"",classes[c]);
+			text.sample(m.queues[c].*queueFields[f].field,labels);
+		}
+	}
+	for(size_t f=0;f<sizeof(sourceFields)/sizeof(sourceFields[0]);f++)
+	{
+		text.counter(sourceFields[f].name,sourceFields[f].help);
+		for(uint8_t i=0;i<m.source_count;i++)
+		{
+			snprintf(labels,sizeof(labels),"source=\"%u\"",m.sources[i].ip);
+			text.sample(m.sources[i].*sourceFields[f].field,labels);
+		}
+	}
+
+	static const char* routing[DEAD + 1] = { "SENT_WELCOME", "GOT_WELCOME", "GOT_JOIN", "SHORTENED", "CONNECTED", "DEAD" };
+	text.gauge("rf24_neighbours","Nodes in the routing table of the master");
+	text.sample(m.neighbour_count);
+	text.gauge("rf24_neighbour_status","State of a neighbour in the routing table");
+	for(uint8_t i=0;i<m.neighbour_count;i++)
+	{
+		const NeighbourMetrics& n = m.neighbours[i];
+		snprintf(labels,sizeof(labels),"node=\"%u\",status=\"%s\"",n.ip,n.status <= DEAD ? routing[n.status] : "?");
+		text.sample(1,labels);
+	}
+	text.gauge("rf24_neighbour_weight","Hops from a neighbour to the master");
+	for(uint8_t i=0;i<m.neighbour_count;i++)
+	{
+		snprintf(labels,sizeof(labels),"node=\"%u\"",m.neighbours[i].ip);
+		text.sample(m.neighbours[i].weight,labels);
+	}
+	text.gauge("rf24_neighbour_congestion","Send queue level a neighbour reported last, 0 to 3");
+	for(uint8_t i=0;i<m.neighbour_count;i++)
+	{
+		snprintf(labels,sizeof(labels),"node=\"%u\"",m.neighbours[i].ip);
+		text.sample(m.neighbours[i].congestion,labels);
+	}
+	text.gauge("rf24_neighbour_sleepy","Whether a neighbour sleeps between wake windows");
+	for(uint8_t i=0;i<m.neighbour_count;i++)
+	{
+		snprintf(labels,sizeof(labels),"node=\"%u\"",m.neighbours[i].ip);
+		text.sample(m.neighbours[i].sleepy,labels);
+	}
+}
+
+static const MetricsField<ShardStats> shardFields[] = {
+	{ "rf24_shard_wakeups_total", "Wakeups of a worker", &ShardStats::wakeups },
+	{ "rf24_shard_frames_total", "Frames handled by a worker", &ShardStats::frames },
+	{ "rf24_shard_records_total", "Records queued by a worker", &ShardStats::records },
+};
+
+static const MetricsField<NodeState> nodeFields[] = {
+	{ "rf24_node_readings_total", "Readings of a source node, without repeats", &NodeState::readings },
+	{ "rf24_node_duplicates_total", "Repeated readings of a source node", &NodeState::duplicates },
+	{ "rf24_node_late_total", "Readings of a source node that came after a newer one", &NodeState::late },
+	{ "rf24_node_skipped_ids_total", "Reading ids of a source node jumped over, late ones among them", &NodeState::skipped },
+	{ "rf24_node_restarts_total", "Times a source node started its ids over", &NodeState::restarts },
+	{ "rf24_node_reports_total", "Stats reports of a node", &NodeState::reports },
+};
+
+static bool byIp(const NodeState* a, const NodeState* b)
+{
+	return a->ip < b->ip;
+}
+
+void Gateway::renderNodes(MetricsText& text)
+{
+	char labels[32];
+
+	for(size_t f=0;f<sizeof(shardFields)/sizeof(shardFields[0]);f++)
+	{
+		text.counter(shardFields[f].name,shardFields[f].help);
+		for(size_t i=0;i<shard_metrics.size();i++)
+		{
+			snprintf(labels,sizeof(labels),"shard=\"%zu\"",i);
+			text.sample(shard_metrics[i].stats.*shardFields[f].field,labels);
+		}
+	}
+	text.gauge("rf24_shard_nodes","Source nodes of a worker");
+	for(size_t i=0;i<shard_metrics.size();i++)
+	{
+		snprintf(labels,sizeof(labels),"shard=\"%zu\"",i);
+		text.sample(shard_metrics[i].table.nodes,labels);
+	}
+
+	// Each node is on one shard, they are listed in order of address
+	std::vector<const NodeState*> nodes;
+	for(size_t i=0;i<shard_metrics.size();i++)
+	{
+		for(size_t j=0;j<shard_metrics[i].nodes.size();j++)
+			nodes.push_back(&shard_metrics[i].nodes[j]);
+	}
+	std::sort(nodes.begin(),nodes.end(),byIp);
+
+	for(size_t f=0;f<sizeof(nodeFields)/sizeof(nodeFields[0]);f++)
+	{
+		text.counter(nodeFields[f].name,nodeFields[f].help);
+		for(size_t i=0;i<nodes.size();i++)
+		{
+			snprintf(labels,sizeof(labels),"node=\"%u\"",nodes[i]->ip);
+			text.sample(nodes[i]->*nodeFields[f].field,labels);
+		}
+	}
+
+	// Ids skipped and not made up for by late readings are taken as lost
+	text.gauge("rf24_node_delivery_ratio","Readings of a source node over those it sent, as its reading ids tell");
+	for(size_t i=0;i<nodes.size();i++)
+	{
+		const NodeState& n = *nodes[i];
+		if(!n.readings)
+			continue;
+		uint64_t lost = n.skipped > n.late ? n.skipped - n.late : 0;
+		snprintf(labels,sizeof(labels),"node=\"%u\"",n.ip);
+		text.sampleReal((double)n.readings / (n.readings + lost),labels);
+	}
+	text.gauge("rf24_node_last_seen_timestamp_seconds","When the last frame of a node came");
+	for(size_t i=0;i<nodes.size();i++)
+	{
+		snprintf(labels,sizeof(labels),"node=\"%u\"",nodes[i]->ip);
+		text.sampleReal(nodes[i]->last_us / 1e6,labels);
+	}
+	text.gauge("rf24_node_first_seen_timestamp_seconds","When the first frame of a node came");
+	for(size_t i=0;i<nodes.size();i++)
+	{
+		snprintf(labels,sizeof(labels),"node=\"%u\"",nodes[i]->ip);
+		text.sampleReal(nodes[i]->first_us / 1e6,labels);
+	}
+	text.gauge("rf24_node_hops","Mean hops of the readings of a source node");
+	for(size_t i=0;i<nodes.size();i++)
+	{
+		if(!nodes[i]->readings)
+			continue;
+		snprintf(labels,sizeof(labels),"node=\"%u\"",nodes[i]->ip);
+		text.sampleReal((double)nodes[i]->hops_sum / nodes[i]->readings,labels);
+	}
+
+	// What the nodes count themselves, in 16 or 8 bits, so these wrap
+	static const struct
+	{
+		const char* name;
+		const char* help;
+		bool gauge;
+	} reported[] = {
+		{ "rf24_node_reported_rx_frames_total", "Frames a node received, as it last reported", false },
+		{ "rf24_node_reported_tx_frames_total", "Frames a node delivered, as it last reported", false },
+		{ "rf24_node_reported_tx_failed_total", "Frames a node gave up on, as it last reported", false },
+		{ "rf24_node_reported_retries_total", "Radio retransmissions of a node, as it last reported", false },
+		{ "rf24_node_reported_max_rt_total", "Writes the radio of a node gave up on, as it last reported", false },
+		{ "rf24_node_reported_drops_total", "Receive and send queue drops of a node, as it last reported", false },
+		{ "rf24_node_reported_route_changes_total", "Route changes of a node, as it last reported", false },
+		{ "rf24_node_reported_join_attempts_total", "Joins a node sent, as it last reported", false },
+		{ "rf24_node_reported_rx_queue_high_water", "Most frames in the receive queue of a node, as it last reported", true },
+		{ "rf24_node_reported_send_queue_high_water", "Most frames in a send queue of a node, as it last reported", true },
+		{ "rf24_node_report_timestamp_seconds", "When the last stats report of a node came", true },
+	};
+	for(size_t f=0;f<sizeof(reported)/sizeof(reported[0]);f++)
+	{
+		if(reported[f].gauge)
+			text.gauge(reported[f].name,reported[f].help);
+		else
+			text.counter(reported[f].name,reported[f].help);
+		for(size_t i=0;i<nodes.size();i++)
+		{
+			const NodeState& n = *nodes[i];
+			if(!n.reports)
+				continue;
+			snprintf(labels,sizeof(labels),"node=\"%u\"",n.ip);
+			const MeshStatsReport& r = n.report;
+			const uint64_t values[] = { r.rx, r.tx, r.tx_failed, r.retries, r.max_rt, r.drops, r.route_changes,
+				r.join_attempts, r.rx_queue_high_water, r.send_queue_high_water };
+			if(f < sizeof(values)/sizeof(values[0]))
+				text.sample(values[f],labels);
+			else
+				text.sampleReal(n.report_us / 1e6,labels);
+		}
+	}
+}
+
+/****************************************************************************/
+
+const GatewayStats& Gateway::getStats(void)
+{
+	return stats;
+}
+
+RadioThread& Gateway::getRadio(void)
+{
+	return radio;
+}
+
+EventLoop& Gateway::getLoop(void)
+{
+	return loop;
+}
+
+static void printRing(const char* name, const SpscRingStats& s)
+{
+	printf("%s ring: pushed:%llu full:%llu popped:%llu batches:%llu depth:%zu high_water:%zu/%zu\n",name,
+		(unsigned long long)s.pushed,(unsigned long long)s.full,(unsigned long long)s.popped,
+		(unsigned long long)s.batches,s.depth,s.high_water,s.capacity);
+}
+
+void Gateway::printStats(void)
+{
+	const RadioStats& r = radio.getStats();
+	printf("radio: irqs:%llu ticks:%llu services:%llu readings:%llu reports:%llu commands:%llu sends_failed:%llu\n",
+		(unsigned long long)r.irqs,(unsigned long long)r.ticks,(unsigned long long)r.services,
+		(unsigned long long)r.readings,(unsigned long long)r.reports,(unsigned long long)r.commands,
+		(unsigned long long)r.sends_failed);
+	printf("application: wakeups:%llu frames:%llu dispatch_full:%llu records:%llu queries:%llu\n",
+		(unsigned long long)stats.wakeups,(unsigned long long)stats.frames,(unsigned long long)stats.dispatch_full,
+		(unsigned long long)stats.records,(unsigned long long)stats.queries);
+
+	SpscRingStats s;
+	radio.getUpStats(s);
+	printRing("up",s);
+	radio.getDownStats(s);
+	printRing("down",s);
+	if(!config.capture.empty())
+	{
+		const CaptureStats& c = capture.getStats();
+		printf("capture: records:%llu bytes:%llu failed:%llu\n",(unsigned long long)c.records,
+			(unsigned long long)c.bytes,(unsigned long long)c.failed);
+		radio.getCaptureStats(s);
+		printRing("capture",s);
+	}
+
+	for(size_t i=0;i<shards.size();i++)
+	{
+		Shard& shard = *shards[i];
+		const ShardStats& w = shard.getStats();
+		const NodeTableStats& t = shard.getNodes().getStats();
+		printf("shard %u: wakeups:%llu frames:%llu records:%llu nodes:%zu readings:%llu duplicates:%llu late:%llu restarts:%llu reports:%llu\n",
+			shard.getIndex(),(unsigned long long)w.wakeups,(unsigned long long)w.frames,(unsigned long long)w.records,
+			t.nodes,(unsigned long long)t.readings,(unsigned long long)t.duplicates,(unsigned long long)t.late,
+			(unsigned long long)t.restarts,(unsigned long long)t.reports);
+		if(shard.getStore().getStats().segments)
+		{
+			const StoreStats& st = shard.getStore().getStats();
+			printf("  store: rows:%llu blocks:%llu segments:%llu bytes:%llu failed:%llu\n",
+				(unsigned long long)st.rows,(unsigned long long)st.blocks,(unsigned long long)st.segments,
+				(unsigned long long)st.bytes,(unsigned long long)st.failed);
+		}
+		const JournalStats& j = shard.getJournal().getStats();
+		if(j.checkpoints)
+		{
+			printf("  journal: records:%llu commits:%llu failed:%llu bytes:%llu sync_us:%llu max_sync_us:%llu checkpoints:%llu recovered:%llu torn:%llu\n",
+				(unsigned long long)j.records,(unsigned long long)j.commits,(unsigned long long)j.failed,(unsigned long long)j.bytes,
+				(unsigned long long)j.sync_us,(unsigned long long)j.max_sync_us,(unsigned long long)j.checkpoints,
+				(unsigned long long)j.recovered,(unsigned long long)j.torn);
+		}
+		const RollupStats& u = shard.getRollup().getStats();
+		if(u.syncs)
+		{
+			printf("  rollup: rows:%llu buckets:%llu late:%llu syncs:%llu bytes:%llu dropped:%llu\n",
+				(unsigned long long)u.rows,(unsigned long long)u.buckets,(unsigned long long)u.late,
+				(unsigned long long)u.syncs,(unsigned long long)u.bytes,(unsigned long long)u.dropped);
+		}
+		if(threaded)
+		{
+			shard.getInStats(s);
+			printRing("  in",s);
+		}
+		shard.getOutStats(s);
+		printRing("  out",s);
+	}
+
+	const ExportStats& e = exporter.getStats();
+	printf("export: records:%llu batches:%llu bytes:%llu dropped:%llu clients:%llu refused:%llu\n",
+		(unsigned long long)e.records,(unsigned long long)e.batches,(unsigned long long)e.bytes_sent,
+		(unsigned long long)e.records_dropped,(unsigned long long)e.clients_accepted,(unsigned long long)e.clients_refused);
+}
@@ -0,0 +1,148 @@
+#ifndef __GATEWAY_H__
+#define __GATEWAY_H__
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Capture.h"
+#include "EventLoop.h"
+#include "Export.h"
+#include "GatewayConfig.h"
+#include "Metrics.h"
+#include "RadioThread.h"
+#include "Shard.h"
+
+/**
+ * @file Gateway.h
+ *
+ * Master node of the mesh on a Linux board
+ *
+ * The radio and the mesh run in their own thread, see RadioThread.h, and
+ * sleep in epoll until the radio pulls its IRQ line low or the mesh timers
+ * are due.  The application thread, this one, takes the frames off the
+ * up ring in batches and deals them out to the workers by source node, see
+ * Shard.h.  What the workers make of them comes back to it, to be streamed
+ * to the clients of the export socket, see Export.h.  With a capture file
+ * it also writes out the raw frames the radio thread read, see Capture.h.
+ * With metrics, it renders the counters the other threads published into
+ * the page of the metrics server every metrics period, see Metrics.h.
+ */
+
+#define GATEWAY_RECEIVE_BATCH 256 /**< Frames taken off the up ring at once */
+
+/**
+ * Counters of the application thread
+ */
+typedef struct
+{
+	uint64_t wakeups; /**< Notifications of the radio thread */
+	uint64_t frames; /**< Taken off the up ring */
+	uint64_t dispatch_full; /**< Frames lost to the full in ring of a worker */
+	uint64_t records; /**< Collected from the workers */
+	uint64_t queries; /**< Stats queries sent to the nodes */
+} GatewayStats;
+
+class Gateway
+{
+public:
+	Gateway(const GatewayConfig& config);
+	~Gateway();
+
+	/**
+	 * Open the radio, the socket and the descriptors of the loop
+	 */
+	bool begin(void);
+
+	/**
+	 * Serve until SIGINT or SIGTERM
+	 */
+	void run(void);
+
+	/**
+	 * Send a frame to a node, from the application thread
+	 *
+	 * @return False if the radio thread has too many commands queued
+	 */
+	bool send(const RF24NetworkHeader& header);
+
+	/**
+	 * Ask every node for its counters, see RF24Mesh::queryStats()
+	 */
+	bool queryStats(void);
+
+	const GatewayStats& getStats(void);
+	RadioThread& getRadio(void);
+	EventLoop& getLoop(void);
+
+	/**
+	 * Print the counters of both threads and the rings, after run()
+	 */
+	void printStats(void);
+
+private:
+	GatewayConfig config;
+	RadioThread radio;
+	EventLoop loop;
+	ExportServer exporter;
+	CaptureWriter capture;
+	MetricsServer metrics;
+	GatewayStats stats;
+	MeshFrame frames[GATEWAY_RECEIVE_BATCH];
+	CaptureRecord captured[GATEWAY_RECEIVE_BATCH];
+	ExportRecord records[SHARD_BATCH];
+	std::vector<std::unique_ptr<Shard> > shards;
+	bool threaded; /**< The shards run their own threads */
+
+	// Counters last published by the other threads, and the page made of them
+	MeshMetrics mesh_metrics;
+	bool have_mesh_metrics;
+	std::vector<ShardMetrics> shard_metrics;
+	std::string page;
+
+	int notify_fd;
+	int done_fd; /**< Written by the workers after queueing records */
+	int flush_fd;
+	int query_fd;
+	int signal_fd;
+	int metrics_fd;
+	EventCallback<Gateway> on_notify;
+	EventCallback<Gateway> on_done;
+	EventCallback<Gateway> on_flush;
+	EventCallback<Gateway> on_query;
+	EventCallback<Gateway> on_signal;
+	EventCallback<Gateway> on_metrics;
+
+	void notified(uint32_t events);
+	void done(uint32_t events);
+	void flush(uint32_t events);
+	void query(uint32_t events);
+	void signal(uint32_t events);
+	void refresh(uint32_t events);
+
+	/**
+	 * Take every frame the radio thread queued and hand it to its shard
+	 */
+	void receive(void);
+
+	/**
+	 * Export what the shards made of them
+	 */
+	void collect(void);
+
+	/**
+	 * Write the raw frames the radio thread queued to the capture file
+	 */
+	void record(void);
+
+	/**
+	 * Take the counters the other threads published and render the page of
+	 * the metrics server
+	 */
+	void render(void);
+	void renderMesh(MetricsText& text);
+	void renderNodes(MetricsText& text);
+};
+
+#endif //__GATEWAY_H__
@@ -0,0 +1,33 @@
+#ifdef RF24_HAL_LINUX
+#include "RF24_hal_linux.h"
+#endif
+
+#include "Export.h"
+#include "Journal.h"
+#include "GatewayConfig.h"
+
+void gatewayDefaults(GatewayConfig& config)
+{
+#ifdef RF24_HAL_LINUX
+	config.spidev = RF24_HAL_SPIDEV;
+	config.gpiochip = RF24_HAL_GPIOCHIP;
+#endif
+	config.ce_pin = GATEWAY_CE_PIN;
+	config.csn_pin = GATEWAY_CSN_PIN;
+	config.irq_pin = GATEWAY_IRQ_PIN;
+	config.channel = GATEWAY_CHANNEL;
+	config.tick_ms = GATEWAY_TICK_MS;
+	config.flush_ms = GATEWAY_FLUSH_MS;
+	config.query_s = 0;
+	config.workers = GATEWAY_WORKERS;
+	config.socket = EXPORT_SOCKET;
+	config.store.clear();
+	config.journal_records = JOURNAL_COMMIT_RECORDS;
+	config.journal_us = JOURNAL_COMMIT_US;
+	config.rollup_word = GATEWAY_ROLLUP_WORD;
+	config.capture.clear();
+	config.metrics.clear();
+	config.metrics_ms = GATEWAY_METRICS_MS;
+	config.client_limit = EXPORT_CLIENT_LIMIT;
+	config.batch_records = EXPORT_BATCH_RECORDS;
+}
@@ -0,0 +1,51 @@
+#ifndef __GATEWAY_CONFIG_H__
+#define __GATEWAY_CONFIG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/**
+ * @file GatewayConfig.h
+ *
+ * Settings of the gateway, from the command line of rf24gw
+ */
+
+#define GATEWAY_CHANNEL 88
+#define GATEWAY_CE_PIN 25 /**< GPIO line offsets, as wired on a Raspberry Pi */
+#define GATEWAY_CSN_PIN 8
+#define GATEWAY_IRQ_PIN 24
+#define GATEWAY_TICK_MS 10 /**< Period of the mesh timers, also catches IRQ edges that were missed */
+#define GATEWAY_POLL_MS 1 /**< Tick without an IRQ line */
+#define GATEWAY_FLUSH_MS 20 /**< Longest a record waits for its batch to fill */
+#define GATEWAY_WORKERS 2 /**< Threads handling the frames, see Shard.h */
+#define GATEWAY_ROLLUP_WORD 0 /**< Payload word rolled up per minute, hour and day, see Rollup.h */
+#define GATEWAY_METRICS_MS 1000 /**< Period of the counters behind the metrics, see Metrics.h */
+
+typedef struct
+{
+	std::string spidev;
+	std::string gpiochip;
+	uint8_t ce_pin;
+	uint8_t csn_pin;
+	int irq_pin; /**< -1 to poll the radio every GATEWAY_POLL_MS */
+	uint8_t channel;
+	uint32_t tick_ms;
+	uint32_t flush_ms;
+	uint32_t query_s; /**< Seconds between stats queries to all nodes, 0 for none */
+	unsigned workers; /**< 0 to handle the frames on the application thread */
+	std::string socket;
+	std::string store; /**< Directory of the reading store, empty for none */
+	uint32_t journal_records; /**< Group commit of the journal of the store, 0 for none */
+	uint32_t journal_us;
+	int rollup_word; /**< -1 for no rollups */
+	std::string capture; /**< File to record the raw frames to, empty for none */
+	std::string metrics; /**< "port" or "address:port" to serve the metrics on, empty for none */
+	uint32_t metrics_ms;
+	size_t client_limit; /**< Bytes queued per export client */
+	uint16_t batch_records;
+} GatewayConfig;
+
+void gatewayDefaults(GatewayConfig& config);
+
+#endif //__GATEWAY_CONFIG_H__
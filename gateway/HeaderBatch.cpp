@@ -0,0 +1,293 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HEADER_X86
+#include <immintrin.h>
+#endif
+
+#include "RF24NetworkHeader.h"
+#include "HeaderBatch.h"
+
+// The kernels load the two words by these offsets
+#define HEADER_HEAD 0 /**< from_node, prev_node, to_node, id */
+#define HEADER_TAIL 22 /**< Last payload bytes, source_data, type, flags */
+
+static_assert(offsetof(RF24NetworkHeader,from_node) == HEADER_HEAD && offsetof(RF24NetworkHeader,prev_node) == 2 &&
+	offsetof(RF24NetworkHeader,to_node) == 4 && offsetof(RF24NetworkHeader,id) == 6, "layout of the header");
+static_assert(offsetof(RF24NetworkHeader,source_data) == HEADER_TAIL + 2 && offsetof(RF24NetworkHeader,type) == HEADER_TAIL + 6 &&
+	offsetof(RF24NetworkHeader,flags) == HEADER_TAIL + 7 && sizeof(RF24NetworkHeader) == HEADER_TAIL + 8, "layout of the header");
+
+void headerFilterAny(HeaderFilter& filter)
+{
+	filter.type = -1;
+	filter.from = -1;
+	filter.to = -1;
+	filter.source = -1;
+}
+
+static inline uint16_t load16(const uint8_t* p)
+{
+	uint16_t v;
+	memcpy(&v,p,sizeof(v));
+	return v;
+}
+
+static void decodeScalar(const uint8_t* frames, size_t stride, size_t begin, size_t n, HeaderColumns& out)
+{
+	for(size_t i=begin;i<n;i++)
+	{
+		const uint8_t* p = frames + i * stride;
+		out.from[i] = load16(p + offsetof(RF24NetworkHeader,from_node));
+		out.prev[i] = load16(p + offsetof(RF24NetworkHeader,prev_node));
+		out.to[i] = load16(p + offsetof(RF24NetworkHeader,to_node));
+		out.id[i] = load16(p + offsetof(RF24NetworkHeader,id));
+		out.source[i] = load16(p + offsetof(RF24NetworkHeader,source_data.ip));
+		out.weight[i] = load16(p + offsetof(RF24NetworkHeader,source_data.weight));
+		out.type[i] = p[offsetof(RF24NetworkHeader,type)];
+		out.flags[i] = p[offsetof(RF24NetworkHeader,flags)];
+	}
+}
+
+static size_t selectScalar(const HeaderColumns& c, const HeaderFilter& f, size_t begin, uint16_t* sel, size_t k)
+{
+	// Unused fields match whatever value the column has, so one loop
+	// without a branch serves every filter
+	uint16_t type_mask = f.type < 0 ? 0 : 0xFF, from_mask = f.from < 0 ? 0 : 0xFFFF;
+	uint16_t to_mask = f.to < 0 ? 0 : 0xFFFF, source_mask = f.source < 0 ? 0 : 0xFFFF;
+	uint16_t type = f.type & type_mask, from = f.from & from_mask, to = f.to & to_mask, source = f.source & source_mask;
+	for(size_t i=begin;i<c.rows;i++)
+	{
+		sel[k] = i;
+		k += ((c.type[i] & type_mask) == type) & ((c.from[i] & from_mask) == from) &
+			((c.to[i] & to_mask) == to) & ((c.source[i] & source_mask) == source);
+	}
+	return k;
+}
+
+#ifdef HEADER_X86
+
+static inline uint64_t load64(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v,p,sizeof(v));
+	return v;
+}
+
+/**
+ * Index of each bit set in @p mask, rows from @p base
+ */
+static inline size_t emit(uint32_t mask, size_t base, uint16_t* sel, size_t k)
+{
+	while(mask)
+	{
+		sel[k++] = base + __builtin_ctz(mask);
+		mask &= mask - 1;
+	}
+	return k;
+}
+
+/**
+ * The four 16 bit fields of two frames in a lane, each field's pair in a
+ * 32 bit word: a0 b0, a1 b1, a2 b2, a3 b3
+ */
+#define HEADER_PAIRS 0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15
+
+/**
+ * Types in the low half, flags in the high half
+ */
+#define HEADER_SPLIT 0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15
+
+__attribute__((target("sse4.2"))) static void decodeSse42(const uint8_t* frames, size_t stride, size_t n, HeaderColumns& out)
+{
+	const __m128i pairs = _mm_setr_epi8(HEADER_PAIRS);
+	const __m128i split = _mm_setr_epi8(0, 2, 4, 6, 1, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+	size_t i = 0;
+	for(;i+4<=n;i+=4)
+	{
+		const uint8_t* p = frames + i * stride;
+		__m128i field[2];
+		for(int w=0;w<2;w++)
+		{
+			size_t offset = w ? HEADER_TAIL : HEADER_HEAD;
+			__m128i x = _mm_set_epi64x(load64(p + stride + offset),load64(p + offset));
+			__m128i y = _mm_set_epi64x(load64(p + 3 * stride + offset),load64(p + 2 * stride + offset));
+			x = _mm_shuffle_epi8(x,pairs);
+			y = _mm_shuffle_epi8(y,pairs);
+
+			// Fields 0 and 1 of the four frames, then fields 2 and 3
+			__m128i lo = _mm_unpacklo_epi32(x,y);
+			__m128i hi = _mm_unpackhi_epi32(x,y);
+			if(!w)
+			{
+				_mm_storel_epi64((__m128i*)(out.from + i),lo);
+				_mm_storeh_pd((double*)(out.prev + i),_mm_castsi128_pd(lo));
+				_mm_storel_epi64((__m128i*)(out.to + i),hi);
+				_mm_storeh_pd((double*)(out.id + i),_mm_castsi128_pd(hi));
+			}
+			else
+			{
+				field[0] = lo;
+				field[1] = hi;
+			}
+		}
+		_mm_storeh_pd((double*)(out.source + i),_mm_castsi128_pd(field[0]));
+		_mm_storel_epi64((__m128i*)(out.weight + i),field[1]);
+
+		__m128i tf = _mm_shuffle_epi8(_mm_unpackhi_epi64(field[1],field[1]),split);
+		uint32_t types = _mm_cvtsi128_si32(tf), flags = _mm_extract_epi32(tf,1);
+		memcpy(out.type + i,&types,4);
+		memcpy(out.flags + i,&flags,4);
+	}
+	decodeScalar(frames,stride,i,n,out);
+}
+
+__attribute__((target("avx2"))) static void decodeAvx2(const uint8_t* frames, size_t stride, size_t n, HeaderColumns& out)
+{
+	const __m256i pairs = _mm256_setr_epi8(HEADER_PAIRS, HEADER_PAIRS);
+	const __m256i spread = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	const __m128i split = _mm_setr_epi8(HEADER_SPLIT);
+
+	size_t i = 0;
+	for(;i+8<=n;i+=8)
+	{
+		const uint8_t* p = frames + i * stride;
+		__m256i lo[2], hi[2];
+		for(int w=0;w<2;w++)
+		{
+			size_t offset = w ? HEADER_TAIL : HEADER_HEAD;
+			__m256i a = _mm256_set_epi64x(load64(p + 3 * stride + offset),load64(p + 2 * stride + offset),
+				load64(p + stride + offset),load64(p + offset));
+			__m256i b = _mm256_set_epi64x(load64(p + 7 * stride + offset),load64(p + 6 * stride + offset),
+				load64(p + 5 * stride + offset),load64(p + 4 * stride + offset));
+
+			// Each field of frames 0-3, then 4-7, in a 64 bit word of its own
+			a = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(a,pairs),spread);
+			b = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(b,pairs),spread);
+
+			// Fields 0 and 2 of the eight frames, then fields 1 and 3
+			lo[w] = _mm256_unpacklo_epi64(a,b);
+			hi[w] = _mm256_unpackhi_epi64(a,b);
+		}
+		_mm_storeu_si128((__m128i*)(out.from + i),_mm256_castsi256_si128(lo[0]));
+		_mm_storeu_si128((__m128i*)(out.to + i),_mm256_extracti128_si256(lo[0],1));
+		_mm_storeu_si128((__m128i*)(out.prev + i),_mm256_castsi256_si128(hi[0]));
+		_mm_storeu_si128((__m128i*)(out.id + i),_mm256_extracti128_si256(hi[0],1));
+		_mm_storeu_si128((__m128i*)(out.source + i),_mm256_castsi256_si128(hi[1]));
+		_mm_storeu_si128((__m128i*)(out.weight + i),_mm256_extracti128_si256(lo[1],1));
+
+		__m128i tf = _mm_shuffle_epi8(_mm256_extracti128_si256(hi[1],1),split);
+		_mm_storel_epi64((__m128i*)(out.type + i),tf);
+		_mm_storeh_pd((double*)(out.flags + i),_mm_castsi128_pd(tf));
+	}
+	decodeScalar(frames,stride,i,n,out);
+}
+
+/**
+ * 16 rows of a 16 bit column against @p value, a bit per row
+ */
+__attribute__((target("sse4.2"))) static inline uint32_t match16Sse42(const uint16_t* column, int value)
+{
+	const __m128i v = _mm_set1_epi16((short)value);
+	__m128i e0 = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)column),v);
+	__m128i e1 = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(column + 8)),v);
+	return _mm_movemask_epi8(_mm_packs_epi16(e0,e1));
+}
+
+__attribute__((target("sse4.2"))) static size_t selectSse42(const HeaderColumns& c, const HeaderFilter& f, uint16_t* sel)
+{
+	const __m128i type = _mm_set1_epi8((char)f.type);
+
+	size_t k = 0, i = 0;
+	for(;i+16<=c.rows;i+=16)
+	{
+		uint32_t mask = 0xFFFF;
+		if(f.type >= 0)
+			mask &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(c.type + i)),type));
+		if(f.from >= 0)
+			mask &= match16Sse42(c.from + i,f.from);
+		if(f.to >= 0)
+			mask &= match16Sse42(c.to + i,f.to);
+		if(f.source >= 0)
+			mask &= match16Sse42(c.source + i,f.source);
+		k = emit(mask,i,sel,k);
+	}
+	return selectScalar(c,f,i,sel,k);
+}
+
+/**
+ * 32 rows of a 16 bit column against @p value, a bit per row
+ */
+__attribute__((target("avx2"))) static inline uint32_t match16Avx2(const uint16_t* column, int value)
+{
+	const __m256i v = _mm256_set1_epi16((short)value);
+	__m256i e0 = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)column),v);
+	__m256i e1 = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(column + 16)),v);
+
+	// The pack works lane by lane, the permute puts the rows back in order
+	return _mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(e0,e1),0xD8));
+}
+
+__attribute__((target("avx2"))) static size_t selectAvx2(const HeaderColumns& c, const HeaderFilter& f, uint16_t* sel)
+{
+	const __m256i type = _mm256_set1_epi8((char)f.type);
+
+	size_t k = 0, i = 0;
+	for(;i+32<=c.rows;i+=32)
+	{
+		uint32_t mask = 0xFFFFFFFF;
+		if(f.type >= 0)
+			mask &= _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(c.type + i)),type));
+		if(f.from >= 0)
+			mask &= match16Avx2(c.from + i,f.from);
+		if(f.to >= 0)
+			mask &= match16Avx2(c.to + i,f.to);
+		if(f.source >= 0)
+			mask &= match16Avx2(c.source + i,f.source);
+		k = emit(mask,i,sel,k);
+	}
+	return selectScalar(c,f,i,sel,k);
+}
+
+#endif //HEADER_X86
+
+/****************************************************************************/
+
+size_t headerDecode(QueryKernel kernel, const void* frames, size_t stride, size_t n, HeaderColumns& out)
+{
+	if(n > HEADER_BATCH_ROWS)
+		n = HEADER_BATCH_ROWS;
+	out.rows = n;
+
+	const uint8_t* p = (const uint8_t*)frames;
+	switch(kernel)
+	{
+#ifdef HEADER_X86
+	case KERNEL_AVX2:
+		decodeAvx2(p,stride,n,out);
+		break;
+	case KERNEL_SSE42:
+		decodeSse42(p,stride,n,out);
+		break;
+#endif
+	default:
+		decodeScalar(p,stride,0,n,out);
+		break;
+	}
+	return n;
+}
+
+size_t headerSelect(QueryKernel kernel, const HeaderColumns& columns, const HeaderFilter& filter, uint16_t* sel)
+{
+	switch(kernel)
+	{
+#ifdef HEADER_X86
+	case KERNEL_AVX2:
+		return selectAvx2(columns,filter,sel);
+	case KERNEL_SSE42:
+		return selectSse42(columns,filter,sel);
+#endif
+	default:
+		return selectScalar(columns,filter,0,sel,0);
+	}
+}
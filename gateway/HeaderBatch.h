@@ -0,0 +1,71 @@
+#ifndef __GATEWAY_HEADER_BATCH_H__
+#define __GATEWAY_HEADER_BATCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "QueryKernels.h"
+
+/**
+ * @file HeaderBatch.h
+ *
+ * The RF24NetworkHeader fields of many frames at once, a column per field,
+ * and the rows of those columns that match a filter
+ *
+ * Frames can be anywhere as long as they are equally far apart, e.g. the
+ * frames of a capture, see Capture.h, or the headers of MeshFrame on the
+ * up ring.  With SSE4.2 and AVX2 eight bytes at the start and eight at the
+ * end of each header are loaded and transposed into columns with byte
+ * shuffles, four or eight frames at a time, and filters compare 16 or 32
+ * rows at once, see QueryKernels.h for how the kernel is picked.  Only the
+ * first 30 bytes of a frame are read, the size of a header.
+ */
+
+#define HEADER_BATCH_ROWS 4096 /**< Frames a HeaderColumns holds */
+
+/**
+ * Fields of up to HEADER_BATCH_ROWS headers
+ */
+typedef struct
+{
+	size_t rows;
+	uint16_t from[HEADER_BATCH_ROWS];
+	uint16_t prev[HEADER_BATCH_ROWS];
+	uint16_t to[HEADER_BATCH_ROWS];
+	uint16_t id[HEADER_BATCH_ROWS];
+	uint16_t source[HEADER_BATCH_ROWS]; /**< source_data.ip */
+	uint16_t weight[HEADER_BATCH_ROWS]; /**< source_data.weight, the hops of readings */
+	uint8_t type[HEADER_BATCH_ROWS];
+	uint8_t flags[HEADER_BATCH_ROWS];
+} HeaderColumns;
+
+/**
+ * Values the rows must have, each -1 for any
+ */
+typedef struct
+{
+	int type;
+	int from;
+	int to;
+	int source;
+} HeaderFilter;
+
+void headerFilterAny(HeaderFilter& filter);
+
+/**
+ * Fill @p out with the headers of @p n frames, @p stride bytes apart
+ *
+ * @param frames The first header
+ * @return Rows decoded, at most HEADER_BATCH_ROWS
+ */
+size_t headerDecode(QueryKernel kernel, const void* frames, size_t stride, size_t n, HeaderColumns& out);
+
+/**
+ * Rows of @p columns that pass @p filter
+ *
+ * @param sel Gets the index of each, in order
+ * @return How many there are
+ */
+size_t headerSelect(QueryKernel kernel, const HeaderColumns& columns, const HeaderFilter& filter, uint16_t* sel);
+
+#endif //__GATEWAY_HEADER_BATCH_H__
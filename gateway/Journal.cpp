@@ -0,0 +1,329 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <utility>
+
+#include "Journal.h"
+
+uint32_t journalCrc(const void* data, size_t len)
+{
+	static uint32_t table[256];
+	static bool ready = false;
+	if(!ready)
+	{
+		for(uint32_t i=0;i<256;i++)
+		{
+			uint32_t c = i;
+			for(int k=0;k<8;k++)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		ready = true;
+	}
+
+	const uint8_t* p = (const uint8_t*)data;
+	uint32_t c = 0xFFFFFFFF;
+	while(len--)
+		c = table[(c ^ *p++) & 0xFF] ^ (c >> 8);
+	return c ^ 0xFFFFFFFF;
+}
+
+static uint64_t monotonicUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Read a whole file
+ */
+static bool readFile(const std::string& path, std::vector<uint8_t>& out)
+{
+	int fd = ::open(path.c_str(),O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if(fd < 0 || fstat(fd,&st) < 0)
+	{
+		if(fd >= 0)
+			::close(fd);
+		return false;
+	}
+
+	out.resize(st.st_size);
+	size_t done = 0;
+	while(done < out.size())
+	{
+		ssize_t n = read(fd,out.data() + done,out.size() - done);
+		if(n <= 0)
+			break;
+		done += n;
+	}
+	out.resize(done);
+	::close(fd);
+	return true;
+}
+
+/****************************************************************************/
+
+Journal::Journal(): shard(0), fd(-1), next(1), written(0), pending_us(0)
+{
+	memset(&config,0,sizeof(config));
+	memset(&stats,0,sizeof(stats));
+}
+
+Journal::~Journal()
+{
+	close();
+}
+
+bool Journal::open(const std::string& _dir, unsigned _shard, const JournalConfig& _config)
+{
+	dir = _dir;
+	shard = _shard;
+	config = _config;
+	if(config.commit_records < 1)
+		config.commit_records = 1;
+	pending.reserve(config.commit_records);
+	next = 1;
+	return true;
+}
+
+std::vector<std::string> Journal::list(void)
+{
+	std::vector<std::pair<unsigned long long, std::string> > files;
+
+	DIR* d = opendir(dir.c_str());
+	if(d)
+	{
+		struct dirent* e;
+		while((e = readdir(d)) != NULL)
+		{
+			unsigned s;
+			unsigned long long first;
+			if(sscanf(e->d_name,"wal-%u-%llu.log",&s,&first) == 2 && s == shard)
+				files.push_back(std::make_pair(first,dir + "/" + e->d_name));
+		}
+		closedir(d);
+	}
+	std::sort(files.begin(),files.end());
+
+	std::vector<std::string> names;
+	for(size_t i=0;i<files.size();i++)
+		names.push_back(files[i].second);
+	return names;
+}
+
+uint64_t Journal::recover(uint64_t after, JournalVisitor& visitor, uint64_t used)
+{
+	uint64_t last = after;
+	uint64_t count = 0;
+
+	std::vector<std::string> files = list();
+	std::vector<uint8_t> data;
+	for(size_t i=0;i<files.size();i++)
+	{
+		JournalHeader h;
+		if(!readFile(files[i],data) || data.size() < sizeof(h))
+			continue;
+		memcpy(&h,data.data(),sizeof(h));
+		if(h.magic != JOURNAL_MAGIC || h.version != JOURNAL_VERSION)
+		{
+			fprintf(stderr,"%s: not a journal\n",files[i].c_str());
+			continue;
+		}
+
+		size_t offset = sizeof(h);
+		for(;offset + sizeof(JournalRecord) <= data.size();offset += sizeof(JournalRecord))
+		{
+			JournalRecord r;
+			memcpy(&r,data.data() + offset,sizeof(r));
+			if(r.crc != journalCrc(&r,offsetof(JournalRecord,crc)))
+				break;
+
+			if(r.sequence > last)
+			{
+				visitor.replay(r.record,r.sequence);
+				last = r.sequence;
+				count++;
+			}
+		}
+		if(offset != data.size())
+		{
+			fprintf(stderr,"%s: torn after %zu bytes\n",files[i].c_str(),offset);
+			stats.torn++;
+		}
+	}
+
+	next = std::max(last,used) + 1;
+	stats.recovered += count;
+	return count;
+}
+
+bool Journal::checkpoint(void)
+{
+	commit();
+	if(fd >= 0)
+		::close(fd);
+
+	char name[64];
+	snprintf(name,sizeof(name),"/wal-%u-%016llu.log",shard,(unsigned long long)next);
+	std::string path = dir + name;
+
+	fd = ::open(path.c_str(),O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,0644);
+	if(fd < 0)
+	{
+		perror(path.c_str());
+		return false;
+	}
+
+	JournalHeader h;
+	memset(&h,0,sizeof(h));
+	h.magic = JOURNAL_MAGIC;
+	h.version = JOURNAL_VERSION;
+	h.shard = shard;
+	h.first_sequence = next;
+	if(write(fd,&h,sizeof(h)) != sizeof(h) || fdatasync(fd) < 0)
+	{
+		perror(path.c_str());
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	written = sizeof(h);
+
+	// The new file has to be there before the old ones go
+	int dfd = ::open(dir.c_str(),O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(dfd >= 0)
+	{
+		fsync(dfd);
+		::close(dfd);
+	}
+
+	std::vector<std::string> files = list();
+	for(size_t i=0;i<files.size();i++)
+	{
+		if(files[i] != path)
+			unlink(files[i].c_str());
+	}
+
+	stats.checkpoints++;
+	return true;
+}
+
+void Journal::close(void)
+{
+	if(fd < 0)
+		return;
+	commit();
+	::close(fd);
+	fd = -1;
+}
+
+bool Journal::isOpen(void)
+{
+	return fd >= 0;
+}
+
+/****************************************************************************/
+
+uint64_t Journal::append(const ExportRecord& record)
+{
+	if(pending.empty())
+		pending_us = monotonicUs();
+
+	JournalRecord r;
+	r.sequence = next++;
+	r.record = record;
+	r.crc = journalCrc(&r,offsetof(JournalRecord,crc));
+	pending.push_back(r);
+	stats.records++;
+
+	if(pending.size() >= config.commit_records)
+		commit();
+	return r.sequence;
+}
+
+bool Journal::commit(void)
+{
+	if(pending.empty())
+		return true;
+	if(fd < 0)
+		return false;
+
+	// A failed commit is cut off again, so that the records stay pending and
+	// the next commit writes them whole, right after the last good one
+	size_t committed = written;
+	const uint8_t* p = (const uint8_t*)pending.data();
+	size_t len = pending.size() * sizeof(JournalRecord);
+	while(len)
+	{
+		ssize_t n = write(fd,p,len);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+		{
+			perror("journal");
+			rollback(committed);
+			return false;
+		}
+		p += n;
+		len -= n;
+		written += n;
+		stats.bytes += n;
+	}
+
+	uint64_t start = monotonicUs();
+	if(fdatasync(fd) < 0)
+	{
+		perror("journal");
+		rollback(committed);
+		return false;
+	}
+	uint64_t took = monotonicUs() - start;
+	stats.sync_us += took;
+	stats.max_sync_us = std::max(stats.max_sync_us,took);
+
+	stats.commits++;
+	pending.clear();
+	return true;
+}
+
+void Journal::rollback(size_t committed)
+{
+	stats.failed++;
+	if(ftruncate(fd,committed) < 0)
+	{
+		// Anything appended after the torn record could never be recovered,
+		// so the journal is given up as if it had not opened
+		perror("journal");
+		::close(fd);
+		fd = -1;
+		return;
+	}
+	written = committed;
+}
+
+int64_t Journal::untilCommit(void)
+{
+	if(pending.empty())
+		return -1;
+
+	uint64_t waited = monotonicUs() - pending_us;
+	return waited >= config.commit_us ? 0 : config.commit_us - waited;
+}
+
+bool Journal::isCheckpointDue(void)
+{
+	return written >= JOURNAL_FILE_BYTES;
+}
+
+const JournalStats& Journal::getStats(void)
+{
+	return stats;
+}
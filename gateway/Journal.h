@@ -0,0 +1,172 @@
+#ifndef __GATEWAY_JOURNAL_H__
+#define __GATEWAY_JOURNAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "ExportProtocol.h"
+
+/**
+ * @file Journal.h
+ *
+ * Write-ahead log of the readings a worker of the gateway takes in
+ *
+ * Every reading a worker accepts gets the next sequence number of its
+ * journal and is appended to it before it goes to the store.  Appends are
+ * collected and committed together, with one write() and one fdatasync(),
+ * once JournalConfig::commit_records are waiting or the oldest of them
+ * waited JournalConfig::commit_us; only then are they safe from a crash.
+ *
+ * The store keeps the sequence of the last row of each block, see
+ * StoreBlockSummary.  After a crash, recover() hands back every committed
+ * reading with a higher sequence than the store has, up to the first
+ * record that is torn or fails its checksum.  Once the store has synced
+ * past them, checkpoint() starts a new journal file and deletes the older
+ * ones, so the journal holds about JOURNAL_FILE_BYTES at most.
+ *
+ * Files are @c wal-<shard>-<first sequence>.log in the directory of the
+ * store: a JournalHeader, then JournalRecord after JournalRecord, all
+ * little endian.
+ */
+
+#define JOURNAL_MAGIC 0x4C415752 /**< "RWAL" */
+#define JOURNAL_VERSION 1
+#define JOURNAL_COMMIT_RECORDS 256
+#define JOURNAL_COMMIT_US 10000
+#define JOURNAL_FILE_BYTES (16 * 1024 * 1024) /**< Written before a checkpoint is due */
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t shard;
+	uint64_t first_sequence; /**< Of the first record in the file */
+} __attribute__((packed)) JournalHeader;
+
+typedef struct
+{
+	uint64_t sequence;
+	ExportRecord record;
+	uint32_t crc; /**< CRC-32 of the bytes before it */
+} __attribute__((packed)) JournalRecord;
+
+typedef struct
+{
+	uint32_t commit_records; /**< Appends that make a commit due */
+	uint32_t commit_us; /**< Longest an append waits for its commit */
+} JournalConfig;
+
+/**
+ * Counters of a journal
+ */
+typedef struct
+{
+	uint64_t records; /**< Appended */
+	uint64_t commits;
+	uint64_t failed; /**< Commits cut back to the last good one, retried with the next */
+	uint64_t bytes; /**< Written */
+	uint64_t sync_us; /**< Spent in fdatasync(), all told */
+	uint64_t max_sync_us;
+	uint64_t checkpoints;
+	uint64_t recovered; /**< Records handed back by recover() */
+	uint64_t torn; /**< Files whose tail was cut short or failed its checksum */
+} JournalStats;
+
+/**
+ * CRC-32 as of zlib and Ethernet, a byte at a time off a table
+ */
+uint32_t journalCrc(const void* data, size_t len);
+
+/**
+ * Readings handed back by Journal::recover()
+ */
+class JournalVisitor
+{
+public:
+	virtual ~JournalVisitor() {}
+	virtual void replay(const ExportRecord& r, uint64_t sequence) = 0;
+};
+
+class Journal
+{
+public:
+	Journal();
+	~Journal();
+
+	/**
+	 * Look for the journal of @p shard in @p dir, nothing is written yet
+	 */
+	bool open(const std::string& dir, unsigned shard, const JournalConfig& config);
+
+	/**
+	 * Hand back each committed record with a sequence above @p after, in
+	 * order, and carry on numbering after the last of them
+	 *
+	 * @param used Highest sequence known to be taken elsewhere, numbering
+	 * also carries on after it
+	 * @return Records handed back
+	 */
+	uint64_t recover(uint64_t after, JournalVisitor& visitor, uint64_t used = 0);
+
+	/**
+	 * Start a new file and delete the older ones, once everything appended
+	 * so far is safe elsewhere
+	 */
+	bool checkpoint(void);
+
+	/**
+	 * Commit what is waiting and close the file
+	 */
+	void close(void);
+
+	bool isOpen(void);
+
+	/**
+	 * @return The sequence of the record, committed if that makes a commit due
+	 */
+	uint64_t append(const ExportRecord& r);
+
+	/**
+	 * Write and sync what is waiting
+	 */
+	bool commit(void);
+
+	/**
+	 * Microseconds until the oldest append waited JournalConfig::commit_us,
+	 * 0 if a commit is due, -1 if nothing waits
+	 */
+	int64_t untilCommit(void);
+
+	/**
+	 * The current file is full, see checkpoint()
+	 */
+	bool isCheckpointDue(void);
+
+	const JournalStats& getStats(void);
+
+private:
+	std::string dir;
+	unsigned shard;
+	JournalConfig config;
+	int fd;
+	uint64_t next; /**< Sequence of the next append */
+	size_t written; /**< Bytes in the current file */
+
+	/**
+	 * Cut the file back to @p committed bytes after a failed commit, or
+	 * close it if that fails too
+	 */
+	void rollback(size_t committed);
+	std::vector<JournalRecord> pending;
+	uint64_t pending_us; /**< When the oldest pending record was appended, monotonic */
+	JournalStats stats;
+
+	/**
+	 * Files of this shard, oldest first
+	 */
+	std::vector<std::string> list(void);
+};
+
+#endif //__GATEWAY_JOURNAL_H__
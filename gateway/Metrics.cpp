@@ -0,0 +1,352 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <algorithm>
+
+#include "Metrics.h"
+
+static uint64_t monotonicUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+MetricsTimer::MetricsTimer()
+{
+	period_us = 0;
+	due_us = 0;
+}
+
+void MetricsTimer::begin(uint32_t period_ms)
+{
+	period_us = (uint64_t)period_ms * 1000;
+	due_us = monotonicUs();
+}
+
+int64_t MetricsTimer::until(void)
+{
+	if(!period_us)
+		return -1;
+
+	uint64_t now = monotonicUs();
+	if(now < due_us)
+		return due_us - now;
+
+	// A late snapshot does not make the next ones come sooner
+	due_us += period_us;
+	if(due_us <= now)
+		due_us = now + period_us;
+	return 0;
+}
+
+/****************************************************************************/
+
+MetricsText::MetricsText(std::string& _page): page(_page)
+{
+	name = "";
+}
+
+void MetricsText::counter(const char* _name, const char* help)
+{
+	family(_name,"counter",help);
+}
+
+void MetricsText::gauge(const char* _name, const char* help)
+{
+	family(_name,"gauge",help);
+}
+
+void MetricsText::sample(uint64_t value, const char* labels)
+{
+	char text[24];
+	snprintf(text,sizeof(text),"%llu",(unsigned long long)value);
+	line(labels,text);
+}
+
+void MetricsText::sampleReal(double value, const char* labels)
+{
+	char text[32];
+	snprintf(text,sizeof(text),"%.15g",value);
+	line(labels,text);
+}
+
+void MetricsText::family(const char* _name, const char* type, const char* help)
+{
+	name = _name;
+	page.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	page.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void MetricsText::line(const char* labels, const char* value)
+{
+	page.append(name);
+	if(labels && *labels)
+		page.append("{").append(labels).append("}");
+	page.append(" ").append(value).append("\n");
+}
+
+/****************************************************************************/
+
+MetricsClient::MetricsClient(MetricsServer& _server, int _fd): server(_server), fd(_fd)
+{
+	accepted_us = monotonicUs();
+	offset = 0;
+}
+
+MetricsClient::~MetricsClient()
+{
+	if(fd >= 0)
+		::close(fd);
+}
+
+void MetricsClient::onEvent(uint32_t events)
+{
+	if(events & (EPOLLERR | EPOLLHUP))
+	{
+		close();
+		return;
+	}
+
+	if(!answer)
+	{
+		char buffer[512];
+		ssize_t n;
+		while((n = recv(fd,buffer,sizeof(buffer),MSG_DONTWAIT)) > 0 && request.size() <= METRICS_REQUEST_BYTES)
+			request.append(buffer,n);
+		bool gone = n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+
+		if(request.find("\r\n\r\n") != std::string::npos || request.find("\n\n") != std::string::npos)
+			handle();
+		else if(request.size() > METRICS_REQUEST_BYTES)
+		{
+			server.stats.bad_requests++;
+			respond("400 Bad Request","request too long\n");
+		}
+		else if(gone)
+		{
+			close();
+			return;
+		}
+
+		if(!answer)
+			return;
+	}
+
+	if(!write())
+		close();
+}
+
+void MetricsClient::handle(void)
+{
+	char method[8], path[256];
+	if(sscanf(request.c_str(),"%7s %255s",method,path) != 2)
+	{
+		server.stats.bad_requests++;
+		respond("400 Bad Request","bad request\n");
+		return;
+	}
+
+	bool head = !strcmp(method,"HEAD");
+	if(!head && strcmp(method,"GET"))
+	{
+		server.stats.bad_requests++;
+		respond("405 Method Not Allowed","only GET\n");
+		return;
+	}
+
+	char* query = strchr(path,'?');
+	if(query)
+		*query = 0;
+	if(strcmp(path,METRICS_PATH))
+	{
+		server.stats.bad_requests++;
+		respond("404 Not Found","see " METRICS_PATH "\n");
+		return;
+	}
+
+	if(!server.answer)
+	{
+		respond("503 Service Unavailable","no counters yet\n");
+		return;
+	}
+
+	answer = server.answer;
+	if(head)
+	{
+		// Only the header of the page
+		std::string* header = new std::string(*answer,0,answer->find("\r\n\r\n") + 4);
+		answer.reset(header);
+	}
+	server.stats.scrapes++;
+}
+
+void MetricsClient::respond(const char* status, const char* body)
+{
+	char header[160];
+	snprintf(header,sizeof(header),"HTTP/1.0 %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		status,strlen(body));
+	answer.reset(new std::string(std::string(header) + body));
+}
+
+bool MetricsClient::write(void)
+{
+	while(offset < answer->size())
+	{
+		ssize_t sent = send(fd,answer->data() + offset,answer->size() - offset,MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(sent < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+
+			// The rest once the socket has room, nothing more is read
+			server.loop.modify(fd,EPOLLOUT,this);
+			return true;
+		}
+		offset += sent;
+		server.stats.bytes_sent += sent;
+	}
+	return false;
+}
+
+void MetricsClient::close(void)
+{
+	server.loop.remove(fd);
+	server.closed(this);
+	server.loop.retire(this);
+}
+
+/****************************************************************************/
+
+MetricsServer::MetricsServer(EventLoop& _loop): loop(_loop)
+{
+	fd = -1;
+	memset(&stats,0,sizeof(stats));
+}
+
+MetricsServer::~MetricsServer()
+{
+	for(size_t i=0;i<clients.size();i++)
+	{
+		loop.remove(clients[i]->fd);
+		delete clients[i];
+	}
+	if(fd >= 0)
+		::close(fd);
+}
+
+bool MetricsServer::begin(const std::string& where)
+{
+	std::string address = METRICS_ADDRESS;
+	std::string port = where;
+	size_t colon = where.rfind(':');
+	if(colon != std::string::npos)
+	{
+		address = where.substr(0,colon);
+		port = where.substr(colon + 1);
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(port.c_str()));
+	if(!addr.sin_port || inet_pton(AF_INET,address.c_str(),&addr.sin_addr) != 1)
+	{
+		fprintf(stderr,"%s: not an address and port\n",where.c_str());
+		return false;
+	}
+
+	fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+	if(fd < 0)
+	{
+		perror("socket");
+		return false;
+	}
+
+	int one = 1;
+	setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+	if(bind(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0 || listen(fd,METRICS_MAX_CLIENTS) < 0)
+	{
+		perror(where.c_str());
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	return loop.add(fd,EPOLLIN,this);
+}
+
+bool MetricsServer::isOpen(void)
+{
+	return fd >= 0;
+}
+
+void MetricsServer::publish(const std::string& page)
+{
+	char header[160];
+	snprintf(header,sizeof(header),"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\nConnection: close\r\n\r\n",page.size());
+
+	std::string* a = new std::string();
+	a->reserve(strlen(header) + page.size());
+	a->append(header).append(page);
+	answer.reset(a);
+	stats.pages++;
+
+	// close() takes a client out of the list
+	uint64_t now = monotonicUs();
+	std::vector<MetricsClient*> targets(clients);
+	for(size_t i=0;i<targets.size();i++)
+	{
+		if(now - targets[i]->accepted_us > METRICS_CLIENT_TIMEOUT_MS * 1000ULL)
+		{
+			stats.timeouts++;
+			targets[i]->close();
+		}
+	}
+}
+
+void MetricsServer::onEvent(uint32_t events)
+{
+	for(;;)
+	{
+		int client_fd = accept4(fd,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(client_fd < 0)
+			break;
+
+		if(clients.size() >= METRICS_MAX_CLIENTS)
+		{
+			::close(client_fd);
+			stats.clients_refused++;
+			continue;
+		}
+
+		MetricsClient* client = new MetricsClient(*this,client_fd);
+		if(!loop.add(client_fd,EPOLLIN | EPOLLRDHUP,client))
+		{
+			delete client;
+			continue;
+		}
+		clients.push_back(client);
+		stats.clients_accepted++;
+	}
+}
+
+const MetricsStats& MetricsServer::getStats(void)
+{
+	return stats;
+}
+
+void MetricsServer::closed(MetricsClient* client)
+{
+	clients.erase(std::remove(clients.begin(),clients.end(),client),clients.end());
+}
@@ -0,0 +1,168 @@
+#ifndef __GATEWAY_METRICS_H__
+#define __GATEWAY_METRICS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EventLoop.h"
+
+/**
+ * @file Metrics.h
+ *
+ * Counters of the gateway and the mesh over HTTP, in the text format
+ * Prometheus scrapes
+ *
+ * Nobody waits for a scrape.  The radio thread and the workers publish a
+ * copy of their counters every so often, see Snapshot.h and MetricsTimer,
+ * the application thread renders all of them into one page on its own
+ * timer, see Gateway.h, and the server only writes out the last page
+ * rendered.  A page being written to a slow client stays around until it
+ * is written, even if a newer one was rendered meanwhile.
+ *
+ * The server only speaks enough HTTP/1.0 for a scraper or curl: one GET or
+ * HEAD per connection, which is closed once the answer is written.
+ */
+
+#define METRICS_ADDRESS "127.0.0.1" /**< Listened on unless an address is given */
+#define METRICS_MAX_CLIENTS 8
+#define METRICS_REQUEST_BYTES 2048 /**< Longest request taken */
+#define METRICS_CLIENT_TIMEOUT_MS 10000 /**< Clients still connected after this are closed */
+#define METRICS_PATH "/metrics"
+
+/**
+ * When the next snapshot of counters is due, on the monotonic clock
+ */
+class MetricsTimer
+{
+public:
+	MetricsTimer();
+
+	/**
+	 * @param period_ms 0 for never
+	 */
+	void begin(uint32_t period_ms);
+
+	/**
+	 * Microseconds until the next snapshot, -1 for never
+	 *
+	 * 0 means it is due; the one after is then a period away.
+	 */
+	int64_t until(void);
+
+private:
+	uint64_t period_us;
+	uint64_t due_us;
+};
+
+/**
+ * Appends metrics to a page
+ *
+ * A family is started with counter() or gauge() and its samples follow,
+ * each with its labels already formatted, e.g. @c node="5", or none.
+ */
+class MetricsText
+{
+public:
+	MetricsText(std::string& page);
+
+	void counter(const char* name, const char* help);
+	void gauge(const char* name, const char* help);
+
+	void sample(uint64_t value, const char* labels = NULL);
+	void sampleReal(double value, const char* labels = NULL);
+
+private:
+	std::string& page;
+	const char* name; /**< Of the family started last */
+
+	void family(const char* name, const char* type, const char* help);
+	void line(const char* labels, const char* value);
+};
+
+/**
+ * Counters of the server
+ */
+typedef struct
+{
+	uint64_t pages; /**< Rendered, see publish() */
+	uint64_t scrapes; /**< Pages sent */
+	uint64_t bytes_sent;
+	uint64_t bad_requests; /**< Not found, not a GET or too long */
+	uint64_t timeouts;
+	uint64_t clients_accepted;
+	uint64_t clients_refused; /**< Over METRICS_MAX_CLIENTS */
+} MetricsStats;
+
+class MetricsServer;
+
+class MetricsClient: public EventHandler
+{
+public:
+	MetricsClient(MetricsServer& server, int fd);
+	~MetricsClient();
+
+	void onEvent(uint32_t events);
+
+private:
+	friend class MetricsServer;
+
+	MetricsServer& server;
+	int fd;
+	uint64_t accepted_us;
+	std::string request;
+	std::shared_ptr<const std::string> answer;
+	size_t offset; /**< Bytes of answer written */
+
+	/**
+	 * Look at the request once it is all in, and queue the answer
+	 */
+	void handle(void);
+	void respond(const char* status, const char* body);
+
+	/**
+	 * Write as much as the socket takes
+	 *
+	 * @return False once there is nothing more to write, or the client is
+	 * gone
+	 */
+	bool write(void);
+	void close(void);
+};
+
+class MetricsServer: public EventHandler
+{
+public:
+	MetricsServer(EventLoop& loop);
+	~MetricsServer();
+
+	/**
+	 * Listen on @p where, "port" or "address:port"
+	 */
+	bool begin(const std::string& where);
+	bool isOpen(void);
+
+	/**
+	 * Serve @p page from now on, and close clients which had their time
+	 */
+	void publish(const std::string& page);
+
+	void onEvent(uint32_t events);
+
+	const MetricsStats& getStats(void);
+
+private:
+	friend class MetricsClient;
+
+	EventLoop& loop;
+	int fd;
+	std::shared_ptr<const std::string> answer; /**< The page with its HTTP header */
+	std::vector<MetricsClient*> clients;
+	MetricsStats stats;
+
+	void closed(MetricsClient* client);
+};
+
+#endif //__GATEWAY_METRICS_H__
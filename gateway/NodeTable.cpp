@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "NodeTable.h"
+
+NodeTable::NodeTable()
+{
+	memset(&stats,0,sizeof(stats));
+}
+
+NodeState& NodeTable::get(uint16_t ip, uint64_t time_us)
+{
+	std::unordered_map<uint16_t, NodeState>::iterator i = nodes.find(ip);
+	if(i != nodes.end())
+		return i->second;
+
+	NodeState& n = nodes[ip];
+	memset(&n,0,sizeof(n));
+	n.ip = ip;
+	n.first_us = time_us;
+	n.hops_min = 0xFFFF;
+	return n;
+}
+
+bool NodeTable::reading(const RF24NetworkHeader& header, uint64_t time_us)
+{
+	NodeState& n = get(header.source_data.ip,time_us);
+	int16_t ahead = (int16_t)(header.id - n.newest_id);
+
+	if(!n.readings || time_us - n.last_us > NODE_DEDUP_EXPIRE_US)
+	{
+		if(n.readings)
+		{
+			n.restarts++;
+			stats.restarts++;
+		}
+		n.newest_id = header.id;
+		n.window = 1;
+	}
+	else if(ahead > 0)
+	{
+		n.window = ahead < NODE_DEDUP_WINDOW ? (n.window << ahead) | 1 : 1;
+		n.newest_id = header.id;
+		n.skipped += ahead - 1;
+	}
+	else if(-ahead < NODE_DEDUP_WINDOW)
+	{
+		uint64_t bit = 1ULL << -ahead;
+		if(n.window & bit)
+		{
+			n.duplicates++;
+			stats.duplicates++;
+			n.last_us = time_us;
+			return false;
+		}
+		n.window |= bit;
+		n.late++;
+		stats.late++;
+	}
+	else
+	{
+		n.restarts++;
+		stats.restarts++;
+		n.newest_id = header.id;
+		n.window = 1;
+	}
+
+	n.readings++;
+	stats.readings++;
+	n.last_us = time_us;
+
+	uint16_t hops = header.source_data.weight;
+	n.hops_sum += hops;
+	if(hops < n.hops_min)
+		n.hops_min = hops;
+	if(hops > n.hops_max)
+		n.hops_max = hops;
+	return true;
+}
+
+void NodeTable::report(const RF24NetworkHeader& header, uint64_t time_us)
+{
+	NodeState& n = get(header.source_data.ip,time_us);
+	memcpy(&n.report,header.payload,sizeof(n.report));
+	n.report_us = time_us;
+	n.last_us = time_us;
+	n.reports++;
+	stats.reports++;
+}
+
+const NodeState* NodeTable::find(uint16_t ip) const
+{
+	std::unordered_map<uint16_t, NodeState>::const_iterator i = nodes.find(ip);
+	return i == nodes.end() ? NULL : &i->second;
+}
+
+size_t NodeTable::size(void) const
+{
+	return nodes.size();
+}
+
+const NodeTableStats& NodeTable::getStats(void)
+{
+	stats.nodes = nodes.size();
+	return stats;
+}
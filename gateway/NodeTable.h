@@ -0,0 +1,108 @@
+#ifndef __GATEWAY_NODE_TABLE_H__
+#define __GATEWAY_NODE_TABLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+#include "RF24Mesh.h"
+
+/**
+ * @file NodeTable.h
+ *
+ * What the gateway keeps per source node
+ *
+ * Each worker has its own table for the nodes hashed to it, so nothing in
+ * here is shared or locked.
+ *
+ * Sources number their readings on their own, see
+ * RF24Mesh::send_SensorData(), so a gap in the ids is a reading lost on the
+ * way.  Repeats are recognised by the id as well: a reading whose
+ * id is among the NODE_DEDUP_WINDOW ids up to the newest one seen, and was
+ * seen already, is a repeat, e.g. a frame forwarded twice after a lost ack.
+ * One seen before but not yet is counted as late.  An id further behind
+ * than the window, or any id after NODE_DEDUP_EXPIRE_US without readings,
+ * means the node started over and the window is reset.
+ */
+
+#define NODE_DEDUP_WINDOW 64 /**< Ids behind the newest one still recognised, at most 64 */
+#define NODE_DEDUP_EXPIRE_US (5 * 60 * 1000000ULL)
+
+/**
+ * State of one source node
+ */
+typedef struct
+{
+	uint16_t ip;
+	uint16_t newest_id; /**< Of the readings */
+	uint64_t window; /**< Bit i is set if newest_id - i was seen */
+	uint64_t first_us; /**< Unix time of the first frame */
+	uint64_t last_us; /**< And of the last one */
+	uint64_t readings; /**< Without repeats */
+	uint64_t duplicates;
+	uint64_t late; /**< Readings that came after a newer one */
+	uint64_t skipped; /**< Reading ids jumped over by a newer reading, late ones among them */
+	uint64_t restarts; /**< Window resets, see NodeTable.h */
+	uint64_t hops_sum;
+	uint16_t hops_min;
+	uint16_t hops_max;
+	uint64_t reports;
+	uint64_t report_us; /**< When the last stats report came */
+	MeshStatsReport report;
+} NodeState;
+
+/**
+ * Totals of a table
+ */
+typedef struct
+{
+	size_t nodes;
+	uint64_t readings;
+	uint64_t duplicates;
+	uint64_t late;
+	uint64_t restarts;
+	uint64_t reports;
+} NodeTableStats;
+
+class NodeTable
+{
+public:
+	NodeTable();
+
+	/**
+	 * Account for a reading, a 'D' or 'F' frame, of @c source_data.ip
+	 *
+	 * @return False if it is a repeat
+	 */
+	bool reading(const RF24NetworkHeader& header, uint64_t time_us);
+
+	/**
+	 * Keep the MeshStatsReport of an 'S' frame
+	 */
+	void report(const RF24NetworkHeader& header, uint64_t time_us);
+
+	/**
+	 * @return NULL for a node never seen
+	 */
+	const NodeState* find(uint16_t ip) const;
+
+	size_t size(void) const;
+	const NodeTableStats& getStats(void);
+
+	/**
+	 * Call @p f with each NodeState, in no particular order
+	 */
+	template<class F> void each(F f) const
+	{
+		for(std::unordered_map<uint16_t, NodeState>::const_iterator i=nodes.begin();i!=nodes.end();++i)
+			f(i->second);
+	}
+
+private:
+	std::unordered_map<uint16_t, NodeState> nodes;
+	NodeTableStats stats;
+
+	NodeState& get(uint16_t ip, uint64_t time_us);
+};
+
+#endif //__GATEWAY_NODE_TABLE_H__
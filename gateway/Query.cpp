@@ -0,0 +1,199 @@
+#include <algorithm>
+
+#include "Query.h"
+
+#define QUERY_SHORT_RUN 16
+
+Query::Query(const QuerySpec& _spec, QueryKernel _kernel): spec(_spec), kernel(_kernel), selected(0),
+	last_key(UINT64_MAX), last_group(0)
+{
+	if(spec.word >= STORE_PAYLOAD_WORDS)
+		spec.word = 0;
+}
+
+uint32_t Query::getColumns(void)
+{
+	return (1 << STORE_TIME) | (1 << STORE_SOURCE) | (1 << (STORE_PAYLOAD + spec.word));
+}
+
+void Query::rows(const StoreBlock& block)
+{
+	add(block.time_us,block.source,(const int32_t*)block.payload[spec.word],block.rows);
+}
+
+QueryGroup& Query::group(uint16_t source, uint64_t bucket)
+{
+	uint64_t key = ((uint64_t)source << 48) | bucket;
+	if(key == last_key)
+		return groups[last_group];
+
+	std::unordered_map<uint64_t, size_t>::iterator i = index.find(key);
+	if(i == index.end())
+	{
+		QueryGroup g;
+		g.source = source;
+		g.start_us = spec.from_us + bucket * spec.bucket_us;
+		g.count = 0;
+		g.sum = 0;
+		g.min = INT32_MAX;
+		g.max = INT32_MIN;
+		i = index.insert(std::make_pair(key,groups.size())).first;
+		groups.push_back(g);
+	}
+
+	last_key = key;
+	last_group = i->second;
+	return groups[last_group];
+}
+
+void Query::add(const uint64_t* time_us, const uint16_t* sources, const int32_t* values, size_t n)
+{
+	for(size_t base=0;base<n;base+=STORE_BLOCK_ROWS)
+	{
+		size_t m = std::min(n - base,(size_t)STORE_BLOCK_ROWS);
+		const uint64_t* t = time_us + base;
+		const uint16_t* s = sources + base;
+		const int32_t* v = values + base;
+
+		size_t k = querySelect(kernel,t,s,m,spec.from_us,spec.to_us,spec.source,sel);
+		selected += k;
+		if(spec.source < 0)
+		{
+			partition(t,s,v,k);
+			continue;
+		}
+
+		// Gather the values of each run of one node and bucket, then fold
+		// the run into its group at once
+		size_t i = 0;
+		while(i < k)
+		{
+			size_t r = sel[i];
+			uint16_t source = s[r];
+			uint64_t bucket = spec.bucket_us ? (t[r] - spec.from_us) / spec.bucket_us : 0;
+			uint64_t low = spec.from_us + bucket * spec.bucket_us;
+			uint64_t high = spec.bucket_us ? low + spec.bucket_us : UINT64_MAX;
+
+			size_t len = 0;
+			for(;i<k;i++)
+			{
+				r = sel[i];
+				if(s[r] != source || t[r] < low || t[r] >= high)
+					break;
+				run[len++] = v[r];
+			}
+
+			fold(group(source,bucket),run,len);
+		}
+	}
+}
+
+void Query::fold(QueryGroup& g, const int32_t* values, size_t len)
+{
+	// Short runs are not worth a vector
+	int32_t min, max;
+	int64_t sum;
+	queryRange(len < QUERY_SHORT_RUN ? KERNEL_SCALAR : kernel,values,len,&min,&max,&sum);
+
+	g.count += len;
+	g.sum += sum;
+	g.min = std::min(g.min,min);
+	g.max = std::max(g.max,max);
+	if(spec.quantiles)
+	{
+		for(size_t j=0;j<len;j++)
+			g.sketch.add(values[j]);
+	}
+}
+
+void Query::partition(const uint64_t* t, const uint16_t* s, const int32_t* v, size_t k)
+{
+	if(source_group.empty())
+	{
+		source_group.assign(UINT16_MAX + 1,UINT32_MAX);
+		source_low.assign(UINT16_MAX + 1,0);
+	}
+
+	// The group of each row, looked up only when its node moved to another
+	// bucket, and how many rows each group has
+	uint64_t bucket = 0, low = 1, high = 0;
+	touched.clear();
+	for(size_t i=0;i<k;i++)
+	{
+		size_t r = sel[i];
+		if(t[r] < low || t[r] >= high)
+		{
+			bucket = spec.bucket_us ? (t[r] - spec.from_us) / spec.bucket_us : 0;
+			low = spec.from_us + bucket * spec.bucket_us;
+			high = spec.bucket_us ? low + spec.bucket_us : UINT64_MAX;
+		}
+
+		uint16_t source = s[r];
+		uint32_t g = source_group[source];
+		if(g == UINT32_MAX || source_low[source] != low)
+		{
+			group(source,bucket);
+			g = source_group[source] = last_group;
+			source_low[source] = low;
+			if(group_rows.size() < groups.size())
+				group_rows.resize(groups.size(),0);
+		}
+
+		if(!group_rows[g]++)
+			touched.push_back(g);
+		row_group[i] = g;
+	}
+
+	// Counting sort of the values by group, then a run per group
+	uint32_t at = 0;
+	for(size_t j=0;j<touched.size();j++)
+	{
+		uint32_t rows = group_rows[touched[j]];
+		group_rows[touched[j]] = at;
+		at += rows;
+	}
+	for(size_t i=0;i<k;i++)
+		run[group_rows[row_group[i]]++] = v[sel[i]];
+
+	uint32_t start = 0;
+	for(size_t j=0;j<touched.size();j++)
+	{
+		uint32_t end = group_rows[touched[j]];
+		fold(groups[touched[j]],run + start,end - start);
+		group_rows[touched[j]] = 0;
+		start = end;
+	}
+}
+
+void Query::addGroup(uint16_t source, uint64_t time_us, uint64_t count, int64_t sum, int32_t min, int32_t max,
+	const QuantileSketch& sketch)
+{
+	if(!count || time_us < spec.from_us || time_us >= spec.to_us || (spec.source >= 0 && source != spec.source))
+		return;
+
+	QueryGroup& g = group(source,spec.bucket_us ? (time_us - spec.from_us) / spec.bucket_us : 0);
+	g.count += count;
+	g.sum += sum;
+	g.min = std::min(g.min,min);
+	g.max = std::max(g.max,max);
+	if(spec.quantiles)
+		g.sketch.merge(sketch);
+	selected += count;
+}
+
+static bool groupBefore(const QueryGroup& a, const QueryGroup& b)
+{
+	return a.source != b.source ? a.source < b.source : a.start_us < b.start_us;
+}
+
+std::vector<QueryGroup> Query::getGroups(void)
+{
+	std::vector<QueryGroup> sorted(groups);
+	std::sort(sorted.begin(),sorted.end(),groupBefore);
+	return sorted;
+}
+
+uint64_t Query::getRows(void)
+{
+	return selected;
+}
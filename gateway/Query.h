@@ -0,0 +1,122 @@
+#ifndef __GATEWAY_QUERY_H__
+#define __GATEWAY_QUERY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "QueryKernels.h"
+#include "Sketch.h"
+#include "Store.h"
+
+/**
+ * @file Query.h
+ *
+ * Aggregates of one payload word per node and time bucket over the columns
+ * of the store
+ *
+ * Rows are taken a column at a time, as StoreReader::scanBlocks() decodes
+ * them.  A kernel, see QueryKernels.h, picks the rows of the time range and
+ * node, their values are gathered into runs of the same node and bucket,
+ * and each run is folded into its group with another kernel, so the cost
+ * per group is paid per run, not per row.  Queries for one node, whose rows
+ * come in time order, have runs as long as a bucket.  The rows of all nodes
+ * interleave, so for those a block's rows are first sorted by group, by
+ * counting, and each group gets one run per block.
+ *
+ * Quantiles come from a QuantileSketch per group, at a cost per row, so
+ * they are only kept if asked for.
+ */
+
+typedef struct
+{
+	uint64_t from_us;
+	uint64_t to_us; /**< Not included */
+	int source; /**< -1 for all nodes */
+	uint64_t bucket_us; /**< Width of the buckets of time, 0 for one over the whole range */
+	unsigned word; /**< Payload word to aggregate, as a signed 32 bit value */
+	bool quantiles;
+} QuerySpec;
+
+typedef struct
+{
+	uint16_t source;
+	uint64_t start_us; /**< Of the bucket */
+	uint64_t count;
+	int64_t sum;
+	int32_t min;
+	int32_t max;
+	QuantileSketch sketch; /**< If QuerySpec::quantiles */
+} QueryGroup;
+
+class Query: public StoreVisitor
+{
+public:
+	Query(const QuerySpec& spec, QueryKernel kernel = queryBestKernel());
+
+	/**
+	 * Columns the query reads, for StoreReader::scanBlocks()
+	 */
+	uint32_t getColumns(void);
+
+	/**
+	 * Whole blocks, as StoreReader::scanBlocks() hands them out
+	 */
+	void rows(const StoreBlock& block);
+
+	/**
+	 * Rows as columns, from anywhere
+	 */
+	void add(const uint64_t* time_us, const uint16_t* sources, const int32_t* values, size_t n);
+
+	/**
+	 * Rows aggregated elsewhere, e.g. a bucket of Rollup.h, all counted in
+	 * the bucket of @p time_us
+	 */
+	void addGroup(uint16_t source, uint64_t time_us, uint64_t count, int64_t sum, int32_t min, int32_t max,
+		const QuantileSketch& sketch);
+
+	/**
+	 * Groups by node, then by time
+	 */
+	std::vector<QueryGroup> getGroups(void);
+
+	uint64_t getRows(void); /**< Selected so far */
+
+private:
+	QuerySpec spec;
+	QueryKernel kernel;
+	uint64_t selected;
+	std::vector<QueryGroup> groups;
+	std::unordered_map<uint64_t, size_t> index; /**< Of groups, by node and bucket */
+	uint64_t last_key; /**< Of the group found last */
+	size_t last_group;
+
+	uint16_t sel[STORE_BLOCK_ROWS];
+	int32_t run[STORE_BLOCK_ROWS];
+
+	// Sorting the rows of a block by group, see partition()
+	std::vector<uint32_t> source_group; /**< Group each node was in last, by address */
+	std::vector<uint64_t> source_low; /**< Start of the bucket of that group */
+	std::vector<uint32_t> group_rows; /**< Rows of each group in the block, then where they go in run */
+	std::vector<uint32_t> touched; /**< Groups with rows in the block, in the order met */
+	uint32_t row_group[STORE_BLOCK_ROWS];
+
+	/**
+	 * The group of a node and bucket, made if new
+	 */
+	QueryGroup& group(uint16_t source, uint64_t bucket);
+
+	/**
+	 * Fold @p len values of @p run into @p g
+	 */
+	void fold(QueryGroup& g, const int32_t* values, size_t len);
+
+	/**
+	 * Fold the @p k selected rows of a block in, sorted by group first
+	 */
+	void partition(const uint64_t* time_us, const uint16_t* sources, const int32_t* values, size_t k);
+};
+
+#endif //__GATEWAY_QUERY_H__
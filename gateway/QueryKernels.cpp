@@ -0,0 +1,274 @@
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define QUERY_X86
+#include <immintrin.h>
+#endif
+
+#include "QueryKernels.h"
+
+static size_t selectScalar(const uint64_t* time_us, const uint16_t* sources, size_t n,
+	uint64_t from_us, uint64_t to_us, int source, uint16_t* sel)
+{
+	if(to_us <= from_us)
+		return 0;
+
+	// One compare for both ends of the range, and no branch on the outcome
+	uint64_t span = to_us - from_us;
+	size_t k = 0;
+	for(size_t i=0;i<n;i++)
+	{
+		sel[k] = i;
+		k += (time_us[i] - from_us < span) & (source < 0 || sources[i] == source);
+	}
+	return k;
+}
+
+static void rangeScalar(const int32_t* values, size_t n, int32_t* min, int32_t* max, int64_t* sum)
+{
+	int32_t lo = INT_MAX, hi = INT_MIN;
+	int64_t s = 0;
+	for(size_t i=0;i<n;i++)
+	{
+		lo = values[i] < lo ? values[i] : lo;
+		hi = values[i] > hi ? values[i] : hi;
+		s += values[i];
+	}
+	*min = lo;
+	*max = hi;
+	*sum = s;
+}
+
+#ifdef QUERY_X86
+
+/**
+ * Index of each bit set in @p mask, 8 rows from @p base
+ */
+static inline size_t emit(unsigned mask, size_t base, uint16_t* sel, size_t k)
+{
+	while(mask)
+	{
+		sel[k++] = base + __builtin_ctz(mask);
+		mask &= mask - 1;
+	}
+	return k;
+}
+
+/**
+ * 8 source addresses at once, a bit per row
+ */
+__attribute__((target("sse4.2"))) static inline unsigned matchSources(const uint16_t* sources, __m128i source)
+{
+	__m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)sources),source);
+	return _mm_movemask_epi8(_mm_packs_epi16(eq,_mm_setzero_si128())) & 0xFF;
+}
+
+__attribute__((target("sse4.2"))) static size_t selectSse42(const uint64_t* time_us, const uint16_t* sources, size_t n,
+	uint64_t from_us, uint64_t to_us, int source, uint16_t* sel)
+{
+	if(to_us <= from_us)
+		return 0;
+
+	// Signed compares only, so both sides get their top bit flipped
+	const __m128i bias = _mm_set1_epi64x((long long)0x8000000000000000ULL);
+	const __m128i from = _mm_xor_si128(_mm_set1_epi64x((long long)from_us),bias);
+	const __m128i to = _mm_xor_si128(_mm_set1_epi64x((long long)to_us),bias);
+	const __m128i match = _mm_set1_epi16((short)source);
+
+	size_t k = 0, i = 0;
+	for(;i+8<=n;i+=8)
+	{
+		unsigned mask = 0;
+		for(int j=0;j<4;j++)
+		{
+			__m128i t = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(time_us + i + j * 2)),bias);
+			__m128i in = _mm_andnot_si128(_mm_cmpgt_epi64(from,t),_mm_cmpgt_epi64(to,t));
+			mask |= _mm_movemask_pd(_mm_castsi128_pd(in)) << (j * 2);
+		}
+		if(source >= 0)
+			mask &= matchSources(sources + i,match);
+		k = emit(mask,i,sel,k);
+	}
+	for(size_t m=selectScalar(time_us + i,sources + i,n - i,from_us,to_us,source,sel + k);m;m--,k++)
+		sel[k] += i;
+	return k;
+}
+
+__attribute__((target("avx2"))) static size_t selectAvx2(const uint64_t* time_us, const uint16_t* sources, size_t n,
+	uint64_t from_us, uint64_t to_us, int source, uint16_t* sel)
+{
+	if(to_us <= from_us)
+		return 0;
+
+	const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+	const __m256i from = _mm256_xor_si256(_mm256_set1_epi64x((long long)from_us),bias);
+	const __m256i to = _mm256_xor_si256(_mm256_set1_epi64x((long long)to_us),bias);
+	const __m128i match = _mm_set1_epi16((short)source);
+
+	size_t k = 0, i = 0;
+	for(;i+8<=n;i+=8)
+	{
+		__m256i t0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(time_us + i)),bias);
+		__m256i t1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(time_us + i + 4)),bias);
+		__m256i in0 = _mm256_andnot_si256(_mm256_cmpgt_epi64(from,t0),_mm256_cmpgt_epi64(to,t0));
+		__m256i in1 = _mm256_andnot_si256(_mm256_cmpgt_epi64(from,t1),_mm256_cmpgt_epi64(to,t1));
+		unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(in0)) | (_mm256_movemask_pd(_mm256_castsi256_pd(in1)) << 4);
+		if(source >= 0)
+			mask &= matchSources(sources + i,match);
+		k = emit(mask,i,sel,k);
+	}
+	for(size_t m=selectScalar(time_us + i,sources + i,n - i,from_us,to_us,source,sel + k);m;m--,k++)
+		sel[k] += i;
+	return k;
+}
+
+__attribute__((target("sse4.2"))) static void rangeSse42(const int32_t* values, size_t n, int32_t* min, int32_t* max, int64_t* sum)
+{
+	__m128i lo = _mm_set1_epi32(INT_MAX), hi = _mm_set1_epi32(INT_MIN);
+	__m128i s = _mm_setzero_si128();
+
+	size_t i = 0;
+	for(;i+4<=n;i+=4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+		lo = _mm_min_epi32(lo,v);
+		hi = _mm_max_epi32(hi,v);
+		s = _mm_add_epi64(s,_mm_cvtepi32_epi64(v));
+		s = _mm_add_epi64(s,_mm_cvtepi32_epi64(_mm_srli_si128(v,8)));
+	}
+
+	int32_t l[4], h[4];
+	int64_t t[2];
+	_mm_storeu_si128((__m128i*)l,lo);
+	_mm_storeu_si128((__m128i*)h,hi);
+	_mm_storeu_si128((__m128i*)t,s);
+	int32_t rl = INT_MAX, rh = INT_MIN;
+	int64_t rs = t[0] + t[1];
+	for(int j=0;j<4;j++)
+	{
+		rl = l[j] < rl ? l[j] : rl;
+		rh = h[j] > rh ? h[j] : rh;
+	}
+	if(i < n)
+	{
+		int32_t tl, th;
+		int64_t ts;
+		rangeScalar(values + i,n - i,&tl,&th,&ts);
+		rl = tl < rl ? tl : rl;
+		rh = th > rh ? th : rh;
+		rs += ts;
+	}
+	*min = rl;
+	*max = rh;
+	*sum = rs;
+}
+
+__attribute__((target("avx2"))) static void rangeAvx2(const int32_t* values, size_t n, int32_t* min, int32_t* max, int64_t* sum)
+{
+	__m256i lo = _mm256_set1_epi32(INT_MAX), hi = _mm256_set1_epi32(INT_MIN);
+	__m256i s = _mm256_setzero_si256();
+
+	size_t i = 0;
+	for(;i+8<=n;i+=8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+		lo = _mm256_min_epi32(lo,v);
+		hi = _mm256_max_epi32(hi,v);
+		s = _mm256_add_epi64(s,_mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+		s = _mm256_add_epi64(s,_mm256_cvtepi32_epi64(_mm256_extracti128_si256(v,1)));
+	}
+
+	int32_t l[8], h[8];
+	int64_t t[4];
+	_mm256_storeu_si256((__m256i*)l,lo);
+	_mm256_storeu_si256((__m256i*)h,hi);
+	_mm256_storeu_si256((__m256i*)t,s);
+	int32_t rl = INT_MAX, rh = INT_MIN;
+	int64_t rs = t[0] + t[1] + t[2] + t[3];
+	for(int j=0;j<8;j++)
+	{
+		rl = l[j] < rl ? l[j] : rl;
+		rh = h[j] > rh ? h[j] : rh;
+	}
+	if(i < n)
+	{
+		int32_t tl, th;
+		int64_t ts;
+		rangeScalar(values + i,n - i,&tl,&th,&ts);
+		rl = tl < rl ? tl : rl;
+		rh = th > rh ? th : rh;
+		rs += ts;
+	}
+	*min = rl;
+	*max = rh;
+	*sum = rs;
+}
+
+#endif //QUERY_X86
+
+/****************************************************************************/
+
+bool queryHasKernel(QueryKernel kernel)
+{
+	switch(kernel)
+	{
+	case KERNEL_SCALAR:
+		return true;
+#ifdef QUERY_X86
+	case KERNEL_SSE42:
+		return __builtin_cpu_supports("sse4.2");
+	case KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+QueryKernel queryBestKernel(void)
+{
+	if(queryHasKernel(KERNEL_AVX2))
+		return KERNEL_AVX2;
+	if(queryHasKernel(KERNEL_SSE42))
+		return KERNEL_SSE42;
+	return KERNEL_SCALAR;
+}
+
+const char* queryKernelName(QueryKernel kernel)
+{
+	static const char* names[KERNEL_COUNT] = { "scalar", "sse4.2", "avx2" };
+	return kernel < KERNEL_COUNT ? names[kernel] : "?";
+}
+
+size_t querySelect(QueryKernel kernel, const uint64_t* time_us, const uint16_t* sources, size_t n,
+	uint64_t from_us, uint64_t to_us, int source, uint16_t* sel)
+{
+	switch(kernel)
+	{
+#ifdef QUERY_X86
+	case KERNEL_AVX2:
+		return selectAvx2(time_us,sources,n,from_us,to_us,source,sel);
+	case KERNEL_SSE42:
+		return selectSse42(time_us,sources,n,from_us,to_us,source,sel);
+#endif
+	default:
+		return selectScalar(time_us,sources,n,from_us,to_us,source,sel);
+	}
+}
+
+void queryRange(QueryKernel kernel, const int32_t* values, size_t n, int32_t* min, int32_t* max, int64_t* sum)
+{
+	switch(kernel)
+	{
+#ifdef QUERY_X86
+	case KERNEL_AVX2:
+		rangeAvx2(values,n,min,max,sum);
+		return;
+	case KERNEL_SSE42:
+		rangeSse42(values,n,min,max,sum);
+		return;
+#endif
+	default:
+		rangeScalar(values,n,min,max,sum);
+	}
+}
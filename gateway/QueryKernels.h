@@ -0,0 +1,50 @@
+#ifndef __GATEWAY_QUERY_KERNELS_H__
+#define __GATEWAY_QUERY_KERNELS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file QueryKernels.h
+ *
+ * The inner loops of Query.h over columns of rows, once in plain C++ and
+ * once each with SSE4.2 and AVX2 on x86
+ *
+ * The vector versions are compiled for their instruction set function by
+ * function, so the gateway still runs on any x86, and picked at run time
+ * by what the CPU has.  Elsewhere, e.g. on the ARM of a Raspberry Pi, only
+ * the plain one is built, and it is left to the compiler to vectorize.
+ */
+
+typedef enum
+{
+	KERNEL_SCALAR = 0,
+	KERNEL_SSE42,
+	KERNEL_AVX2,
+	KERNEL_COUNT
+} QueryKernel;
+
+/**
+ * The fastest the CPU runs
+ */
+QueryKernel queryBestKernel(void);
+
+bool queryHasKernel(QueryKernel kernel);
+const char* queryKernelName(QueryKernel kernel);
+
+/**
+ * Rows with @p from_us <= time_us < @p to_us, and of @p source unless it is
+ * -1, out of at most 65536
+ *
+ * @param sel Gets the index of each such row, in order
+ * @return How many there are
+ */
+size_t querySelect(QueryKernel kernel, const uint64_t* time_us, const uint16_t* sources, size_t n,
+	uint64_t from_us, uint64_t to_us, int source, uint16_t* sel);
+
+/**
+ * Minimum, maximum and sum of @p n values, @p n > 0
+ */
+void queryRange(QueryKernel kernel, const int32_t* values, size_t n, int32_t* min, int32_t* max, int64_t* sum);
+
+#endif //__GATEWAY_QUERY_KERNELS_H__
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#ifdef RF24_HAL_LINUX
+#include <linux/gpio.h>
+#include "RF24_hal_linux.h"
+#endif
+
+#include "RadioThread.h"
+
+RadioThread::RadioThread(const GatewayConfig& _config): config(_config), radio(_config.ce_pin, _config.csn_pin), mesh(radio, *this),
+	on_irq(*this, &RadioThread::irq), on_tick(*this, &RadioThread::tick), on_command(*this, &RadioThread::commands),
+	on_stop(*this, &RadioThread::stopped)
+{
+	memset(&stats,0,sizeof(stats));
+	queued = false;
+	memset(&totals,0,sizeof(totals));
+	memset(&last_mesh,0,sizeof(last_mesh));
+	memset(&last_radio,0,sizeof(last_radio));
+	memset(&last_forward,0,sizeof(last_forward));
+	memset(last_queues,0,sizeof(last_queues));
+	memset(last_sources,0,sizeof(last_sources));
+	memset(last_state_ms,0,sizeof(last_state_ms));
+	last_route_changes = 0;
+	irq_fd = -1;
+	tick_fd = -1;
+	command_fd = -1;
+	notify_fd = -1;
+	stop_fd = -1;
+}
+
+RadioThread::~RadioThread()
+{
+	stop();
+
+	int fds[] = { irq_fd, tick_fd, command_fd, notify_fd, stop_fd };
+	for(size_t i=0;i<sizeof(fds)/sizeof(fds[0]);i++)
+	{
+		if(fds[i] >= 0)
+			close(fds[i]);
+	}
+}
+
+bool RadioThread::begin(void)
+{
+#ifdef RF24_HAL_LINUX
+	if(!HalLinux::open(config.spidev.c_str(),config.gpiochip.c_str()))
+		return false;
+#endif
+
+	if(!loop.begin())
+		return false;
+
+	command_fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+	notify_fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+	stop_fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+	if(command_fd < 0 || notify_fd < 0 || stop_fd < 0)
+	{
+		perror("eventfd");
+		return false;
+	}
+	if(!loop.add(command_fd,EPOLLIN,&on_command) || !loop.add(stop_fd,EPOLLIN,&on_stop))
+		return false;
+
+	// The master of the mesh
+	mesh.setFrameCallback(!config.capture.empty());
+	mesh.begin(config.channel,0);
+
+	uint32_t tick_ms = config.tick_ms;
+#ifdef RF24_HAL_LINUX
+	if(config.irq_pin >= 0)
+		irq_fd = HalLinux::openIrq(config.irq_pin);
+	if(irq_fd >= 0 && !loop.add(irq_fd,EPOLLIN,&on_irq))
+		return false;
+#endif
+	if(irq_fd < 0)
+	{
+		printf("No IRQ line, polling the radio every %u ms\n",GATEWAY_POLL_MS);
+		tick_ms = GATEWAY_POLL_MS;
+	}
+
+	tick_fd = loop.addTimer((uint64_t)tick_ms * 1000,&on_tick);
+	metrics_timer.begin(config.metrics.empty() ? 0 : config.metrics_ms);
+	return tick_fd >= 0;
+}
+
+bool RadioThread::start(void)
+{
+	// Whatever arrived while we were setting up
+	service();
+
+	thread = std::thread(&EventLoop::run,&loop);
+	return true;
+}
+
+void RadioThread::stop(void)
+{
+	if(!thread.joinable())
+		return;
+
+	uint64_t one = 1;
+	if(write(stop_fd,&one,sizeof(one)) != sizeof(one))
+		perror("eventfd");
+	thread.join();
+}
+
+/****************************************************************************/
+
+bool RadioThread::command(const MeshCommand& c)
+{
+	if(!down.push(c))
+		return false;
+
+	uint64_t one = 1;
+	return write(command_fd,&one,sizeof(one)) == sizeof(one);
+}
+
+int RadioThread::getNotifyFd(void)
+{
+	return notify_fd;
+}
+
+size_t RadioThread::receive(MeshFrame* out, size_t max)
+{
+	return up.pop(out,max);
+}
+
+size_t RadioThread::receiveCaptured(CaptureRecord* out, size_t max)
+{
+	return captured.pop(out,max);
+}
+
+bool RadioThread::receiveMetrics(MeshMetrics& out)
+{
+	if(!metrics.update())
+		return false;
+	out = metrics.read();
+	return true;
+}
+
+/****************************************************************************/
+
+void RadioThread::irq(uint32_t events)
+{
+#ifdef RF24_HAL_LINUX
+	struct gpioevent_data edges[RADIO_IRQ_EDGES];
+	ssize_t n = read(irq_fd,edges,sizeof(edges));
+	if(n > 0)
+	{
+		stats.irqs += n / sizeof(edges[0]);
+
+		// The kernel stamped the edge on one of these clocks, depending on
+		// its version; the age it gives is taken back from micros(), which
+		// is what the mesh stamps frames with.  The first edge belongs to
+		// the oldest frame in the FIFO, which is the one read first.
+		uint32_t now_us = micros();
+		clockid_t clocks[] = { CLOCK_MONOTONIC, CLOCK_REALTIME };
+		for(size_t i=0;i<sizeof(clocks)/sizeof(clocks[0]);i++)
+		{
+			struct timespec now;
+			clock_gettime(clocks[i],&now);
+			int64_t age_us = ((int64_t)now.tv_sec * 1000000000 + now.tv_nsec - (int64_t)edges[0].timestamp) / 1000;
+			if(age_us >= 0 && age_us < IRQ_STAMP_MAX_AGE)
+			{
+				mesh.radioInterrupt(now_us - (uint32_t)age_us);
+				break;
+			}
+		}
+	}
+#endif
+	service();
+}
+
+void RadioThread::tick(uint32_t events)
+{
+	drainCounter(tick_fd);
+	stats.ticks++;
+	service();
+
+	if(!metrics_timer.until())
+		publish();
+}
+
+void RadioThread::commands(uint32_t events)
+{
+	drainCounter(command_fd);
+
+	MeshCommand c;
+	while(down.pop(c))
+	{
+		stats.commands++;
+		switch(c.type)
+		{
+		case COMMAND_SEND:
+			if(!mesh.write(c.header))
+				stats.sends_failed++;
+			break;
+		case COMMAND_QUERY_STATS:
+			mesh.queryStats();
+			break;
+		}
+	}
+
+	service();
+}
+
+void RadioThread::stopped(uint32_t events)
+{
+	drainCounter(stop_fd);
+	loop.stop();
+}
+
+/**
+ * Let the mesh read, handle and send whatever is pending
+ */
+void RadioThread::service(void)
+{
+	stats.services++;
+	mesh.loop();
+
+	if(queued)
+	{
+		queued = false;
+		uint64_t one = 1;
+		if(write(notify_fd,&one,sizeof(one)) != sizeof(one))
+			perror("eventfd");
+	}
+}
+
+/****************************************************************************/
+
+void RadioThread::incomingData(RF24NetworkHeader packet)
+{
+	stats.readings++;
+	queue(packet);
+}
+
+void RadioThread::incomingStats(RF24NetworkHeader packet)
+{
+	stats.reports++;
+	queue(packet);
+}
+
+void RadioThread::incomingFrame(const uint8_t* frame, uint8_t pipe, uint32_t rx_time)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+
+	CaptureRecord r;
+	r.time_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	r.pipe = pipe;
+	r.len = CAPTURE_FRAME_BYTES;
+	memset(r.reserved,0,sizeof(r.reserved));
+	memcpy(r.frame,frame,CAPTURE_FRAME_BYTES);
+
+	// Like the up ring, a full ring loses the frame, counted as its full
+	captured.push(r);
+}
+
+void RadioThread::queue(const RF24NetworkHeader& packet)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+
+	MeshFrame f;
+	f.time_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	f.network_ms = mesh.networkMillis();
+	f.header = packet;
+
+	// A full ring counts the frame as lost, the radio does not wait
+	if(up.push(f))
+		queued = true;
+}
+
+/**
+ * Add what a counter grew by since it was @p last, wrapping or not
+ */
+template<class T> static void widen(uint64_t& total, T& last, T now)
+{
+	total += (T)(now - last);
+	last = now;
+}
+
+void RadioThread::publish(void)
+{
+	MeshMetrics& m = totals;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+	m.time_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	m.network_ms = mesh.networkMillis();
+	m.radio = stats;
+
+	const MeshStats& s = mesh.getStats();
+	for(int t=0;t<MESH_STAT_TYPES;t++)
+	{
+		widen(m.rx[t],last_mesh.rx[t],s.rx[t]);
+		widen(m.tx[t],last_mesh.tx[t],s.tx[t]);
+	}
+	widen(m.tx_failed,last_mesh.tx_failed,s.tx_failed);
+	widen(m.rx_drops,last_mesh.rx_drops,s.rx_drops);
+	widen(m.join_attempts,last_mesh.join_attempts,s.join_attempts);
+	m.rx_queue_high_water = s.rx_queue_high_water;
+	for(int i=INIT;i<=JOINED;i++)
+		widen(m.state_ms[i],last_state_ms[i],(uint32_t)mesh.getTimeInState((STATES)i));
+
+	const rf24_stats_t& r = radio.getStats();
+	widen(m.spi_transactions,last_radio.spi_transactions,r.spi_transactions);
+	widen(m.writes,last_radio.writes,r.writes);
+	widen(m.write_ok,last_radio.write_ok,r.write_ok);
+	widen(m.max_rt,last_radio.max_rt,r.max_rt);
+	widen(m.timeouts,last_radio.timeouts,r.timeouts);
+	widen(m.retries,last_radio.retries,r.retries);
+	widen(m.reads,last_radio.reads,r.reads);
+
+	const RF24Mesh::ForwardStats& f = mesh.getForwardStats();
+	widen(m.forwarded,last_forward.count,f.count);
+	widen(m.forward_ms,last_forward.total,f.total);
+	m.forward_max_ms = f.max;
+
+	for(int c=0;c<SQ_CLASSES;c++)
+	{
+		const SendQueueStats& q = mesh.getSendQueueStats((SendQueueClass)c);
+		SendQueueMetrics& qm = m.queues[c];
+		widen(qm.enqueued,last_queues[c].enqueued,q.enqueued);
+		widen(qm.sent,last_queues[c].sent,q.sent);
+		widen(qm.tail_drops,last_queues[c].tail_drops,q.tail_drops);
+		widen(qm.early_drops,last_queues[c].early_drops,q.early_drops);
+		qm.depth = q.depth;
+		qm.high_water = q.high_water;
+	}
+
+	// An entry taken over by another source starts from zero
+	m.source_count = mesh.getSourceCount();
+	for(uint8_t i=0;i<m.source_count;i++)
+	{
+		const SourceStats& src = mesh.getSourceStats(i);
+		SourceMetrics& sm = m.sources[i];
+		if(sm.ip != src.ip || last_sources[i].ip != src.ip)
+		{
+			memset(&sm,0,sizeof(sm));
+			memset(&last_sources[i],0,sizeof(last_sources[i]));
+			sm.ip = last_sources[i].ip = src.ip;
+		}
+		widen(sm.enqueued,last_sources[i].enqueued,src.enqueued);
+		widen(sm.sent,last_sources[i].sent,src.sent);
+		widen(sm.drops,last_sources[i].drops,src.drops);
+	}
+
+	RoutingTable& table = mesh.getRoutingTable();
+	widen(m.route_changes,last_route_changes,table.getRouteChanges());
+	RoutingData* near = table.getTable();
+	m.neighbour_count = table.getTableSize();
+	for(uint8_t i=0;i<m.neighbour_count;i++)
+	{
+		NeighbourMetrics& n = m.neighbours[i];
+		n.ip = near[i].ip_mac.ip;
+		n.weight = near[i].ip_mac.weight;
+		n.status = near[i].status;
+		n.congestion = table.getCongestion(n.ip);
+		n.sleepy = table.isSleepy(n.ip);
+	}
+
+	metrics.write() = m;
+	metrics.publish();
+}
+
+const RadioStats& RadioThread::getStats(void)
+{
+	return stats;
+}
+
+void RadioThread::getUpStats(SpscRingStats& s)
+{
+	up.getStats(s);
+}
+
+void RadioThread::getDownStats(SpscRingStats& s)
+{
+	down.getStats(s);
+}
+
+void RadioThread::getCaptureStats(SpscRingStats& s)
+{
+	captured.getStats(s);
+}
@@ -0,0 +1,270 @@
+#ifndef __GATEWAY_RADIO_THREAD_H__
+#define __GATEWAY_RADIO_THREAD_H__
+
+#include <stdint.h>
+#include <thread>
+
+#include "RF24.h"
+#include "RF24Mesh.h"
+#include "Capture.h"
+#include "EventLoop.h"
+#include "GatewayConfig.h"
+#include "Metrics.h"
+#include "Snapshot.h"
+#include "SpscRing.h"
+
+/**
+ * @file RadioThread.h
+ *
+ * The thread that owns the radio and the mesh
+ *
+ * It only moves frames: what the mesh hands to the application goes into
+ * the up ring, commands of the application come out of the down ring.
+ * Whatever the application does with the frames, it cannot hold up the
+ * radio; if it falls a whole ring behind, new frames are dropped and
+ * counted as the ring's @c full.
+ *
+ * Its epoll loop wakes on the IRQ line, the tick of the mesh timers and an
+ * eventfd the application writes after queueing commands.  After running
+ * the mesh it writes the notify eventfd if it queued frames, once for the
+ * whole lot.
+ *
+ * With a capture file, every frame read off the radio also goes into the
+ * capture ring as it is, for the application to write out, see Capture.h.
+ *
+ * With metrics, the tick also publishes the counters of the thread, the
+ * mesh, the driver and the routing table every metrics period, see
+ * MeshMetrics and Metrics.h.
+ */
+
+#define RADIO_UP_RING 4096 /**< Frames towards the application */
+#define RADIO_DOWN_RING 64 /**< Commands towards the mesh */
+#define RADIO_CAPTURE_RING 4096 /**< Raw frames towards the capture file */
+#define RADIO_IRQ_EDGES 16 /**< Edges read off the IRQ line at once */
+
+/**
+ * A frame the mesh handed to the application
+ */
+typedef struct
+{
+	uint64_t time_us; /**< Unix time it was handed over */
+	uint32_t network_ms; /**< RF24Mesh::networkMillis() at that time */
+	RF24NetworkHeader header;
+} MeshFrame;
+
+typedef enum { COMMAND_SEND = 0, COMMAND_QUERY_STATS } MeshCommandType;
+
+/**
+ * Something for the mesh to do
+ */
+typedef struct
+{
+	uint8_t type; /**< MeshCommandType */
+	RF24NetworkHeader header; /**< Of COMMAND_SEND, with to_node filled in */
+} MeshCommand;
+
+/**
+ * Counters of the radio thread
+ */
+typedef struct
+{
+	uint64_t irqs; /**< Edges seen on the IRQ line */
+	uint64_t ticks;
+	uint64_t services; /**< Runs of RF24Mesh::loop() */
+	uint64_t readings; /**< 'D' frames handed to the application */
+	uint64_t reports; /**< 'S' frames */
+	uint64_t commands;
+	uint64_t sends_failed; /**< COMMAND_SEND the mesh did not take */
+} RadioStats;
+
+/**
+ * Counters of a traffic class of the send queue, see SendQueueStats
+ */
+typedef struct
+{
+	uint64_t enqueued;
+	uint64_t sent;
+	uint64_t tail_drops;
+	uint64_t early_drops;
+	uint8_t depth;
+	uint8_t high_water;
+} SendQueueMetrics;
+
+/**
+ * Counters of an originating node in the send queue, see SourceStats
+ */
+typedef struct
+{
+	uint16_t ip;
+	uint64_t enqueued;
+	uint64_t sent;
+	uint64_t drops;
+} SourceMetrics;
+
+/**
+ * A neighbour in the routing table
+ */
+typedef struct
+{
+	uint16_t ip;
+	uint16_t weight; /**< Hops to the master */
+	uint8_t status; /**< RoutingStates */
+	uint8_t congestion; /**< 0 .. 3, as it last reported */
+	bool sleepy;
+} NeighbourMetrics;
+
+/**
+ * What the radio thread publishes for the metrics
+ *
+ * The mesh and the driver count in 16 or 32 bits.  Here those counters
+ * are 64 bits wide, adding up what they grew by between two snapshots, so
+ * they do not wrap as long as they grow by less than that in a metrics
+ * period.
+ */
+typedef struct
+{
+	uint64_t time_us; /**< Unix time it was taken */
+	uint32_t network_ms; /**< RF24Mesh::networkMillis() */
+	RadioStats radio;
+
+	// RF24Mesh::getStats()
+	uint64_t rx[MESH_STAT_TYPES];
+	uint64_t tx[MESH_STAT_TYPES];
+	uint64_t tx_failed;
+	uint64_t rx_drops;
+	uint64_t join_attempts;
+	uint8_t rx_queue_high_water;
+	uint64_t state_ms[JOINED + 1]; /**< RF24Mesh::getTimeInState() */
+
+	// RF24::getStats()
+	uint64_t spi_transactions;
+	uint64_t writes;
+	uint64_t write_ok;
+	uint64_t max_rt;
+	uint64_t timeouts;
+	uint64_t retries;
+	uint64_t reads;
+
+	// RF24Mesh::getForwardStats()
+	uint64_t forwarded;
+	uint64_t forward_ms;
+	uint32_t forward_max_ms;
+
+	SendQueueMetrics queues[SQ_CLASSES];
+	uint8_t source_count;
+	SourceMetrics sources[SEND_QUEUE_SOURCES];
+
+	// RoutingTable
+	uint64_t route_changes;
+	uint8_t neighbour_count;
+	NeighbourMetrics neighbours[MAX_NEAR_NODE];
+} MeshMetrics;
+
+class RadioThread: public StatusCallback
+{
+public:
+	RadioThread(const GatewayConfig& config);
+	~RadioThread();
+
+	/**
+	 * Open the radio and the descriptors, from the thread calling start()
+	 */
+	bool begin(void);
+	bool start(void);
+
+	/**
+	 * Stop the thread and wait for it
+	 */
+	void stop(void);
+
+	/**
+	 * Application side: queue a command and wake the radio thread
+	 *
+	 * @return False if the down ring is full
+	 */
+	bool command(const MeshCommand& c);
+
+	/**
+	 * Application side: readable once frames were queued, read the count off
+	 * it with drainCounter() before taking them
+	 */
+	int getNotifyFd(void);
+
+	/**
+	 * Application side: take up to @p max frames
+	 */
+	size_t receive(MeshFrame* out, size_t max);
+
+	/**
+	 * Application side: take up to @p max raw frames, with a capture file
+	 */
+	size_t receiveCaptured(CaptureRecord* out, size_t max);
+
+	void incomingData(RF24NetworkHeader packet);
+	void incomingStats(RF24NetworkHeader packet);
+	void incomingFrame(const uint8_t* frame, uint8_t pipe, uint32_t rx_time);
+
+	/**
+	 * Application side: copy out the counters published last
+	 *
+	 * @return False if none were published since the last call
+	 */
+	bool receiveMetrics(MeshMetrics& out);
+
+	/**
+	 * Only while the thread is stopped
+	 */
+	const RadioStats& getStats(void);
+
+	void getUpStats(SpscRingStats& stats);
+	void getDownStats(SpscRingStats& stats);
+	void getCaptureStats(SpscRingStats& stats);
+
+private:
+	GatewayConfig config;
+	RF24 radio;
+	RF24Mesh mesh;
+	EventLoop loop;
+	std::thread thread;
+	RadioStats stats;
+	SpscRing<MeshFrame, RADIO_UP_RING> up;
+	SpscRing<MeshCommand, RADIO_DOWN_RING> down;
+	SpscRing<CaptureRecord, RADIO_CAPTURE_RING> captured;
+	bool queued; /**< Frames went into the up ring since the last notify */
+
+	MetricsTimer metrics_timer;
+	Snapshot<MeshMetrics> metrics;
+	MeshMetrics totals; /**< Widened counters, see MeshMetrics */
+	MeshStats last_mesh; /**< Counters as they were at the last snapshot */
+	rf24_stats_t last_radio;
+	RF24Mesh::ForwardStats last_forward;
+	SendQueueStats last_queues[SQ_CLASSES];
+	SourceStats last_sources[SEND_QUEUE_SOURCES];
+	uint32_t last_state_ms[JOINED + 1];
+	uint16_t last_route_changes;
+
+	int irq_fd;
+	int tick_fd;
+	int command_fd; /**< Written by the application after command() */
+	int notify_fd; /**< Written by us after queueing frames */
+	int stop_fd;
+	EventCallback<RadioThread> on_irq;
+	EventCallback<RadioThread> on_tick;
+	EventCallback<RadioThread> on_command;
+	EventCallback<RadioThread> on_stop;
+
+	void irq(uint32_t events);
+	void tick(uint32_t events);
+	void commands(uint32_t events);
+	void stopped(uint32_t events);
+
+	void service(void);
+	void queue(const RF24NetworkHeader& packet);
+
+	/**
+	 * Widen the counters into totals and publish them
+	 */
+	void publish(void);
+};
+
+#endif //__GATEWAY_RADIO_THREAD_H__
@@ -0,0 +1,166 @@
+#include <string.h>
+
+#include "RF24_hal.h"
+#include "RF24_hal_mock.h"
+#include "nRF24L01.h"
+#include "ReplayRadio.h"
+
+ReplayRadio::ReplayRadio(uint8_t _csn_pin)
+{
+	csn_pin = _csn_pin;
+	memset(reg,0,sizeof(reg));
+	flags = 0;
+	rx_count = 0;
+	selected = false;
+	first = false;
+	command = NOP;
+	index = 0;
+	memset(&stats,0,sizeof(stats));
+}
+
+void ReplayRadio::attach(void)
+{
+	HalMock::setSpi(&ReplayRadio::spi,this);
+	HalMock::setPins(&ReplayRadio::pin,this);
+}
+
+bool ReplayRadio::push(const uint8_t* frame, uint8_t pipe)
+{
+	if(rx_count >= REPLAY_FIFO_DEPTH)
+		return false;
+
+	memcpy(rx_fifo[rx_count],frame,REPLAY_FRAME_BYTES);
+	rx_pipe[rx_count] = pipe & 7;
+	rx_count++;
+	flags |= _BV(RX_DR);
+	stats.pushed++;
+	return true;
+}
+
+uint8_t ReplayRadio::getRoom(void)
+{
+	return REPLAY_FIFO_DEPTH - rx_count;
+}
+
+const ReplayRadioStats& ReplayRadio::getStats(void)
+{
+	return stats;
+}
+
+/****************************************************************************/
+
+uint8_t ReplayRadio::spi(uint8_t data, void* context)
+{
+	return ((ReplayRadio*)context)->transfer(data);
+}
+
+void ReplayRadio::pin(uint8_t pin, uint8_t level, void* context)
+{
+	ReplayRadio& r = *(ReplayRadio*)context;
+	if(pin != r.csn_pin)
+		return;
+
+	if(level == LOW && !r.selected)
+	{
+		r.selected = true;
+		r.first = true;
+		r.stats.transactions++;
+	}
+	else if(level == HIGH && r.selected)
+	{
+		r.end();
+		r.selected = false;
+	}
+}
+
+/**
+ * STATUS, with the pipe of the frame at the head of the RX FIFO, 7 if empty
+ */
+uint8_t ReplayRadio::status(void)
+{
+	return flags | ((rx_count ? rx_pipe[0] : 7) << RX_P_NO);
+}
+
+uint8_t ReplayRadio::transfer(uint8_t data)
+{
+	if(!selected)
+		return 0;
+
+	if(first)
+	{
+		first = false;
+		command = data;
+		index = 0;
+		return status();
+	}
+
+	if(command < W_REGISTER)
+	{
+		uint8_t r = command & REGISTER_MASK;
+		if(index++)
+			return 0;
+		if(r == STATUS)
+			return status();
+		if(r == FIFO_STATUS)
+			return (rx_count ? 0 : _BV(RX_EMPTY)) | (rx_count == REPLAY_FIFO_DEPTH ? _BV(RX_FULL) : 0) | _BV(TX_EMPTY);
+		return reg[r];
+	}
+	if(command < W_REGISTER + 0x20)
+	{
+		// Of the address registers only the first byte is kept
+		uint8_t r = command & REGISTER_MASK;
+		if(index++)
+			return 0;
+		if(r == STATUS)
+			flags &= ~(data & (_BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT)));
+		else
+			reg[r] = data;
+		return 0;
+	}
+
+	switch(command)
+	{
+	case R_RX_PAYLOAD:
+		return (rx_count && index < REPLAY_FRAME_BYTES) ? rx_fifo[0][index++] : 0;
+	case R_RX_PL_WID:
+		return REPLAY_FRAME_BYTES;
+	case W_TX_PAYLOAD:
+		index++;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Chip select went high, whatever the command does at its end
+ */
+void ReplayRadio::end(void)
+{
+	switch(command)
+	{
+	case R_RX_PAYLOAD:
+		if(index && rx_count)
+		{
+			rx_count--;
+			memmove(rx_fifo,rx_fifo + 1,rx_count * sizeof(rx_fifo[0]));
+			memmove(rx_pipe,rx_pipe + 1,rx_count);
+			stats.read++;
+		}
+		break;
+	case W_TX_PAYLOAD:
+		if(index)
+		{
+			flags |= _BV(TX_DS);
+			stats.sent++;
+		}
+		break;
+	case FLUSH_RX:
+		stats.flushed += rx_count;
+		rx_count = 0;
+		break;
+	default:
+		break;
+	}
+	command = NOP;
+}
@@ -0,0 +1,88 @@
+#ifndef __GATEWAY_REPLAY_RADIO_H__
+#define __GATEWAY_REPLAY_RADIO_H__
+
+#include <stdint.h>
+
+/**
+ * @file ReplayRadio.h
+ *
+ * Just enough of an nRF24L01+ behind the mock HAL for RF24 to read frames
+ * that are put into its RX FIFO, see gwreplay.cpp
+ *
+ * Registers keep what is written to them and read it back.  The RX FIFO is
+ * three frames deep like the chip's, push() sets RX_DR as an arrival would.
+ * Frames written to it are sent at once: TX_DS is set when the payload is
+ * in, so the mesh never waits on a send.  Nothing else of the chip is
+ * modelled, there is no air and no other radio.
+ *
+ * Only built with RF24_HAL_MOCK.
+ */
+
+#define REPLAY_FIFO_DEPTH 3
+#define REPLAY_FRAME_BYTES 32
+
+/**
+ * Counters of the emulated chip
+ */
+typedef struct
+{
+	uint64_t pushed; /**< Frames put into the RX FIFO */
+	uint64_t read; /**< Taken out of it by R_RX_PAYLOAD */
+	uint64_t flushed; /**< Lost to FLUSH_RX, e.g. when the mesh starts a send */
+	uint64_t sent; /**< Frames written to the TX FIFO */
+	uint64_t transactions;
+} ReplayRadioStats;
+
+class ReplayRadio
+{
+public:
+	/**
+	 * @param csn_pin Chip select of the RF24 driving it
+	 */
+	ReplayRadio(uint8_t csn_pin);
+
+	/**
+	 * Answer the SPI bus and watch the pins of the mock HAL from now on
+	 */
+	void attach(void);
+
+	/**
+	 * Put a frame into the RX FIFO as if it had come in on @p pipe
+	 *
+	 * @return False if the FIFO is full
+	 */
+	bool push(const uint8_t* frame, uint8_t pipe);
+
+	/**
+	 * Frames the RX FIFO can still take
+	 */
+	uint8_t getRoom(void);
+
+	const ReplayRadioStats& getStats(void);
+
+	static uint8_t spi(uint8_t data, void* context);
+	static void pin(uint8_t pin, uint8_t level, void* context);
+
+private:
+	uint8_t csn_pin;
+	uint8_t reg[0x20];
+	uint8_t flags; /**< RX_DR, TX_DS and MAX_RT of STATUS */
+
+	uint8_t rx_fifo[REPLAY_FIFO_DEPTH][REPLAY_FRAME_BYTES];
+	uint8_t rx_pipe[REPLAY_FIFO_DEPTH];
+	uint8_t rx_count;
+
+	// SPI transaction in progress
+	bool selected;
+	bool first;
+	uint8_t command;
+	uint8_t index;
+
+	ReplayRadioStats stats;
+
+	uint8_t status(void);
+	uint8_t transfer(uint8_t data);
+	void end(void);
+};
+
+#endif //__GATEWAY_REPLAY_RADIO_H__
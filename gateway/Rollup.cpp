@@ -0,0 +1,586 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include "Journal.h"
+#include "Rollup.h"
+
+#define ROLLUP_VARINT_MAX 10
+
+const uint32_t rollupSeconds[ROLLUP_LEVELS] = { 60, 3600, 86400 };
+
+static uint64_t nowUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void putVarint(std::vector<uint8_t>& out, uint64_t v)
+{
+	while(v >= 0x80)
+	{
+		out.push_back((uint8_t)v | 0x80);
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+/**
+ * @return False if the varint runs past @p end
+ */
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v)
+{
+	v = 0;
+	for(unsigned shift=0;shift<7 * ROLLUP_VARINT_MAX;shift+=7)
+	{
+		if(p >= end)
+			return false;
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if(!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static bool readFile(int fd, std::vector<uint8_t>& out)
+{
+	struct stat st;
+	if(fstat(fd,&st) < 0)
+		return false;
+
+	out.resize(st.st_size);
+	size_t done = 0;
+	while(done < out.size())
+	{
+		ssize_t n = pread(fd,out.data() + done,out.size() - done,done);
+		if(n <= 0)
+			break;
+		done += n;
+	}
+	out.resize(done);
+	return true;
+}
+
+/**
+ * Hand each entry of a file to @p visit, up to the first that is torn or
+ * fails its checksum
+ *
+ * @return Bytes up to the end of the last good entry
+ */
+template<class F> static size_t walk(const std::vector<uint8_t>& data, F visit)
+{
+	size_t offset = sizeof(RollupHeader);
+	while(offset + sizeof(RollupEntryHeader) + sizeof(uint32_t) <= data.size())
+	{
+		RollupEntryHeader h;
+		memcpy(&h,data.data() + offset,sizeof(h));
+		size_t end = offset + sizeof(h) + h.bytes + sizeof(uint32_t);
+		if(end > data.size())
+			break;
+
+		uint32_t crc;
+		memcpy(&crc,data.data() + end - sizeof(crc),sizeof(crc));
+		if(crc != journalCrc(data.data() + offset,end - sizeof(crc) - offset))
+			break;
+
+		visit(h.kind,data.data() + offset + sizeof(h),(size_t)h.bytes,end);
+		offset = end;
+	}
+	return offset;
+}
+
+static void clearBucket(RollupBucket& b, uint16_t source, uint64_t start_us)
+{
+	b.source = source;
+	b.start_us = start_us;
+	b.count = 0;
+	b.sum = 0;
+	b.min = INT32_MAX;
+	b.max = INT32_MIN;
+	b.last = 0;
+	b.last_us = 0;
+	b.sketch.clear();
+}
+
+static void fold(RollupBucket& b, uint64_t time_us, int32_t value)
+{
+	b.count++;
+	b.sum += value;
+	b.min = std::min(b.min,value);
+	b.max = std::max(b.max,value);
+	if(time_us >= b.last_us)
+	{
+		b.last = value;
+		b.last_us = time_us;
+	}
+	b.sketch.add(value);
+}
+
+static bool decodeBucket(const uint8_t* p, size_t bytes, RollupBucket& b)
+{
+	RollupBucketRecord r;
+	if(bytes < sizeof(r))
+		return false;
+	memcpy(&r,p,sizeof(r));
+	const uint8_t* end = p + bytes;
+	p += sizeof(r);
+
+	b.source = r.source;
+	b.start_us = r.start_us;
+	b.count = r.count;
+	b.sum = r.sum;
+	b.min = r.min;
+	b.max = r.max;
+	b.last = r.last;
+	b.last_us = r.last_us;
+	b.sketch.clear();
+
+	uint64_t n, gap, count;
+	if(!getVarint(p,end,n))
+		return false;
+	int64_t key = r.sketch_offset;
+	for(uint64_t i=0;i<n;i++)
+	{
+		if(!getVarint(p,end,gap) || !getVarint(p,end,count))
+			return false;
+		key += gap;
+		b.sketch.addKey((int32_t)key,(uint32_t)count);
+	}
+	b.sketch.addRange(b.min,b.max);
+	return true;
+}
+
+void rollupMerge(RollupBucket& into, const RollupBucket& from)
+{
+	into.count += from.count;
+	into.sum += from.sum;
+	into.min = std::min(into.min,from.min);
+	into.max = std::max(into.max,from.max);
+	if(from.last_us >= into.last_us)
+	{
+		into.last = from.last;
+		into.last_us = from.last_us;
+	}
+	into.sketch.merge(from.sketch);
+}
+
+/****************************************************************************/
+
+Rollup::Rollup(): shard(0), word(0), journal(false), last_sequence(0), next_expire_us(0)
+{
+	memset(&stats,0,sizeof(stats));
+	for(unsigned i=0;i<ROLLUP_LEVELS;i++)
+	{
+		levels[i].fd = -1;
+		levels[i].sequence = 0;
+	}
+}
+
+Rollup::~Rollup()
+{
+	close();
+}
+
+bool Rollup::open(const std::string& dir, unsigned _shard, unsigned _word, bool _journal)
+{
+	shard = _shard;
+	word = _word;
+	journal = _journal;
+	last_sequence = 0;
+
+	for(unsigned i=0;i<ROLLUP_LEVELS;i++)
+	{
+		if(!openLevel(dir,i))
+		{
+			close();
+			return false;
+		}
+		last_sequence = std::max(last_sequence,levels[i].sequence);
+	}
+	next_expire_us = nowUs() + ROLLUP_EXPIRE_US;
+	return true;
+}
+
+bool Rollup::openLevel(const std::string& dir, unsigned level)
+{
+	Level& l = levels[level];
+	char name[64];
+	snprintf(name,sizeof(name),"/rup-%u-%u.log",shard,rollupSeconds[level]);
+	l.path = dir + name;
+	l.sequence = 0;
+	l.open.clear();
+	l.buffer.clear();
+
+	l.fd = ::open(l.path.c_str(),O_RDWR | O_CREAT | O_CLOEXEC,0644);
+	std::vector<uint8_t> data;
+	if(l.fd < 0 || !readFile(l.fd,data))
+	{
+		perror(l.path.c_str());
+		return false;
+	}
+
+	RollupHeader h;
+	if(data.size() < sizeof(h))
+	{
+		memset(&h,0,sizeof(h));
+		h.magic = ROLLUP_MAGIC;
+		h.version = ROLLUP_VERSION;
+		h.shard = shard;
+		h.seconds = rollupSeconds[level];
+		h.word = word;
+		h.created_us = nowUs();
+		if(ftruncate(l.fd,0) < 0 || pwrite(l.fd,&h,sizeof(h),0) != sizeof(h))
+		{
+			perror(l.path.c_str());
+			return false;
+		}
+		lseek(l.fd,0,SEEK_END);
+		return true;
+	}
+
+	memcpy(&h,data.data(),sizeof(h));
+	if(h.magic != ROLLUP_MAGIC || h.version != ROLLUP_VERSION || h.seconds != rollupSeconds[level])
+	{
+		fprintf(stderr,"%s: not a rollup of %u s\n",l.path.c_str(),rollupSeconds[level]);
+		return false;
+	}
+	if(h.word != word)
+	{
+		fprintf(stderr,"%s: rolls up payload word %u, not %u\n",l.path.c_str(),h.word,word);
+		return false;
+	}
+
+	size_t marked = sizeof(h);
+	size_t good = walk(data,[&](uint8_t kind, const uint8_t* body, size_t bytes, size_t end)
+	{
+		RollupMarkRecord m;
+		if(kind == ROLLUP_MARK && bytes == sizeof(m))
+		{
+			memcpy(&m,body,sizeof(m));
+			l.sequence = m.sequence;
+			marked = end;
+		}
+	});
+
+	// The journal has the readings of what comes after the last mark
+	size_t keep = journal ? marked : good;
+	if(keep < data.size())
+	{
+		stats.dropped += data.size() - keep;
+		if(ftruncate(l.fd,keep) < 0)
+		{
+			perror(l.path.c_str());
+			return false;
+		}
+	}
+	lseek(l.fd,0,SEEK_END);
+	return true;
+}
+
+void Rollup::close(void)
+{
+	if(isOpen())
+		sync();
+	for(unsigned i=0;i<ROLLUP_LEVELS;i++)
+	{
+		if(levels[i].fd >= 0)
+			::close(levels[i].fd);
+		levels[i].fd = -1;
+		levels[i].open.clear();
+	}
+}
+
+bool Rollup::isOpen(void)
+{
+	return levels[0].fd >= 0;
+}
+
+uint64_t Rollup::getSequence(void)
+{
+	uint64_t s = levels[0].sequence;
+	for(unsigned i=1;i<ROLLUP_LEVELS;i++)
+		s = std::min(s,levels[i].sequence);
+	return s;
+}
+
+/****************************************************************************/
+
+void Rollup::entry(Level& l, uint8_t kind, const uint8_t* body, size_t bytes)
+{
+	RollupEntryHeader h;
+	h.kind = kind;
+	h.reserved = 0;
+	h.bytes = bytes;
+
+	size_t start = l.buffer.size();
+	l.buffer.insert(l.buffer.end(),(const uint8_t*)&h,(const uint8_t*)&h + sizeof(h));
+	l.buffer.insert(l.buffer.end(),body,body + bytes);
+	uint32_t crc = journalCrc(l.buffer.data() + start,l.buffer.size() - start);
+	l.buffer.insert(l.buffer.end(),(const uint8_t*)&crc,(const uint8_t*)&crc + sizeof(crc));
+}
+
+void Rollup::writeBucket(Level& l, const RollupBucket& b)
+{
+	if(!b.count)
+		return;
+
+	RollupBucketRecord r;
+	r.source = b.source;
+	r.start_us = b.start_us;
+	r.count = b.count;
+	r.sum = b.sum;
+	r.min = b.min;
+	r.max = b.max;
+	r.last = b.last;
+	r.last_us = b.last_us;
+	r.sketch_offset = b.sketch.getOffset();
+
+	// Only the buckets of the sketch in use, with the gaps between them
+	std::vector<uint8_t> body((const uint8_t*)&r,(const uint8_t*)&r + sizeof(r));
+	const uint32_t* counts = b.sketch.getCounts();
+	unsigned used = 0;
+	for(unsigned i=0;i<SKETCH_BUCKETS;i++)
+		used += counts[i] != 0;
+	putVarint(body,used);
+	unsigned previous = 0;
+	for(unsigned i=0;i<SKETCH_BUCKETS;i++)
+	{
+		if(!counts[i])
+			continue;
+		putVarint(body,i - previous);
+		putVarint(body,counts[i]);
+		previous = i;
+	}
+
+	entry(l,ROLLUP_BUCKET,body.data(),body.size());
+	stats.buckets++;
+	if(l.buffer.size() >= ROLLUP_BUFFER_BYTES)
+		flush(l);
+}
+
+bool Rollup::flush(Level& l)
+{
+	const uint8_t* p = l.buffer.data();
+	size_t len = l.buffer.size();
+	while(len)
+	{
+		ssize_t n = write(l.fd,p,len);
+		if(n <= 0)
+		{
+			perror(l.path.c_str());
+			l.buffer.clear();
+			return false;
+		}
+		p += n;
+		len -= n;
+		stats.bytes += n;
+	}
+	l.buffer.clear();
+	return true;
+}
+
+void Rollup::add(const ExportRecord& r, uint64_t sequence)
+{
+	int32_t value;
+	memcpy(&value,r.payload + word * sizeof(value),sizeof(value));
+	stats.rows++;
+	last_sequence = std::max(last_sequence,sequence);
+
+	for(unsigned i=0;i<ROLLUP_LEVELS;i++)
+	{
+		Level& l = levels[i];
+		if(sequence && sequence <= l.sequence)
+			continue;
+
+		uint64_t len = (uint64_t)rollupSeconds[i] * 1000000;
+		uint64_t start = r.time_us / len * len;
+
+		Buckets::iterator b = l.open.find(r.source);
+		if(b != l.open.end() && b->second.start_us != start)
+		{
+			if(start < b->second.start_us)
+			{
+				RollupBucket late;
+				clearBucket(late,r.source,start);
+				fold(late,r.time_us,value);
+				writeBucket(l,late);
+				stats.late++;
+				continue;
+			}
+			writeBucket(l,b->second);
+			clearBucket(b->second,r.source,start);
+		}
+		if(b == l.open.end())
+		{
+			b = l.open.emplace(r.source,RollupBucket()).first;
+			clearBucket(b->second,r.source,start);
+		}
+		fold(b->second,r.time_us,value);
+	}
+}
+
+int64_t Rollup::expire(void)
+{
+	if(!isOpen())
+		return -1;
+
+	uint64_t now = nowUs();
+	if(now < next_expire_us)
+		return next_expire_us - now;
+
+	for(unsigned i=0;i<ROLLUP_LEVELS;i++)
+	{
+		Level& l = levels[i];
+		uint64_t len = (uint64_t)rollupSeconds[i] * 1000000;
+		for(Buckets::iterator b=l.open.begin();b!=l.open.end();)
+		{
+			if(b->second.start_us + len + ROLLUP_GRACE_US > now)
+			{
+				++b;
+				continue;
+			}
+			writeBucket(l,b->second);
+			b = l.open.erase(b);
+		}
+		flush(l);
+	}
+
+	next_expire_us = now + ROLLUP_EXPIRE_US;
+	return ROLLUP_EXPIRE_US;
+}
+
+bool Rollup::sync(void)
+{
+	if(!isOpen())
+		return false;
+
+	bool ok = true;
+	for(unsigned i=0;i<ROLLUP_LEVELS;i++)
+	{
+		Level& l = levels[i];
+		for(Buckets::iterator b=l.open.begin();b!=l.open.end();++b)
+			writeBucket(l,b->second);
+		l.open.clear();
+
+		RollupMarkRecord m;
+		m.sequence = last_sequence;
+		entry(l,ROLLUP_MARK,(const uint8_t*)&m,sizeof(m));
+		if(!flush(l) || fdatasync(l.fd) < 0)
+		{
+			perror(l.path.c_str());
+			ok = false;
+			continue;
+		}
+		l.sequence = last_sequence;
+	}
+	stats.syncs++;
+	return ok;
+}
+
+const RollupStats& Rollup::getStats(void)
+{
+	return stats;
+}
+
+/****************************************************************************/
+
+RollupReader::RollupReader(): word(-1), entries(0)
+{
+}
+
+bool RollupReader::read(const std::string& dir, uint32_t seconds, uint64_t from_us, uint64_t to_us, int source)
+{
+	buckets.clear();
+	word = -1;
+	entries = 0;
+
+	DIR* d = opendir(dir.c_str());
+	if(!d)
+	{
+		perror(dir.c_str());
+		return false;
+	}
+	std::vector<std::string> files;
+	struct dirent* e;
+	while((e = readdir(d)) != NULL)
+	{
+		unsigned s, level;
+		if(sscanf(e->d_name,"rup-%u-%u.log",&s,&level) == 2 && level == seconds)
+			files.push_back(dir + "/" + e->d_name);
+	}
+	closedir(d);
+
+	std::map<std::pair<uint16_t, uint64_t>, size_t> found;
+	std::vector<uint8_t> data;
+	RollupBucket b;
+	bool any = false;
+	for(size_t i=0;i<files.size();i++)
+	{
+		int fd = ::open(files[i].c_str(),O_RDONLY | O_CLOEXEC);
+		bool ok = fd >= 0 && readFile(fd,data);
+		if(fd >= 0)
+			::close(fd);
+
+		RollupHeader h;
+		if(!ok || data.size() < sizeof(h))
+			continue;
+		memcpy(&h,data.data(),sizeof(h));
+		if(h.magic != ROLLUP_MAGIC || h.version != ROLLUP_VERSION || h.seconds != seconds)
+		{
+			fprintf(stderr,"%s: not a rollup of %u s\n",files[i].c_str(),seconds);
+			continue;
+		}
+		word = !any || word == h.word ? h.word : -1;
+		any = true;
+
+		walk(data,[&](uint8_t kind, const uint8_t* body, size_t bytes, size_t)
+		{
+			if(kind != ROLLUP_BUCKET || !decodeBucket(body,bytes,b))
+				return;
+			entries++;
+			if(b.start_us < from_us || b.start_us >= to_us || (source >= 0 && b.source != source))
+				return;
+
+			std::pair<uint16_t, uint64_t> key(b.source,b.start_us);
+			std::map<std::pair<uint16_t, uint64_t>, size_t>::iterator f = found.find(key);
+			if(f == found.end())
+			{
+				found.insert(std::make_pair(key,buckets.size()));
+				buckets.push_back(b);
+			}
+			else
+				rollupMerge(buckets[f->second],b);
+		});
+	}
+
+	std::vector<RollupBucket> sorted;
+	sorted.reserve(buckets.size());
+	for(std::map<std::pair<uint16_t, uint64_t>, size_t>::iterator f=found.begin();f!=found.end();++f)
+		sorted.push_back(buckets[f->second]);
+	buckets.swap(sorted);
+	return any;
+}
+
+const std::vector<RollupBucket>& RollupReader::getBuckets(void)
+{
+	return buckets;
+}
+
+int RollupReader::getWord(void)
+{
+	return word;
+}
+
+uint64_t RollupReader::getEntries(void)
+{
+	return entries;
+}
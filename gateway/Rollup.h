@@ -0,0 +1,238 @@
+#ifndef __GATEWAY_ROLLUP_H__
+#define __GATEWAY_ROLLUP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ExportProtocol.h"
+#include "Sketch.h"
+
+/**
+ * @file Rollup.h
+ *
+ * Aggregates of the readings of each node per minute, hour and day, kept
+ * up to date as the readings come
+ *
+ * Each worker of the gateway folds every reading it stores into the open
+ * bucket of its node at each level: count, sum, minimum, maximum, the last
+ * value and a QuantileSketch of one payload word.  A bucket is written out
+ * once a reading of the node falls past it, or ROLLUP_GRACE_US after its
+ * end if the node went quiet.  A reading that comes after its bucket was
+ * written is written as a bucket of its own.
+ *
+ * Files are @c rup-<shard>-<seconds>.log in the directory of the store, one
+ * per worker and level, appended to only.  A RollupHeader, then entries,
+ * each a RollupEntryHeader, its body and a CRC-32 of both.  A bucket entry
+ * is a RollupBucketRecord and the sketch, as the number of buckets in use,
+ * then for each the distance to the one before and its count, as varints.
+ * The same node and interval may be in several entries; readers add them
+ * up, see RollupReader.
+ *
+ * With the journal, see Journal.h, sync() writes out the open buckets too
+ * and ends with a mark of the last journal sequence in them.  After a
+ * crash, whatever follows the last mark is dropped and the journal hands
+ * back the readings after it, so each reading is counted once.
+ *
+ * Everything is little endian.
+ */
+
+#define ROLLUP_MAGIC 0x50555252 /**< "RRUP" */
+#define ROLLUP_VERSION 1
+#define ROLLUP_LEVELS 3
+#define ROLLUP_GRACE_US (10 * 1000000) /**< Buckets stay open past their end for readings still on their way */
+#define ROLLUP_EXPIRE_US 1000000 /**< Period of looking for buckets of quiet nodes */
+#define ROLLUP_BUFFER_BYTES (64 * 1024) /**< Entries collected before a write() */
+
+#define ROLLUP_BUCKET 'B'
+#define ROLLUP_MARK 'M'
+
+/**
+ * Seconds of the buckets of each level
+ */
+extern const uint32_t rollupSeconds[ROLLUP_LEVELS];
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t shard;
+	uint32_t seconds; /**< Of its buckets */
+	uint16_t word; /**< Payload word rolled up */
+	uint16_t reserved;
+	uint64_t created_us; /**< Unix time */
+} __attribute__((packed)) RollupHeader;
+
+typedef struct
+{
+	uint8_t kind; /**< ROLLUP_BUCKET or ROLLUP_MARK */
+	uint8_t reserved;
+	uint16_t bytes; /**< Of the body */
+} __attribute__((packed)) RollupEntryHeader;
+
+typedef struct
+{
+	uint16_t source;
+	uint64_t start_us; /**< Unix time, a multiple of the seconds of the level */
+	uint64_t count;
+	int64_t sum;
+	int32_t min;
+	int32_t max;
+	int32_t last; /**< Value of the reading with the highest time_us */
+	uint64_t last_us;
+	int32_t sketch_offset; /**< Key of the first bucket of the sketch */
+} __attribute__((packed)) RollupBucketRecord;
+
+typedef struct
+{
+	uint64_t sequence; /**< Journal sequence of the last reading written before it, 0 without a journal */
+} __attribute__((packed)) RollupMarkRecord;
+
+/**
+ * A node over one interval
+ */
+typedef struct
+{
+	uint16_t source;
+	uint64_t start_us;
+	uint64_t count;
+	int64_t sum;
+	int32_t min;
+	int32_t max;
+	int32_t last;
+	uint64_t last_us;
+	QuantileSketch sketch;
+} RollupBucket;
+
+/**
+ * Counters of a writer
+ */
+typedef struct
+{
+	uint64_t rows;
+	uint64_t buckets; /**< Entries written */
+	uint64_t late; /**< Readings that came after their bucket was written */
+	uint64_t syncs;
+	uint64_t bytes;
+	uint64_t dropped; /**< Bytes after the last mark when opened */
+} RollupStats;
+
+class Rollup
+{
+public:
+	Rollup();
+	~Rollup();
+
+	/**
+	 * Open or make the files of @p shard in @p dir
+	 *
+	 * @param word Payload word to roll up, the files must have the same
+	 * @param journal Readings come with journal sequences and are handed back
+	 * after a crash, so what follows the last mark is dropped
+	 */
+	bool open(const std::string& dir, unsigned shard, unsigned word, bool journal);
+
+	/**
+	 * Sync and close the files
+	 */
+	void close(void);
+
+	bool isOpen(void);
+
+	/**
+	 * Journal sequence up to which the files have every reading, the
+	 * lowest of all levels
+	 */
+	uint64_t getSequence(void);
+
+	/**
+	 * Fold a reading into its buckets, unless a level has it already
+	 *
+	 * @param sequence Of the reading in the journal, 0 without one
+	 */
+	void add(const ExportRecord& r, uint64_t sequence = 0);
+
+	/**
+	 * Write out the buckets of nodes that went quiet, every ROLLUP_EXPIRE_US
+	 *
+	 * @return Microseconds until it is due again
+	 */
+	int64_t expire(void);
+
+	/**
+	 * Write out every open bucket and a mark, and wait until they are on disk
+	 */
+	bool sync(void);
+
+	const RollupStats& getStats(void);
+
+private:
+	typedef std::unordered_map<uint16_t, RollupBucket> Buckets;
+
+	typedef struct
+	{
+		int fd;
+		std::string path;
+		uint64_t sequence; /**< Of the last mark */
+		Buckets open; /**< By node */
+		std::vector<uint8_t> buffer; /**< Entries not written yet */
+	} Level;
+
+	unsigned shard;
+	unsigned word;
+	bool journal;
+	Level levels[ROLLUP_LEVELS];
+	uint64_t last_sequence; /**< Of the readings added */
+	uint64_t next_expire_us;
+	RollupStats stats;
+
+	bool openLevel(const std::string& dir, unsigned level);
+	void entry(Level& l, uint8_t kind, const uint8_t* body, size_t bytes);
+	void writeBucket(Level& l, const RollupBucket& b);
+	bool flush(Level& l);
+};
+
+/**
+ * Buckets of one level, as found in all files of a store
+ */
+class RollupReader
+{
+public:
+	RollupReader();
+
+	/**
+	 * Read the buckets of every node in @p dir with @p from_us <= start_us <
+	 * @p to_us, those of the same node and interval added up
+	 *
+	 * @param seconds Of the level, one of rollupSeconds
+	 * @param source The node to read, -1 for all
+	 * @return False if no file of the level could be read
+	 */
+	bool read(const std::string& dir, uint32_t seconds, uint64_t from_us, uint64_t to_us, int source);
+
+	/**
+	 * By node, then by time
+	 */
+	const std::vector<RollupBucket>& getBuckets(void);
+
+	/**
+	 * Payload word rolled up, -1 if the files disagree
+	 */
+	int getWord(void);
+
+	uint64_t getEntries(void); /**< Read */
+
+private:
+	std::vector<RollupBucket> buckets;
+	int word;
+	uint64_t entries;
+};
+
+/**
+ * Add @p from into @p into, both of the same node and interval
+ */
+void rollupMerge(RollupBucket& into, const RollupBucket& from);
+
+#endif //__GATEWAY_ROLLUP_H__
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
+
+#include "Schema.h"
+
+static const char* typeNames[FIELD_TYPES] = { "u8", "i8", "u16", "i16", "u32", "i32" };
+static const uint8_t typeBytes[FIELD_TYPES] = { 1, 1, 2, 2, 4, 4 };
+
+/**
+ * The loop of a field of type @p T, with the options fixed, so the
+ * compiler drops what it does not use
+ */
+template<class T, bool BITS, bool DELTA, bool SCALED>
+static void decodeField(SchemaField& f, const ExportRecord* records, const uint32_t* sel, size_t n, void* column)
+{
+	int64_t* ints = (int64_t*)column;
+	double* reals = (double*)column;
+	for(size_t i=0;i<n;i++)
+	{
+		const ExportRecord& r = records[sel[i]];
+		T raw;
+		memcpy(&raw,r.payload + f.offset,sizeof(raw));
+
+		int64_t v = raw;
+		if(BITS)
+			v = ((typename std::make_unsigned<T>::type)raw >> f.shift) & f.mask;
+		if(DELTA)
+			v = f.totals[r.source] += v;
+		if(SCALED)
+			reals[i] = v * f.scale;
+		else
+			ints[i] = v;
+	}
+}
+
+#define SCHEMA_OPTIONS(T, BITS) \
+	{ { decodeField<T, BITS, false, false>, decodeField<T, BITS, false, true> }, \
+	  { decodeField<T, BITS, true, false>, decodeField<T, BITS, true, true> } }
+#define SCHEMA_DECODERS(T) { SCHEMA_OPTIONS(T, false), SCHEMA_OPTIONS(T, true) }
+
+/**
+ * By type, bits, delta and scale
+ */
+static const SchemaDecodeFn decoders[FIELD_TYPES][2][2][2] =
+{
+	SCHEMA_DECODERS(uint8_t),
+	SCHEMA_DECODERS(int8_t),
+	SCHEMA_DECODERS(uint16_t),
+	SCHEMA_DECODERS(int16_t),
+	SCHEMA_DECODERS(uint32_t),
+	SCHEMA_DECODERS(int32_t)
+};
+
+/****************************************************************************/
+
+bool SchemaField::isScaled(void) const
+{
+	return scale != 0;
+}
+
+const int64_t* SchemaColumns::getInts(size_t field) const
+{
+	return ints[field].data();
+}
+
+const double* SchemaColumns::getReals(size_t field) const
+{
+	return reals[field].data();
+}
+
+/****************************************************************************/
+
+SchemaRegistry::SchemaRegistry()
+{
+	memset(any_node,SCHEMA_NONE,sizeof(any_node));
+	any = SCHEMA_NONE;
+}
+
+bool SchemaRegistry::load(const std::string& path)
+{
+	std::ifstream in(path.c_str());
+	if(!in)
+	{
+		perror(path.c_str());
+		return false;
+	}
+	std::stringstream text;
+	text << in.rdbuf();
+	return parse(text.str(),path);
+}
+
+bool SchemaRegistry::parse(const std::string& text, const std::string& name)
+{
+	std::istringstream lines(text);
+	std::string line;
+	unsigned number = 0;
+	while(std::getline(lines,line))
+	{
+		number++;
+		size_t hash = line.find('#');
+		if(hash != std::string::npos)
+			line.erase(hash);
+
+		std::istringstream words(line);
+		std::string word;
+		if(!(words >> word))
+			continue;
+
+		if(word == "schema")
+		{
+			Schema s;
+			s.type = -1;
+			s.node = -1;
+			if(!(words >> s.name) || schemas.size() >= SCHEMA_MAX)
+			{
+				fprintf(stderr,"%s:%u: schema without a name, or too many\n",name.c_str(),number);
+				return false;
+			}
+			while(words >> word)
+			{
+				if(!word.compare(0,5,"type=") && word.size() == 6)
+					s.type = (uint8_t)word[5];
+				else if(!word.compare(0,5,"node="))
+					s.node = strtol(word.c_str() + 5,NULL,0) & 0xFFFF;
+				else
+				{
+					fprintf(stderr,"%s:%u: %s is not type=<char> or node=<address>\n",name.c_str(),number,word.c_str());
+					return false;
+				}
+			}
+			schemas.push_back(s);
+			continue;
+		}
+
+		if(schemas.empty())
+		{
+			fprintf(stderr,"%s:%u: field outside a schema\n",name.c_str(),number);
+			return false;
+		}
+
+		SchemaField f;
+		f.name = word;
+		f.offset = 0;
+		f.shift = 0;
+		f.mask = 0;
+		f.delta = false;
+		f.scale = 0;
+		f.decode = NULL;
+
+		std::string type, at;
+		if(!(words >> type >> at) || at[0] != '@')
+		{
+			fprintf(stderr,"%s:%u: expected <name> <type> @<byte>\n",name.c_str(),number);
+			return false;
+		}
+		int t = 0;
+		while(t < FIELD_TYPES && type != typeNames[t])
+			t++;
+		unsigned offset = atoi(at.c_str() + 1);
+		if(t == FIELD_TYPES || offset + typeBytes[t] > sizeof(((ExportRecord*)0)->payload))
+		{
+			fprintf(stderr,"%s:%u: %s %s is not a type in the payload\n",name.c_str(),number,type.c_str(),at.c_str());
+			return false;
+		}
+		f.type = (SchemaFieldType)t;
+		f.offset = offset;
+
+		while(words >> word)
+		{
+			unsigned lsb, width;
+			if(word == "delta")
+				f.delta = true;
+			else if(word == "bits" && words >> word && sscanf(word.c_str(),"%u:%u",&lsb,&width) == 2 &&
+				width > 0 && lsb + width <= typeBytes[t] * 8u)
+			{
+				f.shift = lsb;
+				f.mask = width == 32 ? 0xFFFFFFFF : (1u << width) - 1;
+			}
+			else if(word[0] == '*' && atof(word.c_str() + 1) != 0)
+				f.scale = atof(word.c_str() + 1);
+			else if(word[0] == '/' && atof(word.c_str() + 1) != 0)
+				f.scale = 1 / atof(word.c_str() + 1);
+			else
+			{
+				fprintf(stderr,"%s:%u: %s is not bits <lsb>:<width>, delta, *<scale> or /<divisor>\n",
+					name.c_str(),number,word.c_str());
+				return false;
+			}
+		}
+		schemas.back().fields.push_back(f);
+	}
+	return true;
+}
+
+void SchemaRegistry::compile(void)
+{
+	for(size_t s=0;s<schemas.size();s++)
+	{
+		for(size_t i=0;i<schemas[s].fields.size();i++)
+		{
+			SchemaField& f = schemas[s].fields[i];
+			f.decode = decoders[f.type][f.mask != 0][f.delta][f.isScaled()];
+			f.totals.assign(f.delta ? 65536 : 0,0);
+		}
+	}
+
+	// The first schema of each kind of match wins
+	memset(any_node,SCHEMA_NONE,sizeof(any_node));
+	any = SCHEMA_NONE;
+	for(int t=0;t<256;t++)
+		by_node[t].clear();
+	by_node_any_type.clear();
+
+	for(size_t s=schemas.size();s-->0;)
+	{
+		const Schema& schema = schemas[s];
+		if(schema.node >= 0)
+		{
+			std::vector<uint8_t>& table = schema.type >= 0 ? by_node[schema.type] : by_node_any_type;
+			if(table.empty())
+				table.assign(65536,SCHEMA_NONE);
+			table[schema.node] = s;
+		}
+		else if(schema.type >= 0)
+			any_node[schema.type] = s;
+		else
+			any = s;
+	}
+}
+
+uint8_t SchemaRegistry::find(uint8_t type, uint16_t node) const
+{
+	if(!by_node[type].empty() && by_node[type][node] != SCHEMA_NONE)
+		return by_node[type][node];
+	if(any_node[type] != SCHEMA_NONE)
+		return any_node[type];
+	if(!by_node_any_type.empty() && by_node_any_type[node] != SCHEMA_NONE)
+		return by_node_any_type[node];
+	return any;
+}
+
+void SchemaRegistry::decode(const ExportRecord* records, size_t n, std::vector<SchemaColumns>& out)
+{
+	out.resize(schemas.size());
+	for(size_t s=0;s<out.size();s++)
+	{
+		out[s].schema = &schemas[s];
+		out[s].rows = 0;
+		out[s].sel.resize(n);
+	}
+
+	// Sort the rows out by schema, then each field is one loop over them
+	uint16_t last_node = 0;
+	uint8_t last_type = 0, last = find(0,0);
+	for(size_t i=0;i<n;i++)
+	{
+		if(records[i].type != last_type || records[i].source != last_node)
+		{
+			last_type = records[i].type;
+			last_node = records[i].source;
+			last = find(last_type,last_node);
+		}
+		if(last != SCHEMA_NONE)
+			out[last].sel[out[last].rows++] = i;
+	}
+
+	for(size_t s=0;s<out.size();s++)
+	{
+		SchemaColumns& c = out[s];
+		std::vector<SchemaField>& fields = schemas[s].fields;
+		c.ints.resize(fields.size());
+		c.reals.resize(fields.size());
+		if(!c.rows)
+			continue;
+
+		for(size_t i=0;i<fields.size();i++)
+		{
+			SchemaField& f = fields[i];
+			void* column;
+			if(f.isScaled())
+			{
+				c.reals[i].resize(c.rows);
+				column = c.reals[i].data();
+			}
+			else
+			{
+				c.ints[i].resize(c.rows);
+				column = c.ints[i].data();
+			}
+			f.decode(f,records,c.sel.data(),c.rows,column);
+		}
+	}
+}
+
+size_t SchemaRegistry::getCount(void) const
+{
+	return schemas.size();
+}
+
+Schema& SchemaRegistry::getSchema(size_t index)
+{
+	return schemas[index];
+}
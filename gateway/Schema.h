@@ -0,0 +1,155 @@
+#ifndef __GATEWAY_SCHEMA_H__
+#define __GATEWAY_SCHEMA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "ExportProtocol.h"
+
+/**
+ * @file Schema.h
+ *
+ * Layouts of the 16 payload bytes of readings, per node or message type,
+ * and decoders of them into typed columns
+ *
+ * A schema file has one schema after the other, each a line
+ *
+ *     schema <name> [type=<char>] [node=<address>]
+ *
+ * followed by a line per field
+ *
+ *     <name> <u8|i8|u16|i16|u32|i32> @<byte> [bits <lsb>:<width>] [delta] [*<scale>|/<divisor>]
+ *
+ * A field is the little endian integer at its byte, or some of its bits,
+ * unsigned.  With @c delta the node sends what changed since its last
+ * reading, e.g. counts of a rain gauge, and the column has the total.  With
+ * a scale, the column has floating point values, e.g. @c /100 for a
+ * temperature in hundredths.  @c # starts a comment.
+ *
+ * A reading gets the schema that names both its node and its type, else
+ * the one of its type, of its node, or of neither, the one of those met
+ * first in the file.
+ *
+ * compile() turns each field into one of the decode loops instantiated
+ * for every integer type and option, so decoding a batch of records runs
+ * a tight loop per field over the rows of its schema, with nothing looked
+ * up per row but the schema.
+ */
+
+#define SCHEMA_MAX 255 /**< Schemas in a registry */
+#define SCHEMA_NONE 0xFF
+
+typedef enum
+{
+	FIELD_U8 = 0,
+	FIELD_I8,
+	FIELD_U16,
+	FIELD_I16,
+	FIELD_U32,
+	FIELD_I32,
+	FIELD_TYPES
+} SchemaFieldType;
+
+class SchemaField;
+
+/**
+ * Decode loop of one field, over the rows @p sel of @p records
+ */
+typedef void (*SchemaDecodeFn)(SchemaField& field, const ExportRecord* records, const uint32_t* sel, size_t n, void* column);
+
+class SchemaField
+{
+public:
+	std::string name;
+	SchemaFieldType type;
+	uint8_t offset; /**< Of its first byte in the payload */
+	uint8_t shift; /**< Of its bits, with mask */
+	uint32_t mask; /**< 0 for the whole integer */
+	bool delta;
+	double scale; /**< 0 for integer values */
+
+	SchemaDecodeFn decode;
+	std::vector<int64_t> totals; /**< Of each node, for delta */
+
+	bool isScaled(void) const;
+};
+
+class Schema
+{
+public:
+	std::string name;
+	int type; /**< -1 for any */
+	int node; /**< -1 for any */
+	std::vector<SchemaField> fields;
+};
+
+/**
+ * Rows of one schema, decoded, see SchemaRegistry::decode()
+ */
+class SchemaColumns
+{
+public:
+	const Schema* schema;
+	size_t rows;
+	std::vector<uint32_t> sel; /**< Index of each row in the records decoded */
+
+	/**
+	 * Column of each field, of int64_t or, if the field is scaled, double
+	 */
+	std::vector<std::vector<int64_t> > ints;
+	std::vector<std::vector<double> > reals;
+
+	const int64_t* getInts(size_t field) const;
+	const double* getReals(size_t field) const;
+};
+
+class SchemaRegistry
+{
+public:
+	SchemaRegistry();
+
+	/**
+	 * Read the schemas of a file, see above
+	 *
+	 * @return False, with the line at fault on stderr, if one is wrong
+	 */
+	bool load(const std::string& path);
+	bool parse(const std::string& text, const std::string& name = "schema");
+
+	/**
+	 * Pick the decode loop of each field, and the schema of every node and type
+	 */
+	void compile(void);
+
+	/**
+	 * Index of the schema of a reading, SCHEMA_NONE if it has none
+	 */
+	uint8_t find(uint8_t type, uint16_t node) const;
+
+	/**
+	 * Decode @p n records into the columns of their schemas, once compiled
+	 *
+	 * @param out Gets the columns of each schema, by index; records without
+	 * a schema are left out
+	 */
+	void decode(const ExportRecord* records, size_t n, std::vector<SchemaColumns>& out);
+
+	size_t getCount(void) const;
+	Schema& getSchema(size_t index);
+
+private:
+	std::vector<Schema> schemas;
+
+	/**
+	 * Schema by node, of each type and of any type, left empty if no
+	 * schema names a node of it
+	 */
+	std::vector<uint8_t> by_node[256];
+	std::vector<uint8_t> by_node_any_type;
+	uint8_t any_node[256]; /**< Of each type */
+	uint8_t any;
+};
+
+#endif //__GATEWAY_SCHEMA_H__
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <algorithm>
+#include <sys/eventfd.h>
+
+#include "Shard.h"
+
+Shard::Shard(unsigned _index): index(_index), running(false)
+{
+	memset(&stats,0,sizeof(stats));
+	dispatched = false;
+	stored = 0;
+	wake_fd = -1;
+	done_fd = -1;
+}
+
+Shard::~Shard()
+{
+	stop();
+	if(wake_fd >= 0)
+		close(wake_fd);
+}
+
+bool Shard::begin(int _done_fd, const GatewayConfig& config)
+{
+	done_fd = _done_fd;
+
+	if(!config.store.empty())
+	{
+		// What the store has of ours, before we add a segment to it
+		stored = 0;
+		if(config.journal_records)
+		{
+			StoreReader reader;
+			if(reader.open(config.store))
+				stored = reader.getLastSequence(index);
+		}
+
+		if(!store.open(config.store,index))
+			return false;
+		if(config.rollup_word >= 0 && !rollup.open(config.store,index,config.rollup_word,config.journal_records > 0))
+			return false;
+
+		if(config.journal_records)
+		{
+			JournalConfig j;
+			j.commit_records = config.journal_records;
+			j.commit_us = config.journal_us;
+			journal.open(config.store,index,j);
+
+			// The rollups may be behind the store, never ahead of it
+			uint64_t after = rollup.isOpen() ? std::min(stored,rollup.getSequence()) : stored;
+			uint64_t n = journal.recover(after,*this,stored);
+			if(n)
+				printf("Shard %u: %llu readings recovered from the journal\n",index,(unsigned long long)n);
+			if(!store.sync() || (rollup.isOpen() && !rollup.sync()) || !journal.checkpoint())
+				return false;
+		}
+	}
+
+	metrics_timer.begin(config.metrics.empty() ? 0 : config.metrics_ms);
+
+	// The worker blocks in read() on it, there is nothing else to wait for
+	wake_fd = eventfd(0,EFD_CLOEXEC);
+	if(wake_fd < 0)
+	{
+		perror("eventfd");
+		return false;
+	}
+	return true;
+}
+
+bool Shard::start(void)
+{
+	running = true;
+	thread = std::thread(&Shard::run,this);
+	return true;
+}
+
+void Shard::stop(void)
+{
+	if(thread.joinable())
+	{
+		running = false;
+		uint64_t one = 1;
+		if(write(wake_fd,&one,sizeof(one)) != sizeof(one))
+			perror("eventfd");
+		thread.join();
+	}
+
+	store.close();
+	rollup.close();
+	if(journal.isOpen())
+	{
+		journal.checkpoint();
+		journal.close();
+	}
+}
+
+/****************************************************************************/
+
+bool Shard::dispatch(const MeshFrame& frame)
+{
+	if(!in.push(frame))
+		return false;
+	dispatched = true;
+	return true;
+}
+
+void Shard::kick(void)
+{
+	if(!dispatched)
+		return;
+
+	dispatched = false;
+	uint64_t one = 1;
+	if(write(wake_fd,&one,sizeof(one)) != sizeof(one))
+		perror("eventfd");
+}
+
+size_t Shard::collect(ExportRecord* records, size_t max)
+{
+	return out.pop(records,max);
+}
+
+/****************************************************************************/
+
+void Shard::run(void)
+{
+	for(;;)
+	{
+		// Sleep until frames come or the journal, the rollups or the metrics
+		// are due
+		int64_t until_us = service();
+		struct pollfd p;
+		p.fd = wake_fd;
+		p.events = POLLIN;
+		struct timespec timeout;
+		timeout.tv_sec = until_us / 1000000;
+		timeout.tv_nsec = (until_us % 1000000) * 1000;
+		if(ppoll(&p,1,until_us >= 0 ? &timeout : NULL,NULL) <= 0)
+			continue;
+
+		uint64_t count;
+		if(read(wake_fd,&count,sizeof(count)) != sizeof(count))
+			continue;
+		stats.wakeups++;
+
+		// Whatever was dispatched before stop() is still handled
+		bool stopping = !running;
+
+		size_t n;
+		bool queued = false;
+		while((n = in.pop(frames,SHARD_BATCH)) > 0)
+		{
+			process(frames,n);
+			queued = true;
+		}
+
+		if(queued)
+		{
+			uint64_t one = 1;
+			if(write(done_fd,&one,sizeof(one)) != sizeof(one))
+				perror("eventfd");
+		}
+
+		if(stopping)
+			break;
+	}
+}
+
+void Shard::process(const MeshFrame* f, size_t n)
+{
+	stats.frames += n;
+	for(size_t i=0;i<n;i++)
+	{
+		const RF24NetworkHeader& packet = f[i].header;
+
+		if(packet.type == 'S')
+			nodes.report(packet,f[i].time_us);
+		else if(!nodes.reading(packet,f[i].time_us))
+			continue;
+
+		ExportRecord r;
+		memset(&r,0,sizeof(r));
+		r.time_us = f[i].time_us;
+		r.network_ms = f[i].network_ms;
+		r.source = packet.source_data.ip;
+		r.from = packet.from_node;
+		r.id = packet.id;
+		r.hops = packet.source_data.weight;
+		r.type = packet.type;
+		r.flags = packet.flags;
+		memcpy(r.payload,packet.payload,sizeof(r.payload));
+
+		if(packet.type != 'S')
+		{
+			uint64_t sequence = journal.isOpen() ? journal.append(r) : 0;
+			if(store.isOpen())
+				store.append(r,sequence);
+			if(rollup.isOpen())
+				rollup.add(r,sequence);
+		}
+
+		// A full ring counts the record as lost, the worker does not wait
+		if(out.push(r))
+			stats.records++;
+	}
+}
+
+/**
+ * The sooner of two waits, -1 standing for none
+ */
+static int64_t sooner(int64_t a, int64_t b)
+{
+	return a < 0 || (b >= 0 && b < a) ? b : a;
+}
+
+int64_t Shard::service(void)
+{
+	int64_t metrics_us = metrics_timer.until();
+	if(metrics_us == 0)
+	{
+		publish();
+		metrics_us = metrics_timer.until();
+	}
+
+	int64_t expire_us = sooner(rollup.expire(),metrics_us);
+	if(!journal.isOpen())
+		return expire_us;
+
+	// The store and the rollups have to be on disk before the journal lets
+	// go of them
+	if(journal.isCheckpointDue() && store.sync() && (!rollup.isOpen() || rollup.sync()))
+		journal.checkpoint();
+
+	int64_t until_us = journal.untilCommit();
+	if(until_us == 0)
+	{
+		journal.commit();
+		until_us = -1;
+	}
+	return sooner(until_us,expire_us);
+}
+
+void Shard::publish(void)
+{
+	// The vector of the copy keeps its room, so this seldom allocates
+	ShardMetrics& m = metrics.write();
+	m.stats = stats;
+	m.table = nodes.getStats();
+	m.nodes.clear();
+	nodes.each([&m](const NodeState& n) { m.nodes.push_back(n); });
+	metrics.publish();
+}
+
+void Shard::replay(const ExportRecord& r, uint64_t sequence)
+{
+	if(sequence > stored)
+		store.append(r,sequence);
+	if(rollup.isOpen())
+		rollup.add(r,sequence);
+}
+
+/****************************************************************************/
+
+unsigned Shard::getIndex(void)
+{
+	return index;
+}
+
+bool Shard::receiveMetrics(ShardMetrics& out)
+{
+	if(!metrics.update())
+		return false;
+	out = metrics.read();
+	return true;
+}
+
+NodeTable& Shard::getNodes(void)
+{
+	return nodes;
+}
+
+StoreWriter& Shard::getStore(void)
+{
+	return store;
+}
+
+Journal& Shard::getJournal(void)
+{
+	return journal;
+}
+
+Rollup& Shard::getRollup(void)
+{
+	return rollup;
+}
+
+const ShardStats& Shard::getStats(void)
+{
+	return stats;
+}
+
+void Shard::getInStats(SpscRingStats& s)
+{
+	in.getStats(s);
+}
+
+void Shard::getOutStats(SpscRingStats& s)
+{
+	out.getStats(s);
+}
@@ -0,0 +1,183 @@
+#ifndef __GATEWAY_SHARD_H__
+#define __GATEWAY_SHARD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "ExportProtocol.h"
+#include "GatewayConfig.h"
+#include "Journal.h"
+#include "Metrics.h"
+#include "NodeTable.h"
+#include "RadioThread.h"
+#include "Rollup.h"
+#include "Snapshot.h"
+#include "SpscRing.h"
+#include "Store.h"
+
+/**
+ * @file Shard.h
+ *
+ * A worker of the gateway and the source nodes hashed to it
+ *
+ * The application thread hands each frame to the shard of its source,
+ * shardOf(), so all frames of a node are handled by one thread, in the
+ * order they came, against state no other thread touches.  The shard
+ * checks the frame against its NodeTable, turns it into an ExportRecord
+ * unless it is a repeat, appends readings to its own journal, segments of
+ * the store and rollups, see Journal.h, Store.h and Rollup.h, and queues the
+ * record on its out ring for the application thread to export.  Records of one node leave in order;
+ * those of nodes on different shards may swap places.
+ *
+ * Like the radio, a shard does not wait: frames for a full in ring are
+ * dropped by the application thread, records for a full out ring by the
+ * shard, both counted as @c full of their ring.
+ *
+ * Without threads, process() and collect() can be called from the
+ * application thread alone.
+ *
+ * With metrics, service() also publishes the counters of the worker and
+ * the state of each of its nodes every metrics period, see ShardMetrics.
+ */
+
+#define SHARD_IN_RING 2048 /**< Frames towards a worker */
+#define SHARD_OUT_RING 2048 /**< Records back from it */
+#define SHARD_BATCH 256 /**< Frames taken off the in ring at once */
+#define SHARD_MAX 16
+
+/**
+ * Index of the shard owning a source node, out of @p shards
+ *
+ * Multiplicative hashing, so addresses that share their low bits, as
+ * those of a tree of nodes do, still spread.
+ */
+inline unsigned shardOf(uint16_t ip, unsigned shards)
+{
+	return (unsigned)(((uint32_t)ip * 2654435761u) >> 16) % shards;
+}
+
+/**
+ * Counters of a worker
+ */
+typedef struct
+{
+	uint64_t wakeups;
+	uint64_t frames; /**< Handed to process() */
+	uint64_t records; /**< Queued on the out ring */
+} ShardStats;
+
+/**
+ * What a worker publishes for the metrics
+ */
+typedef struct
+{
+	ShardStats stats;
+	NodeTableStats table;
+	std::vector<NodeState> nodes;
+} ShardMetrics;
+
+class Shard: public JournalVisitor
+{
+public:
+	Shard(unsigned index);
+	~Shard();
+
+	/**
+	 * Open the store, the journal and the rollups, if the config has a store,
+	 * and replay what the journal has that the store or the rollups have not
+	 *
+	 * @param done_fd eventfd the worker writes after queueing records
+	 */
+	bool begin(int done_fd, const GatewayConfig& config);
+	bool start(void);
+
+	/**
+	 * Stop the thread once it handled what was dispatched, wait for it, seal
+	 * its segment of the store and sync its rollups, which also makes its
+	 * journal redundant
+	 */
+	void stop(void);
+
+	/**
+	 * Application side: queue a frame, false if the in ring is full
+	 */
+	bool dispatch(const MeshFrame& frame);
+
+	/**
+	 * Application side: wake the worker if frames were dispatched since the
+	 * last kick, once per batch rather than per frame
+	 */
+	void kick(void);
+
+	/**
+	 * Application side: take up to @p max records
+	 */
+	size_t collect(ExportRecord* out, size_t max);
+
+	/**
+	 * Worker side, or the application thread without a worker
+	 */
+	void process(const MeshFrame* frames, size_t n);
+
+	/**
+	 * Commit the journal or checkpoint it, write out buckets of quiet nodes
+	 * or publish the metrics, if that is due, by the worker or a timer of the
+	 * application thread without a worker
+	 *
+	 * @return Microseconds until the next of them is due, -1 for none
+	 */
+	int64_t service(void);
+
+	void replay(const ExportRecord& r, uint64_t sequence);
+
+	unsigned getIndex(void);
+
+	/**
+	 * Application side: copy out the counters published last
+	 *
+	 * @return False if none were published since the last call
+	 */
+	bool receiveMetrics(ShardMetrics& out);
+
+	/**
+	 * Only while the thread is stopped
+	 */
+	NodeTable& getNodes(void);
+	StoreWriter& getStore(void);
+	Journal& getJournal(void);
+	Rollup& getRollup(void);
+	const ShardStats& getStats(void);
+
+	void getInStats(SpscRingStats& stats);
+	void getOutStats(SpscRingStats& stats);
+
+private:
+	unsigned index;
+	NodeTable nodes;
+	StoreWriter store;
+	Journal journal;
+	Rollup rollup;
+	uint64_t stored; /**< Journal sequence the store had when opened */
+	ShardStats stats;
+	std::thread thread;
+	std::atomic<bool> running;
+	bool dispatched; /**< Frames went into the in ring since the last kick */
+
+	int wake_fd; /**< Blocking eventfd the worker sleeps on */
+	int done_fd;
+
+	SpscRing<MeshFrame, SHARD_IN_RING> in;
+	SpscRing<ExportRecord, SHARD_OUT_RING> out;
+	MeshFrame frames[SHARD_BATCH];
+
+	MetricsTimer metrics_timer;
+	Snapshot<ShardMetrics> metrics;
+
+	void run(void);
+	void publish(void);
+};
+
+#endif //__GATEWAY_SHARD_H__
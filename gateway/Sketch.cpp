@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "Sketch.h"
+
+QuantileSketch::QuantileSketch()
+{
+	clear();
+}
+
+void QuantileSketch::clear(void)
+{
+	offset = 0;
+	total = 0;
+	min = INT32_MAX;
+	max = INT32_MIN;
+	memset(counts,0,sizeof(counts));
+}
+
+int32_t QuantileSketch::key(int32_t v)
+{
+	if(!v)
+		return 0;
+
+	uint32_t magnitude = v < 0 ? 0 - (uint32_t)v : (uint32_t)v;
+	float f = (float)magnitude;
+	uint32_t bits;
+	memcpy(&bits,&f,sizeof(bits));
+
+	// 1 for 1, then SKETCH_SUB_BITS buckets per power of two
+	int32_t exponent = (int32_t)(bits >> 23) - 127;
+	int32_t sub = (bits >> (23 - SKETCH_SUB_BITS)) & ((1 << SKETCH_SUB_BITS) - 1);
+	int32_t k = 1 + (exponent << SKETCH_SUB_BITS) + sub;
+	return v < 0 ? -k : k;
+}
+
+int32_t QuantileSketch::value(int32_t k)
+{
+	if(!k)
+		return 0;
+
+	uint32_t m = (k < 0 ? -k : k) - 1;
+	uint32_t exponent = m >> SKETCH_SUB_BITS;
+	uint32_t sub = m & ((1 << SKETCH_SUB_BITS) - 1);
+
+	// The integers from the bottom of the bucket to below its top
+	double low = (double)(1ULL << exponent) * (1.0 + (double)sub / (1 << SKETCH_SUB_BITS));
+	double high = (double)(1ULL << exponent) * (1.0 + (double)(sub + 1) / (1 << SKETCH_SUB_BITS));
+	uint64_t first = (uint64_t)low;
+	if(first < low)
+		first++;
+	uint64_t last = (uint64_t)high;
+	if(last >= high)
+		last--;
+	int64_t middle = (int64_t)((first + last) / 2);
+
+	if(middle > INT32_MAX)
+		middle = INT32_MAX;
+	return (int32_t)(k < 0 ? -middle : middle);
+}
+
+void QuantileSketch::rebase(int32_t k)
+{
+	uint32_t moved[SKETCH_BUCKETS];
+	memset(moved,0,sizeof(moved));
+	for(int32_t i=0;i<SKETCH_BUCKETS;i++)
+	{
+		if(!counts[i])
+			continue;
+		int32_t j = offset + i - k;
+		if(j < 0)
+			j = 0;
+		moved[j] += counts[i];
+	}
+	memcpy(counts,moved,sizeof(counts));
+	offset = k;
+}
+
+void QuantileSketch::addKey(int32_t k, uint32_t count)
+{
+	if(!count)
+		return;
+
+	if(!total)
+		offset = k - SKETCH_BUCKETS / 2;
+	else if(k >= offset + SKETCH_BUCKETS)
+		rebase(k - SKETCH_BUCKETS + 1);
+	else if(k < offset)
+	{
+		// Lower the window as far as its highest bucket allows
+		int32_t top = SKETCH_BUCKETS - 1;
+		while(top > 0 && !counts[top])
+			top--;
+		int32_t room = SKETCH_BUCKETS - 1 - top;
+		int32_t lower = offset - k < room ? offset - k : room;
+		if(lower > 0)
+		{
+			memmove(counts + lower,counts,(SKETCH_BUCKETS - lower) * sizeof(counts[0]));
+			memset(counts,0,lower * sizeof(counts[0]));
+			offset -= lower;
+		}
+		if(k < offset)
+			k = offset;
+	}
+
+	counts[k - offset] += count;
+	total += count;
+}
+
+void QuantileSketch::addRange(int32_t low, int32_t high)
+{
+	min = low < min ? low : min;
+	max = high > max ? high : max;
+}
+
+void QuantileSketch::add(int32_t v)
+{
+	min = v < min ? v : min;
+	max = v > max ? v : max;
+
+	int32_t k = key(v);
+	if(total && k >= offset && k < offset + SKETCH_BUCKETS)
+	{
+		counts[k - offset]++;
+		total++;
+		return;
+	}
+	addKey(k,1);
+}
+
+void QuantileSketch::merge(const QuantileSketch& other)
+{
+	for(int32_t i=0;i<SKETCH_BUCKETS;i++)
+	{
+		if(other.counts[i])
+			addKey(other.offset + i,other.counts[i]);
+	}
+	addRange(other.min,other.max);
+}
+
+int32_t QuantileSketch::quantile(double q) const
+{
+	if(!total)
+		return 0;
+	if(q < 0)
+		q = 0;
+	if(q > 1)
+		q = 1;
+
+	uint64_t rank = (uint64_t)(q * (total - 1));
+	uint64_t seen = 0;
+	int32_t v = value(offset + SKETCH_BUCKETS - 1);
+	for(int32_t i=0;i<SKETCH_BUCKETS;i++)
+	{
+		seen += counts[i];
+		if(seen > rank)
+		{
+			v = value(offset + i);
+			break;
+		}
+	}
+	return v < min ? min : v > max ? max : v;
+}
+
+uint64_t QuantileSketch::getCount(void) const
+{
+	return total;
+}
+
+int32_t QuantileSketch::getMin(void) const
+{
+	return min;
+}
+
+int32_t QuantileSketch::getMax(void) const
+{
+	return max;
+}
+
+int32_t QuantileSketch::getOffset(void) const
+{
+	return offset;
+}
+
+const uint32_t* QuantileSketch::getCounts(void) const
+{
+	return counts;
+}
@@ -0,0 +1,86 @@
+#ifndef __GATEWAY_SKETCH_H__
+#define __GATEWAY_SKETCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file Sketch.h
+ *
+ * Quantiles of a stream of integers in a fixed amount of memory
+ *
+ * A value falls into a bucket by the exponent and the top SKETCH_SUB_BITS
+ * bits of the mantissa of its magnitude as a float, so a bucket is at most
+ * 1/16 of its values wide and a quantile, the middle of its bucket, is off
+ * by 3% of the value at most; integers below 16 each have their own.
+ * Negative values mirror positive ones.  SKETCH_BUCKETS consecutive buckets
+ * are counted; if the values spread wider, the lowest buckets are merged,
+ * so the low quantiles of such a sketch lose their accuracy first.
+ *
+ * Quantiles are kept between the least and the greatest value added.
+ *
+ * Two sketches merge into the one of both streams, so sketches of minutes
+ * add up to that of the hour.
+ */
+
+#define SKETCH_SUB_BITS 4
+#define SKETCH_BUCKETS 256
+
+class QuantileSketch
+{
+public:
+	QuantileSketch();
+
+	void clear(void);
+	void add(int32_t value);
+	void merge(const QuantileSketch& other);
+
+	/**
+	 * @param q 0 for the minimum to 1 for the maximum, roughly
+	 * @return 0 for an empty sketch
+	 */
+	int32_t quantile(double q) const;
+
+	uint64_t getCount(void) const;
+	int32_t getMin(void) const;
+	int32_t getMax(void) const;
+
+	/**
+	 * Bucket of a value, they are ordered like the values
+	 */
+	static int32_t key(int32_t value);
+
+	/**
+	 * Middle of the values of a bucket
+	 */
+	static int32_t value(int32_t key);
+
+	/**
+	 * Key of counts[0] and the count of each bucket from there, for storing
+	 * a sketch; the counts past the last one used are 0
+	 */
+	int32_t getOffset(void) const;
+	const uint32_t* getCounts(void) const;
+
+	/**
+	 * Add a bucket as stored, the inverse of getOffset() and getCounts(),
+	 * and then the least and greatest value of the stored sketch
+	 */
+	void addKey(int32_t key, uint32_t count);
+	void addRange(int32_t min, int32_t max);
+
+private:
+	int32_t offset;
+	uint64_t total;
+	int32_t min;
+	int32_t max;
+	uint32_t counts[SKETCH_BUCKETS];
+
+	/**
+	 * Move the window of buckets to start at @p key, folding the buckets
+	 * that fall below it into the first
+	 */
+	void rebase(int32_t key);
+};
+
+#endif //__GATEWAY_SKETCH_H__
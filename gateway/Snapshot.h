@@ -0,0 +1,79 @@
+#ifndef __GATEWAY_SNAPSHOT_H__
+#define __GATEWAY_SNAPSHOT_H__
+
+#include <stdint.h>
+#include <atomic>
+
+#include "SpscRing.h"
+
+/**
+ * @file Snapshot.h
+ *
+ * Latest value of something one thread keeps, for exactly one other thread
+ * to look at, lock-free
+ *
+ * There are three copies.  The writer fills its own and swaps it with the
+ * middle one, marked fresh; the reader swaps its own with the middle one
+ * when that is fresh.  Neither side ever waits for the other or sees a copy
+ * the other is using, and whatever the writer published between two looks
+ * of the reader is skipped.  The copy the writer gets back holds what it
+ * published two rounds ago or less, so it has to be filled in whole.
+ */
+
+#define SNAPSHOT_FRESH 4 /**< Flag of the middle index, published and not yet taken */
+
+template<class T> class Snapshot
+{
+public:
+	Snapshot(): back(0), middle(1), front(2) {}
+
+	/**
+	 * Writer side: the copy to fill in
+	 */
+	T& write(void)
+	{
+		return copies[back].value;
+	}
+
+	/**
+	 * Writer side: hand over what write() was filled with
+	 */
+	void publish(void)
+	{
+		back = middle.exchange(back | SNAPSHOT_FRESH,std::memory_order_acq_rel) & ~SNAPSHOT_FRESH;
+	}
+
+	/**
+	 * Reader side: move on to the latest copy published
+	 *
+	 * @return False if none was since the last call, read() is unchanged
+	 */
+	bool update(void)
+	{
+		if(!(middle.load(std::memory_order_relaxed) & SNAPSHOT_FRESH))
+			return false;
+		front = middle.exchange(front,std::memory_order_acq_rel) & ~SNAPSHOT_FRESH;
+		return true;
+	}
+
+	/**
+	 * Reader side: the copy taken by the last update()
+	 */
+	const T& read(void) const
+	{
+		return copies[front].value;
+	}
+
+private:
+	struct Copy
+	{
+		alignas(SPSC_CACHE_LINE) T value;
+	};
+
+	uint8_t back; /**< Writer's own */
+	alignas(SPSC_CACHE_LINE) std::atomic<uint8_t> middle;
+	alignas(SPSC_CACHE_LINE) uint8_t front; /**< Reader's own */
+	Copy copies[3];
+};
+
+#endif //__GATEWAY_SNAPSHOT_H__
@@ -0,0 +1,142 @@
+#ifndef __GATEWAY_SPSC_RING_H__
+#define __GATEWAY_SPSC_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * @file SpscRing.h
+ *
+ * Lock-free ring between exactly one producer and one consumer thread
+ *
+ * The producer only writes @c head and the consumer only writes @c tail,
+ * each on its own cache line, so the two never contend for a line except
+ * to see the other's progress.  Each side also keeps the last position of
+ * the other it loaded, and loads it again only when the ring looks full
+ * or empty, so a batch of pushes or pops costs one shared load.
+ *
+ * Counters are relaxed atomics written by their own side, any thread may
+ * read them.
+ */
+
+#define SPSC_CACHE_LINE 64
+
+/**
+ * Counters of a ring, see SpscRing::getStats()
+ */
+typedef struct
+{
+	uint64_t pushed;
+	uint64_t full; /**< Pushes refused because the ring was full */
+	uint64_t popped;
+	uint64_t batches; /**< pop() calls that returned something */
+	size_t depth; /**< Items in the ring when the counters were taken */
+	size_t high_water;
+	size_t capacity;
+} SpscRingStats;
+
+template<class T, size_t N> class SpscRing
+{
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "the capacity of a ring is a power of two");
+
+public:
+	SpscRing(): head(0), cached_tail(0), pushed(0), full(0), tail(0), cached_head(0), popped(0), batches(0), high_water(0) {}
+
+	/**
+	 * Producer side
+	 *
+	 * @return False if the ring is full, the item is not taken
+	 */
+	bool push(const T& item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if(h - cached_tail >= N)
+		{
+			cached_tail = tail.load(std::memory_order_acquire);
+			if(h - cached_tail >= N)
+			{
+				full.store(full.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+				return false;
+			}
+		}
+
+		items[h & (N - 1)] = item;
+		head.store(h + 1,std::memory_order_release);
+
+		pushed.store(pushed.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+		return true;
+	}
+
+	/**
+	 * Consumer side, take up to @p max items at once
+	 *
+	 * @return The number of items copied to @p out
+	 */
+	size_t pop(T* out, size_t max)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if(cached_head - t < max)
+			cached_head = head.load(std::memory_order_acquire);
+
+		// The producer's cached tail may be stale, so the depth is taken here
+		size_t n = cached_head - t;
+		if(n > high_water.load(std::memory_order_relaxed))
+			high_water.store(n,std::memory_order_relaxed);
+		if(n > max)
+			n = max;
+		if(!n)
+			return 0;
+
+		for(size_t i=0;i<n;i++)
+			out[i] = items[(t + i) & (N - 1)];
+		tail.store(t + n,std::memory_order_release);
+
+		popped.store(popped.load(std::memory_order_relaxed) + n,std::memory_order_relaxed);
+		batches.store(batches.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+		return n;
+	}
+
+	bool pop(T& out)
+	{
+		return pop(&out,1) == 1;
+	}
+
+	/**
+	 * Items in the ring, exact only from one of its two threads when the
+	 * other is not running
+	 */
+	size_t depth(void) const
+	{
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+
+	void getStats(SpscRingStats& stats) const
+	{
+		stats.pushed = pushed.load(std::memory_order_relaxed);
+		stats.full = full.load(std::memory_order_relaxed);
+		stats.popped = popped.load(std::memory_order_relaxed);
+		stats.batches = batches.load(std::memory_order_relaxed);
+		stats.depth = depth();
+		stats.high_water = high_water.load(std::memory_order_relaxed);
+		stats.capacity = N;
+	}
+
+private:
+	// Producer
+	alignas(SPSC_CACHE_LINE) std::atomic<size_t> head;
+	size_t cached_tail;
+	std::atomic<uint64_t> pushed;
+	std::atomic<uint64_t> full;
+
+	// Consumer
+	alignas(SPSC_CACHE_LINE) std::atomic<size_t> tail;
+	size_t cached_head;
+	std::atomic<uint64_t> popped;
+	std::atomic<uint64_t> batches;
+	std::atomic<size_t> high_water; /**< Deepest the consumer found the ring */
+
+	alignas(SPSC_CACHE_LINE) T items[N];
+};
+
+#endif //__GATEWAY_SPSC_RING_H__
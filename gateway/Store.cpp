@@ -0,0 +1,606 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+
+#include "Store.h"
+
+#define STORE_VARINT_MAX 10 /**< Bytes of the longest varint, a 64 bit value */
+
+/**
+ * Blocks start at multiples of this in a segment
+ */
+#define STORE_ALIGN 8
+
+static size_t alignUp(size_t n)
+{
+	return (n + STORE_ALIGN - 1) & ~(size_t)(STORE_ALIGN - 1);
+}
+
+/**
+ * Delta, zigzag and varint code @p n values, see StoreFormat.h
+ */
+template<class T> static uint8_t* encodeColumn(const T* v, size_t n, uint8_t* out)
+{
+	uint64_t prev = 0;
+	for(size_t i=0;i<n;i++)
+	{
+		int64_t d = (int64_t)((uint64_t)v[i] - prev);
+		prev = v[i];
+
+		uint64_t z = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+		while(z >= 0x80)
+		{
+			*out++ = (uint8_t)z | 0x80;
+			z >>= 7;
+		}
+		*out++ = (uint8_t)z;
+	}
+	return out;
+}
+
+/**
+ * @return Past the last byte read, NULL if the column ends early
+ */
+template<class T> static const uint8_t* decodeColumn(const uint8_t* p, const uint8_t* end, T* v, size_t n)
+{
+	uint64_t prev = 0;
+	for(size_t i=0;i<n;i++)
+	{
+		uint64_t z = 0;
+		unsigned shift = 0;
+		uint8_t b;
+		do
+		{
+			if(p >= end || shift >= 7 * STORE_VARINT_MAX)
+				return NULL;
+			b = *p++;
+			z |= (uint64_t)(b & 0x7F) << shift;
+			shift += 7;
+		}
+		while(b & 0x80);
+
+		prev += (z >> 1) ^ (0 - (z & 1));
+		v[i] = (T)prev;
+	}
+	return p;
+}
+
+static uint64_t nowUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/****************************************************************************/
+
+StoreWriter::StoreWriter(): shard(0), sequence(0), fd(-1), map(NULL), used(0), last_sequence(0)
+{
+	memset(&stats,0,sizeof(stats));
+	block = new StoreBlock;
+	block->rows = 0;
+}
+
+StoreWriter::~StoreWriter()
+{
+	close();
+	delete block;
+}
+
+bool StoreWriter::open(const std::string& _dir, unsigned _shard)
+{
+	dir = _dir;
+	shard = _shard;
+
+	if(mkdir(dir.c_str(),0755) < 0 && errno != EEXIST)
+	{
+		perror(dir.c_str());
+		return false;
+	}
+
+	// Carry on after the last segment of this shard
+	DIR* d = opendir(dir.c_str());
+	if(!d)
+	{
+		perror(dir.c_str());
+		return false;
+	}
+	sequence = 0;
+	struct dirent* e;
+	while((e = readdir(d)) != NULL)
+	{
+		unsigned s, q;
+		if(sscanf(e->d_name,"seg-%u-%u.rts",&s,&q) == 2 && s == shard && q >= sequence)
+			sequence = q + 1;
+	}
+	closedir(d);
+
+	return startSegment();
+}
+
+void StoreWriter::close(void)
+{
+	if(fd < 0)
+		return;
+	flush();
+	sealSegment();
+}
+
+bool StoreWriter::isOpen(void)
+{
+	return fd >= 0;
+}
+
+bool StoreWriter::startSegment(void)
+{
+	char name[32];
+	snprintf(name,sizeof(name),"/seg-%u-%08u.rts",shard,sequence);
+	std::string path = dir + name;
+
+	fd = ::open(path.c_str(),O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,0644);
+	if(fd < 0)
+	{
+		perror(path.c_str());
+		return false;
+	}
+
+	// Sparse, only what is written takes space
+	if(ftruncate(fd,STORE_SEGMENT_BYTES) < 0)
+	{
+		perror(path.c_str());
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	void* m = mmap(NULL,STORE_SEGMENT_BYTES,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+	if(m == MAP_FAILED)
+	{
+		perror("mmap");
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	map = (uint8_t*)m;
+
+	StoreSegmentHeader h;
+	memset(&h,0,sizeof(h));
+	h.magic = STORE_SEGMENT_MAGIC;
+	h.version = STORE_VERSION;
+	h.shard = shard;
+	h.sequence = sequence;
+	h.created_us = nowUs();
+	memcpy(map,&h,sizeof(h));
+
+	used = alignUp(sizeof(h));
+	index.clear();
+	stats.segments++;
+	return true;
+}
+
+void StoreWriter::sealSegment(void)
+{
+	if(fd < 0)
+		return;
+
+	munmap(map,STORE_SEGMENT_BYTES);
+	map = NULL;
+
+	StoreSegmentFooter f;
+	memset(&f,0,sizeof(f));
+	f.index_offset = used;
+	f.blocks = index.size();
+	f.min_time_us = index.empty() ? 0 : UINT64_MAX;
+	for(size_t i=0;i<index.size();i++)
+	{
+		const StoreBlockSummary& s = index[i].summary;
+		f.rows += s.rows;
+		f.min_time_us = std::min(f.min_time_us,s.min_time_us);
+		f.max_time_us = std::max(f.max_time_us,s.max_time_us);
+	}
+	f.version = STORE_VERSION;
+	f.magic = STORE_FOOTER_MAGIC;
+
+	size_t index_bytes = index.size() * sizeof(StoreIndexEntry);
+	if(pwrite(fd,index.data(),index_bytes,used) != (ssize_t)index_bytes ||
+		pwrite(fd,&f,sizeof(f),used + index_bytes) != sizeof(f) ||
+		ftruncate(fd,used + index_bytes + sizeof(f)) < 0 || fdatasync(fd) < 0)
+		perror("seal segment");
+
+	::close(fd);
+	fd = -1;
+	sequence++;
+}
+
+/****************************************************************************/
+
+void StoreWriter::append(const ExportRecord& r, uint64_t sequence)
+{
+	if(r.type != 'D' && r.type != 'F')
+		return;
+
+	if(block->rows && r.time_us - block->time_us[0] >= STORE_BLOCK_US)
+		flush();
+
+	size_t i = block->rows++;
+	block->time_us[i] = r.time_us;
+	block->network_ms[i] = r.network_ms;
+	block->source[i] = r.source;
+	block->id[i] = r.id;
+	block->hops[i] = r.hops;
+	block->flags[i] = r.flags;
+	for(unsigned w=0;w<STORE_PAYLOAD_WORDS;w++)
+		memcpy(&block->payload[w][i],r.payload + w * 4,4);
+	if(sequence)
+		last_sequence = sequence;
+	stats.rows++;
+
+	if(block->rows == STORE_BLOCK_ROWS)
+		flush();
+}
+
+void StoreWriter::flush(void)
+{
+	size_t rows = block->rows;
+	if(!rows)
+		return;
+	block->rows = 0;
+
+	size_t worst = alignUp(sizeof(StoreBlockHeader) + rows * STORE_COLUMNS * STORE_VARINT_MAX);
+	if(fd >= 0 && used + worst > STORE_SEGMENT_BYTES)
+		sealSegment();
+	if(fd < 0 && !startSegment())
+	{
+		stats.failed += rows;
+		return;
+	}
+
+	StoreBlockHeader h;
+	memset(&h,0,sizeof(h));
+	StoreBlockSummary& s = h.summary;
+	s.rows = rows;
+	s.last_sequence = last_sequence;
+	s.min_source = 0xFFFF;
+	s.min_time_us = UINT64_MAX;
+	s.min_network_ms = UINT32_MAX;
+	for(size_t i=0;i<rows;i++)
+	{
+		s.min_source = std::min(s.min_source,block->source[i]);
+		s.max_source = std::max(s.max_source,block->source[i]);
+		s.min_time_us = std::min(s.min_time_us,block->time_us[i]);
+		s.max_time_us = std::max(s.max_time_us,block->time_us[i]);
+		s.min_network_ms = std::min(s.min_network_ms,block->network_ms[i]);
+		s.max_network_ms = std::max(s.max_network_ms,block->network_ms[i]);
+		unsigned bit = storeSourceBit(block->source[i]);
+		s.sources[bit / 64] |= 1ULL << (bit % 64);
+	}
+
+	uint8_t* start = map + used;
+	uint8_t* p = start + sizeof(h);
+	uint8_t* c = p;
+	p = encodeColumn(block->time_us,rows,p);	h.column_bytes[STORE_TIME] = p - c; c = p;
+	p = encodeColumn(block->network_ms,rows,p);	h.column_bytes[STORE_NETWORK] = p - c; c = p;
+	p = encodeColumn(block->source,rows,p);	h.column_bytes[STORE_SOURCE] = p - c; c = p;
+	p = encodeColumn(block->id,rows,p);	h.column_bytes[STORE_ID] = p - c; c = p;
+	p = encodeColumn(block->hops,rows,p);	h.column_bytes[STORE_HOPS] = p - c; c = p;
+	p = encodeColumn(block->flags,rows,p);	h.column_bytes[STORE_FLAGS] = p - c; c = p;
+	for(unsigned w=0;w<STORE_PAYLOAD_WORDS;w++)
+	{
+		p = encodeColumn(block->payload[w],rows,p);
+		h.column_bytes[STORE_PAYLOAD + w] = p - c;
+		c = p;
+	}
+	h.bytes = p - start;
+
+	// The magic goes in last, a reader of the live segment stops at a block
+	// without one
+	memcpy(start,&h,sizeof(h));
+	std::atomic_thread_fence(std::memory_order_release);
+	uint32_t magic = STORE_BLOCK_MAGIC;
+	memcpy(start,&magic,sizeof(magic));
+
+	StoreIndexEntry e;
+	e.offset = used;
+	e.summary = s;
+	index.push_back(e);
+
+	used += alignUp(h.bytes);
+	stats.blocks++;
+	stats.bytes += h.bytes;
+}
+
+bool StoreWriter::sync(void)
+{
+	flush();
+	if(fd < 0)
+		return false;
+	if(msync(map,used,MS_SYNC) < 0)
+	{
+		perror("msync");
+		return false;
+	}
+	return true;
+}
+
+const StoreStats& StoreWriter::getStats(void)
+{
+	return stats;
+}
+
+/****************************************************************************/
+
+StoreReader::StoreReader(): decoded(0)
+{
+	memset(&stats,0,sizeof(stats));
+	block = new StoreBlock;
+	block->rows = 0;
+}
+
+StoreReader::~StoreReader()
+{
+	close();
+	delete block;
+}
+
+bool StoreReader::open(const std::string& dir)
+{
+	close();
+
+	DIR* d = opendir(dir.c_str());
+	if(!d)
+	{
+		perror(dir.c_str());
+		return false;
+	}
+	std::vector<std::string> names;
+	struct dirent* e;
+	while((e = readdir(d)) != NULL)
+	{
+		size_t len = strlen(e->d_name);
+		if(!strncmp(e->d_name,"seg-",4) && len > 8 && !strcmp(e->d_name + len - 4,".rts"))
+			names.push_back(e->d_name);
+	}
+	closedir(d);
+	std::sort(names.begin(),names.end());
+
+	stats.min_time_us = UINT64_MAX;
+	for(size_t i=0;i<names.size();i++)
+	{
+		Segment s;
+		s.name = dir + "/" + names[i];
+		s.map = NULL;
+		s.size = 0;
+
+		int fd = ::open(s.name.c_str(),O_RDONLY | O_CLOEXEC);
+		struct stat st;
+		if(fd < 0 || fstat(fd,&st) < 0 || (size_t)st.st_size < sizeof(StoreSegmentHeader))
+		{
+			if(fd >= 0)
+				::close(fd);
+			continue;
+		}
+		void* m = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+		::close(fd);
+		if(m == MAP_FAILED)
+			continue;
+		s.map = (const uint8_t*)m;
+		s.size = st.st_size;
+
+		if(!load(s))
+		{
+			fprintf(stderr,"%s: not a segment\n",s.name.c_str());
+			munmap((void*)s.map,s.size);
+			continue;
+		}
+		segments.push_back(s);
+
+		stats.segments++;
+		for(size_t j=0;j<s.index.size();j++)
+		{
+			const StoreBlockSummary& b = s.index[j].summary;
+			stats.blocks++;
+			stats.rows += b.rows;
+			stats.min_time_us = std::min(stats.min_time_us,b.min_time_us);
+			stats.max_time_us = std::max(stats.max_time_us,b.max_time_us);
+
+			StoreBlockHeader h;
+			memcpy(&h,s.map + s.index[j].offset,sizeof(h));
+			stats.bytes += h.bytes;
+		}
+	}
+	if(!stats.rows)
+		stats.min_time_us = 0;
+	return true;
+}
+
+void StoreReader::close(void)
+{
+	for(size_t i=0;i<segments.size();i++)
+		munmap((void*)segments[i].map,segments[i].size);
+	segments.clear();
+	memset(&stats,0,sizeof(stats));
+}
+
+/**
+ * Read the index of a segment, or rebuild it from its blocks if it was not
+ * sealed
+ */
+bool StoreReader::load(Segment& s)
+{
+	StoreSegmentHeader h;
+	memcpy(&h,s.map,sizeof(h));
+	if(h.magic != STORE_SEGMENT_MAGIC || h.version != STORE_VERSION)
+		return false;
+	s.shard = h.shard;
+
+	StoreSegmentFooter f;
+	if(s.size >= sizeof(h) + sizeof(f))
+	{
+		memcpy(&f,s.map + s.size - sizeof(f),sizeof(f));
+		if(f.magic == STORE_FOOTER_MAGIC &&
+			f.index_offset + (uint64_t)f.blocks * sizeof(StoreIndexEntry) + sizeof(f) == s.size)
+		{
+			s.index.resize(f.blocks);
+			memcpy(s.index.data(),s.map + f.index_offset,f.blocks * sizeof(StoreIndexEntry));
+			stats.sealed++;
+			return true;
+		}
+	}
+
+	size_t offset = alignUp(sizeof(h));
+	while(offset + sizeof(StoreBlockHeader) <= s.size)
+	{
+		StoreBlockHeader b;
+		memcpy(&b,s.map + offset,sizeof(b));
+		if(b.magic != STORE_BLOCK_MAGIC || b.bytes < sizeof(b) || offset + b.bytes > s.size ||
+			!b.summary.rows || b.summary.rows > STORE_BLOCK_ROWS)
+			break;
+
+		StoreIndexEntry e;
+		e.offset = offset;
+		e.summary = b.summary;
+		s.index.push_back(e);
+		offset += alignUp(b.bytes);
+	}
+	return true;
+}
+
+#define STORE_ALL_COLUMNS ((1 << STORE_COLUMNS) - 1)
+
+bool StoreReader::decode(const Segment& s, const StoreIndexEntry& e, uint32_t columns)
+{
+	StoreBlockHeader h;
+	memcpy(&h,s.map + e.offset,sizeof(h));
+	if(h.magic != STORE_BLOCK_MAGIC || e.offset + h.bytes > s.size)
+		return false;
+
+	size_t rows = h.summary.rows;
+	const uint8_t* p = s.map + e.offset + sizeof(h);
+	const uint8_t* end = s.map + e.offset + h.bytes;
+
+	const uint8_t* c[STORE_COLUMNS + 1];
+	for(unsigned i=0;i<STORE_COLUMNS;i++)
+	{
+		c[i] = p;
+		p += h.column_bytes[i];
+		if(p > end)
+			return false;
+	}
+	c[STORE_COLUMNS] = p;
+
+#define STORE_DECODE(column, out) \
+	(!(columns & (1 << (column))) || decodeColumn(c[column],c[(column) + 1],out,rows))
+
+	bool ok = STORE_DECODE(STORE_TIME,block->time_us) &&
+		STORE_DECODE(STORE_NETWORK,block->network_ms) &&
+		STORE_DECODE(STORE_SOURCE,block->source) &&
+		STORE_DECODE(STORE_ID,block->id) &&
+		STORE_DECODE(STORE_HOPS,block->hops) &&
+		STORE_DECODE(STORE_FLAGS,block->flags);
+	for(unsigned w=0;ok && w<STORE_PAYLOAD_WORDS;w++)
+		ok = STORE_DECODE(STORE_PAYLOAD + w,block->payload[w]);
+#undef STORE_DECODE
+	if(!ok)
+		return false;
+
+	block->rows = rows;
+	decoded++;
+	return true;
+}
+
+uint64_t StoreReader::scan(uint64_t from_us, uint64_t to_us, int source, StoreVisitor& visitor)
+{
+	return scan(from_us,to_us,source,STORE_ALL_COLUMNS,true,visitor);
+}
+
+uint64_t StoreReader::scanBlocks(uint64_t from_us, uint64_t to_us, int source, uint32_t columns, StoreVisitor& visitor)
+{
+	return scan(from_us,to_us,source,columns,false,visitor);
+}
+
+uint64_t StoreReader::scan(uint64_t from_us, uint64_t to_us, int source, uint32_t columns, bool filter, StoreVisitor& visitor)
+{
+	uint64_t total = 0;
+	for(size_t i=0;i<segments.size();i++)
+	{
+		const Segment& seg = segments[i];
+		for(size_t j=0;j<seg.index.size();j++)
+		{
+			const StoreBlockSummary& s = seg.index[j].summary;
+			if(s.max_time_us < from_us || s.min_time_us >= to_us)
+				continue;
+			if(source >= 0)
+			{
+				unsigned bit = storeSourceBit(source);
+				if(source < s.min_source || source > s.max_source || !(s.sources[bit / 64] & (1ULL << (bit % 64))))
+					continue;
+			}
+			if(!decode(seg,seg.index[j],columns))
+			{
+				fprintf(stderr,"%s: bad block at %llu\n",seg.name.c_str(),(unsigned long long)seg.index[j].offset);
+				continue;
+			}
+
+			// Keep the rows that fall in, unless the block is all in
+			bool all = s.min_time_us >= from_us && s.max_time_us < to_us &&
+				(source < 0 || (s.min_source == source && s.max_source == source));
+			if(filter && !all)
+			{
+				StoreBlock& b = *block;
+				size_t n = 0;
+				for(size_t r=0;r<b.rows;r++)
+				{
+					if(b.time_us[r] < from_us || b.time_us[r] >= to_us || (source >= 0 && b.source[r] != source))
+						continue;
+					b.time_us[n] = b.time_us[r];
+					b.network_ms[n] = b.network_ms[r];
+					b.source[n] = b.source[r];
+					b.id[n] = b.id[r];
+					b.hops[n] = b.hops[r];
+					b.flags[n] = b.flags[r];
+					for(unsigned w=0;w<STORE_PAYLOAD_WORDS;w++)
+						b.payload[w][n] = b.payload[w][r];
+					n++;
+				}
+				b.rows = n;
+			}
+
+			if(block->rows)
+			{
+				total += block->rows;
+				visitor.rows(*block);
+			}
+		}
+	}
+	return total;
+}
+
+uint64_t StoreReader::getLastSequence(unsigned shard)
+{
+	uint64_t last = 0;
+	for(size_t i=0;i<segments.size();i++)
+	{
+		if(segments[i].shard != shard)
+			continue;
+		for(size_t j=0;j<segments[i].index.size();j++)
+			last = std::max(last,segments[i].index[j].summary.last_sequence);
+	}
+	return last;
+}
+
+uint64_t StoreReader::getBlocksDecoded(void)
+{
+	return decoded;
+}
+
+const StoreReaderStats& StoreReader::getStats(void)
+{
+	return stats;
+}
@@ -0,0 +1,210 @@
+#ifndef __GATEWAY_STORE_H__
+#define __GATEWAY_STORE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "ExportProtocol.h"
+#include "StoreFormat.h"
+
+/**
+ * @file Store.h
+ *
+ * Append-only column store of the readings the mesh delivered
+ *
+ * Each worker of the gateway appends the readings of its nodes to its own
+ * StoreWriter, so appending takes no lock.  Rows are collected column by
+ * column in a StoreBlock, which is encoded straight into the memory map of
+ * the current segment once it holds STORE_BLOCK_ROWS rows, or when a row
+ * comes STORE_BLOCK_US after its first one.  A segment is sealed with its
+ * index when the next block might not fit, and a new one is started.
+ *
+ * A StoreReader maps every segment of a directory and scans them for a
+ * time range and optionally one source node, decoding only the blocks whose
+ * summary says they may hold any; see StoreFormat.h for the files.
+ *
+ * The store is not a journal: rows still in the StoreBlock of a worker are
+ * lost if the gateway dies, and mapped pages reach the disk when the kernel
+ * writes them back, or when a segment is sealed.
+ */
+
+#define STORE_SEGMENT_BYTES (64 * 1024 * 1024) /**< Mapped per segment, truncated when sealed */
+#define STORE_BLOCK_US 1000000 /**< Longest a row waits for its block to fill */
+
+/**
+ * Rows in columns, as kept while appending and handed out by scans
+ */
+typedef struct
+{
+	size_t rows;
+	uint64_t time_us[STORE_BLOCK_ROWS];
+	uint32_t network_ms[STORE_BLOCK_ROWS];
+	uint16_t source[STORE_BLOCK_ROWS];
+	uint16_t id[STORE_BLOCK_ROWS];
+	uint8_t hops[STORE_BLOCK_ROWS];
+	uint8_t flags[STORE_BLOCK_ROWS];
+	uint32_t payload[STORE_PAYLOAD_WORDS][STORE_BLOCK_ROWS];
+} StoreBlock;
+
+/**
+ * Counters of a writer
+ */
+typedef struct
+{
+	uint64_t rows;
+	uint64_t blocks;
+	uint64_t segments; /**< Started */
+	uint64_t bytes; /**< Of encoded blocks */
+	uint64_t failed; /**< Rows lost because a segment could not be had */
+} StoreStats;
+
+class StoreWriter
+{
+public:
+	StoreWriter();
+	~StoreWriter();
+
+	/**
+	 * Start a new segment in @p dir, which is made if missing
+	 *
+	 * @param shard Tells the files of writers sharing the directory apart
+	 */
+	bool open(const std::string& dir, unsigned shard);
+
+	/**
+	 * Seal the current segment
+	 */
+	void close(void);
+
+	bool isOpen(void);
+
+	/**
+	 * Append a reading, 'D' and 'F' records only
+	 *
+	 * @param sequence Of the reading in the journal, see Journal.h
+	 */
+	void append(const ExportRecord& r, uint64_t sequence = 0);
+
+	/**
+	 * Write out the rows collected so far as a block
+	 */
+	void flush(void);
+
+	/**
+	 * Flush, and wait until the segment so far is on disk
+	 */
+	bool sync(void);
+
+	const StoreStats& getStats(void);
+
+private:
+	std::string dir;
+	unsigned shard;
+	uint32_t sequence; /**< Of the current segment */
+	int fd;
+	uint8_t* map;
+	size_t used; /**< Bytes of the current segment written */
+	std::vector<StoreIndexEntry> index;
+	StoreStats stats;
+	StoreBlock* block;
+	uint64_t last_sequence; /**< Of the rows in block */
+
+	bool startSegment(void);
+	void sealSegment(void);
+};
+
+/**
+ * Rows of a scan, see StoreReader::scan()
+ */
+class StoreVisitor
+{
+public:
+	virtual ~StoreVisitor() {}
+
+	/**
+	 * Rows of one block that fall in the scan, in the order they were appended
+	 */
+	virtual void rows(const StoreBlock& block) = 0;
+};
+
+/**
+ * What a reader found, see StoreReader::getStats()
+ */
+typedef struct
+{
+	size_t segments;
+	size_t sealed;
+	uint64_t blocks;
+	uint64_t rows;
+	uint64_t bytes; /**< Of blocks */
+	uint64_t min_time_us;
+	uint64_t max_time_us;
+} StoreReaderStats;
+
+class StoreReader
+{
+public:
+	StoreReader();
+	~StoreReader();
+
+	/**
+	 * Map every segment in @p dir
+	 *
+	 * @return False if the directory cannot be read
+	 */
+	bool open(const std::string& dir);
+	void close(void);
+
+	/**
+	 * Hand every row with @p from_us <= time_us < @p to_us to @p visitor
+	 *
+	 * @param source The node to scan for, -1 for all
+	 * @return Rows handed out
+	 */
+	uint64_t scan(uint64_t from_us, uint64_t to_us, int source, StoreVisitor& visitor);
+
+	/**
+	 * Hand every block that may hold rows of scan() to @p visitor as a
+	 * whole, for visitors that pick the rows themselves, see Query.h
+	 *
+	 * @param columns Bit 1 << StoreColumn of each column to decode, the
+	 * others are left as they were
+	 * @return Rows handed out
+	 */
+	uint64_t scanBlocks(uint64_t from_us, uint64_t to_us, int source, uint32_t columns, StoreVisitor& visitor);
+
+	/**
+	 * Journal sequence of the last row written by @p shard, 0 if none
+	 */
+	uint64_t getLastSequence(unsigned shard);
+
+	/**
+	 * Blocks decoded by the scans, those skipped by their summary are not
+	 */
+	uint64_t getBlocksDecoded(void);
+
+	const StoreReaderStats& getStats(void);
+
+private:
+	typedef struct
+	{
+		std::string name;
+		unsigned shard;
+		const uint8_t* map;
+		size_t size;
+		std::vector<StoreIndexEntry> index;
+	} Segment;
+
+	std::vector<Segment> segments;
+	StoreReaderStats stats;
+	uint64_t decoded;
+	StoreBlock* block;
+
+	bool load(Segment& s);
+	bool decode(const Segment& s, const StoreIndexEntry& e, uint32_t columns);
+	uint64_t scan(uint64_t from_us, uint64_t to_us, int source, uint32_t columns, bool filter, StoreVisitor& visitor);
+};
+
+#endif //__GATEWAY_STORE_H__
@@ -0,0 +1,111 @@
+#ifndef __GATEWAY_STORE_FORMAT_H__
+#define __GATEWAY_STORE_FORMAT_H__
+
+#include <stdint.h>
+
+/**
+ * @file StoreFormat.h
+ *
+ * Files of the reading store of the gateway, see Store.h
+ *
+ * A store is a directory of segment files, @c seg-<shard>-<sequence>.rts,
+ * each written by one worker only.  A segment is a StoreSegmentHeader,
+ * then blocks of up to STORE_BLOCK_ROWS readings, then, once it is sealed,
+ * an index of its blocks and a StoreSegmentFooter as the last bytes of the
+ * file.  A segment without a footer, because it is still being written or
+ * the gateway died, is read by walking its block headers up to the first
+ * that is not one.
+ *
+ * A block is a StoreBlockHeader followed by its columns, one after the
+ * other in StoreColumn order.  Each column holds the difference of every
+ * value to the one before, the first to 0, zigzag coded so small negative
+ * ones stay small, as a little endian base 128 varint.
+ *
+ * Everything is little endian.
+ */
+
+#define STORE_SEGMENT_MAGIC 0x31535452 /**< "RTS1" */
+#define STORE_BLOCK_MAGIC 0x4B4C4252 /**< "RBLK" */
+#define STORE_FOOTER_MAGIC 0x58444952 /**< "RIDX" */
+#define STORE_VERSION 2
+
+#define STORE_BLOCK_ROWS 4096
+#define STORE_PAYLOAD_WORDS 4 /**< The 16 payload bytes, as 32 bit words */
+
+typedef enum
+{
+	STORE_TIME = 0, /**< time_us */
+	STORE_NETWORK, /**< network_ms */
+	STORE_SOURCE,
+	STORE_ID,
+	STORE_HOPS,
+	STORE_FLAGS,
+	STORE_PAYLOAD, /**< STORE_PAYLOAD_WORDS columns, one per word */
+	STORE_COLUMNS = STORE_PAYLOAD + STORE_PAYLOAD_WORDS
+} StoreColumn;
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t shard;
+	uint32_t sequence;
+	uint32_t reserved;
+	uint64_t created_us; /**< Unix time */
+	uint8_t padding[40];
+} __attribute__((packed)) StoreSegmentHeader;
+
+/**
+ * What a block holds, enough to skip it in a scan
+ */
+typedef struct
+{
+	uint32_t rows;
+	uint16_t min_source;
+	uint16_t max_source;
+	uint64_t min_time_us;
+	uint64_t max_time_us;
+	uint32_t min_network_ms;
+	uint32_t max_network_ms;
+	uint64_t sources[4]; /**< Bit storeSourceBit() of every source in it */
+	uint64_t last_sequence; /**< Journal sequence of its last row, 0 without a journal */
+} __attribute__((packed)) StoreBlockSummary;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t bytes; /**< Of the block, this header included */
+	StoreBlockSummary summary;
+	uint32_t column_bytes[STORE_COLUMNS];
+} __attribute__((packed)) StoreBlockHeader;
+
+/**
+ * One per block in the index of a sealed segment
+ */
+typedef struct
+{
+	uint64_t offset; /**< Of its StoreBlockHeader in the file */
+	StoreBlockSummary summary;
+} __attribute__((packed)) StoreIndexEntry;
+
+typedef struct
+{
+	uint64_t index_offset;
+	uint32_t blocks; /**< Entries in the index */
+	uint32_t reserved;
+	uint64_t rows;
+	uint64_t min_time_us;
+	uint64_t max_time_us;
+	uint32_t version;
+	uint32_t magic; /**< Last, so a torn footer is not one */
+} __attribute__((packed)) StoreSegmentFooter;
+
+/**
+ * Bit of a source node in StoreBlockSummary::sources
+ */
+inline unsigned storeSourceBit(uint16_t source)
+{
+	return ((uint32_t)source * 2654435761u) >> 24;
+}
+
+#endif //__GATEWAY_STORE_FORMAT_H__
@@ -0,0 +1,243 @@
+/**
+ * @file gwcapture.cpp
+ *
+ * Look into a capture of the gateway, see Capture.h, through the columns of
+ * its headers, see HeaderBatch.h
+ *
+ * Usage:
+ *   gwcapture stats file [-t type] [-f from] [-o to] [-n node] [-k kernel]   frames by type and node
+ *   gwcapture dump file [-t type] [-f from] [-o to] [-n node]               one line per frame
+ *   gwcapture bench file [-t type] [-f from] [-o to] [-n node] [-l loops]
+ *                                  decode and filter with each kernel, and with a plain loop over the headers
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+#include "RF24NetworkHeader.h"
+#include "Capture.h"
+#include "HeaderBatch.h"
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: gwcapture stats file [-t type] [-f from] [-o to] [-n node] [-k kernel]\n"
+		"       gwcapture dump file [-t type] [-f from] [-o to] [-n node]\n"
+		"       gwcapture bench file [-t type] [-f from] [-o to] [-n node] [-l loops]\n");
+	exit(2);
+}
+
+static double seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+typedef struct
+{
+	HeaderFilter filter;
+	QueryKernel kernel;
+	unsigned loops;
+} Options;
+
+static void parse(int argc, char** argv, Options& o)
+{
+	headerFilterAny(o.filter);
+	o.kernel = queryBestKernel();
+	o.loops = 10;
+
+	int opt;
+	while((opt = getopt(argc,argv,"t:f:o:n:k:l:")) != -1)
+	{
+		switch(opt)
+		{
+		case 't': o.filter.type = (uint8_t)optarg[0]; break;
+		case 'f': o.filter.from = strtol(optarg,NULL,0) & 0xFFFF; break;
+		case 'o': o.filter.to = strtol(optarg,NULL,0) & 0xFFFF; break;
+		case 'n': o.filter.source = strtol(optarg,NULL,0) & 0xFFFF; break;
+		case 'k':
+			for(o.kernel=KERNEL_SCALAR;o.kernel<KERNEL_COUNT && strcmp(optarg,queryKernelName(o.kernel));o.kernel=(QueryKernel)(o.kernel + 1));
+			if(o.kernel == KERNEL_COUNT || !queryHasKernel(o.kernel))
+			{
+				fprintf(stderr,"no kernel %s on this CPU\n",optarg);
+				exit(2);
+			}
+			break;
+		case 'l': o.loops = atoi(optarg); break;
+		default: usage();
+		}
+	}
+}
+
+/**
+ * Counts per type and node of the frames that pass
+ */
+static int stats(CaptureReader& capture, const Options& o)
+{
+	const CaptureRecord* records = capture.getRecords();
+	size_t count = capture.getCount();
+
+	std::unique_ptr<HeaderColumns> columns(new HeaderColumns);
+	uint16_t sel[HEADER_BATCH_ROWS];
+	std::vector<uint64_t> types(256), sources(65536), hops(65536);
+	uint64_t matched = 0;
+
+	double t0 = seconds();
+	for(size_t i=0;i<count;i+=HEADER_BATCH_ROWS)
+	{
+		const HeaderColumns& c = *columns;
+		headerDecode(o.kernel,records[i].frame,sizeof(CaptureRecord),count - i,*columns);
+		size_t m = headerSelect(o.kernel,c,o.filter,sel);
+		matched += m;
+		for(size_t j=0;j<m;j++)
+		{
+			types[c.type[sel[j]]]++;
+			sources[c.source[sel[j]]]++;
+			hops[c.source[sel[j]]] += c.weight[sel[j]];
+		}
+	}
+	double took = seconds() - t0;
+
+	uint64_t span_us = count ? records[count - 1].time_us - records[0].time_us : 0;
+	printf("%zu frames over %.1f s, %llu pass, %.1f ms with %s\n",count,span_us / 1e6,(unsigned long long)matched,
+		took * 1e3,queryKernelName(o.kernel));
+	for(int t=0;t<256;t++)
+	{
+		if(types[t])
+			printf("type %c: %llu\n",t >= 32 && t < 127 ? t : '?',(unsigned long long)types[t]);
+	}
+	for(int s=0;s<65536;s++)
+	{
+		if(sources[s])
+			printf("node %d: %llu frames, %.2f hops\n",s,(unsigned long long)sources[s],(double)hops[s] / sources[s]);
+	}
+	return 0;
+}
+
+static int dump(CaptureReader& capture, const Options& o)
+{
+	const CaptureRecord* records = capture.getRecords();
+	size_t count = capture.getCount();
+
+	std::unique_ptr<HeaderColumns> columns(new HeaderColumns);
+	uint16_t sel[HEADER_BATCH_ROWS];
+	for(size_t i=0;i<count;i+=HEADER_BATCH_ROWS)
+	{
+		const HeaderColumns& c = *columns;
+		headerDecode(o.kernel,records[i].frame,sizeof(CaptureRecord),count - i,*columns);
+		size_t m = headerSelect(o.kernel,c,o.filter,sel);
+		for(size_t j=0;j<m;j++)
+		{
+			size_t row = sel[j];
+			const CaptureRecord& r = records[i + row];
+			printf("%llu.%06llu pipe:%u type:%c from:%u prev:%u to:%u id:%u source:%u weight:%u flags:%02x ",
+				(unsigned long long)(r.time_us / 1000000),(unsigned long long)(r.time_us % 1000000),r.pipe,
+				c.type[row] >= 32 && c.type[row] < 127 ? c.type[row] : '?',c.from[row],c.prev[row],c.to[row],
+				c.id[row],c.source[row],c.weight[row],c.flags[row]);
+			for(size_t b=0;b<16;b++)
+				printf("%02x",r.frame[offsetof(RF24NetworkHeader,payload) + b]);
+			printf("\n");
+		}
+	}
+	return 0;
+}
+
+/**
+ * Decode the whole capture @p loops times with each kernel, then filter
+ * the columns, against a plain loop that copies out each header and looks
+ * at its fields
+ */
+static int bench(CaptureReader& capture, const Options& o)
+{
+	const CaptureRecord* records = capture.getRecords();
+	size_t count = capture.getCount();
+	size_t batches = (count + HEADER_BATCH_ROWS - 1) / HEADER_BATCH_ROWS;
+	double frames = (double)count * o.loops;
+	printf("%zu frames, %u loops, GB/s of the records scanned\n",count,o.loops);
+
+	uint64_t plain = 0, sum = 0;
+	double t0 = seconds();
+	for(unsigned l=0;l<o.loops;l++)
+	{
+		for(size_t i=0;i<count;i++)
+		{
+			RF24NetworkHeader h;
+			memcpy(&h,records[i].frame,sizeof(h));
+			if((o.filter.type < 0 || h.type == o.filter.type) && (o.filter.from < 0 || h.from_node == o.filter.from) &&
+				(o.filter.to < 0 || h.to_node == o.filter.to) && (o.filter.source < 0 || h.source_data.ip == o.filter.source))
+			{
+				plain++;
+				sum += h.source_data.ip + h.id;
+			}
+		}
+	}
+	double plain_s = seconds() - t0;
+	printf("  plain   filter %6.2f ns/frame %5.1f GB/s, %llu pass\n",plain_s * 1e9 / frames,
+		frames * sizeof(CaptureRecord) / plain_s / 1e9,(unsigned long long)plain / o.loops);
+
+	// Columns of the whole capture, to filter them apart from decoding
+	std::vector<HeaderColumns> columns(batches);
+	std::vector<uint16_t> sel(HEADER_BATCH_ROWS);
+	for(int k=0;k<KERNEL_COUNT;k++)
+	{
+		if(!queryHasKernel((QueryKernel)k))
+			continue;
+
+		t0 = seconds();
+		for(unsigned l=0;l<o.loops;l++)
+		{
+			for(size_t b=0;b<batches;b++)
+				headerDecode((QueryKernel)k,records[b * HEADER_BATCH_ROWS].frame,sizeof(CaptureRecord),
+					count - b * HEADER_BATCH_ROWS,columns[b]);
+		}
+		double decode_s = seconds() - t0;
+
+		uint64_t matched = 0, check = 0;
+		t0 = seconds();
+		for(unsigned l=0;l<o.loops;l++)
+		{
+			for(size_t b=0;b<batches;b++)
+			{
+				const HeaderColumns& c = columns[b];
+				size_t m = headerSelect((QueryKernel)k,c,o.filter,sel.data());
+				matched += m;
+				for(size_t j=0;j<m;j++)
+					check += c.source[sel[j]] + c.id[sel[j]];
+			}
+		}
+		double select_s = seconds() - t0;
+
+		printf("  %-7s decode %6.2f ns/frame %5.1f GB/s, filter %6.2f ns/frame, %llu pass%s\n",
+			queryKernelName((QueryKernel)k),decode_s * 1e9 / frames,frames * sizeof(CaptureRecord) / decode_s / 1e9,
+			select_s * 1e9 / frames,(unsigned long long)matched / o.loops,matched == plain && check == sum ? "" : "  DISAGREES");
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 3)
+		usage();
+
+	const char* command = argv[1];
+	CaptureReader capture;
+	if(!capture.open(argv[2]))
+		return 1;
+
+	Options o;
+	parse(argc - 2,argv + 2,o);
+	if(!strcmp(command,"stats"))
+		return stats(capture,o);
+	if(!strcmp(command,"dump"))
+		return dump(capture,o);
+	if(!strcmp(command,"bench"))
+		return bench(capture,o);
+	usage();
+	return 2;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file gwcat.cpp
+ *
+ * Print the records of the gateway's export socket, one line each
+ *
+ * Also the reference reader of ExportProtocol.h.  With a file of schemas,
+ * see Schema.h, the payload of the readings that have one is printed as
+ * its fields.
+ *
+ * Usage: gwcat [-S schemas] [socket]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+
+#include "ExportProtocol.h"
+#include "Schema.h"
+
+/**
+ * Read exactly @p len bytes
+ *
+ * @return False at the end of the stream
+ */
+static bool readAll(int fd, void* buf, size_t len)
+{
+	uint8_t* p = (uint8_t*)buf;
+	while(len)
+	{
+		ssize_t n = read(fd,p,len);
+		if(n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Print the fields of row @p row of @p c
+ */
+static void printFields(const SchemaColumns& c, size_t row)
+{
+	printf("%s",c.schema->name.c_str());
+	for(size_t f=0;f<c.schema->fields.size();f++)
+	{
+		const SchemaField& field = c.schema->fields[f];
+		if(field.isScaled())
+			printf(" %s=%g",field.name.c_str(),c.getReals(f)[row]);
+		else
+			printf(" %s=%lld",field.name.c_str(),(long long)c.getInts(f)[row]);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	SchemaRegistry schemas;
+	int opt;
+	while((opt = getopt(argc,argv,"S:")) != -1)
+	{
+		if(opt != 'S' || !schemas.load(optarg))
+		{
+			fprintf(stderr,"usage: gwcat [-S schemas] [socket]\n");
+			return 2;
+		}
+	}
+	schemas.compile();
+	const char* path = (optind < argc) ? argv[optind] : EXPORT_SOCKET;
+
+	struct sockaddr_un addr;
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path,path,sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX,SOCK_STREAM,0);
+	if(fd < 0 || connect(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	ExportBatch batch;
+	uint8_t buffer[256];
+	std::vector<ExportRecord> records;
+	std::vector<SchemaColumns> columns;
+
+	// Schema and row in its columns of each record of a batch
+	std::vector<std::pair<uint8_t, uint32_t> > decoded;
+	while(readAll(fd,&batch,sizeof(batch)))
+	{
+		if(batch.magic != EXPORT_MAGIC || batch.record_size < sizeof(ExportRecord) || batch.record_size > sizeof(buffer))
+		{
+			fprintf(stderr,"%s: not an export stream\n",path);
+			return 1;
+		}
+		if(batch.dropped)
+			printf("# lost %u records\n",batch.dropped);
+
+		records.resize(batch.count);
+		for(uint16_t i=0;i<batch.count;i++)
+		{
+			if(!readAll(fd,buffer,batch.record_size))
+				return 0;
+			memcpy(&records[i],buffer,sizeof(ExportRecord));
+		}
+
+		// The whole batch at once, then the fields of each record are at hand
+		decoded.assign(batch.count,std::make_pair((uint8_t)SCHEMA_NONE,0));
+		if(schemas.getCount())
+		{
+			schemas.decode(records.data(),batch.count,columns);
+			for(size_t s=0;s<columns.size();s++)
+			{
+				for(size_t row=0;row<columns[s].rows;row++)
+					decoded[columns[s].sel[row]] = std::make_pair((uint8_t)s,(uint32_t)row);
+			}
+		}
+
+		for(uint16_t i=0;i<batch.count;i++)
+		{
+			const ExportRecord& r = records[i];
+			printf("%llu.%06llu %lu %c source:%u from:%u id:%u hops:%u ",
+				(unsigned long long)(r.time_us / 1000000),(unsigned long long)(r.time_us % 1000000),
+				(unsigned long)r.network_ms,r.type,r.source,r.from,r.id,r.hops);
+			if(decoded[i].first != SCHEMA_NONE)
+				printFields(columns[decoded[i].first],decoded[i].second);
+			else
+			{
+				for(int b=0;b<16;b++)
+					printf("%02x",r.payload[b]);
+			}
+			printf("\n");
+		}
+		fflush(stdout);
+	}
+
+	return 0;
+}
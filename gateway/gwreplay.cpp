@@ -0,0 +1,250 @@
+/**
+ * @file gwreplay.cpp
+ *
+ * Feed a capture of the gateway, see Capture.h, back to a master node on
+ * the mock radio, see ReplayRadio.h, and time it
+ *
+ * The frames go in through the RX FIFO, so RF24Mesh::loop() reads them with
+ * listenRadio() and hands them out with handlePacket() as on the gateway,
+ * only as fast as it can take them: the FIFO is topped up whenever the mesh
+ * drained it.  With -r they come at the pace they were recorded, on the
+ * clock of the mock HAL as well as the wall clock.
+ *
+ * Usage:
+ *   gwreplay run file [-r] [-n loops]     replay, then print the rate and what the mesh made of it
+ *   gwreplay make file [frames] [nodes]   write a capture of synthetic readings
+ *
+ * Only built with HAL=MOCK.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "RF24.h"
+#include "RF24Mesh.h"
+#include "RF24_hal_mock.h"
+#include "Capture.h"
+#include "GatewayConfig.h"
+#include "ReplayRadio.h"
+
+#define REPLAY_DRAIN_LOOPS 16 /**< Runs of the mesh at the end for what is still in the FIFO */
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: gwreplay run file [-r] [-n loops]\n"
+		"       gwreplay make file [frames] [nodes]\n");
+	exit(2);
+}
+
+static double seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Counts what the mesh hands over, and sums it up so two runs can be
+ * compared
+ */
+class ReplayCounter: public StatusCallback
+{
+public:
+	uint64_t frames[MESH_STAT_TYPES]; /**< Read off the radio, by RF24Mesh::statType() */
+	uint64_t data;
+	uint64_t reports;
+	uint64_t digest; /**< FNV-1a of the headers handed over */
+
+	ReplayCounter(): data(0), reports(0), digest(14695981039346656037ULL)
+	{
+		memset(frames,0,sizeof(frames));
+	}
+
+	void incomingFrame(const uint8_t* frame, uint8_t pipe, uint32_t rx_time)
+	{
+		frames[RF24Mesh::statType(frame[offsetof(RF24NetworkHeader,type)])]++;
+	}
+
+	void incomingData(RF24NetworkHeader packet)
+	{
+		data++;
+		hash(packet);
+	}
+
+	void incomingStats(RF24NetworkHeader packet)
+	{
+		reports++;
+		hash(packet);
+	}
+
+private:
+	void hash(const RF24NetworkHeader& packet)
+	{
+		const uint8_t* p = (const uint8_t*)&packet;
+		for(size_t i=0;i<sizeof(packet);i++)
+			digest = (digest ^ p[i]) * 1099511628211ULL;
+	}
+};
+
+static int run(const char* path, int argc, char** argv)
+{
+	bool realtime = false;
+	unsigned loops = 1;
+
+	int opt;
+	while((opt = getopt(argc,argv,"rn:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'r': realtime = true; break;
+		case 'n': loops = atoi(optarg); break;
+		default: usage();
+		}
+	}
+
+	CaptureReader capture;
+	if(!capture.open(path))
+		return 1;
+	const CaptureRecord* records = capture.getRecords();
+	size_t count = capture.getCount();
+	if(!count)
+	{
+		fprintf(stderr,"%s: no frames\n",path);
+		return 1;
+	}
+
+	HalMock::reset();
+	HalMock::setVerbose(false);
+	ReplayRadio chip(GATEWAY_CSN_PIN);
+	chip.attach();
+
+	RF24 radio(GATEWAY_CE_PIN,GATEWAY_CSN_PIN);
+	ReplayCounter counter;
+	RF24Mesh mesh(radio,counter);
+	mesh.setFrameCallback(true);
+	mesh.begin(capture.getHeader().channel,0);
+
+	uint64_t first_us = records[0].time_us;
+	uint64_t overflows = 0, services = 0;
+	double start = seconds();
+	for(unsigned loop=0;loop<loops;loop++)
+	{
+		uint64_t base_us = HalMock::now();
+		double base = seconds();
+		for(size_t i=0;i<count;i++)
+		{
+			const CaptureRecord& r = records[i];
+			if(realtime)
+			{
+				uint64_t at_us = r.time_us > first_us ? r.time_us - first_us : 0;
+				if(base_us + at_us > HalMock::now())
+				{
+					// What came before is handled before time moves on
+					mesh.loop();
+					services++;
+					if(base_us + at_us > HalMock::now())
+						HalMock::advance(base_us + at_us - HalMock::now());
+
+					double wait = base + at_us / 1e6 - seconds();
+					if(wait > 0)
+						usleep(wait * 1e6);
+				}
+			}
+
+			if(!chip.getRoom())
+			{
+				mesh.loop();
+				services++;
+			}
+			if(!chip.push(r.frame,r.pipe))
+				overflows++;
+		}
+	}
+	for(int i=0;i<REPLAY_DRAIN_LOOPS && chip.getRoom() < REPLAY_FIFO_DEPTH;i++)
+	{
+		mesh.loop();
+		services++;
+	}
+	double took = seconds() - start;
+
+	uint64_t frames = (uint64_t)count * loops;
+	const ReplayRadioStats& c = chip.getStats();
+	printf("%llu frames in %.3f s, %.0f frames/s, %.0f ns/frame, %llu services\n",(unsigned long long)frames,
+		took,frames / took,took * 1e9 / frames,(unsigned long long)services);
+	printf("chip: pushed:%llu read:%llu flushed:%llu overflows:%llu sent:%llu spi_transactions:%llu\n",
+		(unsigned long long)c.pushed,(unsigned long long)c.read,(unsigned long long)c.flushed,
+		(unsigned long long)overflows,(unsigned long long)c.sent,(unsigned long long)c.transactions);
+
+	static const char types[MESH_STAT_TYPES] = { 'J', 'W', 'U', 'D', 'F', 'Q', 'S', '?' };
+	printf("read:");
+	for(int t=0;t<MESH_STAT_TYPES;t++)
+		printf(" %c:%llu",types[t],(unsigned long long)counter.frames[t]);
+	printf("\n");
+	printf("handed over: data:%llu reports:%llu drops:%u digest:%016llx\n",(unsigned long long)counter.data,
+		(unsigned long long)counter.reports,mesh.getStats().rx_drops,(unsigned long long)counter.digest);
+	return 0;
+}
+
+/**
+ * Readings of @p nodes nodes two milliseconds apart, as the master gets
+ * them from its children, with a stats report now and then
+ */
+static int make(const char* path, uint64_t frames, unsigned nodes)
+{
+	CaptureWriter writer;
+	if(!writer.open(path,GATEWAY_CHANNEL))
+		return 1;
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+	uint64_t start_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+	std::vector<uint16_t> ids(nodes + 1,0);
+	srand(1);
+	for(uint64_t i=0;i<frames;i++)
+	{
+		unsigned source = 1 + rand() % nodes;
+		unsigned child = source <= 8 ? source : 1 + source % 8;
+
+		RF24NetworkHeader h(0,i % 100 == 99 ? 'S' : 'D',(uint64_t)0,child);
+		h.prev_node = child;
+		h.id = ++ids[source];
+		h.source_data.ip = source;
+		h.source_data.weight = source == child ? 1 : 2;
+		for(size_t b=0;b<sizeof(h.payload);b++)
+			h.payload[b] = rand();
+
+		CaptureRecord r;
+		memset(&r,0,sizeof(r));
+		r.time_us = start_us + i * 2000;
+		r.pipe = 1;
+		r.len = CAPTURE_FRAME_BYTES;
+		memcpy(r.frame,&h,sizeof(h));
+		writer.add(&r,1);
+	}
+	writer.close();
+
+	const CaptureStats& s = writer.getStats();
+	printf("%llu frames of %u nodes, %llu bytes\n",(unsigned long long)s.records,nodes,(unsigned long long)s.bytes);
+	return s.failed ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 3)
+		usage();
+
+	const char* command = argv[1];
+	const char* path = argv[2];
+	if(!strcmp(command,"run"))
+		return run(path,argc - 2,argv + 2);
+	if(!strcmp(command,"make"))
+		return make(path,argc > 3 ? strtoull(argv[3],NULL,0) : 1000000,argc > 4 ? atoi(argv[4]) : 50);
+	usage();
+	return 2;
+}
@@ -0,0 +1,249 @@
+/**
+ * @file gwschema.cpp
+ *
+ * Check a file of payload schemas, see Schema.h, and time their decoders
+ *
+ * Usage:
+ *   gwschema check file               print the schemas as understood
+ *   gwschema bench file [records] [nodes]   decode synthetic records, and
+ *                                     the same with a loop that interprets each field;
+ *                                     exits with 1 if the two disagree
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "Schema.h"
+
+#define BENCH_BATCH 256 /**< Records decoded at once, as many as an export batch may hold */
+#define BENCH_MISMATCHES 10 /**< Shown before the rest are only counted */
+
+/**
+ * Where the timed loops leave their results, so that they are not optimized away
+ */
+static volatile double sink;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: gwschema check file\n"
+		"       gwschema bench file [records] [nodes]\n");
+	exit(2);
+}
+
+static double seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int check(SchemaRegistry& registry)
+{
+	static const char* types[FIELD_TYPES] = { "u8", "i8", "u16", "i16", "u32", "i32" };
+	for(size_t s=0;s<registry.getCount();s++)
+	{
+		const Schema& schema = registry.getSchema(s);
+		printf("schema %s",schema.name.c_str());
+		if(schema.type >= 0)
+			printf(" type=%c",schema.type);
+		if(schema.node >= 0)
+			printf(" node=%d",schema.node);
+		printf("\n");
+		for(size_t i=0;i<schema.fields.size();i++)
+		{
+			const SchemaField& f = schema.fields[i];
+			printf("\t%s %s @%u",f.name.c_str(),types[f.type],f.offset);
+			if(f.mask)
+				printf(" bits %u:%u",f.shift,(unsigned)__builtin_popcount(f.mask));
+			if(f.delta)
+				printf(" delta");
+			if(f.isScaled())
+				printf(" *%g",f.scale);
+			printf("\n");
+		}
+	}
+	return 0;
+}
+
+/**
+ * What decoding looks like without compiling: every field of every row
+ * looked at anew
+ *
+ * @return The integer value, before the scale
+ */
+static int64_t interpret(const Schema& schema, const ExportRecord& r, size_t field, std::vector<int64_t>& totals)
+{
+	const SchemaField& f = schema.fields[field];
+	int64_t v = 0;
+	switch(f.type)
+	{
+	case FIELD_U8: v = r.payload[f.offset]; break;
+	case FIELD_I8: v = (int8_t)r.payload[f.offset]; break;
+	case FIELD_U16: { uint16_t x; memcpy(&x,r.payload + f.offset,2); v = x; break; }
+	case FIELD_I16: { int16_t x; memcpy(&x,r.payload + f.offset,2); v = x; break; }
+	case FIELD_U32: { uint32_t x; memcpy(&x,r.payload + f.offset,4); v = x; break; }
+	case FIELD_I32: { int32_t x; memcpy(&x,r.payload + f.offset,4); v = x; break; }
+	default: break;
+	}
+	if(f.mask)
+	{
+		static const uint64_t widths[FIELD_TYPES] = { 0xFF, 0xFF, 0xFFFF, 0xFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+		v = (((uint64_t)v & widths[f.type]) >> f.shift) & f.mask;
+	}
+	if(f.delta)
+		v = totals[r.source * schema.fields.size() + field] += v;
+	return v;
+}
+
+/**
+ * Delta totals of each schema, for interpret(), with the sources of the
+ * bench numbered 1 to @p nodes
+ */
+static std::vector<std::vector<int64_t> > interpretTotals(SchemaRegistry& registry, unsigned nodes)
+{
+	std::vector<std::vector<int64_t> > totals(registry.getCount());
+	for(size_t s=0;s<totals.size();s++)
+		totals[s].assign((size_t)(nodes + 1) * registry.getSchema(s).fields.size(),0);
+	return totals;
+}
+
+/**
+ * Whether the compiled decoders give what interpret() does, for every field
+ * of every record
+ *
+ * Runs on a registry of its own, so that delta fields start from zero on
+ * both sides.
+ */
+static bool verify(const char* path, const std::vector<ExportRecord>& records, unsigned nodes)
+{
+	SchemaRegistry registry;
+	if(!registry.load(path))
+		return false;
+	registry.compile();
+
+	std::vector<std::vector<int64_t> > totals = interpretTotals(registry,nodes);
+	std::vector<SchemaColumns> columns;
+	size_t n = records.size(), rows = 0, expected = 0, mismatches = 0;
+	for(size_t i=0;i<n;i+=BENCH_BATCH)
+	{
+		size_t m = n - i < BENCH_BATCH ? n - i : BENCH_BATCH;
+		for(size_t j=0;j<m;j++)
+		{
+			if(registry.find(records[i + j].type,records[i + j].source) != SCHEMA_NONE)
+				expected++;
+		}
+
+		registry.decode(records.data() + i,m,columns);
+		for(size_t s=0;s<columns.size();s++)
+		{
+			const SchemaColumns& c = columns[s];
+			const Schema& schema = *c.schema;
+			rows += c.rows;
+			for(size_t r=0;r<c.rows;r++)
+			{
+				size_t at = i + c.sel[r];
+				for(size_t f=0;f<schema.fields.size();f++)
+				{
+					const SchemaField& field = schema.fields[f];
+					int64_t v = interpret(schema,records[at],f,totals[s]);
+					double compiled = field.isScaled() ? c.getReals(f)[r] : c.getInts(f)[r];
+					double interpreted = field.isScaled() ? v * field.scale : v;
+					bool same = field.isScaled() ? compiled == interpreted : c.getInts(f)[r] == v;
+					if(!same && mismatches++ < BENCH_MISMATCHES)
+						fprintf(stderr,"record %zu, %s.%s: compiled %.17g, interpreted %.17g\n",
+							at,schema.name.c_str(),field.name.c_str(),compiled,interpreted);
+				}
+			}
+		}
+	}
+
+	if(rows != expected)
+		fprintf(stderr,"%zu records decoded, %zu have a schema\n",rows,expected);
+	if(mismatches)
+		fprintf(stderr,"%zu fields decoded differently\n",mismatches);
+	return !mismatches && rows == expected;
+}
+
+static int bench(SchemaRegistry& registry, const char* path, size_t n, unsigned nodes)
+{
+	std::vector<ExportRecord> records(n);
+	srand(1);
+	for(size_t i=0;i<n;i++)
+	{
+		ExportRecord& r = records[i];
+		memset(&r,0,sizeof(r));
+		r.type = 'D';
+		r.source = 1 + i % nodes;
+		for(size_t b=0;b<sizeof(r.payload);b++)
+			r.payload[b] = rand();
+	}
+
+	size_t fields = 0, decoded = 0;
+	std::vector<SchemaColumns> columns;
+	double sum = 0;
+	double t0 = seconds();
+	for(size_t i=0;i<n;i+=BENCH_BATCH)
+	{
+		size_t m = n - i < BENCH_BATCH ? n - i : BENCH_BATCH;
+		registry.decode(records.data() + i,m,columns);
+		for(size_t s=0;s<columns.size();s++)
+		{
+			const SchemaColumns& c = columns[s];
+			decoded += c.rows;
+			fields += c.rows * c.schema->fields.size();
+			if(c.rows && !c.schema->fields.empty())
+				sum += c.schema->fields[0].isScaled() ? c.getReals(0)[c.rows - 1] : c.getInts(0)[c.rows - 1];
+		}
+	}
+	double compiled = seconds() - t0;
+
+	std::vector<std::vector<int64_t> > totals = interpretTotals(registry,nodes);
+	t0 = seconds();
+	for(size_t i=0;i<n;i++)
+	{
+		uint8_t s = registry.find(records[i].type,records[i].source);
+		if(s == SCHEMA_NONE)
+			continue;
+		const Schema& schema = registry.getSchema(s);
+		for(size_t f=0;f<schema.fields.size();f++)
+		{
+			int64_t v = interpret(schema,records[i],f,totals[s]);
+			sum += schema.fields[f].isScaled() ? v * schema.fields[f].scale : v;
+		}
+	}
+	double interpreted = seconds() - t0;
+	sink = sum;
+
+	printf("%zu records, %zu with a schema, %zu fields\n",n,decoded,fields);
+	printf("compiled: %.1f ms, %.2f ns/record, %.2f ns/field, %.1f Mrecords/s\n",compiled * 1e3,
+		compiled * 1e9 / n,fields ? compiled * 1e9 / fields : 0.0,n / compiled / 1e6);
+	printf("interpreted: %.1f ms, %.2f ns/record, %.1fx slower\n",interpreted * 1e3,interpreted * 1e9 / n,
+		interpreted / compiled);
+
+	if(!verify(path,records,nodes))
+		return 1;
+	printf("compiled and interpreted agree\n");
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 3)
+		usage();
+
+	SchemaRegistry registry;
+	if(!registry.load(argv[2]))
+		return 1;
+	registry.compile();
+
+	if(!strcmp(argv[1],"check"))
+		return check(registry);
+	if(!strcmp(argv[1],"bench"))
+		return bench(registry,argv[2],argc > 3 ? strtoull(argv[3],NULL,0) : 10000000,argc > 4 ? atoi(argv[4]) : 100);
+	usage();
+	return 2;
+}
@@ -0,0 +1,539 @@
+/**
+ * @file gwstore.cpp
+ *
+ * Look into the reading store of the gateway, see Store.h
+ *
+ * Usage:
+ *   gwstore stats dir
+ *   gwstore scan dir [-f from_us] [-t to_us] [-n node]
+ *   gwstore bench dir [rows] [nodes]    append synthetic rows to an empty dir, then scan them
+ *   gwstore query dir [-f from_us] [-t to_us] [-n node] [-w word] [-g bucket_s] [-q] [-k kernel] [-r]
+ *   gwstore rollup dir [-l seconds] [-f from_us] [-t to_us] [-n node]
+ *   gwstore qbench [rows] [nodes]       Query.h against a plain loop over records, in memory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "Query.h"
+#include "Rollup.h"
+#include "Store.h"
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: gwstore stats dir\n"
+		"       gwstore scan dir [-f from_us] [-t to_us] [-n node]\n"
+		"       gwstore bench dir [rows] [nodes]\n"
+		"       gwstore query dir [-f from_us] [-t to_us] [-n node] [-w word] [-g bucket_s] [-q] [-k kernel] [-r]\n"
+		"       gwstore rollup dir [-l seconds] [-f from_us] [-t to_us] [-n node]\n"
+		"       gwstore qbench [rows] [nodes]\n");
+	exit(2);
+}
+
+static double seconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Print each row, like gwcat
+ */
+class PrintRows: public StoreVisitor
+{
+public:
+	void rows(const StoreBlock& b)
+	{
+		for(size_t i=0;i<b.rows;i++)
+		{
+			printf("%llu.%06llu %lu source:%u id:%u hops:%u ",
+				(unsigned long long)(b.time_us[i] / 1000000),(unsigned long long)(b.time_us[i] % 1000000),
+				(unsigned long)b.network_ms[i],b.source[i],b.id[i],b.hops[i]);
+			for(unsigned w=0;w<STORE_PAYLOAD_WORDS;w++)
+			{
+				const uint8_t* p = (const uint8_t*)&b.payload[w][i];
+				printf("%02x%02x%02x%02x",p[0],p[1],p[2],p[3]);
+			}
+			printf("\n");
+		}
+	}
+};
+
+/**
+ * Only touch the rows, for timing scans
+ */
+class SumRows: public StoreVisitor
+{
+public:
+	SumRows(): sum(0) {}
+
+	void rows(const StoreBlock& b)
+	{
+		for(size_t i=0;i<b.rows;i++)
+			sum += b.payload[0][i];
+	}
+
+	uint64_t sum;
+};
+
+static int stats(const char* dir)
+{
+	StoreReader reader;
+	if(!reader.open(dir))
+		return 1;
+
+	const StoreReaderStats& s = reader.getStats();
+	printf("segments:%zu sealed:%zu blocks:%llu rows:%llu bytes:%llu bytes_per_row:%.2f\n",
+		s.segments,s.sealed,(unsigned long long)s.blocks,(unsigned long long)s.rows,(unsigned long long)s.bytes,
+		s.rows ? (double)s.bytes / s.rows : 0.0);
+	printf("from:%llu to:%llu\n",(unsigned long long)s.min_time_us,(unsigned long long)s.max_time_us);
+	return 0;
+}
+
+static int scan(const char* dir, int argc, char** argv)
+{
+	uint64_t from_us = 0, to_us = UINT64_MAX;
+	int node = -1;
+
+	int opt;
+	while((opt = getopt(argc,argv,"f:t:n:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'f': from_us = strtoull(optarg,NULL,0); break;
+		case 't': to_us = strtoull(optarg,NULL,0); break;
+		case 'n': node = strtol(optarg,NULL,0); break;
+		default: usage();
+		}
+	}
+
+	StoreReader reader;
+	if(!reader.open(dir))
+		return 1;
+
+	PrintRows print;
+	reader.scan(from_us,to_us,node,print);
+	return 0;
+}
+
+/**
+ * Readings of @p nodes nodes a millisecond apart, with payloads that change
+ * slowly like those of sensors
+ */
+static int bench(const char* dir, uint64_t rows, unsigned nodes)
+{
+	StoreWriter writer;
+	Rollup rollup;
+	if(!writer.open(dir,0) || !rollup.open(dir,0,0,false))
+		return 1;
+
+	ExportRecord r;
+	memset(&r,0,sizeof(r));
+	r.type = 'D';
+	uint64_t start_us = 1700000000000000ULL;
+
+	double t0 = seconds();
+	for(uint64_t i=0;i<rows;i++)
+	{
+		r.time_us = start_us + i * 1000;
+		r.network_ms = i;
+		r.source = 1 + i % nodes;
+		r.id = i / nodes;
+		r.hops = 1 + r.source % 4;
+		uint32_t value = 2000 + (i / nodes) % 64 + r.source;
+		memcpy(r.payload,&value,sizeof(value));
+		memcpy(r.payload + 4,&r.id,sizeof(r.id));
+		writer.append(r);
+		rollup.add(r);
+	}
+	writer.close();
+	rollup.close();
+	double t1 = seconds();
+
+	const StoreStats& w = writer.getStats();
+	printf("append: rows:%llu blocks:%llu segments:%llu bytes:%llu bytes_per_row:%.2f %.2f Mrows/s\n",
+		(unsigned long long)w.rows,(unsigned long long)w.blocks,(unsigned long long)w.segments,
+		(unsigned long long)w.bytes,(double)w.bytes / rows,rows / (t1 - t0) / 1e6);
+
+	StoreReader reader;
+	if(!reader.open(dir))
+		return 1;
+
+	SumRows all;
+	t0 = seconds();
+	uint64_t n = reader.scan(0,UINT64_MAX,-1,all);
+	t1 = seconds();
+	printf("scan all: rows:%llu blocks:%llu %.2f Mrows/s\n",(unsigned long long)n,
+		(unsigned long long)reader.getBlocksDecoded(),n / (t1 - t0) / 1e6);
+
+	// The middle tenth of the time, then one node over all of it
+	uint64_t span = rows * 1000;
+	uint64_t decoded = reader.getBlocksDecoded();
+	SumRows range;
+	t0 = seconds();
+	n = reader.scan(start_us + span * 45 / 100,start_us + span * 55 / 100,-1,range);
+	t1 = seconds();
+	printf("scan 10%% of the time: rows:%llu blocks:%llu %.3f ms\n",(unsigned long long)n,
+		(unsigned long long)(reader.getBlocksDecoded() - decoded),(t1 - t0) * 1e3);
+
+	decoded = reader.getBlocksDecoded();
+	SumRows node;
+	t0 = seconds();
+	n = reader.scan(0,UINT64_MAX,1,node);
+	t1 = seconds();
+	printf("scan node 1: rows:%llu blocks:%llu %.3f ms\n",(unsigned long long)n,
+		(unsigned long long)(reader.getBlocksDecoded() - decoded),(t1 - t0) * 1e3);
+
+	// Every node per hour, from the rows and from the rollups
+	QuerySpec spec;
+	spec.from_us = start_us / 3600000000ULL * 3600000000ULL;
+	spec.to_us = UINT64_MAX;
+	spec.source = -1;
+	spec.bucket_us = 3600000000ULL;
+	spec.word = 0;
+	spec.quantiles = true;
+	Query raw(spec);
+	t0 = seconds();
+	reader.scanBlocks(spec.from_us,spec.to_us,spec.source,raw.getColumns(),raw);
+	t1 = seconds();
+	printf("query per hour from rows: groups:%zu rows:%llu %.3f ms\n",raw.getGroups().size(),
+		(unsigned long long)raw.getRows(),(t1 - t0) * 1e3);
+
+	Query rolled(spec);
+	RollupReader rollups;
+	t0 = seconds();
+	rollups.read(dir,3600,spec.from_us,spec.to_us,spec.source);
+	const std::vector<RollupBucket>& buckets = rollups.getBuckets();
+	for(size_t i=0;i<buckets.size();i++)
+	{
+		const RollupBucket& b = buckets[i];
+		rolled.addGroup(b.source,b.start_us,b.count,b.sum,b.min,b.max,b.sketch);
+	}
+	t1 = seconds();
+	printf("query per hour from rollups: groups:%zu rows:%llu entries:%llu %.3f ms\n",rolled.getGroups().size(),
+		(unsigned long long)rolled.getRows(),(unsigned long long)rollups.getEntries(),(t1 - t0) * 1e3);
+	return 0;
+}
+
+static bool parseKernel(const char* name, QueryKernel& kernel)
+{
+	for(int k=0;k<KERNEL_COUNT;k++)
+	{
+		if(!strcmp(name,queryKernelName((QueryKernel)k)) && queryHasKernel((QueryKernel)k))
+		{
+			kernel = (QueryKernel)k;
+			return true;
+		}
+	}
+	fprintf(stderr,"no kernel %s here\n",name);
+	return false;
+}
+
+static void printGroups(Query& q, bool quantiles)
+{
+	std::vector<QueryGroup> groups = q.getGroups();
+	for(size_t i=0;i<groups.size();i++)
+	{
+		const QueryGroup& g = groups[i];
+		printf("%u %llu.%06llu count:%llu min:%d max:%d mean:%.2f",g.source,
+			(unsigned long long)(g.start_us / 1000000),(unsigned long long)(g.start_us % 1000000),
+			(unsigned long long)g.count,g.min,g.max,(double)g.sum / g.count);
+		if(quantiles)
+			printf(" p50:%d p90:%d p99:%d",g.sketch.quantile(0.5),g.sketch.quantile(0.9),g.sketch.quantile(0.99));
+		printf("\n");
+	}
+}
+
+/**
+ * query from the coarsest rollups whose buckets fit those asked for
+ */
+static int queryRollups(const char* dir, const QuerySpec& spec)
+{
+	int level = -1;
+	for(int l=ROLLUP_LEVELS-1;l>=0 && level<0;l--)
+	{
+		uint64_t len = (uint64_t)rollupSeconds[l] * 1000000;
+		if(!spec.bucket_us ? !(spec.from_us % len) : !(spec.bucket_us % len) && !(spec.from_us % len))
+			level = l;
+	}
+	if(level < 0)
+	{
+		fprintf(stderr,"no rollups fit buckets of %llu s from %llu\n",(unsigned long long)(spec.bucket_us / 1000000),
+			(unsigned long long)spec.from_us);
+		return 2;
+	}
+
+	RollupReader reader;
+	double t0 = seconds();
+	if(!reader.read(dir,rollupSeconds[level],spec.from_us,spec.to_us,spec.source))
+		return 1;
+	if(reader.getWord() != (int)spec.word)
+	{
+		fprintf(stderr,"the rollups are of payload word %d\n",reader.getWord());
+		return 1;
+	}
+
+	Query q(spec);
+	const std::vector<RollupBucket>& buckets = reader.getBuckets();
+	for(size_t i=0;i<buckets.size();i++)
+	{
+		const RollupBucket& b = buckets[i];
+		q.addGroup(b.source,b.start_us,b.count,b.sum,b.min,b.max,b.sketch);
+	}
+	double t1 = seconds();
+
+	printGroups(q,spec.quantiles);
+	fprintf(stderr,"%llu rows, %llu rollups of %u s, %.3f ms\n",(unsigned long long)q.getRows(),
+		(unsigned long long)reader.getEntries(),rollupSeconds[level],(t1 - t0) * 1e3);
+	return 0;
+}
+
+static int rollup(const char* dir, int argc, char** argv)
+{
+	uint32_t level = rollupSeconds[0];
+	uint64_t from_us = 0, to_us = UINT64_MAX;
+	int node = -1;
+
+	int opt;
+	while((opt = getopt(argc,argv,"l:f:t:n:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'l': level = strtoul(optarg,NULL,0); break;
+		case 'f': from_us = strtoull(optarg,NULL,0); break;
+		case 't': to_us = strtoull(optarg,NULL,0); break;
+		case 'n': node = strtol(optarg,NULL,0); break;
+		default: usage();
+		}
+	}
+
+	RollupReader reader;
+	if(!reader.read(dir,level,from_us,to_us,node))
+		return 1;
+
+	const std::vector<RollupBucket>& buckets = reader.getBuckets();
+	for(size_t i=0;i<buckets.size();i++)
+	{
+		const RollupBucket& b = buckets[i];
+		printf("%u %llu count:%llu min:%d max:%d mean:%.2f last:%d p50:%d p90:%d p99:%d\n",b.source,
+			(unsigned long long)(b.start_us / 1000000),(unsigned long long)b.count,b.min,b.max,(double)b.sum / b.count,
+			b.last,b.sketch.quantile(0.5),b.sketch.quantile(0.9),b.sketch.quantile(0.99));
+	}
+	return 0;
+}
+
+static int query(const char* dir, int argc, char** argv)
+{
+	QuerySpec spec;
+	spec.from_us = 0;
+	spec.to_us = UINT64_MAX;
+	spec.source = -1;
+	spec.bucket_us = 60000000;
+	spec.word = 0;
+	spec.quantiles = false;
+	QueryKernel kernel = queryBestKernel();
+	bool rollups = false;
+
+	int opt;
+	while((opt = getopt(argc,argv,"f:t:n:w:g:qk:r")) != -1)
+	{
+		switch(opt)
+		{
+		case 'f': spec.from_us = strtoull(optarg,NULL,0); break;
+		case 't': spec.to_us = strtoull(optarg,NULL,0); break;
+		case 'n': spec.source = strtol(optarg,NULL,0); break;
+		case 'w': spec.word = atoi(optarg); break;
+		case 'g': spec.bucket_us = strtoull(optarg,NULL,0) * 1000000; break;
+		case 'q': spec.quantiles = true; break;
+		case 'k': if(!parseKernel(optarg,kernel)) return 2; break;
+		case 'r': rollups = true; break;
+		default: usage();
+		}
+	}
+	if(rollups)
+		return queryRollups(dir,spec);
+
+	StoreReader reader;
+	if(!reader.open(dir))
+		return 1;
+
+	// Buckets start where those of the rollups do, at whole multiples
+	if(!spec.from_us && spec.bucket_us)
+		spec.from_us = reader.getStats().min_time_us / spec.bucket_us * spec.bucket_us;
+
+	Query q(spec,kernel);
+	double t0 = seconds();
+	reader.scanBlocks(spec.from_us,spec.to_us,spec.source,q.getColumns(),q);
+	double t1 = seconds();
+
+	printGroups(q,spec.quantiles);
+	fprintf(stderr,"%llu rows, %llu blocks, %.3f ms with %s\n",(unsigned long long)q.getRows(),
+		(unsigned long long)reader.getBlocksDecoded(),(t1 - t0) * 1e3,queryKernelName(kernel));
+	return 0;
+}
+
+/**
+ * What a query would do with a map of groups and a vector of values each,
+ * for qbench to compare against
+ */
+typedef struct
+{
+	uint64_t count;
+	int64_t sum;
+	int32_t min;
+	int32_t max;
+	std::vector<int32_t> values;
+} NaiveGroup;
+
+static void naiveQuery(const std::vector<ExportRecord>& records, const QuerySpec& spec,
+	std::map<std::pair<uint16_t, uint64_t>, NaiveGroup>& groups)
+{
+	for(size_t i=0;i<records.size();i++)
+	{
+		const ExportRecord& r = records[i];
+		if(r.time_us < spec.from_us || r.time_us >= spec.to_us || (spec.source >= 0 && r.source != spec.source))
+			continue;
+
+		int32_t value;
+		memcpy(&value,r.payload + spec.word * 4,sizeof(value));
+		uint64_t start = spec.from_us + (r.time_us - spec.from_us) / spec.bucket_us * spec.bucket_us;
+
+		NaiveGroup& g = groups[std::make_pair(r.source,start)];
+		if(!g.count)
+		{
+			g.min = value;
+			g.max = value;
+		}
+		g.count++;
+		g.sum += value;
+		g.min = std::min(g.min,value);
+		g.max = std::max(g.max,value);
+		if(spec.quantiles)
+			g.values.push_back(value);
+	}
+
+	if(!spec.quantiles)
+		return;
+	for(std::map<std::pair<uint16_t, uint64_t>, NaiveGroup>::iterator i=groups.begin();i!=groups.end();++i)
+		std::sort(i->second.values.begin(),i->second.values.end());
+}
+
+/**
+ * Run @p spec the plain way and with each kernel, and check they agree
+ */
+static void qbenchRun(const char* name, const QuerySpec& spec, const std::vector<ExportRecord>& records,
+	const std::vector<uint64_t>& time_us, const std::vector<uint16_t>& sources, const std::vector<int32_t>& values)
+{
+	std::map<std::pair<uint16_t, uint64_t>, NaiveGroup> naive;
+	double t0 = seconds();
+	naiveQuery(records,spec,naive);
+	double naive_s = seconds() - t0;
+	printf("%s%s: naive %.1f ms, %zu groups\n",name,spec.quantiles ? " with quantiles" : "",naive_s * 1e3,naive.size());
+
+	for(int k=0;k<KERNEL_COUNT;k++)
+	{
+		if(!queryHasKernel((QueryKernel)k))
+			continue;
+
+		Query q(spec,(QueryKernel)k);
+		t0 = seconds();
+		q.add(time_us.data(),sources.data(),values.data(),time_us.size());
+		double s = seconds() - t0;
+
+		std::vector<QueryGroup> groups = q.getGroups();
+		bool agree = groups.size() == naive.size();
+		for(size_t i=0;agree && i<groups.size();i++)
+		{
+			const QueryGroup& g = groups[i];
+			std::map<std::pair<uint16_t, uint64_t>, NaiveGroup>::const_iterator n = naive.find(std::make_pair(g.source,g.start_us));
+			agree = n != naive.end() && n->second.count == g.count && n->second.sum == g.sum &&
+				n->second.min == g.min && n->second.max == g.max;
+		}
+		printf("  %-7s %8.1f ms %6.1fx %.0f Mrows/s%s\n",queryKernelName((QueryKernel)k),s * 1e3,naive_s / s,
+			time_us.size() / s / 1e6,agree ? "" : "  DISAGREES");
+	}
+}
+
+/**
+ * Random walks of @p nodes nodes, each reporting every second, in memory
+ */
+static int qbench(uint64_t rows, unsigned nodes)
+{
+	std::vector<ExportRecord> records(rows);
+	std::vector<uint64_t> time_us(rows);
+	std::vector<uint16_t> sources(rows);
+	std::vector<int32_t> values(rows);
+	std::vector<int32_t> walk(nodes,2000);
+
+	uint64_t start_us = 1700000000000000ULL;
+	uint64_t step_us = 1000000 / nodes;
+	srand(1);
+	for(uint64_t i=0;i<rows;i++)
+	{
+		unsigned n = i % nodes;
+		walk[n] += rand() % 21 - 10;
+
+		ExportRecord& r = records[i];
+		memset(&r,0,sizeof(r));
+		r.type = 'D';
+		r.time_us = start_us + i * step_us;
+		r.source = 1 + n;
+		memcpy(r.payload,&walk[n],sizeof(walk[n]));
+
+		time_us[i] = r.time_us;
+		sources[i] = r.source;
+		values[i] = walk[n];
+	}
+	printf("%llu rows of %u nodes, %.1f days\n",(unsigned long long)rows,nodes,
+		(double)rows * step_us / 86400e6);
+
+	QuerySpec spec;
+	spec.from_us = start_us;
+	spec.to_us = start_us + rows * step_us;
+	spec.source = 1;
+	spec.bucket_us = 60000000;
+	spec.word = 0;
+	spec.quantiles = false;
+	qbenchRun("one node per minute",spec,records,time_us,sources,values);
+	spec.quantiles = true;
+	qbenchRun("one node per minute",spec,records,time_us,sources,values);
+
+	spec.source = -1;
+	spec.bucket_us = 3600000000ULL;
+	spec.quantiles = false;
+	qbenchRun("all nodes per hour",spec,records,time_us,sources,values);
+	spec.quantiles = true;
+	qbenchRun("all nodes per hour",spec,records,time_us,sources,values);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc > 1 && !strcmp(argv[1],"qbench"))
+		return qbench(argc > 2 ? strtoull(argv[2],NULL,0) : 10000000,argc > 3 ? atoi(argv[3]) : 100);
+	if(argc < 3)
+		usage();
+
+	const char* command = argv[1];
+	const char* dir = argv[2];
+	if(!strcmp(command,"stats"))
+		return stats(dir);
+	if(!strcmp(command,"scan"))
+		return scan(dir,argc - 2,argv + 2);
+	if(!strcmp(command,"query"))
+		return query(dir,argc - 2,argv + 2);
+	if(!strcmp(command,"rollup"))
+		return rollup(dir,argc - 2,argv + 2);
+	if(!strcmp(command,"bench"))
+		return bench(dir,argc > 3 ? strtoull(argv[3],NULL,0) : 10000000,argc > 4 ? atoi(argv[4]) : 1000);
+	usage();
+	return 2;
+}
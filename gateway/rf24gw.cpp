@@ -0,0 +1,82 @@
+/**
+ * @file rf24gw.cpp
+ *
+ * Gateway daemon, the master node of the mesh on a Linux board
+ *
+ * Usage: rf24gw [options], see usage() or README.md
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Gateway.h"
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: rf24gw [-d spidev] [-g gpiochip] [-e ce] [-n csn] [-i irq|-1] [-c channel]\n"
+		"              [-t tick_ms] [-f flush_ms] [-q query_s] [-w workers] [-s socket] [-b batch]\n"
+		"              [-l client_limit_kb] [-o store_dir]\n"
+		"              [-j commit_records] [-u commit_us] [-r rollup_word|-1] [-C capture]\n"
+		"              [-m [address:]port] [-M metrics_ms]\n");
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	GatewayConfig config;
+	gatewayDefaults(config);
+
+	int opt;
+	while((opt = getopt(argc,argv,"d:g:e:n:i:c:t:f:q:w:s:b:l:o:j:u:r:C:m:M:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'd': config.spidev = optarg; break;
+		case 'g': config.gpiochip = optarg; break;
+		case 'e': config.ce_pin = atoi(optarg); break;
+		case 'n': config.csn_pin = atoi(optarg); break;
+		case 'i': config.irq_pin = atoi(optarg); break;
+		case 'c': config.channel = atoi(optarg); break;
+		case 't': config.tick_ms = atoi(optarg); break;
+		case 'f': config.flush_ms = atoi(optarg); break;
+		case 'q': config.query_s = atoi(optarg); break;
+		case 'w': config.workers = atoi(optarg); break;
+		case 's': config.socket = optarg; break;
+		case 'b': config.batch_records = atoi(optarg); break;
+		case 'l': config.client_limit = (size_t)atoi(optarg) * 1024; break;
+		case 'o': config.store = optarg; break;
+		case 'j': config.journal_records = atoi(optarg); break;
+		case 'u': config.journal_us = atoi(optarg); break;
+		case 'r': config.rollup_word = atoi(optarg); break;
+		case 'C': config.capture = optarg; break;
+		case 'm': config.metrics = optarg; break;
+		case 'M': config.metrics_ms = atoi(optarg); break;
+		default: usage();
+		}
+	}
+	if(optind != argc || config.tick_ms < 1 || config.flush_ms < 1 || config.batch_records < 1 || config.metrics_ms < 1 ||
+		config.workers > SHARD_MAX || config.rollup_word >= STORE_PAYLOAD_WORDS)
+		usage();
+
+	// Log lines as they come, also when stdout is a pipe to a logger
+	setvbuf(stdout,NULL,_IOLBF,0);
+
+	Gateway gateway(config);
+	if(!gateway.begin())
+		return 1;
+
+	printf("Serving on %s\n",config.socket.c_str());
+	if(!config.metrics.empty())
+	{
+		bool port_only = config.metrics.find(':') == std::string::npos;
+		printf("Metrics on http://%s%s%s" METRICS_PATH "\n",port_only ? METRICS_ADDRESS : "",port_only ? ":" : "",
+			config.metrics.c_str());
+	}
+	gateway.run();
+
+	gateway.printStats();
+	return 0;
+}
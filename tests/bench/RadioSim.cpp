@@ -0,0 +1,576 @@
+#include <string.h>
+#include <algorithm>
+
+#include "RF24_hal.h"
+#include "nRF24L01.h"
+#include "Sim.h"
+#include "RadioSim.h"
+
+RadioSim::RadioSim(Medium& _medium, SimNode& _node): medium(_medium), node(_node)
+{
+	reset();
+	spi_bytes = 0;
+	spi_transactions = 0;
+	tx_pid = 0;
+	history_next = 0;
+	for(int i=0;i<SIM_HISTORY;i++)
+	{
+		history_time[i] = 0;
+		history_listening[i] = false;
+	}
+	node.radio = this;
+	medium.add(this);
+}
+
+/**
+ * Power on values of the registers
+ */
+void RadioSim::reset(void)
+{
+	memset(reg,0,sizeof(reg));
+	reg[CONFIG][0] = 0x08;
+	reg[EN_AA][0] = 0x3F;
+	reg[EN_RXADDR][0] = 0x03;
+	reg[SETUP_AW][0] = 0x03;
+	reg[SETUP_RETR][0] = 0x03;
+	reg[RF_CH][0] = 0x02;
+	reg[RF_SETUP][0] = 0x0F;
+	memset(reg[RX_ADDR_P0],0xE7,5);
+	memset(reg[RX_ADDR_P1],0xC2,5);
+	reg[RX_ADDR_P2][0] = 0xC3;
+	reg[RX_ADDR_P3][0] = 0xC4;
+	reg[RX_ADDR_P4][0] = 0xC5;
+	reg[RX_ADDR_P5][0] = 0xC6;
+	memset(reg[TX_ADDR],0xE7,5);
+
+	status = 0;
+	ce = false;
+	csn = true;
+	rx_count = 0;
+	tx_count = 0;
+	tx_busy = false;
+	tx_done = 0;
+	tx_ok = false;
+	tx_retries = 0;
+	plos = 0;
+	first = false;
+	command = NOP;
+	index = 0;
+}
+
+bool RadioSim::isListening(void)
+{
+	uint8_t config = reg[CONFIG][0];
+	return ce && (config & _BV(PWR_UP)) && (config & _BV(PRIM_RX));
+}
+
+void RadioSim::updateListening(void)
+{
+	bool listening = isListening();
+	uint8_t last = (history_next + SIM_HISTORY - 1) % SIM_HISTORY;
+	if(history_listening[last] == listening)
+		return;
+
+	history_time[history_next] = node.now;
+	history_listening[history_next] = listening;
+	history_next = (history_next + 1) % SIM_HISTORY;
+}
+
+bool RadioSim::listeningAt(uint64_t t)
+{
+	// Newest change at or before t
+	for(int i=1;i<=SIM_HISTORY;i++)
+	{
+		uint8_t e = (history_next + SIM_HISTORY - i) % SIM_HISTORY;
+		if(history_time[e] <= t)
+			return history_listening[e];
+	}
+	return isListening();
+}
+
+uint8_t RadioSim::getChannel(void)
+{
+	return reg[RF_CH][0];
+}
+
+int8_t RadioSim::pipeFor(const uint8_t address[5])
+{
+	for(uint8_t p=0;p<6;p++)
+	{
+		if(!(reg[EN_RXADDR][0] & _BV(p)) || !reg[RX_PW_P0 + p][0])
+			continue;
+
+		if(p < 2)
+		{
+			if(!memcmp(reg[RX_ADDR_P0 + p],address,5))
+				return p;
+		}
+		else if(reg[RX_ADDR_P0 + p][0] == address[0] && !memcmp(reg[RX_ADDR_P1] + 1,address + 1,4))
+			return p;
+	}
+	return -1;
+}
+
+bool RadioSim::autoAck(uint8_t pipe)
+{
+	return reg[EN_AA][0] & _BV(pipe);
+}
+
+uint8_t RadioSim::rxRoom(void)
+{
+	uint8_t used = rx_count;
+	for(size_t i=0;i<pending.size();i++)
+	{
+		if(!pending[i].noise && !pending[i].corrupted)
+			used++;
+	}
+	return used < SIM_FIFO_DEPTH ? SIM_FIFO_DEPTH - used : 0;
+}
+
+bool RadioSim::arrive(const SimArrival& arrival)
+{
+	SimArrival a = arrival;
+
+	for(size_t i=0;i<pending.size();i++)
+	{
+		if(pending[i].start < a.end && a.start < pending[i].end)
+		{
+			if(!a.corrupted)
+				medium.stats.collisions++;
+			a.corrupted = true;
+			break;
+		}
+	}
+
+	pending.push_back(a);
+	return !a.corrupted;
+}
+
+void RadioSim::inject(const SimFrame& frame)
+{
+	if(rx_count == SIM_FIFO_DEPTH)
+	{
+		medium.stats.rx_overflows++;
+		return;
+	}
+	rx_fifo[rx_count++] = frame;
+	status |= _BV(RX_DR);
+}
+
+void RadioSim::ackLast(void)
+{
+	pending.back().acked = true;
+}
+
+bool RadioSim::duplicate(int from, uint32_t pid)
+{
+	for(size_t i=0;i<last_pid.size();i++)
+		if(last_pid[i].first == from)
+			return last_pid[i].second == pid;
+	return false;
+}
+
+void RadioSim::received(int from, uint32_t pid)
+{
+	for(size_t i=0;i<last_pid.size();i++)
+	{
+		if(last_pid[i].first == from)
+		{
+			last_pid[i].second = pid;
+			return;
+		}
+	}
+	last_pid.push_back(std::make_pair(from,pid));
+}
+
+/****************************************************************************/
+
+void RadioSim::settle(uint64_t now)
+{
+	if(tx_busy && now >= tx_done)
+		finishTx();
+
+	if(pending.empty())
+		return;
+
+	std::sort(pending.begin(),pending.end(),[](const SimArrival& a, const SimArrival& b) { return a.end < b.end; });
+
+	size_t done = 0;
+	while(done < pending.size() && pending[done].end <= now)
+	{
+		const SimArrival& a = pending[done++];
+		if(a.noise || a.corrupted)
+			continue;
+
+		// The ack went out with the frame, a receiver which has left RX
+		// since must still hold what its ack promised
+		if(!a.acked && !listeningAt(a.end))
+			medium.stats.rx_missed++;
+		else if(rx_count == SIM_FIFO_DEPTH)
+			medium.stats.rx_overflows++;
+		else
+		{
+			// IRQ goes low when RX_DR is set, until it is cleared
+			bool edge = !(status & _BV(RX_DR));
+			rx_fifo[rx_count++] = a.frame;
+			status |= _BV(RX_DR);
+			if(edge && medium.on_irq)
+				medium.on_irq(*this,a.end);
+		}
+	}
+
+	// Frames long over are only kept for collisions, drop them
+	pending.erase(pending.begin(),pending.begin() + done);
+}
+
+void RadioSim::startTx(void)
+{
+	uint8_t config = reg[CONFIG][0];
+	uint8_t setup = reg[RF_SETUP][0];
+
+	uint32_t bit_ns = 1000;
+	if(setup & _BV(RF_DR_LOW))
+		bit_ns = 4000;
+	else if(setup & _BV(RF_DR_HIGH))
+		bit_ns = 500;
+
+	uint8_t crc = (config & _BV(EN_CRC)) ? ((config & _BV(CRCO)) ? 2 : 1) : 0;
+	uint8_t address_width = reg[SETUP_AW][0] + 2;
+	const SimFrame& frame = tx_fifo[0];
+
+	// Preamble, address, packet control field, payload and CRC
+	uint64_t air = (uint64_t)(8 * (1 + address_width + frame.len + crc) + 9) * bit_ns;
+	uint64_t ack_air = (uint64_t)(8 * (1 + address_width + crc) + 9) * bit_ns;
+
+	uint8_t retr = reg[SETUP_RETR][0];
+	bool ack = autoAck(0);
+
+	if(medium.on_tx)
+		medium.on_tx(*this,frame);
+
+	tx_pid++;
+	tx_busy = true;
+	tx_ok = medium.transmit(*this, node.now, frame, reg[TX_ADDR], getChannel(), ack, retr >> ARD, retr & 0x0F, air, ack_air, tx_pid, tx_retries, tx_done);
+	if(!tx_ok && plos < 15)
+		plos++;
+}
+
+void RadioSim::finishTx(void)
+{
+	tx_busy = false;
+	if(tx_ok)
+	{
+		status |= _BV(TX_DS);
+		tx_count--;
+		memmove(tx_fifo,tx_fifo + 1,tx_count * sizeof(SimFrame));
+	}
+	else
+		status |= _BV(MAX_RT);
+}
+
+/****************************************************************************/
+
+uint8_t RadioSim::readStatus(void)
+{
+	uint8_t pipe = rx_count ? rx_fifo[0].pipe : 7;
+	return (status & 0x70) | (pipe << RX_P_NO) | ((tx_count == SIM_FIFO_DEPTH) ? _BV(TX_FULL) : 0);
+}
+
+uint8_t RadioSim::readRegister(uint8_t r, uint8_t i)
+{
+	switch(r)
+	{
+	case STATUS:
+		return readStatus();
+	case OBSERVE_TX:
+		return (plos << PLOS_CNT) | tx_retries;
+	case CD:
+		return 0;
+	case FIFO_STATUS:
+		return (tx_count == SIM_FIFO_DEPTH ? _BV(FIFO_FULL) : 0) | (tx_count ? 0 : _BV(TX_EMPTY)) |
+			(rx_count == SIM_FIFO_DEPTH ? _BV(RX_FULL) : 0) | (rx_count ? 0 : _BV(RX_EMPTY));
+	default:
+		return reg[r][i < 5 ? i : 0];
+	}
+}
+
+void RadioSim::writeRegister(uint8_t r, uint8_t i, uint8_t value)
+{
+	if(i >= 5)
+		return;
+
+	switch(r)
+	{
+	case STATUS:
+		// Flags are cleared by writing ones
+		if(i == 0)
+			status &= ~(value & 0x70);
+		break;
+	case RF_CH:
+		reg[r][0] = value & 0x7F;
+		break;
+	case RX_ADDR_P0:
+	case RX_ADDR_P1:
+	case TX_ADDR:
+		reg[r][i] = value;
+		break;
+	case CONFIG:
+		if(i == 0)
+		{
+			reg[r][0] = value;
+			updateListening();
+		}
+		break;
+	case OBSERVE_TX:
+		// Writing RF_CH resets PLOS_CNT on the chip, writes here do nothing
+		break;
+	default:
+		if(i == 0)
+			reg[r][0] = value;
+	}
+}
+
+/**
+ * Status polls which find nothing to do stand for the rest of the loop
+ * around them, move the clock on
+ *
+ * Not past the end of a transmission or the arrival of a frame though.
+ */
+void RadioSim::idle(void)
+{
+	uint64_t now = node.now;
+	uint64_t skip = medium.idle_poll_ns;
+
+	if(tx_busy)
+		skip = tx_done > now ? std::min(skip,tx_done - now) : 0;
+	else if(status & (_BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT)))
+		skip = 0;
+
+	for(size_t i=0;i<pending.size() && skip;i++)
+	{
+		if(pending[i].noise || pending[i].corrupted)
+			continue;
+		skip = pending[i].end > now ? std::min(skip,pending[i].end - now) : 0;
+	}
+
+	Sim::advance(skip);
+}
+
+void RadioSim::pin(uint8_t pin, uint8_t level)
+{
+	if(pin == SIM_CSN_PIN)
+	{
+		if(level == LOW && csn)
+		{
+			settle(node.now);
+			spi_transactions++;
+			first = true;
+			csn = false;
+			Sim::advance(SIM_CSN_NS);
+		}
+		else if(level == HIGH && !csn)
+		{
+			endTransaction();
+			csn = true;
+		}
+	}
+	else if(pin == SIM_CE_PIN)
+	{
+		bool rising = level && !ce;
+		ce = level;
+		uint8_t config = reg[CONFIG][0];
+		if(rising && (config & _BV(PWR_UP)) && !(config & _BV(PRIM_RX)) && tx_count && !tx_busy)
+			startTx();
+		updateListening();
+	}
+}
+
+uint8_t RadioSim::transfer(uint8_t data)
+{
+	Sim::advance(SIM_SPI_BYTE_NS);
+	spi_bytes++;
+
+	if(csn)
+		return 0;
+
+	if(first)
+	{
+		first = false;
+		command = data;
+		index = 0;
+
+		if(command == FLUSH_TX)
+			tx_count = 0;
+		else if(command == FLUSH_RX)
+			rx_count = 0;
+		else if(command == W_TX_PAYLOAD)
+			buffer.len = 0;
+
+		uint8_t s = readStatus();
+		if(command == NOP || command == (R_REGISTER | OBSERVE_TX))
+			idle();
+		return s;
+	}
+
+	if(command < W_REGISTER)
+		return readRegister(command & REGISTER_MASK,index++);
+	if(command < W_REGISTER + 0x20)
+	{
+		writeRegister(command & REGISTER_MASK,index++,data);
+		return 0;
+	}
+
+	switch(command)
+	{
+	case R_RX_PAYLOAD:
+		return (rx_count && index < 32) ? rx_fifo[0].data[index++] : 0;
+	case R_RX_PL_WID:
+		return rx_count ? rx_fifo[0].len : 0;
+	case W_TX_PAYLOAD:
+		if(index < 32)
+		{
+			buffer.data[index++] = data;
+			buffer.len = index;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+void RadioSim::endTransaction(void)
+{
+	if(command == W_TX_PAYLOAD && buffer.len && tx_count < SIM_FIFO_DEPTH)
+	{
+		buffer.pipe = 0;
+		tx_fifo[tx_count++] = buffer;
+	}
+	else if(command == R_RX_PAYLOAD && index && rx_count)
+	{
+		if(medium.on_read)
+			medium.on_read(*this,rx_fifo[0]);
+		rx_count--;
+		memmove(rx_fifo,rx_fifo + 1,rx_count * sizeof(SimFrame));
+	}
+	command = NOP;
+}
+
+/****************************************************************************/
+
+Medium::Medium(uint64_t seed): on_read(NULL), on_tx(NULL), on_irq(NULL), idle_poll_ns(50000)
+{
+	memset(&stats,0,sizeof(stats));
+	rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+}
+
+void Medium::add(RadioSim* radio)
+{
+	radios.push_back(radio);
+	links.resize(radios.size());
+}
+
+void Medium::link(int a, int b, float loss)
+{
+	if((int)links.size() <= std::max(a,b))
+		links.resize(std::max(a,b) + 1);
+
+	SimLink ab = {b, loss};
+	SimLink ba = {a, loss};
+	links[a].push_back(ab);
+	links[b].push_back(ba);
+}
+
+/**
+ * xorshift64*, the same sequence on every host
+ */
+double Medium::random(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return ((rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool Medium::transmit(RadioSim& from, uint64_t start, const SimFrame& frame, const uint8_t address[5], uint8_t channel, bool ack, uint8_t ard, uint8_t arc, uint64_t air_ns, uint64_t ack_ns, uint32_t pid, uint8_t& retries, uint64_t& done)
+{
+	int sender = from.getNode().index;
+	const std::vector<SimLink>& near = links[sender];
+
+	uint64_t ard_ns = (uint64_t)(ard + 1) * 250000;
+
+	uint64_t t = start + SIM_SETTLE_NS;
+	for(uint8_t attempt=0;attempt<=arc;attempt++)
+	{
+		uint64_t end = t + air_ns;
+		bool acked = false;
+
+		stats.transmissions++;
+		stats.airtime_ns += air_ns;
+
+		for(size_t i=0;i<near.size();i++)
+		{
+			RadioSim& r = *radios[near[i].to];
+			if(r.getChannel() != channel)
+				continue;
+
+			int8_t pipe = r.isListening() ? r.pipeFor(address) : -1;
+
+			SimArrival a;
+			a.start = t;
+			a.end = end;
+			a.frame = frame;
+			a.frame.pipe = pipe < 0 ? 0 : pipe;
+			a.from = sender;
+			a.noise = pipe < 0;
+			a.corrupted = false;
+			a.acked = false;
+			if(random() < near[i].loss)
+			{
+				a.corrupted = true;
+				if(!a.noise)
+					stats.link_losses++;
+			}
+
+			bool wants_ack = ack && !a.noise && r.autoAck(pipe);
+			bool room = r.rxRoom() > 0;
+
+			// A retransmission of a frame which got through is acked, not kept
+			if(wants_ack && !a.corrupted && room && r.duplicate(sender,pid))
+			{
+				a.noise = true;
+				stats.duplicates++;
+			}
+
+			// Only a frame which did not collide counts as received
+			if(!r.arrive(a) || !wants_ack || !room)
+				continue;
+			if(!a.noise)
+				r.received(sender,pid);
+
+			if(random() < near[i].loss)
+			{
+				stats.link_losses++;
+				continue;
+			}
+
+			if(!a.noise)
+				r.ackLast();
+			acked = true;
+			stats.acks++;
+			stats.airtime_ns += ack_ns;
+		}
+
+		if(!ack || acked)
+		{
+			retries = attempt;
+			done = end + (ack ? SIM_SETTLE_NS + ack_ns : 0);
+			return true;
+		}
+
+		t = end + ard_ns;
+	}
+
+	retries = arc;
+	done = t;
+	return false;
+}
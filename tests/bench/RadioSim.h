@@ -0,0 +1,234 @@
+#ifndef __BENCH_RADIOSIM_H__
+#define __BENCH_RADIOSIM_H__
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @file RadioSim.h
+ *
+ * nRF24L01+ seen through its SPI registers, and the air between radios
+ *
+ * RF24 drives the emulated chip exactly like a real one: registers, the
+ * three deep FIFOs, CE pulses, STATUS flags and OBSERVE_TX.  Enhanced
+ * ShockBurst is modelled with its airtime, auto retransmit delay and count,
+ * acknowledgements and duplicate suppression by packet id.
+ *
+ * Approximations:
+ * - Whether a radio is listening is sampled when a transmission starts
+ *   and again when it ends, not in between.  The ack is settled at the
+ *   start, so an acked frame is kept even if the receiver left RX since.
+ * - Of two overlapping frames at a receiver the first one survives and
+ *   the second is lost, as if the first always captured the receiver.
+ * - Links are symmetric, lose frames independently with a fixed
+ *   probability, and there is no interference beyond the radio range.
+ */
+
+#define SIM_FIFO_DEPTH 3
+#define SIM_CE_PIN 9
+#define SIM_CSN_PIN 10
+#define SIM_SETTLE_NS 130000 /**< Standby to TX or RX */
+#define SIM_HISTORY 16
+
+class Medium;
+struct SimNode;
+
+typedef struct
+{
+	uint8_t data[32];
+	uint8_t len;
+	uint8_t pipe;
+} SimFrame;
+
+typedef struct
+{
+	uint64_t start;
+	uint64_t end;
+	SimFrame frame;
+	int from; /**< Index of the sending node */
+	bool corrupted; /**< Overlapped an earlier frame, or the link lost it */
+	bool noise; /**< Not addressed to any open pipe, only occupies the receiver */
+	bool acked; /**< The sender was told it got through */
+} SimArrival;
+
+typedef struct
+{
+	int to;
+	float loss; /**< Probability that a frame does not make it */
+} SimLink;
+
+/**
+ * Totals over all radios of a run
+ */
+typedef struct
+{
+	uint64_t airtime_ns; /**< Frames and acknowledgements on the air, summed over senders */
+	uint64_t transmissions; /**< Including retransmissions */
+	uint64_t acks;
+	uint64_t link_losses;
+	uint64_t collisions;
+	uint64_t rx_overflows; /**< Arrived with the RX FIFO full */
+	uint64_t rx_missed; /**< Receiver left RX mode while the frame was on the air */
+	uint64_t duplicates; /**< Retransmissions suppressed by packet id */
+} MediumStats;
+
+class RadioSim
+{
+public:
+	RadioSim(Medium& _medium, SimNode& _node);
+
+	void pin(uint8_t pin, uint8_t level);
+	uint8_t transfer(uint8_t data);
+
+	/**
+	 * Deliver the frames whose time has come into the RX FIFO
+	 */
+	void settle(uint64_t now);
+
+	SimNode& getNode(void) { return node; }
+	bool isListening(void);
+	bool listeningAt(uint64_t t);
+	uint8_t getChannel(void);
+	int8_t pipeFor(const uint8_t address[5]);
+	bool autoAck(uint8_t pipe);
+	uint8_t rxRoom(void);
+
+	/**
+	 * A frame has started arriving, called by the Medium
+	 *
+	 * @return Whether it can be received, i.e. did not collide
+	 */
+	bool arrive(const SimArrival& arrival);
+
+	/**
+	 * The frame which arrived last was acked to its sender
+	 */
+	void ackLast(void);
+
+	/**
+	 * Put a frame straight into the RX FIFO, as if it had just arrived
+	 */
+	void inject(const SimFrame& frame);
+
+	/**
+	 * Whether a frame with this packet id from that node was received last
+	 */
+	bool duplicate(int from, uint32_t pid);
+
+	/**
+	 * A frame with this packet id from that node was received
+	 */
+	void received(int from, uint32_t pid);
+
+	uint64_t getSpiBytes(void) { return spi_bytes; }
+	uint64_t getSpiTransactions(void) { return spi_transactions; }
+
+private:
+	Medium& medium;
+	SimNode& node;
+
+	uint8_t reg[0x20][5];
+	uint8_t status;
+	bool ce;
+	bool csn;
+
+	SimFrame rx_fifo[SIM_FIFO_DEPTH];
+	uint8_t rx_count;
+	SimFrame tx_fifo[SIM_FIFO_DEPTH];
+	uint8_t tx_count;
+
+	bool tx_busy;
+	uint64_t tx_done; /**< When the current transmission is over */
+	bool tx_ok;
+	uint8_t tx_retries;
+	uint32_t tx_pid;
+	uint8_t plos;
+
+	std::vector<SimArrival> pending;
+	std::vector<std::pair<int, uint32_t> > last_pid;
+
+	uint64_t history_time[SIM_HISTORY]; /**< When the listening state changed */
+	bool history_listening[SIM_HISTORY];
+	uint8_t history_next;
+
+	// SPI transaction in progress
+	uint8_t command;
+	uint8_t index;
+	bool first;
+	SimFrame buffer;
+
+	uint64_t spi_bytes;
+	uint64_t spi_transactions;
+
+	void reset(void);
+	void updateListening(void);
+	void startTx(void);
+	void finishTx(void);
+	uint8_t readStatus(void);
+	uint8_t readRegister(uint8_t r, uint8_t i);
+	void writeRegister(uint8_t r, uint8_t i, uint8_t value);
+	void endTransaction(void);
+	void idle(void);
+};
+
+/**
+ * Radio links between the nodes
+ */
+class Medium
+{
+public:
+	Medium(uint64_t seed);
+
+	void add(RadioSim* radio);
+
+	/**
+	 * Let two radios hear each other
+	 */
+	void link(int a, int b, float loss);
+
+	/**
+	 * Put a frame on the air with Enhanced ShockBurst
+	 *
+	 * @param air_ns, ack_ns Time on the air of the frame and of its acknowledgement
+	 * @param pid Packet id, the same for all retransmissions of a frame
+	 * @param retries Retransmissions needed, returned
+	 * @param done When the sender learns the outcome, returned
+	 * @return Whether it was acknowledged, or simply sent without auto ack
+	 */
+	bool transmit(RadioSim& from, uint64_t start, const SimFrame& frame, const uint8_t address[5], uint8_t channel, bool ack, uint8_t ard, uint8_t arc, uint64_t air_ns, uint64_t ack_ns, uint32_t pid, uint8_t& retries, uint64_t& done);
+
+	double random(void);
+
+	const std::vector<SimLink>& neighbours(int node) { return links[node]; }
+
+	MediumStats stats;
+
+	/**
+	 * Called for every payload read out of a radio
+	 */
+	void (*on_read)(RadioSim& radio, const SimFrame& frame);
+
+	/**
+	 * Called for every payload a radio starts to send, retransmissions
+	 * by the chip not included
+	 */
+	void (*on_tx)(RadioSim& radio, const SimFrame& frame);
+
+	/**
+	 * Called when a received frame pulls the IRQ pin of a radio low, with
+	 * the simulated time the frame ended, NULL to leave the pin unwired
+	 */
+	void (*on_irq)(RadioSim& radio, uint64_t at);
+
+	/**
+	 * How far an empty status poll moves the clock, see RadioSim::idle()
+	 */
+	uint64_t idle_poll_ns;
+
+private:
+	std::vector<RadioSim*> radios;
+	std::vector<std::vector<SimLink> > links;
+	uint64_t rng;
+};
+
+#endif //__BENCH_RADIOSIM_H__
@@ -0,0 +1,220 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+
+#include "RadioSim.h"
+#include "Scenario.h"
+
+Scenario::Scenario(void): name("unnamed"), topology("grid"), nodes(16), range(1.5), branching(3), loss(0.0),
+	duration(60), warmup(20), drain(5), interval(5000), loop_delay(1000), idle_poll(50), quantum(100), seed(1),
+	clock_ppm(0), sync_within(0), sync_ppm(2), min_delivery(0), fast_forward(true)
+{
+}
+
+static std::string trim(const std::string& s)
+{
+	size_t b = s.find_first_not_of(" \t\r\n");
+	size_t e = s.find_last_not_of(" \t\r\n");
+	return b == std::string::npos ? std::string() : s.substr(b,e - b + 1);
+}
+
+bool Scenario::load(const char* path)
+{
+	FILE* f = fopen(path,"r");
+	if(!f)
+	{
+		fprintf(stderr,"%s: cannot open\n",path);
+		return false;
+	}
+
+	char line[256];
+	int number = 0;
+	bool ok = true;
+	while(fgets(line,sizeof(line),f))
+	{
+		number++;
+		std::string l(line);
+		l = trim(l.substr(0,l.find('#')));
+		if(l.empty())
+			continue;
+
+		size_t eq = l.find('=');
+		if(eq == std::string::npos)
+		{
+			fprintf(stderr,"%s:%d: expected key = value\n",path,number);
+			ok = false;
+			continue;
+		}
+
+		std::string key = trim(l.substr(0,eq));
+		std::string value = trim(l.substr(eq + 1));
+		const char* v = value.c_str();
+
+		if(key == "name") name = value;
+		else if(key == "topology") topology = value;
+		else if(key == "nodes") nodes = atoi(v);
+		else if(key == "range") range = atof(v);
+		else if(key == "branching") branching = atoi(v);
+		else if(key == "loss") loss = atof(v);
+		else if(key == "duration") duration = atof(v);
+		else if(key == "warmup") warmup = atof(v);
+		else if(key == "drain") drain = atof(v);
+		else if(key == "interval") interval = strtoul(v,NULL,10);
+		else if(key == "loop_delay") loop_delay = strtoul(v,NULL,10);
+		else if(key == "idle_poll") idle_poll = strtoul(v,NULL,10);
+		else if(key == "quantum") quantum = strtoul(v,NULL,10);
+		else if(key == "seed") seed = strtoul(v,NULL,10);
+		else if(key == "clock_ppm") clock_ppm = atof(v);
+		else if(key == "sync_within") sync_within = atof(v);
+		else if(key == "sync_ppm") sync_ppm = atof(v);
+		else if(key == "min_delivery") min_delivery = atof(v);
+		else if(key == "fast_forward") fast_forward = atoi(v) != 0;
+		else
+		{
+			fprintf(stderr,"%s:%d: unknown key %s\n",path,number,key.c_str());
+			ok = false;
+		}
+	}
+	fclose(f);
+
+	if(topology != "line" && topology != "tree" && topology != "grid" && topology != "random")
+	{
+		fprintf(stderr,"%s: unknown topology %s\n",path,topology.c_str());
+		ok = false;
+	}
+	if(nodes < 2 || branching < 1 || duration <= warmup + drain || !interval || !quantum)
+	{
+		fprintf(stderr,"%s: need nodes >= 2, branching >= 1, duration > warmup + drain, interval and quantum\n",path);
+		ok = false;
+	}
+
+	return ok;
+}
+
+void Scenario::build(Medium& medium)
+{
+	// Same placement for the same seed, whatever the C library
+	uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 7;
+	struct { uint64_t& s; double operator()() { s ^= s >> 12; s ^= s << 25; s ^= s >> 27;
+		return ((s * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0); } } uniform = {state};
+
+	x.assign(nodes,0);
+	y.assign(nodes,0);
+	adjacency.assign(nodes,std::vector<int>());
+
+	if(topology == "tree")
+	{
+		for(int i=1;i<nodes;i++)
+		{
+			int parent = (i - 1) / branching;
+			adjacency[i].push_back(parent);
+			adjacency[parent].push_back(i);
+			medium.link(i,parent,loss);
+		}
+		return;
+	}
+
+	int side = (int)ceil(sqrt((double)nodes));
+	for(int i=0;i<nodes;i++)
+	{
+		if(topology == "line")
+			x[i] = i;
+		else if(topology == "grid")
+		{
+			x[i] = i % side;
+			y[i] = i / side;
+		}
+		else if(i == 0)
+		{
+			x[i] = side / 2.0;
+			y[i] = side / 2.0;
+		}
+		else
+		{
+			x[i] = uniform() * side;
+			y[i] = uniform() * side;
+		}
+	}
+
+	// Bucket the nodes by range sized cells, only neighbouring cells can link
+	int cells = (int)ceil((topology == "line" ? nodes : side) / range) + 1;
+	std::vector<std::vector<int> > grid(cells * cells);
+	for(int i=0;i<nodes;i++)
+		grid[(int)(y[i] / range) * cells + (int)(x[i] / range)].push_back(i);
+
+	for(int i=0;i<nodes;i++)
+	{
+		int cx = x[i] / range;
+		int cy = y[i] / range;
+		for(int dy=-1;dy<=1;dy++)
+			for(int dx=-1;dx<=1;dx++)
+			{
+				int gx = cx + dx;
+				int gy = cy + dy;
+				if(gx < 0 || gy < 0 || gx >= cells || gy >= cells)
+					continue;
+
+				const std::vector<int>& cell = grid[gy * cells + gx];
+				for(size_t k=0;k<cell.size();k++)
+				{
+					int j = cell[k];
+					if(j <= i)
+						continue;
+					double ddx = x[i] - x[j];
+					double ddy = y[i] - y[j];
+					if(ddx * ddx + ddy * ddy <= range * range)
+					{
+						adjacency[i].push_back(j);
+						adjacency[j].push_back(i);
+						medium.link(i,j,loss);
+					}
+				}
+			}
+	}
+}
+
+std::vector<int> Scenario::depths(void)
+{
+	std::vector<int> depth(nodes,-1);
+	std::deque<int> queue;
+
+	depth[0] = 0;
+	queue.push_back(0);
+	while(!queue.empty())
+	{
+		int n = queue.front();
+		queue.pop_front();
+		for(size_t i=0;i<adjacency[n].size();i++)
+		{
+			int m = adjacency[n][i];
+			if(depth[m] < 0)
+			{
+				depth[m] = depth[n] + 1;
+				queue.push_back(m);
+			}
+		}
+	}
+	return depth;
+}
+
+int Scenario::reachable(std::vector<bool>& connected)
+{
+	std::vector<int> depth = depths();
+	int count = 0;
+
+	connected.assign(nodes,false);
+	for(int i=0;i<nodes;i++)
+	{
+		connected[i] = depth[i] >= 0;
+		count += connected[i];
+	}
+	return count;
+}
+
+uint16_t Scenario::ip(int index)
+{
+	// 0x7918 is the broadcast address of RoutingTable
+	return index >= 0x7918 ? index + 1 : index;
+}
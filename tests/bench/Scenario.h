@@ -0,0 +1,90 @@
+#ifndef __BENCH_SCENARIO_H__
+#define __BENCH_SCENARIO_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class Medium;
+
+/**
+ * @file Scenario.h
+ *
+ * A benchmark run described in a text file, one "key = value" per line and
+ * '#' for comments:
+ *
+ * @code
+ * name = grid400
+ * topology = grid     # line, tree, grid or random
+ * nodes = 400         # master included
+ * range = 1.5         # radio range, in units of the grid spacing
+ * duration = 120      # seconds of simulated time
+ * clock_ppm = 50      # oscillator error of each node, drawn within +-50 ppm
+ * sync_within = 120   # fail unless the time sync converged that fast
+ * min_delivery = 0.95 # fail if fewer of the counted readings arrive
+ * fast_forward = 0    # relays queue data passing through like any frame
+ * @endcode
+ *
+ * Node 0 is the master.  line puts the nodes one unit apart, grid on a
+ * square of unit spacing with the master in a corner, random uniformly on a
+ * square holding one node per unit of area with the master in the middle.
+ * tree links node i to its parent (i - 1) / branching and nothing else.
+ */
+class Scenario
+{
+public:
+	std::string name;
+	std::string topology;
+	int nodes;
+	double range;
+	int branching;
+	double loss; /**< Probability that a frame on any link is lost */
+	double duration; /**< Simulated seconds */
+	double warmup; /**< Seconds before readings are counted */
+	double drain; /**< Seconds at the end in which new readings are not counted, they could not arrive */
+	uint32_t interval; /**< ms between readings of each node */
+	uint32_t loop_delay; /**< us each sketch waits when it has nothing to do */
+	uint32_t idle_poll; /**< us an empty status poll stands for, see RadioSim::idle() */
+	uint32_t quantum; /**< us a node may run ahead of the others */
+	uint32_t seed;
+	double clock_ppm; /**< Every node's oscillator is off by up to this much, either way */
+	double sync_within; /**< Seconds from its first time sample by which every node's skew must be right, 0 for no check */
+	double sync_ppm; /**< How far off the skew may be and still count as right */
+	double min_delivery; /**< Share of the counted readings that must arrive, 0 for no check */
+	bool fast_forward; /**< See RF24Mesh::setFastForward() */
+
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<std::vector<int> > adjacency;
+
+	Scenario(void);
+
+	/**
+	 * Read a scenario file
+	 *
+	 * @return False with a message on stderr if it is unusable
+	 */
+	bool load(const char* path);
+
+	/**
+	 * Place the nodes and link those in range, in @p medium too
+	 */
+	void build(Medium& medium);
+
+	/**
+	 * Nodes with a path to the master, only those can ever join
+	 */
+	int reachable(std::vector<bool>& connected);
+
+	/**
+	 * Hops from the master along the shortest path, -1 if unreachable
+	 */
+	std::vector<int> depths(void);
+
+	/**
+	 * Mesh address of a node, skipping the broadcast address
+	 */
+	static uint16_t ip(int index);
+};
+
+#endif //__BENCH_SCENARIO_H__
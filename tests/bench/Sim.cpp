@@ -0,0 +1,240 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+
+#include "RF24_hal.h"
+#include "Sim.h"
+#include "RadioSim.h"
+
+SPIClass SPI;
+
+static std::vector<SimNode*> all_nodes;
+static std::vector<SimNode*> heap; /**< Runnable nodes, slowest clock on top */
+static SimNode* running;
+static jmp_buf scheduler;
+static uint64_t quantum;
+static uint64_t limit; /**< Clock the running node may reach before it yields */
+static uint64_t end_time;
+static uint64_t switches;
+static uint64_t slice_start; /**< Host time the running node was switched to */
+static bool verbose;
+
+static bool later(const SimNode* a, const SimNode* b)
+{
+	return a->now > b->now || (a->now == b->now && a->index > b->index);
+}
+
+static uint64_t hostNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void trampoline(void)
+{
+	running->body(*running);
+	running->finished = true;
+	_longjmp(scheduler, 1);
+}
+
+SimNode* Sim::addNode(SimBody body, void* user)
+{
+	SimNode* node = new SimNode();
+	node->index = all_nodes.size();
+	node->now = 0;
+	node->drift = 0;
+	node->radio = NULL;
+	node->body = body;
+	node->user = user;
+	node->stack = malloc(SIM_STACK_SIZE);
+	node->finished = false;
+	node->started = false;
+	node->host_ns = 0;
+
+	getcontext(&node->context);
+	node->context.uc_stack.ss_sp = node->stack;
+	node->context.uc_stack.ss_size = SIM_STACK_SIZE;
+	node->context.uc_link = NULL;
+	makecontext(&node->context, trampoline, 0);
+
+	all_nodes.push_back(node);
+	return node;
+}
+
+void Sim::run(uint64_t end_ns, uint64_t quantum_ns, SimMonitor monitor, uint64_t period_ns, void* context)
+{
+	end_time = end_ns;
+	quantum = quantum_ns;
+	heap.assign(all_nodes.begin(), all_nodes.end());
+	std::make_heap(heap.begin(), heap.end(), later);
+
+	uint64_t next_monitor = 0;
+	while(!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), later);
+		SimNode* node = heap.back();
+		heap.pop_back();
+
+		while(monitor && node->now >= next_monitor && next_monitor <= end_ns)
+		{
+			monitor(next_monitor, context);
+			next_monitor += period_ns;
+		}
+
+		if(node->now >= end_ns || node->finished)
+			continue;
+
+		// Run it until it is a quantum ahead of the next slowest node
+		uint64_t next = heap.empty() ? node->now : heap.front()->now;
+		limit = std::min(std::max(next, node->now) + quantum, end_ns);
+		running = node;
+		switches++;
+		slice_start = hostNow();
+		if(!_setjmp(scheduler))
+		{
+			// ucontext only to get onto the new stack, it saves and restores
+			// the signal mask with a system call on every switch
+			if(node->started)
+				_longjmp(node->resume, 1);
+			node->started = true;
+			setcontext(&node->context);
+		}
+		node->host_ns += hostNow() - slice_start;
+		running = NULL;
+
+		heap.push_back(node);
+		std::push_heap(heap.begin(), heap.end(), later);
+	}
+
+	if(monitor && next_monitor <= end_ns)
+		monitor(end_ns, context);
+}
+
+void Sim::advance(uint64_t ns)
+{
+	if(!running)
+		return;
+
+	running->now += ns;
+	if(running->now >= limit && !_setjmp(running->resume))
+		_longjmp(scheduler, 1);
+}
+
+SimNode* Sim::current(void)
+{
+	return running;
+}
+
+uint64_t Sim::now(void)
+{
+	if(running)
+		return running->now;
+	return heap.empty() ? end_time : heap.front()->now;
+}
+
+uint64_t Sim::hostTime(const SimNode& node)
+{
+	return node.host_ns + (running == &node ? hostNow() - slice_start : 0);
+}
+
+const std::vector<SimNode*>& Sim::nodes(void)
+{
+	return all_nodes;
+}
+
+void Sim::setVerbose(bool enable)
+{
+	verbose = enable;
+}
+
+bool Sim::isVerbose(void)
+{
+	return verbose;
+}
+
+uint64_t Sim::getSwitches(void)
+{
+	return switches;
+}
+
+/****************************************************************************/
+
+uint64_t Sim::local(const SimNode& node, uint64_t ns)
+{
+	return ns + (int64_t)(ns * node.drift);
+}
+
+// Backend of RF24_hal.h, on the clock and radio of the running node.  The
+// clock runs off by the drift of the node and wraps at 32 bits, as on the
+// Arduinos the nodes stand for.
+
+static uint64_t localNow(void)
+{
+	SimNode* node = Sim::current();
+	return node ? Sim::local(*node,Sim::now()) : Sim::now();
+}
+
+unsigned long millis(void)
+{
+	Sim::advance(SIM_CALL_NS);
+	return (uint32_t)(localNow() / 1000000);
+}
+
+unsigned long micros(void)
+{
+	Sim::advance(SIM_CALL_NS);
+	return (uint32_t)(localNow() / 1000);
+}
+
+void delay(unsigned long ms)
+{
+	Sim::advance((uint64_t)ms * 1000000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	Sim::advance((uint64_t)us * 1000);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+	SimNode* node = Sim::current();
+	if(node && node->radio)
+		node->radio->pin(pin, level);
+}
+
+void SPIClass::begin(void)
+{
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+	SimNode* node = Sim::current();
+	if(!node || !node->radio)
+		return 0;
+	return node->radio->transfer(data);
+}
+
+int printf_P(const char* format, ...)
+{
+	if(!verbose)
+		return 0;
+
+	SimNode* node = Sim::current();
+	if(node)
+		printf("[%d %.6f] ", node->index, node->now / 1e9);
+
+	va_list args;
+	va_start(args, format);
+	int n = vprintf(format, args);
+	va_end(args);
+	return n;
+}
@@ -0,0 +1,113 @@
+#ifndef __BENCH_SIM_H__
+#define __BENCH_SIM_H__
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <ucontext.h>
+#include <vector>
+
+/**
+ * @file Sim.h
+ *
+ * Discrete event scheduler of the host benchmark
+ *
+ * Every node runs its sketch in a coroutine with its own clock.  The sketch
+ * never waits for real: each SPI byte, each micros() call and each delay
+ * moves the clock of the node forward, and once a node is a quantum ahead
+ * of the slowest node it yields.  Nodes thus run in close lock step and the
+ * radios can exchange frames at the right times, while a node doing nothing
+ * costs almost nothing to simulate.
+ */
+
+#define SIM_STACK_SIZE (64 * 1024)
+#define SIM_SPI_BYTE_NS 2000 /**< 8 bits at 4 MHz, plus the loop around SPI.transfer() */
+#define SIM_CSN_NS 1000 /**< Setting up the bus and toggling the pin */
+#define SIM_CALL_NS 200 /**< Cost of a micros() or millis() call */
+
+class RadioSim;
+struct SimNode;
+
+typedef void (*SimBody)(SimNode& node);
+typedef void (*SimMonitor)(uint64_t now, void* context);
+
+/**
+ * A simulated device
+ */
+struct SimNode
+{
+	int index;
+	uint64_t now; /**< Simulated time this node has reached, ns since the start of the run */
+	double drift; /**< Error of its oscillator, 1e-6 == 1 ppm, see Sim::local() */
+	RadioSim* radio;
+	SimBody body;
+	void* user; /**< Whatever the sketch keeps per node */
+	ucontext_t context; /**< Start of the coroutine */
+	jmp_buf resume; /**< Where it yielded */
+	void* stack;
+	bool started;
+	bool finished;
+	uint64_t host_ns; /**< Real time the host spent running it, see Sim::hostTime() */
+};
+
+class Sim
+{
+public:
+	/**
+	 * Add a node, its body runs once run() starts
+	 */
+	static SimNode* addNode(SimBody body, void* user);
+
+	/**
+	 * Run all nodes until every clock reaches @p end_ns
+	 *
+	 * @param quantum_ns How far a node may run ahead of the slowest one
+	 * @param monitor Called whenever the slowest clock passes another
+	 * multiple of @p period_ns, NULL if not needed
+	 */
+	static void run(uint64_t end_ns, uint64_t quantum_ns, SimMonitor monitor, uint64_t period_ns, void* context);
+
+	/**
+	 * Move the clock of the running node forward, yielding if it got too far
+	 * ahead
+	 */
+	static void advance(uint64_t ns);
+
+	/**
+	 * The node being run, NULL outside of a node
+	 */
+	static SimNode* current(void);
+
+	/**
+	 * Clock of the running node, or the slowest clock outside of a node
+	 */
+	static uint64_t now(void);
+
+	/**
+	 * What the oscillator of @p node reads at simulated time @p ns, the
+	 * time behind its millis() and micros()
+	 */
+	static uint64_t local(const SimNode& node, uint64_t ns);
+
+	/**
+	 * Real time the host spent running @p node so far, in ns
+	 *
+	 * The library code and the emulation of its radio, not the scheduler.
+	 * Unlike everything else it differs from run to run.
+	 */
+	static uint64_t hostTime(const SimNode& node);
+
+	static const std::vector<SimNode*>& nodes(void);
+
+	/**
+	 * Let the library print through printf_P, off by default
+	 */
+	static void setVerbose(bool enable);
+	static bool isVerbose(void);
+
+	/**
+	 * Context switches done so far
+	 */
+	static uint64_t getSwitches(void);
+};
+
+#endif //__BENCH_SIM_H__
@@ -0,0 +1,615 @@
+/**
+ * @file bench.cpp
+ *
+ * Host benchmark of the mesh
+ *
+ * Runs every node of a scenario with the real library code against
+ * emulated radios, see Sim.h and RadioSim.h, and reports as JSON:
+ * - how long the nodes take to join,
+ * - which share of the readings sent after the warm up reach the master,
+ * - readings per second arriving at the master,
+ * - end to end and per hop latency percentiles,
+ * - airtime, radio transmissions and SPI transactions per delivered reading,
+ * - how long relays hold the readings they forward and what that costs,
+ * - how fast and how well the nodes synchronize their clocks.
+ *
+ * Usage: bench [-v] [-s] [-o result.json] scenario.scn
+ *
+ * -s runs the scenario with fast_forward = 0.
+ *
+ * Exits with 1 if the scenario sets a bound the run did not meet, see
+ * check().
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "RF24.h"
+#include "RF24Mesh.h"
+#include "Sim.h"
+#include "RadioSim.h"
+#include "Scenario.h"
+
+#define BENCH_CHANNEL 88
+#define BENCH_MAGIC 0x4CBE /**< First payload bytes of benchmark readings */
+#define BENCH_MAX_HOPS 16 /**< Hops with their own latency percentiles */
+#define BENCH_MONITOR_NS 100000000ULL /**< Joins are sampled every 100 ms */
+
+typedef struct
+{
+	uint16_t magic;
+	uint16_t origin; /**< Node index */
+	uint32_t seq;
+} Reading;
+
+/**
+ * A relay holding a reading, from its first read to its first send
+ */
+typedef struct
+{
+	int node;
+	uint64_t read; /**< Simulated ns */
+	uint64_t spi_bytes; /**< Of the relay's radio at the read */
+	uint64_t host_ns; /**< Sim::hostTime() of the relay at the read */
+	bool sent;
+} Hold;
+
+typedef struct
+{
+	uint64_t generated;
+	uint64_t delivered; /**< 0 until it arrives at the master */
+	std::vector<std::pair<uint64_t, int> > reads; /**< Time and node of each radio read on the way */
+	std::vector<Hold> holds;
+} ReadingLog;
+
+typedef struct
+{
+	RF24* radio;
+	StatusCallback* callback;
+	RF24Mesh* mesh;
+	uint32_t seq;
+	uint64_t next_reading; /**< 0 until the node joined */
+	uint32_t refused; /**< send_SensorData() returned false */
+} NodeApp;
+
+static Scenario scenario;
+static Medium* medium;
+static std::vector<NodeApp> apps;
+static std::map<uint64_t, ReadingLog> readings;
+
+// Join convergence
+static std::vector<bool> connected;
+static int connected_count;
+static std::vector<double> join_time;
+static double converged_50 = -1, converged_90 = -1, converged_all = -1;
+
+// Time sync, see trackSync()
+static std::vector<double> sync_start; /**< When the clock of a node got its first sample, -1 while it has none */
+static std::vector<double> sync_wrong; /**< Last time its skew was further than sync_ppm off */
+static std::vector<double> sync_error; /**< us between network time and the master clock, in the window */
+static double sync_last; /**< When trackSync() last ran */
+
+// Forwarding of counted readings, see onTx()
+static std::vector<double> hold_us;
+static std::vector<double> hold_spi_bytes;
+static std::vector<double> hold_host_ns;
+
+// Totals when the measurement window opened, at the warm up
+static MediumStats medium_at_warmup;
+static uint64_t spi_at_warmup;
+static bool warm;
+
+static uint64_t key(uint16_t origin, uint32_t seq)
+{
+	return ((uint64_t)origin << 32) | seq;
+}
+
+static uint64_t sec(double s)
+{
+	return (uint64_t)(s * 1e9);
+}
+
+static bool counted(uint64_t generated)
+{
+	return generated >= sec(scenario.warmup) && generated < sec(scenario.duration - scenario.drain);
+}
+
+/**
+ * The log of the benchmark reading a frame carries, NULL for other frames
+ */
+static ReadingLog* logOf(const SimFrame& frame)
+{
+	RF24NetworkHeader header;
+	memcpy(&header,frame.data,sizeof(header));
+	if(header.type != 'D' && header.type != 'F')
+		return NULL;
+
+	Reading r;
+	memcpy(&r,header.payload,sizeof(r));
+	if(r.magic != BENCH_MAGIC)
+		return NULL;
+
+	std::map<uint64_t, ReadingLog>::iterator it = readings.find(key(r.origin,r.seq));
+	return it == readings.end() ? NULL : &it->second;
+}
+
+/**
+ * Every payload read out of any radio, called on the node reading it
+ */
+static void onRead(RadioSim& radio, const SimFrame& frame)
+{
+	ReadingLog* log = logOf(frame);
+	if(!log)
+		return;
+
+	int node = radio.getNode().index;
+	log->reads.push_back(std::make_pair(Sim::now(),node));
+	if(node == 0 && !log->delivered)
+		log->delivered = Sim::now();
+
+	for(size_t i=0;i<log->holds.size();i++)
+		if(log->holds[i].node == node)
+			return;
+	if(node)
+	{
+		Hold hold = {node, Sim::now(), radio.getSpiBytes(), Sim::hostTime(radio.getNode()), false};
+		log->holds.push_back(hold);
+	}
+}
+
+/**
+ * Every payload a radio starts to send, called on the sending node
+ *
+ * A relay sending a reading it read ends its hold.  The simulated time and
+ * the SPI bytes in between are what getting it through the relay costs on
+ * the bus and in queues.  The host time adds the CPU work, which the
+ * simulated clocks do not charge for: the library's handling of the frame
+ * and the emulation of the SPI transfers, the same with and without the
+ * fast path.
+ */
+static void onTx(RadioSim& radio, const SimFrame& frame)
+{
+	ReadingLog* log = logOf(frame);
+	if(!log)
+		return;
+
+	int node = radio.getNode().index;
+	for(size_t i=0;i<log->holds.size();i++)
+	{
+		Hold& hold = log->holds[i];
+		if(hold.node != node || hold.sent)
+			continue;
+		hold.sent = true;
+		if(counted(log->generated))
+		{
+			hold_host_ns.push_back(Sim::hostTime(radio.getNode()) - hold.host_ns);
+			hold_us.push_back((Sim::now() - hold.read) / 1000.0);
+			hold_spi_bytes.push_back(radio.getSpiBytes() - hold.spi_bytes);
+		}
+	}
+}
+
+/**
+ * IRQ pin of a radio, wired to the mesh as RadioThread does on the gateway
+ */
+static void onIrq(RadioSim& radio, uint64_t at)
+{
+	const SimNode& node = radio.getNode();
+	apps[node.index].mesh->radioInterrupt((uint32_t)(Sim::local(node,at) / 1000));
+}
+
+/**
+ * The sketch of every node
+ */
+static void nodeBody(SimNode& node)
+{
+	NodeApp& app = apps[node.index];
+
+	// Nodes are not all switched on in the same millisecond
+	delay(node.index ? (uint32_t)(medium->random() * 1000) : 0);
+
+	app.mesh->begin(BENCH_CHANNEL,Scenario::ip(node.index));
+
+	while(true)
+	{
+		if(node.index && app.mesh->isJoined())
+		{
+			if(!app.next_reading)
+				app.next_reading = node.now + (uint64_t)(medium->random() * scenario.interval * 1000000ULL);
+			else if(node.now >= app.next_reading)
+			{
+				Reading r = {BENCH_MAGIC, (uint16_t)node.index, app.seq++};
+
+				ReadingLog& log = readings[key(r.origin,r.seq)];
+				log.generated = node.now;
+				log.delivered = 0;
+
+				if(!app.mesh->send_SensorData((const uint8_t*)&r,sizeof(r)))
+					app.refused++;
+				app.next_reading += scenario.interval * 1000000ULL;
+			}
+		}
+
+		app.mesh->loop();
+		delayMicroseconds(scenario.loop_delay);
+	}
+}
+
+static uint64_t spiTotal(void)
+{
+	uint64_t total = 0;
+	const std::vector<SimNode*>& nodes = Sim::nodes();
+	for(size_t i=0;i<nodes.size();i++)
+		total += nodes[i]->radio->getSpiTransactions();
+	return total;
+}
+
+/**
+ * Compare the network time of every node with the master clock
+ *
+ * The skew a node should find is the rate of the master oscillator over its
+ * own, the offset is what its network time differs from the master's at the
+ * same instant.
+ */
+static void trackSync(uint64_t now)
+{
+	const std::vector<SimNode*>& nodes = Sim::nodes();
+	uint32_t master = (uint32_t)(Sim::local(*nodes[0],now) / 1000);
+	double t = now / 1e9;
+
+	for(int i=1;i<scenario.nodes;i++)
+	{
+		TimeSync& clock = apps[i].mesh->getRoutingTable().getTimeSync();
+		if(!clock.isSynced())
+		{
+			sync_start[i] = -1;
+			continue;
+		}
+		if(sync_start[i] < 0)
+			sync_start[i] = sync_wrong[i] = t;
+
+		double skew = (1 + nodes[0]->drift) / (1 + nodes[i]->drift) - 1;
+		if(fabs(clock.getSkew() - skew) > scenario.sync_ppm * 1e-6)
+			sync_wrong[i] = t;
+
+		if(warm)
+		{
+			uint32_t local = (uint32_t)(Sim::local(*nodes[i],now) / 1000);
+			sync_error.push_back(fabs((double)(int32_t)(clock.toNetworkMicros(local) - master)));
+		}
+	}
+	sync_last = t;
+}
+
+/**
+ * Runs every BENCH_MONITOR_NS of simulated time, between the nodes
+ */
+static void monitor(uint64_t now, void* context)
+{
+	int joined = 0;
+	for(int i=1;i<scenario.nodes;i++)
+	{
+		if(!connected[i])
+			continue;
+		if(join_time[i] < 0 && apps[i].mesh->isJoined())
+			join_time[i] = now / 1e9;
+		if(join_time[i] >= 0)
+			joined++;
+	}
+
+	int others = connected_count - 1;
+	double t = now / 1e9;
+	if(converged_50 < 0 && joined * 2 >= others)
+		converged_50 = t;
+	if(converged_90 < 0 && joined * 10 >= others * 9)
+		converged_90 = t;
+	if(converged_all < 0 && joined == others)
+		converged_all = t;
+
+	trackSync(now);
+
+	if(!warm && now >= sec(scenario.warmup))
+	{
+		warm = true;
+		medium_at_warmup = medium->stats;
+		spi_at_warmup = spiTotal();
+	}
+}
+
+static double percentile(std::vector<double>& v, double p)
+{
+	if(v.empty())
+		return 0;
+	size_t i = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+	return v[std::min(i,v.size() - 1)];
+}
+
+static void printPercentiles(FILE* out, const char* name, std::vector<double>& v, const char* trailer)
+{
+	std::sort(v.begin(),v.end());
+	fprintf(out,"    \"%s\": {\"count\": %zu, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"max\": %.0f}%s\n",
+		name,v.size(),percentile(v,50),percentile(v,90),percentile(v,99),v.empty() ? 0.0 : v.back(),trailer);
+}
+
+static void report(FILE* out, double wall)
+{
+	// Readings
+	uint64_t sent = 0, delivered = 0, delivered_window = 0;
+	std::vector<double> end_to_end;
+	std::vector<std::vector<double> > per_hop(BENCH_MAX_HOPS);
+	std::vector<double> any_hop;
+
+	for(std::map<uint64_t, ReadingLog>::iterator it=readings.begin();it!=readings.end();++it)
+	{
+		ReadingLog& log = it->second;
+		if(log.delivered >= sec(scenario.warmup))
+			delivered_window++;
+		if(!counted(log.generated))
+			continue;
+
+		sent++;
+		if(!log.delivered)
+			continue;
+		delivered++;
+		end_to_end.push_back((log.delivered - log.generated) / 1000.0);
+
+		// First read at each node, in order, up to the master
+		std::sort(log.reads.begin(),log.reads.end());
+		std::vector<bool> seen;
+		uint64_t last = log.generated;
+		int hop = 0;
+		for(size_t i=0;i<log.reads.size();i++)
+		{
+			int node = log.reads[i].second;
+			if((size_t)node < seen.size() && seen[node])
+				continue;
+			if((size_t)node >= seen.size())
+				seen.resize(node + 1,false);
+			seen[node] = true;
+
+			double us = (log.reads[i].first - last) / 1000.0;
+			last = log.reads[i].first;
+			any_hop.push_back(us);
+			if(hop < BENCH_MAX_HOPS)
+				per_hop[hop].push_back(us);
+			hop++;
+
+			if(node == 0)
+				break;
+		}
+	}
+
+	// Radios and mesh layers
+	uint64_t writes = 0, write_ok = 0, max_rt = 0, retries = 0, tx_failed = 0, rx_drops = 0, join_attempts = 0, refused = 0;
+	for(int i=0;i<scenario.nodes;i++)
+	{
+		const rf24_stats_t& r = apps[i].radio->getStats();
+		writes += r.writes;
+		write_ok += r.write_ok;
+		max_rt += r.max_rt;
+		retries += r.retries;
+
+		const MeshStats& m = apps[i].mesh->getStats();
+		tx_failed += m.tx_failed;
+		rx_drops += m.rx_drops;
+		join_attempts += m.join_attempts;
+		refused += apps[i].refused;
+	}
+
+	MediumStats& m = medium->stats;
+	double window = scenario.duration - scenario.warmup;
+	double per = delivered_window ? 1.0 / delivered_window : 0;
+	std::vector<int> depth = scenario.depths();
+	int max_depth = *std::max_element(depth.begin(),depth.end());
+	std::vector<double> joins;
+	for(int i=1;i<scenario.nodes;i++)
+		if(join_time[i] >= 0)
+			joins.push_back(join_time[i] * 1e3);
+
+	fprintf(out,"{\n");
+	fprintf(out,"  \"scenario\": {\"name\": \"%s\", \"topology\": \"%s\", \"nodes\": %d, \"reachable\": %d, \"max_depth\": %d, "
+		"\"range\": %g, \"loss\": %g, \"duration_s\": %g, \"warmup_s\": %g, \"interval_ms\": %u, \"seed\": %u},\n",
+		scenario.name.c_str(),scenario.topology.c_str(),scenario.nodes,connected_count,max_depth,
+		scenario.range,scenario.loss,scenario.duration,scenario.warmup,scenario.interval,scenario.seed);
+
+	int joined = joins.size();
+	fprintf(out,"  \"convergence\": {\n");
+	fprintf(out,"    \"joined\": %d, \"joinable\": %d,\n",joined,connected_count - 1);
+	fprintf(out,"    \"t50_s\": %g, \"t90_s\": %g, \"t100_s\": %g,\n",converged_50,converged_90,converged_all);
+	fprintf(out,"    \"join_attempts\": %llu,\n",(unsigned long long)join_attempts);
+	printPercentiles(out,"join_time_ms",joins,"");
+	fprintf(out,"  },\n");
+
+	fprintf(out,"  \"delivery\": {\"sent\": %llu, \"delivered\": %llu, \"ratio\": %.4f, \"refused\": %llu, \"tx_failed\": %llu, \"rx_drops\": %llu},\n",
+		(unsigned long long)sent,(unsigned long long)delivered,sent ? (double)delivered / sent : 0.0,
+		(unsigned long long)refused,(unsigned long long)tx_failed,(unsigned long long)rx_drops);
+
+	fprintf(out,"  \"throughput\": {\"readings_per_s\": %.3f, \"payload_bytes_per_s\": %.1f},\n",
+		delivered_window / window,delivered_window * 16 / window);
+
+	fprintf(out,"  \"latency_us\": {\n");
+	printPercentiles(out,"end_to_end",end_to_end,",");
+	printPercentiles(out,"per_hop",any_hop,",");
+	fprintf(out,"    \"by_hop\": [\n");
+	int hops = BENCH_MAX_HOPS;
+	while(hops && per_hop[hops - 1].empty())
+		hops--;
+	for(int h=0;h<hops;h++)
+	{
+		std::sort(per_hop[h].begin(),per_hop[h].end());
+		fprintf(out,"      {\"hop\": %d, \"count\": %zu, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f}%s\n",h + 1,per_hop[h].size(),
+			percentile(per_hop[h],50),percentile(per_hop[h],90),percentile(per_hop[h],99),h + 1 < hops ? "," : "");
+	}
+	fprintf(out,"    ]\n");
+	fprintf(out,"  },\n");
+
+	fprintf(out,"  \"forwarding\": {\n");
+	fprintf(out,"    \"fast_forward\": %s,\n",scenario.fast_forward ? "true" : "false");
+	printPercentiles(out,"hold_us",hold_us,",");
+	printPercentiles(out,"spi_bytes",hold_spi_bytes,",");
+	printPercentiles(out,"host_ns",hold_host_ns,"");
+	fprintf(out,"  },\n");
+
+	fprintf(out,"  \"cost_per_delivered\": {\"airtime_us\": %.1f, \"transmissions\": %.2f, \"spi_transactions\": %.1f},\n",
+		(m.airtime_ns - medium_at_warmup.airtime_ns) * per / 1000.0,(m.transmissions - medium_at_warmup.transmissions) * per,
+		(spiTotal() - spi_at_warmup) * per);
+
+	fprintf(out,"  \"radio\": {\"transmissions\": %llu, \"acks\": %llu, \"airtime_s\": %.3f, \"link_losses\": %llu, \"collisions\": %llu, "
+		"\"rx_overflows\": %llu, \"rx_missed\": %llu, \"duplicates\": %llu, \"writes\": %llu, \"write_ok\": %llu, \"max_rt\": %llu, \"retries\": %llu},\n",
+		(unsigned long long)m.transmissions,(unsigned long long)m.acks,m.airtime_ns / 1e9,(unsigned long long)m.link_losses,
+		(unsigned long long)m.collisions,(unsigned long long)m.rx_overflows,(unsigned long long)m.rx_missed,(unsigned long long)m.duplicates,
+		(unsigned long long)writes,(unsigned long long)write_ok,(unsigned long long)max_rt,(unsigned long long)retries);
+
+	// A clock converged once its skew stayed right until the end
+	std::vector<double> converge;
+	int synced = 0;
+	for(int i=1;i<scenario.nodes;i++)
+	{
+		if(sync_start[i] < 0)
+			continue;
+		synced++;
+		if(sync_wrong[i] < sync_last)
+			converge.push_back((sync_wrong[i] - sync_start[i]) * 1e3);
+	}
+	fprintf(out,"  \"time_sync\": {\n");
+	fprintf(out,"    \"clock_ppm\": %g, \"sync_ppm\": %g, \"synced\": %d, \"converged\": %zu,\n",
+		scenario.clock_ppm,scenario.sync_ppm,synced,converge.size());
+	printPercentiles(out,"converge_ms",converge,",");
+	printPercentiles(out,"error_us",sync_error,"");
+	fprintf(out,"  },\n");
+
+	fprintf(out,"  \"simulator\": {\"wall_s\": %.2f, \"speedup\": %.2f, \"switches\": %llu}\n",wall,scenario.duration / wall,
+		(unsigned long long)Sim::getSwitches());
+	fprintf(out,"}\n");
+}
+
+/**
+ * Bounds the scenario sets on the run, each broken one is told on stderr
+ */
+static bool check(void)
+{
+	bool ok = true;
+
+	if(scenario.min_delivery > 0)
+	{
+		uint64_t sent = 0, delivered = 0;
+		for(std::map<uint64_t, ReadingLog>::iterator it=readings.begin();it!=readings.end();++it)
+		{
+			if(!counted(it->second.generated))
+				continue;
+			sent++;
+			if(it->second.delivered)
+				delivered++;
+		}
+		double ratio = sent ? (double)delivered / sent : 0;
+		if(ratio < scenario.min_delivery)
+		{
+			fprintf(stderr,"%s: delivered %llu of %llu readings, %.4f is below %g\n",scenario.name.c_str(),
+				(unsigned long long)delivered,(unsigned long long)sent,ratio,scenario.min_delivery);
+			ok = false;
+		}
+	}
+
+	if(scenario.sync_within > 0)
+	{
+		for(int i=1;i<scenario.nodes;i++)
+		{
+			if(sync_start[i] < 0)
+				continue;
+			double took = sync_wrong[i] - sync_start[i];
+			if(sync_wrong[i] >= sync_last || took > scenario.sync_within)
+			{
+				fprintf(stderr,"%s: node %d clock not within %g ppm %gs after its first sample\n",
+					scenario.name.c_str(),i,scenario.sync_ppm,scenario.sync_within);
+				ok = false;
+			}
+		}
+	}
+
+	return ok;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,"usage: bench [-v] [-s] [-o result.json] scenario.scn\n");
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	const char* output = NULL;
+	const char* path = NULL;
+	bool slow = false;
+
+	for(int i=1;i<argc;i++)
+	{
+		if(!strcmp(argv[i],"-v"))
+			Sim::setVerbose(true);
+		else if(!strcmp(argv[i],"-s"))
+			slow = true;
+		else if(!strcmp(argv[i],"-o") && i + 1 < argc)
+			output = argv[++i];
+		else if(argv[i][0] == '-' || path)
+			usage();
+		else
+			path = argv[i];
+	}
+	if(!path || !scenario.load(path))
+		usage();
+	if(slow)
+		scenario.fast_forward = false;
+
+	medium = new Medium(scenario.seed);
+	medium->on_read = onRead;
+	medium->on_tx = onTx;
+	medium->on_irq = onIrq;
+	medium->idle_poll_ns = scenario.idle_poll * 1000ULL;
+
+	apps.resize(scenario.nodes);
+	for(int i=0;i<scenario.nodes;i++)
+	{
+		NodeApp& app = apps[i];
+		app.radio = new RF24(SIM_CE_PIN,SIM_CSN_PIN);
+		app.callback = new StatusCallback();
+		app.mesh = new RF24Mesh(*app.radio,*app.callback);
+		app.mesh->setFastForward(scenario.fast_forward);
+		app.seq = 0;
+		app.next_reading = 0;
+		app.refused = 0;
+
+		SimNode* node = Sim::addNode(nodeBody,&app);
+		new RadioSim(*medium,*node);
+		if(scenario.clock_ppm > 0)
+			node->drift = scenario.clock_ppm * 1e-6 * (2 * medium->random() - 1);
+	}
+
+	scenario.build(*medium);
+	connected_count = scenario.reachable(connected);
+	join_time.assign(scenario.nodes,-1);
+	sync_start.assign(scenario.nodes,-1);
+	sync_wrong.assign(scenario.nodes,-1);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	Sim::run(sec(scenario.duration),scenario.quantum * 1000ULL,monitor,BENCH_MONITOR_NS,NULL);
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	FILE* out = output ? fopen(output,"w") : stdout;
+	if(!out)
+	{
+		perror(output);
+		return 1;
+	}
+	report(out,wall);
+	if(output)
+		fclose(out);
+
+	return check() ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/env python
+"""
+Compare two results of bench or spibench, e.g. of the last release and of
+a change.
+
+Prints the key metrics side by side and exits with 1 if any got worse by
+more than the tolerance.  Runs are deterministic, so any difference comes
+from the code, but small changes in timing move the numbers a little.
+
+Usage: compare.py [--tolerance PERCENT] BASE.json NEW.json
+"""
+
+import argparse
+import json
+import sys
+
+# Path into the result, and whether bigger is better
+METRICS = [
+    (('convergence', 't100_s'), False),
+    (('delivery', 'ratio'), True),
+    (('throughput', 'readings_per_s'), True),
+    (('latency_us', 'end_to_end', 'p50'), False),
+    (('latency_us', 'end_to_end', 'p99'), False),
+    (('latency_us', 'per_hop', 'p50'), False),
+    (('latency_us', 'per_hop', 'p99'), False),
+    (('cost_per_delivered', 'airtime_us'), False),
+    (('cost_per_delivered', 'transmissions'), False),
+    (('cost_per_delivered', 'spi_transactions'), False),
+]
+
+
+# Per operation of spibench, all better when smaller
+OPERATION_METRICS = ['transactions', 'bytes', 'spi_us', 'total_us']
+
+
+def lookup(result, path):
+    for key in path:
+        result = result[key]
+    return result
+
+
+def pairs(base, new):
+    """
+    (name, base value, new value, bigger is better) of every metric
+    """
+    if 'operations' in base:
+        ops = dict((op['name'], op) for op in new['operations'])
+        for op in base['operations']:
+            if op['name'] not in ops:
+                continue
+            for metric in OPERATION_METRICS:
+                yield ('%s.%s' % (op['name'], metric), op[metric], ops[op['name']][metric], False)
+    else:
+        for path, higher_better in METRICS:
+            yield ('.'.join(path), lookup(base, path), lookup(new, path), higher_better)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--tolerance', type=float, default=5.0, help='percent, default 5')
+    parser.add_argument('base')
+    parser.add_argument('new')
+    args = parser.parse_args()
+
+    with open(args.base) as f:
+        base = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+
+    worse = 0
+    for name, b, n, higher_better in pairs(base, new):
+        if b == n:
+            change = 0.0
+        elif b <= 0:
+            # -1 is "never", e.g. not all nodes joined
+            change = 100.0 if (n > b) != higher_better else -100.0
+        else:
+            change = (n - b) * 100.0 / b
+            if higher_better:
+                change = -change
+        flag = ''
+        if change > args.tolerance:
+            flag = '  WORSE'
+            worse += 1
+        elif change < -args.tolerance:
+            flag = '  better'
+        print('%-36s %12g %12g%s' % (name, b, n, flag))
+
+    return 1 if worse else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
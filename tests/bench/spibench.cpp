@@ -0,0 +1,257 @@
+/**
+ * @file spibench.cpp
+ *
+ * SPI cost of the RF24 driver operations
+ *
+ * Each operation runs against the emulated radio of RadioSim.h, which
+ * counts every chip select and byte on the bus.  The result is the cost
+ * per call in transactions and bytes, the time those bytes take at 4 MHz,
+ * and the whole time of the call including the waits of the driver.  The
+ * numbers do not depend on the host, so they can be compared across
+ * commits with compare.py.
+ *
+ * Usage: spibench [-n iterations] [-o result.json]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RF24.h"
+#include "Sim.h"
+#include "RadioSim.h"
+
+#define SPI_BENCH_CHANNEL 88
+#define SPI_BENCH_DUT 0xE8E8E8E8E1LL /**< Address of the radio being measured */
+#define SPI_BENCH_PEER 0xE8E8E8E8E2LL /**< Address of the radio acknowledging its writes */
+#define SPI_BENCH_CLOCK_MHZ 4
+
+typedef struct
+{
+	const char* name;
+	void (*setup)(void); /**< Not measured, brings the radio into the state the call expects */
+	void (*run)(void);
+} Operation;
+
+typedef struct
+{
+	uint64_t transactions;
+	uint64_t bytes;
+	uint64_t ns;
+} Cost;
+
+static RF24 dut(SIM_CE_PIN, SIM_CSN_PIN);
+static RF24 peer(SIM_CE_PIN, SIM_CSN_PIN);
+static SimNode* dut_node;
+static int iterations = 100;
+static bool finished;
+static uint8_t payload[32];
+
+/****************************************************************************/
+
+static void listening(void)
+{
+	dut.startListening();
+}
+
+static void notListening(void)
+{
+	dut.stopListening();
+}
+
+static void frameWaiting(void)
+{
+	// One frame in an otherwise empty FIFO, with RX_DR set
+	dut.startListening();
+
+	SimFrame frame;
+	memcpy(frame.data,payload,sizeof(payload));
+	frame.len = sizeof(payload);
+	frame.pipe = 1;
+	dut_node->radio->inject(frame);
+}
+
+static void readyToWrite(void)
+{
+	dut.stopListening();
+	dut.setAutoAck(0,true);
+	dut.openWritingPipe(SPI_BENCH_PEER);
+}
+
+static void none(void)
+{
+}
+
+static void doWrite(void)
+{
+	dut.write(payload,sizeof(payload));
+}
+
+static void doRead(void)
+{
+	dut.read(payload,sizeof(payload));
+}
+
+static void doAvailable(void)
+{
+	uint8_t pipe;
+	dut.available(&pipe);
+}
+
+static void doStartListening(void)
+{
+	dut.startListening();
+}
+
+static void doStopListening(void)
+{
+	dut.stopListening();
+}
+
+static void doOpenWritingPipe(void)
+{
+	dut.openWritingPipe(SPI_BENCH_PEER);
+}
+
+static void doSetAutoAck(void)
+{
+	dut.setAutoAck(0,true);
+}
+
+static const Operation operations[] =
+{
+	{"write", readyToWrite, doWrite},
+	{"read", frameWaiting, doRead},
+	{"available_empty", listening, doAvailable},
+	{"available_frame", frameWaiting, doAvailable},
+	{"startListening", notListening, doStartListening},
+	{"stopListening", listening, doStopListening},
+	{"openWritingPipe", none, doOpenWritingPipe},
+	{"setAutoAck", none, doSetAutoAck},
+};
+#define OPERATIONS (sizeof(operations) / sizeof(operations[0]))
+
+static Cost costs[OPERATIONS];
+
+/****************************************************************************/
+
+static void configure(RF24& radio, uint64_t address)
+{
+	// As RF24Mesh::begin() sets the radio up
+	radio.begin();
+	radio.setChannel(SPI_BENCH_CHANNEL);
+	radio.setDataRate(RF24_250KBPS);
+	radio.setCRCLength(RF24_CRC_8);
+	radio.setRetries(5,15);
+	radio.openReadingPipe(1,address);
+	radio.setAutoAck(1,true);
+	radio.startListening();
+}
+
+/**
+ * Acknowledges and drains whatever the radio under test writes
+ */
+static void peerBody(SimNode& node)
+{
+	configure(peer,SPI_BENCH_PEER);
+
+	while(!finished)
+	{
+		bool done = false;
+		while(peer.available() && !done)
+			done = peer.read(payload,sizeof(payload));
+		delayMicroseconds(100);
+	}
+}
+
+static void dutBody(SimNode& node)
+{
+	configure(dut,SPI_BENCH_DUT);
+	for(int i=0;i<32;i++)
+		payload[i] = i;
+
+	for(size_t o=0;o<OPERATIONS;o++)
+	{
+		Cost& cost = costs[o];
+		memset(&cost,0,sizeof(cost));
+
+		for(int i=0;i<iterations;i++)
+		{
+			operations[o].setup();
+
+			uint64_t transactions = node.radio->getSpiTransactions();
+			uint64_t bytes = node.radio->getSpiBytes();
+			uint64_t start = node.now;
+
+			operations[o].run();
+
+			cost.transactions += node.radio->getSpiTransactions() - transactions;
+			cost.bytes += node.radio->getSpiBytes() - bytes;
+			cost.ns += node.now - start;
+		}
+
+		// Leave nothing behind for the next operation
+		dut.stopListening();
+		dut.startListening();
+	}
+
+	finished = true;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,"usage: spibench [-n iterations] [-o result.json]\n");
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	const char* output = NULL;
+
+	for(int i=1;i<argc;i++)
+	{
+		if(!strcmp(argv[i],"-n") && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-o") && i + 1 < argc)
+			output = argv[++i];
+		else
+			usage();
+	}
+	if(iterations < 1)
+		usage();
+
+	// Status polls cost only their bytes here
+	Medium medium(1);
+	medium.idle_poll_ns = 0;
+
+	dut_node = Sim::addNode(dutBody,NULL);
+	new RadioSim(medium,*dut_node);
+	SimNode* peer_node = Sim::addNode(peerBody,NULL);
+	new RadioSim(medium,*peer_node);
+	medium.link(0,1,0);
+
+	Sim::run(3600ULL * 1000000000ULL,10000,NULL,0,NULL);
+
+	FILE* out = output ? fopen(output,"w") : stdout;
+	if(!out)
+	{
+		perror(output);
+		return 1;
+	}
+
+	fprintf(out,"{\n  \"iterations\": %d,\n  \"spi_clock_mhz\": %d,\n  \"operations\": [\n",iterations,SPI_BENCH_CLOCK_MHZ);
+	for(size_t o=0;o<OPERATIONS;o++)
+	{
+		const Cost& c = costs[o];
+		double transactions = (double)c.transactions / iterations;
+		double bytes = (double)c.bytes / iterations;
+		fprintf(out,"    {\"name\": \"%s\", \"transactions\": %.2f, \"bytes\": %.2f, \"spi_us\": %.2f, \"total_us\": %.2f}%s\n",
+			operations[o].name,transactions,bytes,bytes * 8 / SPI_BENCH_CLOCK_MHZ,c.ns / 1000.0 / iterations,
+			o + 1 < OPERATIONS ? "," : "");
+	}
+	fprintf(out,"  ]\n}\n");
+	if(output)
+		fclose(out);
+
+	return 0;
+}
@@ -0,0 +1,119 @@
+#!/usr/bin/env python
+"""
+Decode the binary log written by MeshLog::flush() (LOG_SINK_BINARY).
+
+The records only carry module, line and arguments.  The format strings are
+looked up in the MESH_LOG() calls of the sources the firmware was built from.
+
+Usage: meshlog_decode.py [-s SOURCE_DIR] [LOG_FILE]
+    LOG_FILE is the raw serial capture, stdin if omitted.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+LOG_SYNC = 0xA5
+
+# Keep in sync with LOG_ID_* in MeshLog.h
+MODULES = {1: 'MESH', 2: 'ROUTING', 3: 'QUEUE', 4: 'POOL', 5: 'TIME', 6: 'RADIO'}
+
+LEVELS = {'LOG_ERROR': 'E', 'LOG_WARN': 'W', 'LOG_INFO': 'I', 'LOG_DEBUG': 'D'}
+
+MACROS = {'LOG_HEADER_FMT': '"id:%u type:%c from:%u to:%u"'}
+
+CALL = re.compile(r'MESH_LOG\(\s*(\w+)\s*,\s*((?:"(?:[^"\\]|\\.)*"|\w+|\s)+)')
+STRING = re.compile(r'"((?:[^"\\]|\\.)*)"')
+CONVERSION = re.compile(r'%([-+ #0]*\d*)(?:hh|h|ll|l)?([diuxXcp%])')
+
+
+def load_formats(source_dir):
+    """Map (module, line) to (level, format) for every MESH_LOG() call."""
+    formats = {}
+    for name in sorted(os.listdir(source_dir)):
+        if not name.endswith('.cpp'):
+            continue
+        with open(os.path.join(source_dir, name)) as f:
+            lines = f.read().split('\n')
+        module = None
+        for number, text in enumerate(lines, 1):
+            m = re.match(r'\s*#define\s+LOG_MODULE\s+(\w+)', text)
+            if m:
+                module = m.group(1)
+            m = CALL.search(text)
+            if not m or module is None or text.lstrip().startswith('//'):
+                continue
+            literal = m.group(2)
+            for macro, value in MACROS.items():
+                literal = literal.replace(macro, value)
+            fmt = ''.join(STRING.findall(literal))
+            fmt = fmt.encode().decode('unicode_escape')
+            formats[(module, number)] = (LEVELS.get(m.group(1), '?'), fmt)
+    return formats
+
+
+def render(fmt, args):
+    """printf() with the raw 32 bit words of the record."""
+    args = list(args)
+
+    def convert(m):
+        flags, kind = m.group(1), m.group(2)
+        if kind == '%':
+            return '%'
+        value = args.pop(0) if args else 0
+        if kind == 'd' or kind == 'i':
+            value = value - (1 << 32) if value & 0x80000000 else value
+            kind = 'd'
+        elif kind == 'c':
+            return chr(value & 0xff)
+        elif kind == 'p':
+            kind = 'x'
+        return ('%' + flags + kind) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def records(data):
+    """Yield (time, module, line, args), resynchronizing on garbage."""
+    i = 0
+    while i + 9 <= len(data):
+        if data[i] != LOG_SYNC:
+            i += 1
+            continue
+        time, module, line, nargs = struct.unpack_from('<IBHB', data, i + 1)
+        end = i + 9 + 4 * nargs
+        if module not in MODULES or nargs > 6 or end > len(data):
+            i += 1
+            continue
+        args = struct.unpack_from('<%dI' % nargs, data, i + 9)
+        yield time, MODULES[module], line, args
+        i = end
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode MeshLog binary records')
+    parser.add_argument('-s', '--source', default=os.path.join(os.path.dirname(__file__), '..'),
+                        help='directory with the sources of the firmware')
+    parser.add_argument('log', nargs='?', help='raw capture, stdin if omitted')
+    options = parser.parse_args()
+
+    formats = load_formats(options.source)
+    if options.log:
+        with open(options.log, 'rb') as f:
+            data = bytearray(f.read())
+    else:
+        data = bytearray(sys.stdin.buffer.read())
+
+    for time, module, line, args in records(data):
+        level, fmt = formats.get((module, line), ('?', None))
+        if fmt is None:
+            text = 'unknown message %s:%d %s' % (module, line, ' '.join('%x' % a for a in args))
+        else:
+            text = render(fmt, args).rstrip('\r\n')
+        sys.stdout.write('%10u %s %-7s %s\n' % (time, level, module, text))
+
+
+if __name__ == '__main__':
+    main()
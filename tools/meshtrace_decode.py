@@ -0,0 +1,147 @@
+#!/usr/bin/env python
+"""
+Decode the binary event traces written by MeshTrace::flush() (MESH_TRACE).
+
+Traces of several nodes are merged by network time and the frame events are
+grouped into one hop timeline per packet, known by its origin node and
+header id.  The summary at the end lists the steps packets spend the most
+time in, e.g. waiting in the send queue of a relay or retrying on air.
+
+Usage: meshtrace_decode.py [--events] [--top N] CAPTURE...
+    Each CAPTURE is the raw serial output of one node, other output mixed
+    into it is skipped.
+"""
+
+import argparse
+import struct
+import sys
+from collections import defaultdict
+
+MESH_TRACE_SYNC = 0x5A
+EVENT_FORMAT = '<IHBHHHBBB'
+EVENT_SIZE = 1 + struct.calcsize(EVENT_FORMAT)
+
+# Keep in sync with TraceEvent in MeshTrace.h
+EVENTS = {
+    1: 'RX',
+    2: 'RX_DROP',
+    3: 'ENQUEUE',
+    4: 'ENQUEUE_DROP',
+    5: 'SEND_ENQUEUE',
+    6: 'SEND_DROP',
+    7: 'TX',
+    8: 'TX_FAIL',
+    9: 'STATE',
+    10: 'ROUTE_ADD',
+    11: 'ROUTE_PARENT',
+    12: 'ROUTE_REMOVE',
+}
+FRAME_EVENTS = set(range(1, 9))
+
+STATES = {0: 'INIT', 1: 'NJOINED', 2: 'SENDJOIN', 3: 'JOINRECEIVED', 4: 'NEW_JOINED', 5: 'JOINED'}
+
+
+class Event(object):
+    __slots__ = ('time', 'node', 'event', 'origin', 'id', 'peer', 'pipe', 'retries', 'depth')
+
+    def __init__(self, fields):
+        for name, value in zip(self.__slots__, fields):
+            setattr(self, name, value)
+
+    @property
+    def name(self):
+        return EVENTS.get(self.event, 'EVENT_%d' % self.event)
+
+    def describe(self):
+        if self.event == 9:
+            return 'node %u %s -> %s' % (self.node, STATES.get(self.peer, self.peer),
+                                         STATES.get(self.id, self.id))
+        if self.event in (10, 11, 12):
+            return 'node %u neighbour %u weight %u' % (self.node, self.peer, self.id)
+        text = 'node %u peer %u' % (self.node, self.peer)
+        if self.event in (1, 2):
+            text += ' pipe %u' % self.pipe
+        if self.event in (7, 8):
+            text += ' retries %u' % self.retries
+        if self.event in (3, 4, 5, 6, 7, 8):
+            text += ' depth %u' % self.depth
+        return text
+
+
+def parse(data):
+    """Yield the events in a capture, resynchronizing on other output."""
+    i = 0
+    while i + EVENT_SIZE <= len(data):
+        if data[i] != MESH_TRACE_SYNC:
+            i += 1
+            continue
+        fields = struct.unpack_from(EVENT_FORMAT, data, i + 1)
+        # time, node, event, ...
+        if fields[2] not in EVENTS:
+            i += 1
+            continue
+        yield Event(fields)
+        i += EVENT_SIZE
+
+
+def timelines(events):
+    """Frame events grouped by (origin, id), each sorted by time."""
+    packets = defaultdict(list)
+    for e in events:
+        if e.event in FRAME_EVENTS:
+            packets[(e.origin, e.id)].append(e)
+    for hops in packets.values():
+        hops.sort(key=lambda e: e.time)
+    return packets
+
+
+def hot_spots(packets):
+    """Time between consecutive events of a packet, by kind of step."""
+    steps = defaultdict(list)
+    for hops in packets.values():
+        for a, b in zip(hops, hops[1:]):
+            if a.node == b.node:
+                label = '%s -> %s on node %u' % (a.name, b.name, a.node)
+            else:
+                label = '%s on node %u -> %s on node %u' % (a.name, a.node, b.name, b.node)
+            steps[label].append(b.time - a.time)
+    return steps
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode MeshTrace binary events')
+    parser.add_argument('--events', action='store_true', help='list all events in time order')
+    parser.add_argument('--top', type=int, default=10, help='number of hot spots to list')
+    parser.add_argument('captures', nargs='+')
+    options = parser.parse_args()
+
+    events = []
+    for name in options.captures:
+        with open(name, 'rb') as f:
+            events.extend(parse(bytearray(f.read())))
+    events.sort(key=lambda e: e.time)
+
+    if options.events:
+        for e in events:
+            sys.stdout.write('%10u %-12s origin %u id %u %s\n' % (e.time, e.name, e.origin, e.id, e.describe()))
+        sys.stdout.write('\n')
+
+    packets = timelines(events)
+    for (origin, id), hops in sorted(packets.items(), key=lambda p: p[1][0].time):
+        start = hops[0].time
+        sys.stdout.write('packet origin %u id %u, %u us\n' % (origin, id, hops[-1].time - start))
+        previous = start
+        for e in hops:
+            sys.stdout.write('  %+10d %+8d  %-12s %s\n' % (e.time - start, e.time - previous, e.name, e.describe()))
+            previous = e.time
+
+    steps = hot_spots(packets)
+    if steps:
+        sys.stdout.write('\nslowest steps (mean us, max us, count)\n')
+        ranked = sorted(steps.items(), key=lambda s: -sum(s[1]) / float(len(s[1])))
+        for label, times in ranked[:options.top]:
+            sys.stdout.write('  %10.0f %10d %6d  %s\n' % (sum(times) / float(len(times)), max(times), len(times), label))
+
+
+if __name__ == '__main__':
+    main()